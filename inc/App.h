@@ -10,6 +10,8 @@
 #define APP_H
 #pragma once
 
+#include "MemoryBudget.h"
+#include "PartitionRouter.h"
 #include "ThreadMgr.h"
 
 namespace {
@@ -53,6 +55,136 @@ public:
     void Wait(MsgProcess msgProcess, void* param);
     int GetThreadIdByName(const std::string& threadName);
     Error SendMessage(int dest, int msgId, std::shared_ptr<void> data);
+    /**
+     * @brief Send a typed payload, its PayloadBytes are accounted in flight
+     * @param [in]: dest: thread instance id
+     * @param [in]: msgId: message id
+     * @param [in]: data: message data
+     * @return Error OK: success, ERROR_ENQUEUE: queue full or, for a
+     *         source, memory ceiling reached
+     */
+    template<typename T>
+    Error SendMessage(int dest, int msgId, const std::shared_ptr<T>& data)
+    {
+        return SendMessageWithBytes(dest, msgId, data, (data != nullptr) ? PayloadBytes(*data) : 0);
+    }
+    /**
+     * @brief Send a message accounted as bytes in flight until its Process
+     *        call is over
+     * @param [in]: dest: thread instance id
+     * @param [in]: msgId: message id
+     * @param [in]: data: message data
+     * @param [in]: bytes: accounted size
+     * @return Error OK: success, ERROR_ENQUEUE: queue full or, for a
+     *         source, memory ceiling reached
+     */
+    Error SendMessageWithBytes(int dest, int msgId, std::shared_ptr<void> data, uint64_t bytes);
+    /**
+     * @brief Send a message that is dropped unprocessed once its deadline
+     *        passes, dest gets OnExpired for it instead of Process
+     * @param [in]: dest: thread instance id
+     * @param [in]: msgId: message id
+     * @param [in]: data: message data
+     * @param [in]: deadlineUs: MsgClockUs time, 0: no deadline
+     * @param [in]: bytes: accounted size, as for SendMessageWithBytes
+     * @return Error OK: success, a message already expired counts as sent
+     */
+    Error SendMessageWithDeadline(int dest, int msgId, std::shared_ptr<void> data, int64_t deadlineUs,
+                                  uint64_t bytes = 0);
+    /**
+     * @brief Send a message that is dropped unprocessed after ttlUs
+     * @param [in]: dest: thread instance id
+     * @param [in]: msgId: message id
+     * @param [in]: data: message data
+     * @param [in]: ttlUs: longest time from now to Process, 0: no limit
+     * @param [in]: bytes: accounted size, as for SendMessageWithBytes
+     * @return Error OK: success
+     */
+    Error SendMessageWithTtl(int dest, int msgId, std::shared_ptr<void> data, int64_t ttlUs, uint64_t bytes = 0)
+    {
+        return SendMessageWithDeadline(dest, msgId, data, (ttlUs > 0) ? MsgClockUs() + ttlUs : 0, bytes);
+    }
+    /**
+     * @brief Queue a message, never a direct Process call, even in the
+     *        fuse group of the sender. For a thread that sends to itself
+     * @param [in]: dest: thread instance id
+     * @param [in]: msgId: message id
+     * @param [in]: data: message data
+     * @return Error OK: success, ERROR_ENQUEUE: queue full
+     */
+    Error SendMessageToQueue(int dest, int msgId, std::shared_ptr<void> data);
+    /**
+     * @brief Send a message to the replica of dest that owns the key, the
+     *        messages of one key are processed in the order sent
+     * @param [in]: dest: any replica of the group, a thread without
+     *        replicas gets the message itself
+     * @param [in]: msgId: message id
+     * @param [in]: data: message data
+     * @param [in]: partitionKey: key, a camera id or a stream id
+     * @return Error OK: success, ERROR_DEST_INVALID: no replica is active
+     */
+    Error SendMessage(int dest, int msgId, std::shared_ptr<void> data, uint64_t partitionKey);
+    /**
+     * @brief Send a typed payload to the replica of dest that owns the key,
+     *        its PayloadBytes are accounted in flight
+     * @param [in]: dest: any replica of the group
+     * @param [in]: msgId: message id
+     * @param [in]: data: message data
+     * @param [in]: partitionKey: key, a camera id or a stream id
+     * @return Error OK: success, ERROR_DEST_INVALID: no replica is active
+     */
+    template<typename T>
+    Error SendMessage(int dest, int msgId, const std::shared_ptr<T>& data, uint64_t partitionKey)
+    {
+        return SendMessageWithBytes(dest, msgId, data, partitionKey, (data != nullptr) ? PayloadBytes(*data) : 0);
+    }
+    /**
+     * @brief Send a message to the replica of dest that owns the key,
+     *        accounted as bytes in flight until its Process call is over
+     * @param [in]: dest: any replica of the group
+     * @param [in]: msgId: message id
+     * @param [in]: data: message data
+     * @param [in]: partitionKey: key, a camera id or a stream id
+     * @param [in]: bytes: accounted size
+     * @return Error OK: success, ERROR_DEST_INVALID: no replica is active,
+     *         ERROR_ENQUEUE: queue full or, for a source, memory ceiling reached
+     */
+    Error SendMessageWithBytes(int dest, int msgId, std::shared_ptr<void> data, uint64_t partitionKey,
+                               uint64_t bytes);
+    /**
+     * @brief Take a replica in or out of the key routing of its group, to
+     *        change the replica count. Only the keys of the replica move
+     * @param [in]: instId: thread instance id of the replica
+     * @param [in]: active: true: keys are routed to it
+     * @return Error OK: success, ERROR_DEST_INVALID: not a replica
+     */
+    Error SetReplicaActive(int instId, bool active);
+    /**
+     * @brief Get the queue metrics of a thread
+     * @param [in]: instId: thread instance id
+     * @param [out]: stats: queue metrics
+     * @return Error OK: success, ERROR_DEST_INVALID: no such thread
+     */
+    Error GetThreadQueueStats(int instId, ThreadQueueStats& stats);
+    /**
+     * @brief Get the number of thread instances, main included
+     * @return thread instance ids are 0 to the number - 1
+     */
+    int GetThreadNum()
+    {
+        return threadList_.size();
+    }
+    /**
+     * @brief Get the name of a thread instance
+     * @param [in]: instId: thread instance id
+     * @return name, empty when there is no such thread
+     */
+    std::string GetThreadName(int instId);
+    /**
+     * @brief Check whether any thread stopped for an error
+     * @return true: some thread is in THREAD_ERROR
+     */
+    bool CheckThreadAbnormal();
     void WaitEnd()
     {
         waitEnd_ = true;
@@ -63,8 +195,11 @@ private:
     Error Init();
     int CreateThreadMgr(Thread* thInst, const std::string& instName,
                                aclrtContext context, aclrtRunMode runMode, const uint32_t msgQueueSize);
-    bool CheckThreadAbnormal();
     bool CheckThreadNameUnique(const std::string& threadName);
+    // router: the replica group dest was picked from, the key is released
+    // when the message does not stay queued
+    Error PostMessage(int dest, int msgId, std::shared_ptr<void>& data, int64_t deadlineUs, uint64_t bytes,
+                      PartitionRouter* router = nullptr, uint64_t partitionKey = 0);
     void ReleaseThreads();
 
 private:
@@ -77,4 +212,24 @@ App& CreateAppInstance();
 App& GetAppInstance();
 Error SendMessage(int dest, int msgId, std::shared_ptr<void> data);
 int GetThreadIdByName(const std::string& threadName);
+Error GetThreadQueueStats(int instId, ThreadQueueStats& stats);
+Error SendMessage(int dest, int msgId, std::shared_ptr<void> data, uint64_t partitionKey);
+Error SendMessageWithDeadline(int dest, int msgId, std::shared_ptr<void> data, int64_t deadlineUs,
+                              uint64_t bytes = 0);
+Error SendMessageWithTtl(int dest, int msgId, std::shared_ptr<void> data, int64_t ttlUs, uint64_t bytes = 0);
+Error SendMessageWithBytes(int dest, int msgId, std::shared_ptr<void> data, uint64_t bytes);
+Error SendMessageWithBytes(int dest, int msgId, std::shared_ptr<void> data, uint64_t partitionKey, uint64_t bytes);
+Error SendMessageToQueue(int dest, int msgId, std::shared_ptr<void> data);
+template<typename T>
+Error SendMessage(int dest, int msgId, const std::shared_ptr<T>& data)
+{
+    App& app = GetAppInstance();
+    return app.SendMessage(dest, msgId, data);
+}
+template<typename T>
+Error SendMessage(int dest, int msgId, const std::shared_ptr<T>& data, uint64_t partitionKey)
+{
+    App& app = GetAppInstance();
+    return app.SendMessage(dest, msgId, data, partitionKey);
+}
 #endif
\ No newline at end of file
@@ -0,0 +1,155 @@
+/**
+* Copyright (c) Huawei Technologies Co., Ltd. 2020-2022. All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+
+* http://www.apache.org/licenses/LICENSE-2.0
+
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+
+* File AsyncWriter.h
+* Description: background batched file writer
+*/
+#ifndef ASYNC_WRITER_H
+#define ASYNC_WRITER_H
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Error.h"
+
+/**
+ * Write is the non blocking form of SaveBinFile. The caller hands over a
+ * reference to the buffer and goes on, one writer thread takes the queued
+ * files in batches and writes them with a gathered write each, all of a
+ * batch in one io_uring submission when the kernel allows it and by
+ * pwritev otherwise.
+ */
+
+enum WriteDurability {
+    WRITE_DURABILITY_NONE = 0,  // leave the data in the page cache
+    WRITE_DURABILITY_BATCH,     // fdatasync every syncBatch files
+    WRITE_DURABILITY_FILE,      // fdatasync every file before the next batch is taken
+};
+
+struct AsyncWriterConfig {
+    WriteDurability durability = WRITE_DURABILITY_NONE;
+    uint32_t syncBatch = 16;
+    // files taken from the queue for one round of writes
+    uint32_t batchSize = 32;
+    // Write fails with ERROR_ENQUEUE beyond these
+    uint32_t maxQueueFiles = 1024;
+    uint64_t maxQueueBytes = 512ULL * 1024 * 1024;
+    bool useIoUring = true;
+};
+
+/**
+ * One piece of a file, kept alive until it is written
+ */
+struct WriteBuffer {
+    std::shared_ptr<const void> data;
+    uint32_t size = 0;
+};
+
+struct AsyncWriterStats {
+    bool ioUring = false;
+    uint32_t queueFiles = 0;
+    uint64_t queueBytes = 0;
+    uint32_t maxQueueFiles = 0;
+    uint64_t files = 0;
+    uint64_t failed = 0;
+    uint64_t rejected = 0;
+    uint64_t bytes = 0;
+    uint64_t syncs = 0;
+    // time the writer thread spent writing and syncing
+    double writeSeconds = 0;
+    double megaBytesPerSecond = 0;
+};
+
+class WriteBackend;
+
+class AsyncWriter {
+public:
+    explicit AsyncWriter(const AsyncWriterConfig& config = AsyncWriterConfig());
+    AsyncWriter(const AsyncWriter&) = delete;
+    AsyncWriter& operator=(const AsyncWriter&) = delete;
+
+    /**
+     * @brief Destructor, writes and syncs all queued files first
+     */
+    ~AsyncWriter();
+
+    /**
+     * @brief Get the process wide writer with the default config
+     */
+    static AsyncWriter& GetInstance();
+
+    /**
+     * @brief Queue a file to be created or truncated and written
+     * @param [in]: fileName: path of the file
+     * @param [in]: data: buffer, referenced until the file is written
+     * @param [in]: size: bytes of data
+     * @return Error OK: queued, ERROR_ENQUEUE: the queue is full,
+     *         ERROR_INVALID_ARGS: no data
+     */
+    Error Write(const std::string& fileName, std::shared_ptr<const void> data, uint32_t size);
+
+    /**
+     * @brief Queue a file made of several buffers written one after another
+     */
+    Error Write(const std::string& fileName, const std::vector<WriteBuffer>& buffers);
+
+    /**
+     * @brief Wait until all files queued so far are written, and synced
+     *        when the durability asks for it
+     */
+    void Flush();
+
+    AsyncWriterStats GetStats();
+
+private:
+    struct WriteJob {
+        std::string fileName;
+        std::vector<WriteBuffer> buffers;
+        uint64_t size = 0;
+        uint64_t done = 0;
+        int fd = -1;
+    };
+
+    void WorkerEntry();
+    // counts the files written and failed
+    void WriteBatch(std::vector<WriteJob>& batch, uint64_t& written, uint64_t& failed);
+    // fdatasync and close the written files, return the failed ones
+    uint64_t SyncPending();
+
+    AsyncWriterConfig config_;
+    std::unique_ptr<WriteBackend> backend_;
+    std::mutex lock_;
+    std::condition_variable jobReady_;
+    std::condition_variable idle_;
+    std::deque<WriteJob> queue_;
+    uint64_t queueBytes_;
+    // the writer holds files taken from the queue or owes a sync
+    bool working_;
+    uint32_t flushWaiters_;
+    bool exit_;
+    // written files waiting for their fdatasync, still open, only the
+    // writer touches the list, unsyncedNum_ is its size under lock_
+    std::vector<int> unsynced_;
+    uint32_t unsyncedNum_;
+    AsyncWriterStats stats_;
+    std::thread worker_;
+};
+
+#endif
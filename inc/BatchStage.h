@@ -0,0 +1,167 @@
+/**
+* Copyright (c) Huawei Technologies Co., Ltd. 2020-2022. All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+
+* http://www.apache.org/licenses/LICENSE-2.0
+
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+
+* File BatchStage.h
+* Description: dynamic batching stage that packs frames into model batches
+*/
+#ifndef BATCH_STAGE_H
+#define BATCH_STAGE_H
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "Thread.h"
+#include "Utils.h"
+
+/**
+ * The stage takes one image for each message and packs the images into a
+ * pooled buffer of maxBatch slots, slot i at i * frameSize. A batch goes
+ * out when it is full, when its first frame has waited maxWaitUs, when an
+ * image of another geometry arrives, or on MSG_BATCH_FLUSH. The payloads
+ * of the frames ride along in the batch, SplitBatchResult gives each of
+ * them its part of the model output afterwards. A view (IsImageView), a
+ * crop at (0, 0) too, takes a slot of its compact geometry, only its own
+ * rows are copied.
+ */
+
+enum BatchStageMsg {
+    MSG_BATCH_FRAME = 1400,
+    MSG_BATCH_FLUSH,
+    // flush, then send a batch with isFinished set
+    MSG_BATCH_FINISH,
+    MSG_BATCH_TICK,
+    MSG_BATCH_OUTPUT,
+};
+
+struct FrameBatch {
+    bool isFinished = false;
+    uint32_t batchId = 0;
+    // frames in the batch, at most capacity
+    uint32_t count = 0;
+    uint32_t capacity = 0;
+    // bytes of one slot, the image size of the frames
+    uint32_t frameSize = 0;
+    // geometry of the frames, data is empty
+    ImageData image;
+    // capacity * frameSize bytes, the slots past count are zero with
+    // padBatch and unset otherwise
+    std::shared_ptr<uint8_t> data;
+    // message payloads of the frames, in slot order
+    std::vector<std::shared_ptr<void>> items;
+    // accounted size the items were sent to the stage with
+    uint64_t itemBytes = 0;
+};
+
+inline uint64_t PayloadBytes(const FrameBatch& batch)
+{
+    return static_cast<uint64_t>(batch.capacity) * batch.frameSize + batch.itemBytes;
+}
+
+struct BatchFrameResult {
+    std::shared_ptr<void> item;
+    // part of the output of the frame, shares the output buffer
+    std::shared_ptr<const uint8_t> data;
+    size_t size = 0;
+};
+
+/**
+ * @brief Split a batch output into the results of its frames, the output
+ *        holds capacity equal parts in slot order
+ * @param [in]: batch: the batch the output is of
+ * @param [in]: output: model output of the batch
+ * @param [in]: outputSize: bytes size of output
+ * @param [out]: results: one for each frame of the batch
+ * @return Error OK: success, ERROR_INVALID_ARGS: the output does not split
+ */
+Error SplitBatchResult(const FrameBatch& batch, const std::shared_ptr<const uint8_t>& output,
+                       size_t outputSize, std::vector<BatchFrameResult>& results);
+
+struct BatchStageConfig {
+    std::string destThread;
+    int destMsgId = MSG_BATCH_OUTPUT;
+    int inputMsgId = MSG_BATCH_FRAME;
+    uint32_t maxBatch = 8;
+    // longest time the first frame of a batch waits for more
+    int64_t maxWaitUs = 5000;
+    // zero the unused slots, for models with a fixed batch
+    bool padBatch = false;
+    // image of an input payload, nullptr: the payload is an ImageData
+    std::function<const ImageData*(const std::shared_ptr<void>&)> getImage;
+};
+
+struct BatchStageStats {
+    uint64_t batches = 0;
+    uint64_t frames = 0;
+    // batches by the reason they were sent
+    uint64_t fullBatches = 0;
+    uint64_t timeoutBatches = 0;
+    uint64_t mismatchBatches = 0;
+    uint64_t flushBatches = 0;
+    // input payloads without an image
+    uint64_t rejectedFrames = 0;
+    uint64_t queueFullRetries = 0;
+    // frames / (batches * maxBatch)
+    double meanFill = 0;
+    // fillCounts[n]: batches of n frames
+    std::vector<uint64_t> fillCounts;
+    // time from the arrival of a frame to the send of its batch
+    int64_t meanAddedUs = 0;
+    int64_t maxAddedUs = 0;
+};
+
+class BatchStage : public Thread {
+public:
+    explicit BatchStage(const BatchStageConfig& config);
+    ~BatchStage() {}
+
+    int Init() override;
+    int Process(int msgId, std::shared_ptr<void> msgData) override;
+
+    /**
+     * @brief Get the stage statistics, callable from any thread
+     * @return statistics so far
+     */
+    BatchStageStats GetStats();
+
+private:
+    enum FlushReason {
+        FLUSH_FULL = 0,
+        FLUSH_TIMEOUT,
+        FLUSH_MISMATCH,
+        FLUSH_REQUEST,
+    };
+
+    void AddFrame(std::shared_ptr<void> item);
+    Error OpenBatch(const ImageData& image);
+    void Flush(FlushReason reason);
+    void Tick();
+    void SendBatch(std::shared_ptr<FrameBatch> batch);
+
+    BatchStageConfig config_;
+    int destId_;
+    uint32_t batchId_;
+    std::shared_ptr<FrameBatch> batch_;
+    int64_t batchOpenUs_;
+    std::vector<int64_t> arrivalUs_;
+    std::mutex statsLock_;
+    BatchStageStats stats_;
+    int64_t addedUsTotal_;
+};
+
+#endif
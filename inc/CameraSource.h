@@ -0,0 +1,172 @@
+/**
+* Copyright (c) Huawei Technologies Co., Ltd. 2020-2022. All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+
+* http://www.apache.org/licenses/LICENSE-2.0
+
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+
+* File CameraSource.h
+* Description: simulated multi-camera NV12 source thread for load tests
+*/
+#ifndef CAMERA_SOURCE_H
+#define CAMERA_SOURCE_H
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <vector>
+#include "DropPolicy.h"
+#include "Thread.h"
+#include "Utils.h"
+
+/**
+ * The source plays N cameras at their own fps and resolution and sends one
+ * CameraFrame for each captured frame. A frame is a pooled NV12 image with
+ * the VPC stride, filled from a raw NV12 file (frames packed back to back,
+ * no padding) or from a generated moving pattern. The capture times follow
+ * the nominal schedule, the send may be held back by a random jitter like
+ * the arrival of a real camera. A camera the receiver can not keep up with
+ * drops frames as a sensor does, the counters tell how many streams the
+ * pipeline sustains.
+ */
+
+enum CameraSourceMsg {
+    MSG_CAMERA_START = 1300,
+    MSG_CAMERA_TICK,
+    MSG_CAMERA_FRAME,
+};
+
+struct CameraConfig {
+    uint32_t cameraId = CAMERA_ID_0;
+    Resolution resolution;
+    double fps = 25;
+    // empty: generated pattern, else a raw NV12 file replayed in a loop
+    std::string rawFile;
+};
+
+struct CameraSourceConfig {
+    std::vector<CameraConfig> cameras;
+    std::string destThread;
+    int destMsgId = MSG_CAMERA_FRAME;
+    // 0: endless, else frames of each camera before finishing
+    uint32_t framesPerCamera = 0;
+    // upper bound of the random delay of each frame arrival
+    uint32_t jitterUs = 0;
+    // true: the cameras capture on a shared clock, frame n of cameras with
+    // the same fps has the same timestamp. false: each camera gets a random
+    // phase within its frame interval
+    bool synchronized = true;
+    // false: send the prepared buffers as they are, no copy for each frame,
+    // the receiver must not write them
+    bool copyFrames = true;
+    uint32_t seed = 1;
+    // nullptr: send every frame, else frames the policy refuses are dropped
+    // at the source, the policy may be shared with other sources
+    std::shared_ptr<DropPolicy> dropPolicy;
+    // 0: frames never expire, else a frame not processed within this time
+    // of its capture is dropped by the receiver thread. Finish frames never expire
+    int64_t frameTtlUs = 0;
+};
+
+/**
+ * One captured frame, the last frame of a camera has isFinished set and no
+ * image
+ */
+struct CameraFrame {
+    bool isFinished = false;
+    uint32_t cameraId = 0;
+    uint32_t frameId = 0;
+    // capture time, microseconds since the source started
+    int64_t timestampUs = 0;
+    ImageData image;
+};
+
+inline uint64_t PayloadBytes(const CameraFrame& frame)
+{
+    return frame.image.size;
+}
+
+struct CameraStats {
+    uint32_t cameraId = 0;
+    uint32_t frames = 0;
+    // frames not sent because the receiver queue was full
+    uint32_t droppedFrames = 0;
+    // frames refused by the drop policy
+    uint32_t policyDrops = 0;
+    // frames sent later than their arrival time by over one frame interval
+    uint32_t lateFrames = 0;
+    int64_t maxLateUs = 0;
+};
+
+struct CameraSourceStats {
+    std::vector<CameraStats> cameras;
+    uint32_t frames = 0;
+    uint32_t droppedFrames = 0;
+    uint32_t policyDrops = 0;
+    uint32_t lateFrames = 0;
+    uint64_t bytes = 0;
+};
+
+class CameraSource : public Thread {
+public:
+    explicit CameraSource(const CameraSourceConfig& config);
+    ~CameraSource() {}
+
+    int Init() override;
+    int Process(int msgId, std::shared_ptr<void> msgData) override;
+
+    /**
+     * @brief Get the source statistics, callable from any thread
+     * @return statistics so far
+     */
+    CameraSourceStats GetStats();
+
+private:
+    struct Camera {
+        CameraConfig config;
+        int64_t intervalUs = 0;
+        int64_t phaseUs = 0;
+        // arrival time of the next frame, capture time plus jitter
+        int64_t dueUs = 0;
+        uint32_t frameId = 0;
+        bool finished = false;
+        ImageData geometry;
+        // prepared frames with the pool stride, cycled through
+        std::vector<std::shared_ptr<uint8_t>> frames;
+    };
+
+    Error Start();
+    Error PrepareCamera(Camera& camera);
+    Error LoadRawFrames(Camera& camera);
+    void GenerateFrames(Camera& camera);
+    void Tick();
+    void SendFrame(Camera& camera, int64_t nowUs);
+    // false when the receiver queue is full
+    bool SendFinished(Camera& camera);
+    int64_t CaptureTimeUs(const Camera& camera, uint32_t frameId) const;
+    void ScheduleNext(Camera& camera);
+    int64_t NowUs() const;
+
+    CameraSourceConfig config_;
+    std::vector<Camera> cameras_;
+    int destId_;
+    bool running_;
+    std::mt19937 random_;
+    std::chrono::steady_clock::time_point startTime_;
+    std::mutex statsLock_;
+    CameraSourceStats stats_;
+};
+
+#endif
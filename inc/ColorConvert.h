@@ -0,0 +1,54 @@
+/**
+* Copyright (c) Huawei Technologies Co., Ltd. 2020-2022. All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+
+* http://www.apache.org/licenses/LICENSE-2.0
+
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+
+* File ColorConvert.h
+* Description: NV12 and packed RGB colour conversion of ImageData
+*/
+#ifndef COLOR_CONVERT_H
+#define COLOR_CONVERT_H
+#pragma once
+
+#include "Error.h"
+#include "Type.h"
+
+/**
+ * Conversions use BT.601 limited range in fixed point, the scalar and
+ * the simd paths give the same bytes. Both sides respect alignWidth and
+ * alignHeight as strides. Large frames are split by rows over ParallelFor.
+ */
+
+/**
+ * @brief Convert NV12 image to packed RGB24 or BGR24
+ * @param [in]: src: NV12 image
+ * @param [in/out]: dst: dst.format selects PIXEL_FORMAT_RGB_888 or
+ *                  PIXEL_FORMAT_BGR_888. When dst.data is set it must have
+ *                  the size of src, otherwise a buffer is taken from
+ *                  FramePool and dst is filled
+ * @return Error OK: success, others: failed
+ */
+Error ConvertNv12ToRgb(const ImageData& src, ImageData& dst);
+
+/**
+ * @brief Convert packed RGB24 or BGR24 image to NV12, chroma is the average
+ *        of each 2x2 block
+ * @param [in]: src: RGB_888 or BGR_888 image
+ * @param [in/out]: dst: output image. When dst.data is set it must have the
+ *                  size of src, otherwise a buffer with VPC stride is taken
+ *                  from FramePool and dst is filled
+ * @return Error OK: success, others: failed
+ */
+Error ConvertRgbToNv12(const ImageData& src, ImageData& dst);
+
+#endif
@@ -0,0 +1,169 @@
+/**
+* Copyright (c) Huawei Technologies Co., Ltd. 2020-2022. All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+
+* http://www.apache.org/licenses/LICENSE-2.0
+
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+
+* File ConfigService.h
+* Description: config file watcher sending changed keys as messages
+*/
+#ifndef CONFIG_SERVICE_H
+#define CONFIG_SERVICE_H
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+#include "Thread.h"
+
+/**
+ * The service owns a key=value file as read by ReadConfig. It watches the
+ * directory of the file with inotify, so editors that replace the file
+ * are seen too, and parses the file again only when it was written or
+ * moved in. A missing file keeps the last keys. The new keys are compared with the old ones and
+ * every subscriber gets one MSG_CONFIG_UPDATE with the keys it asked for
+ * that changed, their values already parsed. Without inotify the file
+ * time is checked on every tick instead.
+ */
+
+enum ConfigServiceMsg {
+    MSG_CONFIG_START = 1100,
+    MSG_CONFIG_SUBSCRIBE,
+    MSG_CONFIG_TICK,
+    MSG_CONFIG_UPDATE,
+};
+
+enum ConfigValueType {
+    CONFIG_VALUE_STRING = 0,
+    CONFIG_VALUE_BOOL,
+    CONFIG_VALUE_INT,
+    CONFIG_VALUE_FLOAT,
+};
+
+/**
+ * A value parsed once by the service. An int also fills floatValue, a
+ * bool also fills intValue and floatValue, so a stage reads the field it
+ * wants whatever was written in the file
+ */
+struct ConfigValue {
+    std::string key;
+    std::string text;
+    ConfigValueType type = CONFIG_VALUE_STRING;
+    bool boolValue = false;
+    int64_t intValue = 0;
+    double floatValue = 0;
+    // the key was taken out of the file
+    bool removed = false;
+};
+
+/**
+ * Payload of MSG_CONFIG_UPDATE, the first one after subscribing holds
+ * all subscribed keys present in the file
+ */
+struct ConfigUpdate {
+    // goes up each time the keys of the file change
+    uint32_t version = 0;
+    std::vector<ConfigValue> values;
+};
+
+/**
+ * Payload of MSG_CONFIG_SUBSCRIBE, or set in ConfigServiceConfig
+ */
+struct ConfigSubscription {
+    std::string threadName;
+    // no keys: all keys
+    std::vector<std::string> keys;
+    int msgId = MSG_CONFIG_UPDATE;
+};
+
+struct ConfigServiceConfig {
+    std::string configFile;
+    std::vector<ConfigSubscription> subscriptions;
+    // longest wait for a file change in one tick
+    uint32_t pollMs = 100;
+};
+
+struct ConfigServiceStats {
+    bool inotify = false;
+    uint32_t version = 0;
+    uint32_t reloads = 0;
+    uint32_t failedReloads = 0;
+    uint32_t updatesSent = 0;
+    uint32_t sendFailed = 0;
+};
+
+/**
+ * @brief Parse the text of a value as ConfigService does
+ * @param [in]: key: key of the value
+ * @param [in]: text: value as written in the file
+ * @return ConfigValue the value with its type
+ */
+ConfigValue ParseConfigValue(const std::string& key, const std::string& text);
+
+/**
+ * @brief Find a key in an update
+ * @return const ConfigValue* the value, nullptr when the key is not in it
+ */
+const ConfigValue* FindConfigValue(const ConfigUpdate& update, const std::string& key);
+
+class ConfigService : public Thread {
+public:
+    explicit ConfigService(const ConfigServiceConfig& config);
+    ~ConfigService();
+
+    int Init() override;
+    int Process(int msgId, std::shared_ptr<void> msgData) override;
+
+    /**
+     * @brief Get the service statistics
+     * @return statistics so far
+     */
+    ConfigServiceStats GetStats();
+
+private:
+    struct Subscriber {
+        int threadId;
+        std::string threadName;
+        std::set<std::string> keys;
+        int msgId;
+        // the last update was not taken, send all keys on the next tick
+        bool resync;
+    };
+
+    void Subscribe(const ConfigSubscription& subscription);
+    void Tick();
+    bool FileChanged();
+    void Reload();
+    bool Wants(const Subscriber& subscriber, const std::string& key) const;
+    // all subscribed keys when changed is nullptr
+    void SendUpdate(Subscriber& subscriber, const std::vector<ConfigValue>* changed);
+
+    ConfigServiceConfig config_;
+    std::string fileDir_;
+    std::string fileName_;
+    int inotifyFd_;
+    int watchFd_;
+    // modify time in ns, used when there is no inotify
+    int64_t fileTime_;
+    bool running_;
+    std::map<std::string, std::string> text_;
+    std::map<std::string, ConfigValue> values_;
+    std::vector<Subscriber> subscribers_;
+    std::mutex statsLock_;
+    ConfigServiceStats stats_;
+};
+
+#endif
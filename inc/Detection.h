@@ -0,0 +1,152 @@
+/**
+* Copyright (c) Huawei Technologies Co., Ltd. 2020-2022. All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+
+* http://www.apache.org/licenses/LICENSE-2.0
+
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+
+* File Detection.h
+* Description: score threshold, top-k and nms of detection model output
+*/
+#ifndef DETECTION_H
+#define DETECTION_H
+#pragma once
+
+#include <functional>
+#include <string>
+#include <vector>
+#include "Error.h"
+#include "Type.h"
+
+/**
+ * Boxes are kept as structure of arrays so that the overlap of one box
+ * against many is computed 8 lanes at a time. Coordinates are corners in
+ * model input pixels.
+ */
+struct BoxArray {
+    std::vector<float> x1;
+    std::vector<float> y1;
+    std::vector<float> x2;
+    std::vector<float> y2;
+    std::vector<float> score;
+    std::vector<int32_t> classId;
+
+    size_t Size() const
+    {
+        return score.size();
+    }
+
+    void Clear()
+    {
+        x1.clear();
+        y1.clear();
+        x2.clear();
+        y2.clear();
+        score.clear();
+        classId.clear();
+    }
+
+    void Reserve(size_t num)
+    {
+        x1.reserve(num);
+        y1.reserve(num);
+        x2.reserve(num);
+        y2.reserve(num);
+        score.reserve(num);
+        classId.reserve(num);
+    }
+
+    void Push(float left, float top, float right, float bottom, float boxScore, int32_t boxClass)
+    {
+        x1.push_back(left);
+        y1.push_back(top);
+        x2.push_back(right);
+        y2.push_back(bottom);
+        score.push_back(boxScore);
+        classId.push_back(boxClass);
+    }
+};
+
+enum BoxEncoding {
+    // per box: x1 y1 x2 y2 score class, class as float
+    BOX_XYXY_SCORE_CLASS = 0,
+    // per box: cx cy w h objectness then classNum class scores
+    BOX_CXCYWH_OBJ_CLASSES,
+};
+
+struct TensorLayout {
+    BoxEncoding encoding = BOX_XYXY_SCORE_CLASS;
+    uint32_t boxNum = 0;
+    uint32_t classNum = 1;
+};
+
+struct DetectParam {
+    float scoreThreshold = 0.25f;
+    float iouThreshold = 0.45f;
+    // candidates that enter nms, 0 keeps all over the threshold
+    uint32_t topK = 1000;
+    uint32_t maxDetections = 100;
+    // only boxes of the same class suppress each other
+    bool classAware = true;
+};
+
+typedef std::function<std::string(int32_t classId, float score)> LabelFunc;
+
+/**
+ * @brief Decode the boxes of a float32 output tensor whose score is over
+ *        the threshold
+ * @param [in]: output: model output
+ * @param [in]: layout: box encoding and number
+ * @param [in]: scoreThreshold: boxes with a lower score are dropped
+ * @param [out]: boxes: decoded boxes, unordered
+ * @return Error OK: success, others: failed
+ */
+Error DecodeBoxes(const InferenceOutput& output, const TensorLayout& layout,
+                  float scoreThreshold, BoxArray& boxes);
+
+/**
+ * @brief Keep the topK best boxes and run greedy nms over them
+ * @param [in]: boxes: candidates, unordered
+ * @param [in]: param: thresholds and limits
+ * @param [out]: result: kept boxes by score descending
+ * @return None
+ */
+void NmsBoxes(const BoxArray& boxes, const DetectParam& param, BoxArray& result);
+
+/**
+ * @brief DecodeBoxes followed by NmsBoxes
+ */
+Error PostProcessDetections(const InferenceOutput& output, const TensorLayout& layout,
+                            const DetectParam& param, BoxArray& result);
+
+/**
+ * @brief Convert boxes to BBox clipped to the image, score in percent. The
+ *        text is only filled when label is given, see AttachLabels
+ * @param [in]: boxes: nms result
+ * @param [in]: width, height: image size the coordinates refer to
+ * @param [out]: bboxes: one BBox per box, same order
+ * @param [in]: label: text of a box, empty to leave text unset
+ * @return None
+ */
+void BoxesToBBoxes(const BoxArray& boxes, uint32_t width, uint32_t height,
+                   std::vector<BBox>& bboxes, const LabelFunc& label = LabelFunc());
+
+/**
+ * @brief Fill the text of the BBox that have none, for the consumers that
+ *        draw or print the result
+ * @param [in]: boxes: the boxes bboxes were built from
+ * @param [in/out]: bboxes: BoxesToBBoxes result
+ * @param [in]: label: text of a box
+ * @return None
+ */
+void AttachLabels(const BoxArray& boxes, std::vector<BBox>& bboxes, const LabelFunc& label);
+
+#endif
@@ -0,0 +1,69 @@
+/**
+* Copyright (c) Huawei Technologies Co., Ltd. 2020-2022. All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+
+* http://www.apache.org/licenses/LICENSE-2.0
+
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+
+* File DirWalker.h
+* Description: parallel directory traversal streaming file paths
+*/
+#ifndef DIR_WALKER_H
+#define DIR_WALKER_H
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include "Error.h"
+
+/**
+ * Subdirectories are spread over worker threads. Entries are classified
+ * by d_type, an fstatat relative to the open directory is made only for
+ * symlinks and file systems that report no type, and with followSymlinks
+ * for each directory too: its device and inode are what tell a symlink
+ * loop or a directory reached twice. Files are handed to the callback a
+ * directory at a time while the walk goes on, in no fixed order.
+ */
+
+struct DirWalkConfig {
+    // threads walking, the caller included
+    uint32_t threadNum = 4;
+    // symlinked directories are entered once each
+    bool followSymlinks = true;
+    // skip entries whose name starts with '.'
+    bool skipHidden = true;
+};
+
+struct DirWalkStats {
+    uint64_t dirs = 0;
+    uint64_t files = 0;
+    uint64_t errors = 0;
+};
+
+/**
+ * Called for every file found, from the walking threads but never two
+ * calls at once
+ */
+typedef std::function<void(const std::string& path)> PathCallback;
+
+/**
+ * @brief Walk root and its subdirectories, return when all is walked
+ * @param [in]: root: directory, or a file that is reported as is
+ * @param [in]: callback: receives the file paths
+ * @param [in]: config: threads and filters
+ * @param [out]: stats: counts of the walk, may be nullptr
+ * @return Error OK: success, ERROR_ACCESS_FILE: root can not be accessed
+ */
+Error WalkDirectory(const std::string& root, const PathCallback& callback,
+                    const DirWalkConfig& config = DirWalkConfig(), DirWalkStats* stats = nullptr);
+
+#endif
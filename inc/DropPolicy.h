@@ -0,0 +1,104 @@
+/**
+* Copyright (c) Huawei Technologies Co., Ltd. 2020-2022. All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+
+* http://www.apache.org/licenses/LICENSE-2.0
+
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+
+* File DropPolicy.h
+* Description: latency budget frame dropping for live sources
+*/
+#ifndef DROP_POLICY_H
+#define DROP_POLICY_H
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/**
+ * A source asks the policy before it sends each frame. The policy watches
+ * the queues of the downstream threads and estimates the latency a new
+ * frame would see, the larger of the average queue wait and the queue
+ * depth times the average Process time. The average wait only moves when
+ * a message is processed, it counts while the thread took messages off
+ * since the last refresh and has some queued. Below decimateAt of the
+ * budget every frame goes, from there on one frame of N goes with N
+ * growing up to maxDecimation, and past the budget only the frames that
+ * must go do; a camera that never sent a key frame keeps one frame of
+ * maxDecimation there. Key frames and finish frames always go. The frames kept are picked by
+ * frameId with a phase by camera, so the cameras do not all drop the same
+ * instant.
+ */
+
+struct DropPolicyConfig {
+    // downstream threads, the most loaded one decides
+    std::vector<std::string> watchThreads;
+    int64_t latencyBudgetUs = 200000;
+    // fraction of the budget where decimation starts
+    double decimateAt = 0.5;
+    uint32_t maxDecimation = 8;
+    // how often the queue metrics are read again
+    int64_t refreshUs = 1000;
+};
+
+struct CameraDropStats {
+    uint32_t cameraId = 0;
+    uint64_t keyFrames = 0;
+    uint64_t keptFrames = 0;
+    uint64_t droppedFrames = 0;
+};
+
+struct DropPolicyStats {
+    std::vector<CameraDropStats> cameras;
+    // latency estimate of the last refresh
+    int64_t latencyUs = 0;
+    // 1: every frame kept, N: one of N kept, 0: only key frames kept
+    uint32_t decimation = 1;
+    uint64_t keptFrames = 0;
+    uint64_t droppedFrames = 0;
+};
+
+class DropPolicy {
+public:
+    explicit DropPolicy(const DropPolicyConfig& config);
+    ~DropPolicy() {}
+
+    /**
+     * @brief Decide if a frame goes downstream, callable from any thread
+     * @param [in]: cameraId: camera or stream of the frame
+     * @param [in]: frameId: frame number in its stream
+     * @param [in]: isKeyFrame: key frames are always kept
+     * @param [in]: isFinished: finish frames are always kept
+     * @return bool true: send the frame, false: drop it
+     */
+    bool Admit(uint32_t cameraId, uint32_t frameId, bool isKeyFrame = false, bool isFinished = false);
+
+    DropPolicyStats GetStats();
+
+private:
+    void Refresh(int64_t nowUs);
+    uint32_t DecimationOf(int64_t latencyUs) const;
+
+    DropPolicyConfig config_;
+    std::vector<int> watchIds_;
+    // messages processed by each watched thread at the last refresh
+    std::vector<uint64_t> watchMessages_;
+    std::mutex lock_;
+    int64_t refreshedUs_;
+    int64_t latencyUs_;
+    uint32_t decimation_;
+    std::map<uint32_t, CameraDropStats> cameras_;
+};
+
+#endif
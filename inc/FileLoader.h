@@ -0,0 +1,137 @@
+/**
+* Copyright (c) Huawei Technologies Co., Ltd. 2020-2022. All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+
+* http://www.apache.org/licenses/LICENSE-2.0
+
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+
+* File FileLoader.h
+* Description: read ahead file loader thread for offline batch mode
+*/
+#ifndef FILE_LOADER_H
+#define FILE_LOADER_H
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "Thread.h"
+
+/**
+ * The loader reads the files of a GetAllFiles list with several reads in
+ * flight, on io_uring when the kernel allows it and on a small thread pool
+ * otherwise, and sends them to one thread in list order. It runs from
+ * MSG_FILE_LOADER_START and keeps itself going with tick messages, so
+ * the thread still takes other messages between batches of reads.
+ */
+
+enum FileLoaderMsg {
+    MSG_FILE_LOADER_START = 1000,
+    MSG_FILE_LOADER_TICK,
+    MSG_FILE_LOADED,
+};
+
+/**
+ * Payload of MSG_FILE_LOADED. After the last file one more message comes
+ * with isFinished set and no data
+ */
+struct LoadedFile {
+    bool isFinished = false;
+    uint32_t index = 0;
+    std::string path;
+    Error result = OK;
+    uint32_t size = 0;
+    std::shared_ptr<uint8_t> data = nullptr;
+};
+
+inline uint64_t PayloadBytes(const LoadedFile& file)
+{
+    return file.size;
+}
+
+struct FileLoaderConfig {
+    // files and directories separated by ',', as for GetAllFiles
+    std::string fileList;
+    std::string destThread;
+    int destMsgId = MSG_FILE_LOADED;
+    // reads submitted at once
+    uint32_t inFlight = 8;
+    // loaded buffers alive at once: in flight, waiting for their turn and
+    // not yet released by the receiver
+    uint32_t window = 32;
+    bool useIoUring = true;
+};
+
+struct FileLoaderStats {
+    bool ioUring = false;
+    uint32_t files = 0;
+    uint32_t failed = 0;
+    uint64_t bytes = 0;
+    double seconds = 0;
+    double megaBytesPerSecond = 0;
+    uint32_t maxInFlight = 0;
+    uint32_t windowFullWaits = 0;
+    uint32_t queueFullRetries = 0;
+};
+
+class ReadBackend;
+
+class FileLoader : public Thread {
+public:
+    explicit FileLoader(const FileLoaderConfig& config);
+    ~FileLoader();
+
+    int Init() override;
+    int Process(int msgId, std::shared_ptr<void> msgData) override;
+
+    /**
+     * @brief Get the loader statistics, callable from any thread
+     * @return statistics so far
+     */
+    FileLoaderStats GetStats();
+
+private:
+    struct ReadJob {
+        int fd = -1;
+        uint32_t size = 0;
+        uint32_t done = 0;
+        std::shared_ptr<uint8_t> data;
+    };
+
+    Error Start();
+    void Tick();
+    bool ReapReads(bool wait);
+    bool SubmitReads();
+    bool DeliverReady();
+    void FinishJob(uint32_t index, Error result);
+    void SendFinished();
+    void UpdateStats();
+
+    FileLoaderConfig config_;
+    std::unique_ptr<ReadBackend> backend_;
+    std::vector<std::string> files_;
+    std::map<uint32_t, ReadJob> reading_;
+    std::map<uint32_t, std::shared_ptr<LoadedFile>> ready_;
+    std::shared_ptr<std::atomic<uint32_t>> alive_;
+    int destId_;
+    bool running_;
+    uint32_t nextSubmit_;
+    uint32_t nextDeliver_;
+    std::chrono::steady_clock::time_point startTime_;
+    std::mutex statsLock_;
+    FileLoaderStats stats_;
+};
+
+#endif
@@ -0,0 +1,163 @@
+/**
+* Copyright (c) Huawei Technologies Co., Ltd. 2020-2022. All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+
+* http://www.apache.org/licenses/LICENSE-2.0
+
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+
+* File FramePool.h
+* Description: aligned frame buffer pool for ImageData and FrameData
+*/
+#ifndef FRAME_POOL_H
+#define FRAME_POOL_H
+#pragma once
+
+#include <memory>
+#include <vector>
+#include "Error.h"
+#include "Type.h"
+
+/**
+ * Stride rules of the buffers handed to the media engine
+ */
+enum StrideAlign {
+    STRIDE_ALIGN_VPC = 0,   // width ALIGN_UP16, height ALIGN_UP2, vpc and vdec output
+    STRIDE_ALIGN_JPEGD,     // width ALIGN_UP128, height ALIGN_UP16, jpegd output
+    STRIDE_ALIGN_NONE,      // no padding
+};
+
+struct FramePoolConfig {
+    // alignment of buffer start address, a power of two
+    size_t addrAlign = 128;
+    // back buffers of at least 2 MB by huge pages, fall back to normal pages
+    bool useHugePages = false;
+    // touch all pages when the buffer is created
+    bool prefault = false;
+    // idle bytes kept for reuse, buffers returned above this are freed
+    size_t maxIdleBytes = 256 * 1024 * 1024;
+};
+
+struct FramePoolClassStats {
+    size_t classSize = 0;
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint32_t idle = 0;
+    uint32_t inUse = 0;
+};
+
+struct FramePoolStats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t idleBytes = 0;
+    uint64_t inUseBytes = 0;
+    uint64_t hugePageBuffers = 0;
+    std::vector<FramePoolClassStats> classes;
+};
+
+class FramePool {
+public:
+    /**
+    * @brief Constructor
+    */
+    explicit FramePool(const FramePoolConfig& config = FramePoolConfig());
+    FramePool(const FramePool&) = delete;
+    FramePool& operator=(const FramePool&) = delete;
+
+    /**
+    * @brief Destructor, buffers still in use stay valid until released
+    */
+    ~FramePool();
+
+    /**
+     * @brief Get the process wide default pool
+     * @return Instance of FramePool
+     */
+    static FramePool& GetInstance()
+    {
+        static FramePool instance;
+        return instance;
+    }
+
+    /**
+     * @brief Get a buffer of at least size bytes, the buffer goes back to
+     *        the pool when the last reference dies
+     * @param [in]: size: bytes size of buffer
+     * @return shared pointer of buffer, nullptr if out of memory
+     */
+    std::shared_ptr<uint8_t> Alloc(size_t size);
+
+    /**
+     * @brief Fill image geometry by stride rule and attach a pooled buffer
+     * @param [out]: image: image to fill
+     * @param [in]: width: image width
+     * @param [in]: height: image height
+     * @param [in]: format: pixel format
+     * @param [in]: align: stride rule
+     * @return Error OK: success, others: failed
+     */
+    Error AllocImage(ImageData& image, uint32_t width, uint32_t height,
+                     acldvppPixelFormat format = PIXEL_FORMAT_YUV_SEMIPLANAR_420,
+                     StrideAlign align = STRIDE_ALIGN_VPC);
+
+    /**
+     * @brief Attach a pooled buffer to frame, FrameData does not own its
+     *        memory so the caller keeps the returned reference alive
+     * @param [out]: frame: frame to fill
+     * @param [in]: size: bytes size of frame
+     * @return shared pointer of the buffer, nullptr if out of memory
+     */
+    std::shared_ptr<uint8_t> AllocFrame(FrameData& frame, uint32_t size);
+
+    /**
+     * @brief Free all idle buffers
+     * @return None
+     */
+    void Trim();
+
+    void GetStats(FramePoolStats& stats);
+
+    /**
+     * @brief Round a request to the size class that serves it
+     * @param [in]: size: bytes size of request
+     * @return bytes size of class
+     */
+    static size_t ClassSize(size_t size);
+
+public:
+    struct Impl;
+
+private:
+    std::shared_ptr<Impl> impl_;
+};
+
+/**
+ * @brief Calculate aligned image stride by stride rule
+ * @param [in]: width: image width
+ * @param [in]: height: image height
+ * @param [in]: align: stride rule
+ * @param [out]: alignWidth: aligned width
+ * @param [out]: alignHeight: aligned height
+ * @return None
+ */
+void GetAlignedStride(uint32_t width, uint32_t height, StrideAlign align,
+                      uint32_t& alignWidth, uint32_t& alignHeight);
+
+/**
+ * @brief Calculate bytes size of an image with aligned stride
+ * @param [in]: format: pixel format
+ * @param [in]: alignWidth: aligned width
+ * @param [in]: alignHeight: aligned height
+ * @return bytes size, 0 if the format is not supported
+ */
+uint32_t GetImageBufferSize(acldvppPixelFormat format,
+                            uint32_t alignWidth, uint32_t alignHeight);
+
+#endif
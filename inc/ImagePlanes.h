@@ -0,0 +1,131 @@
+/**
+* Copyright (c) Huawei Technologies Co., Ltd. 2020-2022. All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+
+* http://www.apache.org/licenses/LICENSE-2.0
+
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+
+* File ImagePlanes.h
+* Description: plane addresses and strides of ImageData
+*/
+#ifndef IMAGE_PLANES_H
+#define IMAGE_PLANES_H
+#pragma once
+
+#include "Type.h"
+
+/**
+ * Memory layout of an image, strides in bytes. Packed RGB has one plane,
+ * NV12 has the Y plane followed by the interleaved UV plane
+ */
+struct ImagePlanes {
+    uint8_t* plane[2] = { nullptr, nullptr };
+    uint32_t stride[2] = { 0, 0 };
+    uint32_t planeNum = 0;
+};
+
+/**
+ * @brief Get plane addresses of image, alignWidth and alignHeight are the
+ *        strides, 0 means not aligned. For a view the planes start at the
+ *        pixel image.offset points to. When image.size is set the buffer
+ *        must hold every row of every plane
+ * @param [in]: image: input image
+ * @param [out]: planes: plane addresses and strides
+ * @return bool true: success, false: no buffer, unsupported format, view
+ *              out of the buffer or buffer too small
+ */
+inline bool GetImagePlanes(const ImageData& image, ImagePlanes& planes)
+{
+    uint8_t* base = image.data.get();
+    if (base == nullptr || image.width == 0 || image.height == 0) {
+        return false;
+    }
+    uint32_t alignWidth = (image.alignWidth != 0) ? image.alignWidth : image.width;
+    uint32_t alignHeight = (image.alignHeight != 0) ? image.alignHeight : image.height;
+    uint64_t minSize = 0;
+    switch (image.format) {
+        case PIXEL_FORMAT_YUV_SEMIPLANAR_420: {
+            // a chroma row holds whole UV pairs
+            if ((alignWidth & 1) != 0) {
+                return false;
+            }
+            // a view starts on a whole chroma sample
+            uint32_t x = image.offset % alignWidth;
+            uint32_t y = image.offset / alignWidth;
+            if (((x | y) & 1) != 0 || (uint64_t)x + image.width > alignWidth ||
+                (uint64_t)y + image.height > alignHeight) {
+                return false;
+            }
+            planes.plane[0] = base + image.offset;
+            planes.stride[0] = alignWidth;
+            planes.plane[1] = base + (uint64_t)alignWidth * alignHeight + (uint64_t)alignWidth * (y / 2) + x;
+            planes.stride[1] = alignWidth;
+            planes.planeNum = 2;
+            minSize = (uint64_t)alignWidth * alignHeight + (uint64_t)alignWidth * ((y + image.height + 1) / 2);
+            break;
+        }
+        case PIXEL_FORMAT_RGB_888:
+        case PIXEL_FORMAT_BGR_888: {
+            uint32_t rowBytes = alignWidth * 3;
+            uint32_t x = image.offset % rowBytes;
+            uint32_t y = image.offset / rowBytes;
+            if ((x % 3) != 0 || (uint64_t)x / 3 + image.width > alignWidth ||
+                (uint64_t)y + image.height > alignHeight) {
+                return false;
+            }
+            planes.plane[0] = base + image.offset;
+            planes.stride[0] = rowBytes;
+            planes.planeNum = 1;
+            minSize = (uint64_t)rowBytes * (y + image.height);
+            break;
+        }
+        default:
+            return false;
+    }
+    return (image.size == 0) || (image.size >= minSize);
+}
+
+/**
+ * @brief Make a view of a part of image with no copy, it shares and keeps
+ *        alive the buffer of image. Corners are inclusive and clipped to
+ *        the image, for NV12 the part is widened to even coordinates
+ * @param [in]: image: NV12, RGB_888 or BGR_888 image or view
+ * @param [in]: rect: part of image
+ * @param [out]: view: view of the part
+ * @return bool true: success, false: invalid image or rect
+ */
+bool MakeImageView(const ImageData& image, const Rect& rect, ImageData& view);
+
+/**
+ * @brief Whether image is a view of a part of a larger buffer, made by
+ *        MakeImageView
+ * @param [in]: image: image or view
+ * @return bool true: a view, false: the image owns its whole buffer
+ */
+bool IsImageView(const ImageData& image);
+
+/**
+ * @brief Get the geometry of a compact copy of image, the rows of a view
+ *        without the rest of its buffer, strides kept
+ * @param [in]: image: image or view
+ * @param [out]: compact: geometry and size, data not set
+ * @return bool true: success, false: invalid image
+ */
+bool GetCompactGeometry(const ImageData& image, ImageData& compact);
+
+/**
+ * @brief Copy the pixels of src into dst row by row, either may be a view
+ * @param [in]: src: source image
+ * @param [in]: dst: image of the same format, width and height, with data
+ * @return bool true: success, false: the images do not match
+ */
+bool CopyImage(const ImageData& src, const ImageData& dst);
+#endif
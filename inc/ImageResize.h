@@ -0,0 +1,103 @@
+/**
+* Copyright (c) Huawei Technologies Co., Ltd. 2020-2022. All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+
+* http://www.apache.org/licenses/LICENSE-2.0
+
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+
+* File ImageResize.h
+* Description: crop, resize and letterbox of NV12 and RGB ImageData
+*/
+#ifndef IMAGE_RESIZE_H
+#define IMAGE_RESIZE_H
+#pragma once
+
+#include <memory>
+#include <vector>
+#include "Error.h"
+#include "Type.h"
+
+/**
+ * Rect corners are inclusive, as for the vpc crop area. For NV12 the crop
+ * is widened to even coordinates so that it covers whole chroma samples.
+ * Output images keep the input format. When an output buffer is given it
+ * is used as is, otherwise one is taken from FramePool.
+ */
+
+enum ResizeInterp {
+    RESIZE_NEAREST = 0,
+    RESIZE_BILINEAR,
+};
+
+/**
+ * Placement of the scaled content inside a letterboxed image, maps model
+ * coordinates back to the source: srcX = roi.ltX + (x - padLeft) / scale
+ */
+struct LetterboxInfo {
+    float scale = 1.0f;
+    uint32_t padLeft = 0;
+    uint32_t padTop = 0;
+    uint32_t contentWidth = 0;
+    uint32_t contentHeight = 0;
+};
+
+/**
+ * @brief Crop roi from src and resize it to the size of dst
+ * @param [in]: src: NV12, RGB_888 or BGR_888 image
+ * @param [in]: roi: crop area, clipped to the image
+ * @param [in/out]: dst: dst.width and dst.height give the output size
+ * @param [in]: interp: interpolation
+ * @return Error OK: success, others: failed
+ */
+Error CropResizeImage(const ImageData& src, const Rect& roi, ImageData& dst,
+                      ResizeInterp interp = RESIZE_BILINEAR);
+
+/**
+ * @brief Resize the whole src to the size of dst
+ */
+Error ResizeImage(const ImageData& src, ImageData& dst,
+                  ResizeInterp interp = RESIZE_BILINEAR);
+
+/**
+ * @brief Crop roi from src and resize it into dst keeping the aspect ratio,
+ *        the border is filled by padValue
+ * @param [in]: src: NV12, RGB_888 or BGR_888 image
+ * @param [in]: roi: crop area, clipped to the image
+ * @param [in/out]: dst: dst.width and dst.height give the model input size
+ * @param [in]: padValue: border value per channel in dst order, Y U V for NV12
+ * @param [out]: info: placement of the content
+ * @param [in]: interp: interpolation
+ * @return Error OK: success, others: failed
+ */
+Error LetterboxImage(const ImageData& src, const Rect& roi, ImageData& dst,
+                     const uint8_t padValue[3], LetterboxInfo& info,
+                     ResizeInterp interp = RESIZE_BILINEAR);
+
+/**
+ * @brief Crop every box from src and resize each to dstSize x dstSize. The
+ *        outputs are laid one after another in one buffer and the scale
+ *        tables are shared by boxes of the same size
+ * @param [in]: src: NV12, RGB_888 or BGR_888 image
+ * @param [in]: boxes: crop areas
+ * @param [in]: dstSize: output width and height, even for NV12
+ * @param [in]: buffer: output buffer of boxes.size() images, nullptr to
+ *              take one from FramePool
+ * @param [in]: bufferSize: bytes size of buffer
+ * @param [out]: outputs: one image per box, sharing the buffer
+ * @param [in]: interp: interpolation
+ * @return Error OK: success, others: failed
+ */
+Error CropResizeBatch(const ImageData& src, const std::vector<BBox>& boxes,
+                      uint32_t dstSize, std::shared_ptr<uint8_t> buffer,
+                      uint32_t bufferSize, std::vector<ImageData>& outputs,
+                      ResizeInterp interp = RESIZE_BILINEAR);
+
+#endif
@@ -0,0 +1,116 @@
+/**
+* Copyright (c) Huawei Technologies Co., Ltd. 2020-2022. All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+
+* http://www.apache.org/licenses/LICENSE-2.0
+
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+
+* File IoUring.h
+* Description: minimal io_uring ring on the raw system calls
+*/
+#ifndef IO_URING_H
+#define IO_URING_H
+#pragma once
+
+#include <cstdint>
+#include "Error.h"
+
+struct iovec;
+
+/**
+ * One ring used by one thread, no liburing is needed. Init fails on
+ * kernels without io_uring or where it is blocked, the caller then falls
+ * back to blocking calls on a thread pool.
+ */
+
+struct IoCompletion {
+    uint64_t userData = 0;
+    int32_t result = 0;     // bytes done, or -errno
+};
+
+class IoUring {
+public:
+    IoUring();
+    ~IoUring();
+    IoUring(const IoUring&) = delete;
+    IoUring& operator=(const IoUring&) = delete;
+
+    /**
+     * @brief Create the ring
+     * @param [in]: entries: submission ring size, rounded up to a power of 2
+     * @return Error OK: success, others: io_uring is not usable
+     */
+    Error Init(uint32_t entries);
+
+    bool IsReady() const
+    {
+        return ringFd_ >= 0;
+    }
+
+    /**
+     * @brief Queue a read of len bytes at offset, sent by the next Submit
+     * @return bool true: queued, false: the submission ring is full
+     */
+    bool PrepRead(int fd, void* buf, uint32_t len, uint64_t offset, uint64_t userData);
+
+    /**
+     * @brief Queue a gathered write at offset, iov must stay valid until
+     *        the request completes
+     * @return bool true: queued, false: the submission ring is full
+     */
+    bool PrepWritev(int fd, const struct iovec* iov, uint32_t iovCnt, uint64_t offset, uint64_t userData);
+
+    /**
+     * @brief Queue an fsync, or an fdatasync when dataOnly is set
+     * @return bool true: queued, false: the submission ring is full
+     */
+    bool PrepFsync(int fd, bool dataOnly, uint64_t userData);
+
+    /**
+     * @brief Hand the queued requests to the kernel
+     * @param [in]: waitNum: block until this many completions are ready
+     * @return int requests submitted, or -errno
+     */
+    int Submit(uint32_t waitNum = 0);
+
+    /**
+     * @brief Take one completion without blocking
+     * @param [out]: completion: user data and result of a request
+     * @return bool true: got one, false: none is ready
+     */
+    bool PeekCompletion(IoCompletion& completion);
+
+private:
+    // a cleared entry at the tail, nullptr when the ring is full
+    void* NextEntry(uint32_t& index);
+    void QueueEntry(uint32_t index);
+    void Release();
+
+    int ringFd_;
+    uint32_t entries_;
+    uint32_t queued_;
+    void* sqRing_;
+    void* cqRing_;
+    void* sqes_;
+    size_t sqRingSize_;
+    size_t cqRingSize_;
+    size_t sqesSize_;
+    uint32_t* sqHead_;
+    uint32_t* sqTail_;
+    uint32_t* sqMask_;
+    uint32_t* sqArray_;
+    uint32_t* cqHead_;
+    uint32_t* cqTail_;
+    uint32_t* cqMask_;
+    void* cqes_;
+};
+
+#endif
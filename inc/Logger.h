@@ -0,0 +1,329 @@
+/**
+* Copyright (c) Huawei Technologies Co., Ltd. 2020-2022. All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+
+* http://www.apache.org/licenses/LICENSE-2.0
+
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+
+* File Logger.h
+* Description: asynchronous logger behind the LOG_* macros
+*/
+#ifndef LOGGER_H
+#define LOGGER_H
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <type_traits>
+
+/**
+ * A LOG_* call copies its arguments, strings included, into a lock free
+ * buffer of the calling thread and returns, the printf formatting and the
+ * write to stdout are done by a flusher thread. A full buffer drops the
+ * message and counts it instead of blocking the stage. Every call site
+ * passes at most a number of messages per second, the rest are counted
+ * and reported with the next message that passes.
+ */
+
+enum LogLevel {
+    LOG_LEVEL_DEBUG = 0,
+    LOG_LEVEL_INFO,
+    LOG_LEVEL_WARNING,
+    LOG_LEVEL_ERROR,
+    LOG_LEVEL_NONE,
+};
+
+// levels below this are not compiled in, a LogLevel value
+#ifndef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL 0
+#endif
+
+/**
+ * State of one LOG_* call site
+ */
+struct LogSite {
+    LogSite(LogLevel logLevel, const char* logFormat, bool limited = true)
+        : level(logLevel), format(logFormat), rateLimited(limited), window(0), count(0), suppressed(0)
+    {
+    }
+
+    const LogLevel level;
+    const char* const format;
+    // false: the site passes every message, for reports written in one go
+    const bool rateLimited;
+    std::atomic<int64_t> window;
+    std::atomic<uint32_t> count;
+    std::atomic<uint32_t> suppressed;
+};
+
+/**
+ * Arguments of one message packed as tagged values, the tag of an integer
+ * holds its size in bytes above the type
+ */
+class LogArgs {
+public:
+    enum ArgType : uint8_t {
+        ARG_INT = 0,
+        ARG_UINT,
+        ARG_DOUBLE,
+        ARG_STRING,
+        ARG_POINTER,
+    };
+    static const uint32_t kCapacity = 1024;
+    static const uint8_t kTypeMask = 0x0f;
+    static const uint8_t kWidthShift = 4;
+
+    LogArgs() : size_(0) {}
+
+    // width: size of the argument before it was widened to 64 bits
+    void AddInt(int64_t value, uint8_t width = sizeof(int64_t))
+    {
+        AddValue(static_cast<uint8_t>(ARG_INT | (width << kWidthShift)), &value, sizeof(value));
+    }
+    void AddUint(uint64_t value, uint8_t width = sizeof(uint64_t))
+    {
+        AddValue(static_cast<uint8_t>(ARG_UINT | (width << kWidthShift)), &value, sizeof(value));
+    }
+    void AddDouble(double value)
+    {
+        AddValue(ARG_DOUBLE, &value, sizeof(value));
+    }
+    void AddPointer(const void* value)
+    {
+        uint64_t bits = reinterpret_cast<uintptr_t>(value);
+        AddValue(ARG_POINTER, &bits, sizeof(bits));
+    }
+    // the text is cut to what fits, a 16 bit length and the NUL follow the tag
+    void AddString(const char* value);
+
+    const uint8_t* Data() const
+    {
+        return data_;
+    }
+    uint32_t Size() const
+    {
+        return size_;
+    }
+
+private:
+    void AddValue(uint8_t type, const void* value, uint32_t len)
+    {
+        if (size_ + 1 + len > kCapacity) {
+            return;
+        }
+        data_[size_] = type;
+        memcpy(data_ + size_ + 1, value, len);
+        size_ += 1 + len;
+    }
+
+    uint8_t data_[kCapacity];
+    uint32_t size_;
+};
+
+template<typename T>
+inline typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value>::type
+LogArg(LogArgs& args, T value)
+{
+    args.AddInt(value, sizeof(T));
+}
+
+template<typename T>
+inline typename std::enable_if<std::is_integral<T>::value && !std::is_signed<T>::value>::type
+LogArg(LogArgs& args, T value)
+{
+    args.AddUint(value, sizeof(T));
+}
+
+template<typename T>
+inline typename std::enable_if<std::is_enum<T>::value>::type LogArg(LogArgs& args, T value)
+{
+    args.AddInt(static_cast<int64_t>(value), sizeof(T));
+}
+
+template<typename T>
+inline typename std::enable_if<std::is_floating_point<T>::value>::type LogArg(LogArgs& args, T value)
+{
+    args.AddDouble(static_cast<double>(value));
+}
+
+inline void LogArg(LogArgs& args, const char* value)
+{
+    args.AddString(value);
+}
+
+template<typename T>
+inline void LogArg(LogArgs& args, const T* value)
+{
+    args.AddPointer(value);
+}
+
+inline void LogArg(LogArgs& args, std::nullptr_t)
+{
+    args.AddPointer(nullptr);
+}
+
+// never called, lets the compiler check the format against the arguments
+inline void LogFormatCheck(const char*, ...) __attribute__((format(printf, 1, 2)));
+inline void LogFormatCheck(const char*, ...)
+{
+}
+
+struct LoggerStats {
+    uint64_t written = 0;
+    // lost for a full thread buffer
+    uint64_t dropped = 0;
+    // held back by the rate limit
+    uint64_t suppressed = 0;
+    uint32_t threads = 0;
+};
+
+class Logger {
+public:
+    /**
+     * @brief Get the process wide logger, the flusher starts on first use
+     */
+    static Logger& GetInstance();
+
+    static bool IsEnabled(LogLevel level)
+    {
+        return level >= level_.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Set the lowest level written, LOG_LEVEL_INFO by default
+     */
+    static void SetLevel(LogLevel level)
+    {
+        level_.store(level, std::memory_order_relaxed);
+    }
+
+    static LogLevel GetLevel()
+    {
+        return static_cast<LogLevel>(level_.load(std::memory_order_relaxed));
+    }
+
+    /**
+     * @brief Set the messages passed per call site and second, 0: no limit
+     */
+    void SetRateLimit(uint32_t perSecond)
+    {
+        rateLimit_.store(perSecond, std::memory_order_relaxed);
+    }
+
+    template<typename... Args>
+    void Log(LogSite& site, const Args&... values)
+    {
+        LogArgs args;
+        int expand[] = { 0, (LogArg(args, values), 0)... };
+        (void)expand;
+        Write(site, args);
+    }
+
+    /**
+     * @brief Write out everything logged so far before returning
+     */
+    void Flush();
+
+    LoggerStats GetStats();
+
+private:
+    Logger();
+    ~Logger() = delete;
+    Logger(const Logger&) = delete;
+    Logger& operator=(const Logger&) = delete;
+
+    void Write(LogSite& site, const LogArgs& args);
+
+    static std::atomic<int> level_;
+    std::atomic<uint32_t> rateLimit_;
+};
+
+#define LOG_AT_SITE(level, limited, fmt, ...)                         \
+    do {                                                              \
+        if (Logger::IsEnabled(level)) {                               \
+            static LogSite logSite(level, fmt, limited);              \
+            Logger::GetInstance().Log(logSite, ##__VA_ARGS__);        \
+        }                                                             \
+        if (0) {                                                      \
+            LogFormatCheck(fmt, ##__VA_ARGS__);                       \
+        }                                                             \
+    } while (0)
+
+#define LOG_AT(level, fmt, ...) LOG_AT_SITE(level, true, fmt, ##__VA_ARGS__)
+
+/**
+ * @brief Write a log that the per site rate limit never holds back, for
+ *        the lines of a report written from one call site in a loop
+ * @param [in]: level: LogLevel
+ * @param [in]: fmt: the input format string
+ * @return none
+ */
+#define LOG_AT_UNLIMITED(level, fmt, ...)                             \
+    do {                                                              \
+        if ((level) >= LOG_COMPILE_LEVEL) {                           \
+            LOG_AT_SITE(level, false, fmt, ##__VA_ARGS__);            \
+        }                                                             \
+    } while (0)
+
+#define LOG_COMPILED_OUT(fmt, ...)                                    \
+    do {                                                              \
+        if (0) {                                                      \
+            LogFormatCheck(fmt, ##__VA_ARGS__);                       \
+        }                                                             \
+    } while (0)
+
+/**
+ * @brief Write error level log
+ * @param [in]: fmt: the input format string
+ * @return none
+ */
+#if LOG_COMPILE_LEVEL <= 3
+#define LOG_ERROR(fmt, ...) LOG_AT(LOG_LEVEL_ERROR, fmt, ##__VA_ARGS__)
+#else
+#define LOG_ERROR(fmt, ...) LOG_COMPILED_OUT(fmt, ##__VA_ARGS__)
+#endif
+
+/**
+ * @brief Write warning level log
+ * @param [in]: fmt: the input format string
+ * @return none
+ */
+#if LOG_COMPILE_LEVEL <= 2
+#define LOG_WARNING(fmt, ...) LOG_AT(LOG_LEVEL_WARNING, fmt, ##__VA_ARGS__)
+#else
+#define LOG_WARNING(fmt, ...) LOG_COMPILED_OUT(fmt, ##__VA_ARGS__)
+#endif
+
+/**
+ * @brief Write info level log
+ * @param [in]: fmt: the input format string
+ * @return none
+ */
+#if LOG_COMPILE_LEVEL <= 1
+#define LOG_INFO(fmt, ...) LOG_AT(LOG_LEVEL_INFO, fmt, ##__VA_ARGS__)
+#else
+#define LOG_INFO(fmt, ...) LOG_COMPILED_OUT(fmt, ##__VA_ARGS__)
+#endif
+
+/**
+ * @brief Write debug level log, only written after SetLevel(LOG_LEVEL_DEBUG)
+ * @param [in]: fmt: the input format string
+ * @return none
+ */
+#if LOG_COMPILE_LEVEL <= 0
+#define LOG_DEBUG(fmt, ...) LOG_AT(LOG_LEVEL_DEBUG, fmt, ##__VA_ARGS__)
+#else
+#define LOG_DEBUG(fmt, ...) LOG_COMPILED_OUT(fmt, ##__VA_ARGS__)
+#endif
+
+#endif
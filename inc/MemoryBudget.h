@@ -0,0 +1,121 @@
+/**
+* Copyright (c) Huawei Technologies Co., Ltd. 2020-2022. All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+
+* http://www.apache.org/licenses/LICENSE-2.0
+
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+
+* File MemoryBudget.h
+* Description: bytes in flight between threads and the memory ceiling
+*/
+#ifndef MEMORY_BUDGET_H
+#define MEMORY_BUDGET_H
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include "Type.h"
+
+/**
+ * A message sent with a size counts its bytes from SendMessage until its
+ * Process call, or its expiry, is over, in the gauge of the receiver
+ * thread and in the budget of the process. A stage that keeps payloads
+ * past Process, a reorder window or an open batch, goes on counting them
+ * with Thread::HoldBytes until it passes them on. Threads started with
+ * ThreadParam::memoryAdmission are sources: once the budget holds the
+ * ceiling, their sends with a size get ERROR_ENQUEUE, the backpressure
+ * they already handle, until the pipeline drains. Other threads are never
+ * refused, so a stage can always pass on what it holds.
+ */
+
+struct MemoryBudgetStats {
+    uint64_t bytesInFlight = 0;
+    uint64_t maxBytesInFlight = 0;
+    // 0: no ceiling
+    uint64_t ceiling = 0;
+    // source sends refused at the ceiling
+    uint64_t refused = 0;
+    uint64_t refusedBytes = 0;
+};
+
+class MemoryBudget {
+public:
+    MemoryBudget();
+    MemoryBudget(const MemoryBudget&) = delete;
+    MemoryBudget& operator=(const MemoryBudget&) = delete;
+    ~MemoryBudget() {}
+
+    /**
+     * @brief Get the process wide budget
+     * @return Instance of MemoryBudget
+     */
+    static MemoryBudget& GetInstance()
+    {
+        static MemoryBudget instance;
+        return instance;
+    }
+
+    /**
+     * @brief Set the bytes in flight above which sources are refused
+     * @param [in]: bytes: ceiling, 0: none
+     * @return None
+     */
+    void SetCeiling(uint64_t bytes);
+
+    /**
+     * @brief Count bytes in flight for a source, when they fit under the
+     *        ceiling. With nothing in flight anything fits
+     * @param [in]: bytes: size of the message
+     * @return bool true: counted, false: refused
+     */
+    bool TryAcquire(uint64_t bytes);
+
+    /**
+     * @brief Count bytes in flight, ceiling or not
+     * @param [in]: bytes: size of the message
+     * @return None
+     */
+    void Acquire(uint64_t bytes);
+
+    void Release(uint64_t bytes);
+
+    MemoryBudgetStats GetStats();
+
+private:
+    void UpdateMax(uint64_t inFlight);
+
+    std::atomic<uint64_t> bytesInFlight_;
+    std::atomic<uint64_t> maxBytesInFlight_;
+    std::atomic<uint64_t> ceiling_;
+    std::atomic<uint64_t> refused_;
+    std::atomic<uint64_t> refusedBytes_;
+};
+
+/**
+ * Accounted size of a message payload, a typed SendMessage takes it from
+ * here. Payloads of other types count 0 unless they get an overload
+ * next to their definition; a view counts the size of its compact copy,
+ * views of one buffer would count it many times over otherwise
+ */
+uint64_t PayloadBytes(const ImageData& image);
+
+inline uint64_t PayloadBytes(const FrameData& frame)
+{
+    return frame.size;
+}
+
+template<typename T>
+inline uint64_t PayloadBytes(const T&)
+{
+    return 0;
+}
+
+#endif
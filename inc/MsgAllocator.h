@@ -0,0 +1,137 @@
+/**
+* Copyright (c) Huawei Technologies Co., Ltd. 2020-2022. All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+
+* http://www.apache.org/licenses/LICENSE-2.0
+
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+
+* File MsgAllocator.h
+* Description: per-thread slab allocator for short-lived message payloads
+*/
+#ifndef MSG_ALLOCATOR_H
+#define MSG_ALLOCATOR_H
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+/**
+ * Payloads are carved from slabs owned by the allocating thread. A buffer
+ * freed on another thread is not handed to malloc: it is queued back to its
+ * owner in batches and reused there, so producer/consumer stage pairs stop
+ * bouncing memory between malloc arenas.
+ */
+
+struct MsgAllocStats {
+    uint64_t bytesInUse = 0;       // block bytes handed out and not yet freed
+    uint64_t bytesReserved = 0;    // slab bytes held by all thread caches
+    uint64_t allocCount = 0;
+    uint64_t freeCount = 0;
+    uint64_t remoteFreeCount = 0;  // frees that were done on a non-owner thread
+    uint64_t largeAllocCount = 0;  // requests above the biggest size class, served by new
+    uint32_t threadCaches = 0;
+};
+
+/**
+ * @brief Allocate a payload buffer from the calling thread's slab cache
+ * @param [in]: size: bytes size of buffer
+ * @return buffer aligned to 16 bytes, nullptr if out of memory
+ */
+void* MsgAlloc(size_t size);
+
+/**
+ * @brief Release a buffer allocated by MsgAlloc, may be called on any thread
+ * @param [in]: ptr: buffer, nullptr is ignored
+ * @return None
+ */
+void MsgFree(void* ptr);
+
+/**
+ * @brief Hand the frees batched by the calling thread back to their owners.
+ *        Called by the thread loop when its queue is idle
+ * @return None
+ */
+void MsgAllocFlush();
+
+/**
+ * @brief Sum the statistics of all thread caches
+ * @param [out]: stats: allocator statistics
+ * @return None
+ */
+void GetMsgAllocStats(MsgAllocStats& stats);
+
+/**
+ * @brief std allocator on top of MsgAlloc, used to place shared_ptr control
+ *        blocks and small message structs in the thread cache as well
+ */
+template<typename T>
+struct MsgAllocator {
+    typedef T value_type;
+
+    MsgAllocator() = default;
+    template<typename U>
+    MsgAllocator(const MsgAllocator<U>&) {}
+
+    T* allocate(size_t n)
+    {
+        void* p = MsgAlloc(n * sizeof(T));
+        if (p == nullptr) {
+            throw std::bad_alloc();
+        }
+        return static_cast<T*>(p);
+    }
+
+    void deallocate(T* p, size_t)
+    {
+        MsgFree(p);
+    }
+};
+
+template<typename T, typename U>
+bool operator==(const MsgAllocator<T>&, const MsgAllocator<U>&)
+{
+    return true;
+}
+
+template<typename T, typename U>
+bool operator!=(const MsgAllocator<T>&, const MsgAllocator<U>&)
+{
+    return false;
+}
+
+/**
+ * @brief make_shared replacement whose object and control block come from
+ *        the calling thread's slab cache
+ */
+template<typename T, typename... Args>
+std::shared_ptr<T> MakeMsgShared(Args&&... args)
+{
+    return std::allocate_shared<T>(MsgAllocator<T>(), std::forward<Args>(args)...);
+}
+
+/**
+ * @brief Allocate a payload buffer owned by shared pointer, the buffer is
+ *        returned to the slab cache when the last reference dies
+ * @param [in]: size: bytes size of buffer
+ * @return shared pointer of buffer, nullptr if out of memory
+ */
+std::shared_ptr<uint8_t> MsgAllocBuffer(size_t size);
+
+/**
+ * @brief generate shared pointer of memory
+ * @param [in]: size: bytes size of buffer
+ * @return shared pointer of buffer, malloc by MsgAlloc
+ */
+#define SHARED_PTR_MSG_BUF(size) MsgAllocBuffer(size)
+
+#endif
@@ -0,0 +1,76 @@
+/**
+* Copyright (c) Huawei Technologies Co., Ltd. 2020-2022. All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+
+* http://www.apache.org/licenses/LICENSE-2.0
+
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+
+* File Normalize.h
+* Description: packed RGB u8 to normalized float32 NCHW tensor
+*/
+#ifndef NORMALIZE_H
+#define NORMALIZE_H
+#pragma once
+
+#include <vector>
+#include "Error.h"
+#include "Type.h"
+#include "Utils.h"
+
+/**
+ * One pass per row does deinterleave, u8 to float and (x - mean) / std,
+ * the latter as x * (1 / std) - mean / std. The simd paths use fused
+ * multiply add, so they can differ from the scalar path in the last bit.
+ */
+
+struct NormalizeParam {
+    // per channel of the tensor, in the order given by tensorFormat
+    float mean[3] = { 0.0f, 0.0f, 0.0f };
+    float std[3] = { 1.0f, 1.0f, 1.0f };
+    // channel order of the tensor, PIXEL_FORMAT_RGB_888 or BGR_888. Input
+    // of the other order is swapped on the fly
+    acldvppPixelFormat tensorFormat = PIXEL_FORMAT_RGB_888;
+};
+
+/**
+ * @brief Get bytes size of a float32 NCHW tensor of batch images
+ * @param [in]: width, height: image size
+ * @param [in]: batch: images number
+ * @return bytes size
+ */
+inline uint32_t GetNchwTensorSize(uint32_t width, uint32_t height, uint32_t batch)
+{
+    return RGBF32_IMAGE_SIZE(width, height) * batch;
+}
+
+/**
+ * @brief Normalize one RGB_888 or BGR_888 image to a CHW float32 tensor
+ * @param [in]: src: input image, alignWidth is the row stride
+ * @param [in]: param: mean, std and channel order
+ * @param [out]: dst: 3 * src.width * src.height floats
+ * @return Error OK: success, others: failed
+ */
+Error NormalizeToNchw(const ImageData& src, const NormalizeParam& param, float* dst);
+
+/**
+ * @brief Normalize images of the same size to one contiguous NCHW tensor
+ * @param [in]: images: RGB_888 or BGR_888 images
+ * @param [in]: param: mean, std and channel order
+ * @param [in/out]: output: tensor buffer. When output.data is set
+ *                  output.size must hold the tensor, otherwise a buffer
+ *                  is taken from FramePool. output.size is set to the
+ *                  tensor size
+ * @return Error OK: success, others: failed
+ */
+Error NormalizeBatchToNchw(const std::vector<ImageData>& images, const NormalizeParam& param,
+                           InferenceOutput& output);
+
+#endif
@@ -0,0 +1,48 @@
+/**
+* Copyright (c) Huawei Technologies Co., Ltd. 2020-2022. All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+
+* http://www.apache.org/licenses/LICENSE-2.0
+
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+
+* File ParallelFor.h
+* Description: split data parallel kernels over a shared worker pool
+*/
+#ifndef PARALLEL_FOR_H
+#define PARALLEL_FOR_H
+#pragma once
+
+#include <cstdint>
+#include <functional>
+
+typedef std::function<void(uint32_t begin, uint32_t end)> ParallelTask;
+
+/**
+ * @brief Split [0, count) to chunks of grain items and run them on the
+ *        shared worker pool. The calling thread takes part and the call
+ *        returns when all chunks are done
+ * @param [in]: count: items number
+ * @param [in]: grain: items number of one chunk
+ * @param [in]: task: function called with the item range of a chunk
+ * @return None
+ */
+void ParallelFor(uint32_t count, uint32_t grain, const ParallelTask& task);
+
+/**
+ * @brief Set workers number of the pool, takes effect only before the
+ *        first ParallelFor. Default is cpu number - 1, at most 8
+ * @param [in]: num: workers number, 0 runs every task on the caller
+ * @return None
+ */
+void SetParallelWorkers(uint32_t num);
+
+uint32_t GetParallelWorkers();
+#endif
@@ -0,0 +1,124 @@
+/**
+* Copyright (c) Huawei Technologies Co., Ltd. 2020-2022. All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+
+* http://www.apache.org/licenses/LICENSE-2.0
+
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+
+* File PartitionRouter.h
+* Description: key affine routing over the replicas of a stage
+*/
+#ifndef PARTITION_ROUTER_H
+#define PARTITION_ROUTER_H
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * A replica group is the threads started with the same
+ * ThreadParam::replicaGroup. A keyed SendMessage to any of them goes to
+ * the replica that wins the rendezvous hash of the key over the active
+ * replicas, so a key stays on one replica and a change of the replica
+ * count moves only the keys won or lost by the changed replica. A key
+ * with messages still queued or in Process stays on the replica it is on
+ * and moves once they are done, which keeps the messages of a key in
+ * order across the change.
+ */
+
+struct ReplicaStats {
+    int instId = -1;
+    std::string name;
+    bool active = false;
+    uint64_t routed = 0;
+};
+
+struct PartitionStats {
+    std::string group;
+    std::vector<ReplicaStats> replicas;
+    uint64_t routed = 0;
+    // routes kept on the old replica of a key for its messages in flight
+    uint64_t heldRoutes = 0;
+    uint32_t keysInFlight = 0;
+};
+
+/**
+ * @brief Pick the rendezvous hash winner of a key
+ * @param [in]: key: partition key
+ * @param [in]: seeds: hash seed of each candidate
+ * @return index of the winner, seeds.size() when there is none
+ */
+size_t PickReplica(uint64_t key, const std::vector<uint64_t>& seeds);
+
+class PartitionRouter {
+public:
+    explicit PartitionRouter(const std::string& group);
+    ~PartitionRouter() {}
+
+    void AddReplica(int instId, const std::string& name);
+
+    /**
+     * @brief Take a replica in or out of the routing, its keys in flight
+     *        stay on it until they are done
+     * @param [in]: instId: thread instance id of the replica
+     * @param [in]: active: true: routed to, false: not routed to
+     * @return bool false: not a replica of this group
+     */
+    bool SetActive(int instId, bool active);
+
+    /**
+     * @brief Pick the replica of a key and count one message of it in
+     *        flight, Release ends it
+     * @param [in]: key: partition key
+     * @return thread instance id, -1 when no replica is active
+     */
+    int Route(uint64_t key);
+
+    /**
+     * @brief End one message of a key, after its Process or a failed send
+     * @param [in]: key: partition key
+     */
+    void Release(uint64_t key);
+
+    PartitionStats GetStats();
+
+private:
+    struct KeyState {
+        // index in replicas_
+        size_t index = 0;
+        uint32_t inFlight = 0;
+    };
+
+    void UpdateActive();
+
+    std::string group_;
+    std::mutex lock_;
+    std::vector<ReplicaStats> replicas_;
+    // seeds of the active replicas and their index in replicas_
+    std::vector<uint64_t> activeSeeds_;
+    std::vector<size_t> activeIndex_;
+    // only keys with messages in flight
+    std::unordered_map<uint64_t, KeyState> keys_;
+    uint64_t routed_;
+    uint64_t heldRoutes_;
+};
+
+/**
+ * @brief Get the router of a replica group, creating it on first use
+ * @param [in]: group: replica group name
+ * @return router, it lives as long as the process
+ */
+PartitionRouter* GetPartitionRouter(const std::string& group);
+
+#endif
@@ -0,0 +1,152 @@
+/**
+* Copyright (c) Huawei Technologies Co., Ltd. 2020-2022. All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+
+* http://www.apache.org/licenses/LICENSE-2.0
+
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+
+* File ReorderStage.h
+* Description: reorder buffer that restores frameId order after parallel workers
+*/
+#ifndef REORDER_STAGE_H
+#define REORDER_STAGE_H
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "Thread.h"
+#include "Utils.h"
+
+/**
+ * The stage passes the frames of each stream on in frameId order. A frame
+ * ahead of the next expected one waits in the window of its stream. The
+ * window gives up on a missing frame when its oldest frame has waited
+ * gapTimeoutUs, or when it holds windowSize frames, and goes on from the
+ * lowest frame it has. A frame behind the expected one came too late and
+ * is dropped, or sent on out of order with forwardLate. A finish frame
+ * takes its place in the sequence and closes the stream when released.
+ */
+
+enum ReorderStageMsg {
+    MSG_REORDER_FRAME = 1600,
+    MSG_REORDER_TICK,
+    // release everything held, gaps skipped
+    MSG_REORDER_FLUSH,
+    MSG_REORDER_OUTPUT,
+};
+
+/**
+ * Sequence of a payload
+ */
+struct ReorderKey {
+    uint32_t streamId = 0;
+    uint32_t frameId = 0;
+    bool isFinished = false;
+};
+
+struct ReorderStageConfig {
+    std::string destThread;
+    int destMsgId = MSG_REORDER_OUTPUT;
+    int inputMsgId = MSG_REORDER_FRAME;
+    // frames held for each stream at most
+    uint32_t windowSize = 64;
+    // longest wait for a missing frame
+    int64_t gapTimeoutUs = 100000;
+    // frameId each stream starts at
+    uint32_t firstFrameId = 0;
+    // send late frames on out of order instead of dropping them
+    bool forwardLate = false;
+    // sequence of an input payload, false when it has none. nullptr: the
+    // payload is a FrameData of stream 0
+    std::function<bool(const std::shared_ptr<void>&, ReorderKey&)> getKey;
+};
+
+struct ReorderStreamStats {
+    uint32_t streamId = 0;
+    uint64_t released = 0;
+    // frame ids given up on, by timeout or a full window
+    uint64_t skipped = 0;
+    uint64_t lateFrames = 0;
+    uint64_t duplicates = 0;
+    // frames held now and at most
+    uint32_t occupancy = 0;
+    uint32_t maxOccupancy = 0;
+    uint32_t nextFrameId = 0;
+};
+
+struct ReorderStageStats {
+    std::vector<ReorderStreamStats> streams;
+    uint64_t released = 0;
+    uint64_t skipped = 0;
+    uint64_t timeoutSkips = 0;
+    uint64_t overflowSkips = 0;
+    uint64_t lateFrames = 0;
+    uint64_t duplicates = 0;
+    // payloads without a sequence
+    uint64_t rejected = 0;
+    uint64_t queueFullRetries = 0;
+    uint32_t occupancy = 0;
+};
+
+class ReorderStage : public Thread {
+public:
+    explicit ReorderStage(const ReorderStageConfig& config);
+    ~ReorderStage() {}
+
+    int Init() override;
+    int Process(int msgId, std::shared_ptr<void> msgData) override;
+
+    /**
+     * @brief Get the stage statistics, callable from any thread
+     * @return statistics so far
+     */
+    ReorderStageStats GetStats();
+
+private:
+    struct Pending {
+        std::shared_ptr<void> item;
+        // size the frame came with, passed on with it
+        uint64_t bytes = 0;
+        bool isFinished = false;
+        int64_t arrivalUs = 0;
+    };
+
+    struct Stream {
+        uint32_t nextFrameId = 0;
+        std::map<uint32_t, Pending> window;
+        ReorderStreamStats stats;
+    };
+
+    void AddFrame(std::shared_ptr<void> item, uint64_t bytes);
+    // send the frames from nextFrameId on that are there
+    void ReleaseReady(Stream& stream);
+    // give up on the frames before the lowest one held
+    void SkipGap(Stream& stream);
+    void Tick();
+    void Send(const std::shared_ptr<void>& item, uint64_t bytes);
+    void UpdateStats();
+
+    ReorderStageConfig config_;
+    int destId_;
+    std::map<uint32_t, Stream> streams_;
+    uint32_t occupancy_;
+    // counters of the stage thread, copied to stats_ after each message
+    ReorderStageStats totals_;
+    std::mutex statsLock_;
+    ReorderStageStats stats_;
+};
+
+#endif
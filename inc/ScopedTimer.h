@@ -0,0 +1,136 @@
+/**
+* Copyright (c) Huawei Technologies Co., Ltd. 2020-2022. All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+
+* http://www.apache.org/licenses/LICENSE-2.0
+
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+
+* File ScopedTimer.h
+* Description: named scoped timers recorded into histograms
+*/
+#ifndef SCOPED_TIMER_H
+#define SCOPED_TIMER_H
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/**
+ * SCOPED_TIMER("name") times the rest of the enclosing scope. Samples go
+ * to a histogram of the calling thread without locks, the histograms of
+ * all threads are merged when a report is asked for. The clock is the
+ * TSC when the CPU marks it invariant and steady_clock otherwise. Build
+ * with SCOPED_TIMER_ENABLE=0 to compile the timers out.
+ */
+
+#ifndef SCOPED_TIMER_ENABLE
+#define SCOPED_TIMER_ENABLE 1
+#endif
+
+struct TimerStats {
+    std::string name;
+    uint64_t count = 0;
+    // microseconds, the percentiles are within 1/16 of the true value
+    double totalUs = 0;
+    double meanUs = 0;
+    double minUs = 0;
+    double p50Us = 0;
+    double p99Us = 0;
+    double p999Us = 0;
+    double maxUs = 0;
+};
+
+/**
+ * @brief Whether the timers count TSC ticks
+ */
+bool TimerUsesTsc();
+
+/**
+ * @brief Read the timer clock
+ * @return uint64_t ticks, TSC or nanoseconds
+ */
+inline uint64_t TimerNow()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    if (TimerUsesTsc()) {
+        return __rdtsc();
+    }
+#endif
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * @brief Get the id of a timer name, the same name gives the same id
+ * @param [in]: name: timer name
+ * @return uint32_t timer id
+ */
+uint32_t RegisterTimer(const char* name);
+
+/**
+ * @brief Add one sample to a timer from the calling thread
+ * @param [in]: timerId: id by RegisterTimer
+ * @param [in]: ticks: elapsed TimerNow ticks
+ */
+void RecordTimer(uint32_t timerId, uint64_t ticks);
+
+/**
+ * @brief Merge the histograms of all threads
+ * @return std::vector<TimerStats> one entry for each timer with samples
+ */
+std::vector<TimerStats> GetTimerReport();
+
+/**
+ * @brief Write the report by LOG_INFO, one line for each timer
+ */
+void LogTimerReport();
+
+/**
+ * @brief Clear the samples of all timers
+ */
+void ResetTimers();
+
+class ScopedTimer {
+public:
+    explicit ScopedTimer(uint32_t timerId) : timerId_(timerId), start_(TimerNow()) {}
+    ~ScopedTimer()
+    {
+        RecordTimer(timerId_, TimerNow() - start_);
+    }
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+private:
+    uint32_t timerId_;
+    uint64_t start_;
+};
+
+#define SCOPED_TIMER_CONCAT_INNER(a, b) a##b
+#define SCOPED_TIMER_CONCAT(a, b) SCOPED_TIMER_CONCAT_INNER(a, b)
+
+/**
+ * @brief Time the rest of the scope under name, a string literal
+ */
+#if SCOPED_TIMER_ENABLE
+#define SCOPED_TIMER(name)                                                               \
+    static const uint32_t SCOPED_TIMER_CONCAT(scopedTimerId, __LINE__) = RegisterTimer(name); \
+    ScopedTimer SCOPED_TIMER_CONCAT(scopedTimer, __LINE__)(SCOPED_TIMER_CONCAT(scopedTimerId, __LINE__))
+#else
+#define SCOPED_TIMER(name) do {} while (0)
+#endif
+
+#endif
@@ -0,0 +1,118 @@
+/**
+* Copyright (c) Huawei Technologies Co., Ltd. 2020-2022. All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+
+* http://www.apache.org/licenses/LICENSE-2.0
+
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+
+* File Simd.h
+* Description: runtime cpu feature dispatch and shared simd helpers
+*/
+#ifndef SIMD_H
+#define SIMD_H
+#pragma once
+
+#include <cstdint>
+
+/**
+ * Kernels are built for the baseline target and carry per function target
+ * attributes for the wider instruction sets, the level is picked once at
+ * runtime. Non x86 builds only have the scalar path.
+ */
+#if defined(__x86_64__) || defined(__i386__)
+#define SIMD_X86 1
+#include <immintrin.h>
+#define SIMD_TARGET(isa) __attribute__((target(isa)))
+#else
+#define SIMD_X86 0
+#define SIMD_TARGET(isa)
+#endif
+
+enum SimdLevel {
+    SIMD_SCALAR = 0,
+    SIMD_SSE41,
+    SIMD_AVX2,
+    SIMD_AVX512,
+};
+
+/**
+ * @brief Get the widest instruction set usable by the kernels, detected on
+ *        first call and capped by SetSimdLevel or env RUN_LOOP_SIMD
+ *        (scalar, sse41, avx2, avx512)
+ * @return simd level
+ */
+SimdLevel GetSimdLevel();
+
+/**
+ * @brief Cap the instruction set used by the kernels, for benchmark and
+ *        verification against the scalar path
+ * @param [in]: level: the widest level allowed
+ * @return None
+ */
+void SetSimdLevel(SimdLevel level);
+
+const char* SimdLevelName(SimdLevel level);
+
+#if SIMD_X86
+/**
+ * @brief Split 16 interleaved RGB24 pixels (48 bytes) to planes
+ * @param [in]: src: 48 bytes of packed pixels
+ * @param [out]: c0, c1, c2: 16 bytes of channel 0, 1, 2
+ * @return None
+ */
+SIMD_TARGET("ssse3")
+static inline void DeinterleaveRgb16(const uint8_t* src, __m128i& c0, __m128i& c1, __m128i& c2)
+{
+    const __m128i s0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+    const __m128i s1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 16));
+    const __m128i s2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 32));
+    c0 = _mm_or_si128(_mm_or_si128(
+        _mm_shuffle_epi8(s0, _mm_setr_epi8(0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1)),
+        _mm_shuffle_epi8(s1, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14, -1, -1, -1, -1, -1))),
+        _mm_shuffle_epi8(s2, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 1, 4, 7, 10, 13)));
+    c1 = _mm_or_si128(_mm_or_si128(
+        _mm_shuffle_epi8(s0, _mm_setr_epi8(1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1)),
+        _mm_shuffle_epi8(s1, _mm_setr_epi8(-1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1))),
+        _mm_shuffle_epi8(s2, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14)));
+    c2 = _mm_or_si128(_mm_or_si128(
+        _mm_shuffle_epi8(s0, _mm_setr_epi8(2, 5, 8, 11, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1)),
+        _mm_shuffle_epi8(s1, _mm_setr_epi8(-1, -1, -1, -1, -1, 1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1))),
+        _mm_shuffle_epi8(s2, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15)));
+}
+
+/**
+ * @brief Pack 16 pixels of three planes to interleaved RGB24 (48 bytes)
+ * @param [in]: c0, c1, c2: 16 bytes of channel 0, 1, 2
+ * @param [out]: dst: 48 bytes of packed pixels
+ * @return None
+ */
+SIMD_TARGET("ssse3")
+static inline void InterleaveRgb16(__m128i c0, __m128i c1, __m128i c2, uint8_t* dst)
+{
+    __m128i d0 = _mm_or_si128(_mm_or_si128(
+        _mm_shuffle_epi8(c0, _mm_setr_epi8(0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1, -1, 5)),
+        _mm_shuffle_epi8(c1, _mm_setr_epi8(-1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1, -1))),
+        _mm_shuffle_epi8(c2, _mm_setr_epi8(-1, -1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1)));
+    __m128i d1 = _mm_or_si128(_mm_or_si128(
+        _mm_shuffle_epi8(c0, _mm_setr_epi8(-1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1, 10, -1)),
+        _mm_shuffle_epi8(c1, _mm_setr_epi8(5, -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1, 10))),
+        _mm_shuffle_epi8(c2, _mm_setr_epi8(-1, 5, -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1)));
+    __m128i d2 = _mm_or_si128(_mm_or_si128(
+        _mm_shuffle_epi8(c0, _mm_setr_epi8(-1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1, -1)),
+        _mm_shuffle_epi8(c1, _mm_setr_epi8(-1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1))),
+        _mm_shuffle_epi8(c2, _mm_setr_epi8(10, -1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15)));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), d0);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 16), d1);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 32), d2);
+}
+#endif
+
+#endif
@@ -0,0 +1,162 @@
+/**
+* Copyright (c) Huawei Technologies Co., Ltd. 2020-2022. All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+
+* http://www.apache.org/licenses/LICENSE-2.0
+
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+
+* File StreamDemuxer.h
+* Description: H.264/H.265 Annex-B elementary stream source thread
+*/
+#ifndef STREAM_DEMUXER_H
+#define STREAM_DEMUXER_H
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include "DropPolicy.h"
+#include "Thread.h"
+#include "Utils.h"
+
+/**
+ * The demuxer maps a .h264/.h265 file and cuts it into access units, one
+ * FrameData each with the start codes kept, as the decoder takes them.
+ * The frames point into the mapping, FrameData::buffer keeps it mapped
+ * while any frame is alive. Frames go out as fast as the receiver takes
+ * them, or at fps when pacing is asked for.
+ */
+
+enum StreamDemuxerMsg {
+    MSG_DEMUX_START = 1200,
+    MSG_DEMUX_TICK,
+    MSG_DEMUX_FRAME,
+};
+
+enum StreamCodec {
+    STREAM_CODEC_AUTO = 0,      // by file extension, .h265 and .hevc are H.265
+    STREAM_CODEC_H264,
+    STREAM_CODEC_H265,
+};
+
+/**
+ * One access unit, start codes included
+ */
+struct AccessUnit {
+    const uint8_t* data = nullptr;
+    uint32_t size = 0;
+    bool isKeyFrame = false;
+};
+
+/**
+ * @brief Find the next 00 00 01 start code prefix
+ * @param [in]: begin, end: bytes to search
+ * @return const uint8_t* the first 00 of the prefix, end when there is none
+ */
+const uint8_t* FindStartCode(const uint8_t* begin, const uint8_t* end);
+
+/**
+ * Cuts a buffer into access units on the NAL unit types and the first
+ * slice flags, walking it once
+ */
+class AnnexBParser {
+public:
+    AnnexBParser(const uint8_t* data, uint64_t size, StreamCodec codec);
+
+    /**
+     * @brief Get the next access unit
+     * @param [out]: unit: the access unit
+     * @return bool true: got one, false: the end is reached
+     */
+    bool Next(AccessUnit& unit);
+
+    void Rewind();
+
+private:
+    // where the NAL unit at start code nal begins a new access unit
+    bool StartsAccessUnit(const uint8_t* nal, bool haveSlice, bool& isSlice, bool& isKey) const;
+
+    const uint8_t* begin_;
+    const uint8_t* end_;
+    const uint8_t* next_;
+    StreamCodec codec_;
+};
+
+struct StreamDemuxerConfig {
+    std::string filePath;
+    StreamCodec codec = STREAM_CODEC_AUTO;
+    std::string destThread;
+    int destMsgId = MSG_DEMUX_FRAME;
+    // 0: full speed, else frames per second of the replay
+    double fps = 0;
+    // start over at the end instead of finishing
+    bool loop = false;
+    // frames sent in one tick at full speed
+    uint32_t framesPerTick = 8;
+    // stream id given to the drop policy
+    uint32_t cameraId = 0;
+    // nullptr: send every frame. Else the frames the policy refuses are
+    // dropped, and the rest of the GOP with them as the decoder can not
+    // use frames whose references are gone
+    std::shared_ptr<DropPolicy> dropPolicy;
+};
+
+struct StreamDemuxerStats {
+    uint32_t frames = 0;
+    uint32_t keyFrames = 0;
+    uint64_t bytes = 0;
+    uint32_t loops = 0;
+    uint32_t queueFullRetries = 0;
+    // frames sent later than their paced time by over one frame interval
+    uint32_t lateFrames = 0;
+    // frames dropped by the drop policy, up to the next key frame
+    uint32_t policyDrops = 0;
+};
+
+class StreamDemuxer : public Thread {
+public:
+    explicit StreamDemuxer(const StreamDemuxerConfig& config);
+    ~StreamDemuxer() {}
+
+    int Init() override;
+    int Process(int msgId, std::shared_ptr<void> msgData) override;
+
+    /**
+     * @brief Get the demuxer statistics, callable from any thread
+     * @return statistics so far
+     */
+    StreamDemuxerStats GetStats();
+
+private:
+    Error Start();
+    void Tick();
+    // false when the receiver queue is full
+    bool SendFrame(const AccessUnit& unit);
+    void SendFinished();
+
+    StreamDemuxerConfig config_;
+    FileView file_;
+    std::unique_ptr<AnnexBParser> parser_;
+    AccessUnit pending_;
+    bool hasPending_;
+    // a frame was dropped, the next frames wait for a key frame
+    bool skipToKey_;
+    int destId_;
+    bool running_;
+    uint32_t frameId_;
+    std::chrono::steady_clock::time_point startTime_;
+    std::mutex statsLock_;
+    StreamDemuxerStats stats_;
+};
+
+#endif
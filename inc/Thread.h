@@ -11,6 +11,23 @@
 #include "Type.h"
 
 #define INVALID_INSTANCE_ID (-1)
+
+/**
+ * How a thread waits for messages when its queue is empty
+ */
+enum WaitStrategy {
+    // sleep 10 ms when idle and yield after each message, the old loop
+    WAIT_SLEEP = 0,
+    // spin with a pause instruction, lowest latency, a core of CPU
+    WAIT_SPIN,
+    // sched_yield in a loop, low latency while the core is not wanted
+    WAIT_YIELD,
+    // spin for spinUs, then block on the queue
+    WAIT_SPIN_PARK,
+    // block on the queue, woken by the sender
+    WAIT_BLOCK,
+};
+
 class Thread {
 public:
     Thread();
@@ -20,6 +37,15 @@ public:
         return OK;
     };
     virtual int Process(int msgId, std::shared_ptr<void> msgData) = 0;
+    /**
+     * @brief Called on the thread instead of Process for a message whose
+     *        deadline passed before it was processed
+     * @param [in]: msgId: message id
+     * @param [in]: msgData: message data
+     * @param [in]: lateUs: time since the deadline
+     * @return None
+     */
+    virtual void OnExpired(int msgId, std::shared_ptr<void> msgData, int64_t lateUs) {}
     int SelfInstanceId()
     {
         return instanceId_;
@@ -38,6 +64,69 @@ public:
     }
     Error BaseConfig(int instanceId, const std::string& threadName,
                             aclrtContext context, aclrtRunMode runMode);
+    /**
+     * @brief Called by the thread loop before each Process call, ends the
+     *        pending tick when msgId is the tick
+     * @param [in]: msgId: message about to be processed
+     * @param [in]: bytes: size it was sent with
+     * @return None
+     */
+    void BeforeProcess(int msgId, uint64_t bytes);
+    /**
+     * @brief Called by the thread loop after it took a message off the
+     *        queue, sends a deferred tick again
+     * @return None
+     */
+    void AfterProcess();
+
+protected:
+    /**
+     * @brief Get the size the message in Process was sent with, for a stage
+     *        that passes the payload on
+     * @return accounted bytes, 0 when sent without a size
+     */
+    uint64_t CurrentMessageBytes()
+    {
+        return msgBytes_;
+    }
+    /**
+     * @brief Keep the thread going with a message to itself. At most one
+     *        tick is queued, a tick that finds the queue full is sent again
+     *        once the thread has taken a message off
+     * @param [in]: tickMsgId: message id of the tick
+     * @param [in]: waitUs: time until the tick is due, slept off first
+     *              while no other message is queued for the thread
+     * @return Error OK: queued or deferred, others: the thread is stopping
+     */
+    Error ScheduleTick(int tickMsgId, int64_t waitUs = 0);
+    /**
+     * @brief Send, waiting while the receiver queue is full, until the
+     *        message is queued or this thread is asked to stop
+     * @param [in]: dest: thread instance id
+     * @param [in]: msgId: message id
+     * @param [in]: data: message data
+     * @param [in]: bytes: accounted size, as for SendMessageWithBytes
+     * @param [out]: retries: added the number of full queue waits
+     * @return Error OK: success, ERROR_ENQUEUE: still full at stop, others:
+     *         send failed
+     */
+    Error SendWithRetry(int dest, int msgId, std::shared_ptr<void> data, uint64_t bytes, uint64_t& retries);
+    /**
+     * @brief Keep counting payload bytes in the gauge of this thread and in
+     *        MemoryBudget after the Process call of their message, for a
+     *        stage that holds payloads. Call from Process only
+     * @param [in]: bytes: size of the payloads kept
+     * @return None
+     */
+    void HoldBytes(uint64_t bytes);
+    /**
+     * @brief End the count of HoldBytes once the payloads are passed on or
+     *        dropped. Call from Process only
+     * @param [in]: bytes: as given to HoldBytes
+     * @return None
+     */
+    void ReleaseHeldBytes(uint64_t bytes);
+
 private:
     aclrtContext context_;
     aclrtRunMode runMode_;
@@ -45,6 +134,10 @@ private:
     std::string instanceName_;
     bool baseConfiged_;
     bool isExit_;
+    int tickMsgId_;
+    bool tickPending_;
+    bool tickDeferred_;
+    uint64_t msgBytes_;
 };
 
 struct ThreadParam {
@@ -54,5 +147,19 @@ struct ThreadParam {
     aclrtRunMode runMode = ACL_HOST;
     int threadInstId = INVALID_INSTANCE_ID;
     uint32_t queueSize = 256;
+    // empty: a thread of its own. Threads with the same group name share
+    // the OS thread and the queue of the first of them, messages between
+    // them are direct Process calls
+    std::string fuseGroup = "";
+    // empty: no replicas. Threads with the same group name are replicas of
+    // one stage, a keyed SendMessage to any of them picks one by the key
+    std::string replicaGroup = "";
+    // a fuse group waits as its leader does
+    WaitStrategy waitStrategy = WAIT_SLEEP;
+    // spin budget of WAIT_SPIN_PARK
+    uint32_t spinUs = 50;
+    // a source: its sends with a size are refused with ERROR_ENQUEUE while
+    // the pipeline holds the MemoryBudget ceiling
+    bool memoryAdmission = false;
 };
 #endif
\ No newline at end of file
@@ -19,9 +19,12 @@
 #ifndef THREADMGR_H
 #define THREADMGR_H
 #pragma once
+#include <atomic>
+#include <chrono>
 #include <iostream>
 #include <memory>
 #include <thread>
+#include <vector>
 #include <unistd.h>
 #include "Utils.h"
 #include "ThreadSafeQueue.h"
@@ -35,6 +38,60 @@ enum ThreadStatus {
     THREAD_ERROR = 4,
 };
 
+/**
+ * Queue metrics of one thread, the wait and service times are moving
+ * averages over the last few messages
+ */
+struct ThreadQueueStats {
+    uint32_t depth = 0;
+    uint32_t capacity = 0;
+    uint64_t messages = 0;
+    // time from SendMessage to Process
+    int64_t waitUs = 0;
+    int64_t maxWaitUs = 0;
+    // time in Process
+    int64_t serviceUs = 0;
+    ThreadStatus status = THREAD_READY;
+    // time in the Process call running now, 0 when idle
+    int64_t busyUs = 0;
+    int busyMsgId = 0;
+    WaitStrategy waitStrategy = WAIT_SLEEP;
+    // messages that found the thread idle, and the average time from their
+    // SendMessage to Process, what the wait strategy buys
+    uint64_t wakeups = 0;
+    int64_t wakeUs = 0;
+    // times WAIT_SPIN_PARK or WAIT_BLOCK blocked on the queue
+    uint64_t parks = 0;
+    // CPU time of the OS thread and the part of it in Process, what the
+    // wait strategy costs is the rest. Sampled every few milliseconds
+    int64_t cpuUs = 0;
+    int64_t processTotalUs = 0;
+    // messages dropped for a passed deadline instead of processed, and the
+    // most one was past its deadline
+    uint64_t expired = 0;
+    int64_t maxExpiredLateUs = 0;
+    // payload bytes queued for the thread or in its Process call, see MemoryBudget
+    uint64_t bytesInFlight = 0;
+    uint64_t maxBytesInFlight = 0;
+};
+
+/**
+ * @brief Read the clock stamped on queued messages
+ * @return steady clock microseconds
+ */
+inline int64_t MsgClockUs()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * Threads of one fuse group share the OS thread and the queue of the first
+ * of them, the leader. A message sent from inside the group to a member
+ * that is not in Process already is a direct Process call, with no queue
+ * hop; other messages to the group go through the leader queue. A direct
+ * call runs before the messages queued for the member earlier.
+ */
 class ThreadMgr {
 public:
     ThreadMgr(Thread* userThreadInstance,
@@ -67,12 +124,136 @@ public:
         return status_;
     }
     Error WaitThreadInitEnd();
- 
+    void GetQueueStats(ThreadQueueStats& stats);
+    /**
+     * @brief Run member on the thread and the queue of this leader
+     * @param [in]: member: thread manager of a later thread of the group
+     * @return None
+     */
+    void AddFuseMember(ThreadMgr* member);
+    /**
+     * @brief Whether SendMessage to this thread from the calling OS thread
+     *        can be a direct Process call
+     * @return true: same fuse group, and this thread is not in Process
+     */
+    bool CanProcessInline();
+    /**
+     * @brief Process a message at once on the calling OS thread
+     * @param [in]: msgId: message id
+     * @param [in]: data: message data
+     * @param [in]: bytes: size the message was sent with, not accounted
+     * @return Error OK: success, ERROR_THREAD_ABNORMAL: Process failed
+     */
+    Error ProcessInline(int msgId, std::shared_ptr<void> data, uint64_t bytes);
+    /**
+     * @brief Drop a message past its deadline, the user thread gets
+     *        OnExpired instead of Process, the main thread nothing
+     * @param [in]: msgId: message id
+     * @param [in]: data: message data
+     * @param [in]: lateUs: time since the deadline
+     * @return None
+     */
+    void ExpireMessage(int msgId, std::shared_ptr<void>& data, int64_t lateUs);
+    /**
+     * @brief Set how the thread waits on an empty queue, before it starts
+     * @param [in]: strategy: wait strategy
+     * @param [in]: spinUs: spin budget of WAIT_SPIN_PARK
+     * @return None
+     */
+    void SetWaitStrategy(WaitStrategy strategy, uint32_t spinUs);
+    void SetPartitionRouter(PartitionRouter* router)
+    {
+        router_ = router;
+    }
+    PartitionRouter* GetPartitionRouter()
+    {
+        return router_;
+    }
+    void SetMemoryAdmission(bool admission)
+    {
+        memoryAdmission_ = admission;
+    }
+    bool GetMemoryAdmission()
+    {
+        return memoryAdmission_;
+    }
+    /**
+     * @brief End the accounting of a message taken off the queue, processed
+     *        or not: its bytes in flight and the key it holds on a replica
+     * @param [in]: msg: message sent to this thread
+     * @return None
+     */
+    void EndMessage(const Message& msg);
+    /**
+     * @brief Count payload bytes the thread keeps past the Process call of
+     *        their message, as if still in flight to it. Never refused
+     * @param [in]: bytes: size of the payloads kept
+     * @return None
+     */
+    void HoldBytes(uint64_t bytes);
+    /**
+     * @brief End the count of held bytes, once they are passed on or dropped
+     * @param [in]: bytes: as given to HoldBytes
+     * @return None
+     */
+    void ReleaseHeldBytes(uint64_t bytes);
+    /**
+     * @brief Get the thread whose Process call runs on the calling OS thread
+     * @return thread manager, nullptr outside Process
+     */
+    static ThreadMgr* GetCurrent();
+
+private:
+    // called by the owner thread only, read by any thread
+    void RecordMessage(int64_t waitUs, int64_t serviceUs);
+    int RunProcess(int msgId, std::shared_ptr<void>& data, int64_t enqueueUs, uint64_t bytes);
+    // the next message by the wait strategy, nullptr to check the status
+    std::shared_ptr<Message> WaitMessage(bool& waited);
+    void SampleCpu(int64_t nowUs);
+    void RecordWakeup(int64_t wakeUs);
+    ThreadMgr* FindFuseMember(int instId);
+    // set failed to error and the other members to exited, the leader last,
+    // when the OS thread ends
+    void StopFuseGroup(ThreadMgr* failed);
+
 public:
     bool isExit_;
     ThreadStatus status_;
     Thread* userInstance_;
     std::string name_;
     ThreadSafeQueue<std::shared_ptr<Message>> msgQueue_;
+
+private:
+    std::atomic<uint64_t> messages_;
+    std::atomic<int64_t> waitUs_;
+    std::atomic<int64_t> maxWaitUs_;
+    std::atomic<int64_t> serviceUs_;
+    // start of the Process call running now, 0 when idle
+    std::atomic<int64_t> busySinceUs_;
+    std::atomic<int> busyMsgId_;
+    // nullptr: not fused. The leader points to itself
+    ThreadMgr* fuseLeader_;
+    // on the leader, all threads of the group with the leader first
+    std::vector<ThreadMgr*> fuseMembers_;
+    bool inProcess_;
+    // on the leader, the member whose direct call failed
+    ThreadMgr* fuseFailed_;
+    // router of the replica group of the thread, nullptr when there is none
+    PartitionRouter* router_;
+    WaitStrategy waitStrategy_;
+    uint32_t spinUs_;
+    std::atomic<uint64_t> wakeups_;
+    std::atomic<int64_t> wakeUs_;
+    std::atomic<uint64_t> parks_;
+    std::atomic<int64_t> cpuUs_;
+    std::atomic<int64_t> processTotalUs_;
+    int64_t cpuSampledUs_;
+    std::atomic<uint64_t> expired_;
+    std::atomic<int64_t> maxExpiredLateUs_;
+    std::atomic<uint64_t> bytesInFlight_;
+    std::atomic<uint64_t> maxBytesInFlight_;
+    // the part of bytesInFlight_ held past Process, see HoldBytes
+    std::atomic<uint64_t> heldBytes_;
+    bool memoryAdmission_;
 };
 #endif
\ No newline at end of file
@@ -34,6 +34,9 @@
 #ifndef THREAD_SAFE_QUEUE_H
 #define THREAD_SAFE_QUEUE_H
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <mutex>
 #include <queue>
 
@@ -45,7 +48,7 @@ public:
      * @brief ThreadSafeQueue constructor
      * @param [in] capacity: the queue capacity
      */
-    ThreadSafeQueue(uint32_t capacity)
+    ThreadSafeQueue(uint32_t capacity) : size_(0), waiters_(0)
     {
         // check the input value: capacity is valid
         if (capacity >= kMinQueueCapacity && capacity <= kMaxQueueCapacity) {
@@ -58,7 +61,7 @@ public:
     /**
      * @brief ThreadSafeQueue constructor
      */
-    ThreadSafeQueue()
+    ThreadSafeQueue() : size_(0), waiters_(0)
     {
         queueCapacity = kDefaultQueueCapacity;
     }
@@ -75,15 +78,22 @@ public:
      */
     bool Push(T input_value)
     {
-        std::lock_guard<std::mutex> lock(mutex_);
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
 
-        // check current size is less than capacity
-        if (queue_.size() < queueCapacity) {
+            // check current size is less than capacity
+            if (queue_.size() >= queueCapacity) {
+                return false;
+            }
             queue_.push(input_value);
-            return true;
+            size_.store(queue_.size(), std::memory_order_release);
         }
-
-        return false;
+        // a waiter counts itself under the mutex, so it is seen here or
+        // it sees the value
+        if (waiters_.load(std::memory_order_acquire) > 0) {
+            notEmpty_.notify_one();
+        }
+        return true;
     }
 
     /**
@@ -99,9 +109,41 @@ public:
 
         T tmp_ptr = queue_.front();
         queue_.pop();
+        size_.store(queue_.size(), std::memory_order_release);
+        return tmp_ptr;
+    }
+
+    /**
+     * @brief pop data from queue, waiting for data up to timeoutUs
+     * @param [in] timeoutUs: longest wait in microseconds
+     * @return data, nullptr when the queue stayed empty
+     */
+    T PopWait(int64_t timeoutUs)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (queue_.empty()) {
+            waiters_++;
+            notEmpty_.wait_for(lock, std::chrono::microseconds(timeoutUs), [this] { return !queue_.empty(); });
+            waiters_--;
+            if (queue_.empty()) {
+                return nullptr;
+            }
+        }
+        T tmp_ptr = queue_.front();
+        queue_.pop();
+        size_.store(queue_.size(), std::memory_order_release);
         return tmp_ptr;
     }
 
+    /**
+     * @brief check the queue is empty without the lock, for spinning
+     * @return true: the queue looked empty
+     */
+    bool EmptyRelaxed() const
+    {
+        return size_.load(std::memory_order_acquire) == 0;
+    }
+
     /**
      * @brief check the queue is empty
      * @return true: the queue is empty; false: the queue is not empty
@@ -122,6 +164,15 @@ public:
         return queue_.size();
     }
 
+    /**
+     * @brief get the queue capacity
+     * @return the queue capacity
+     */
+    uint32_t Capacity() const
+    {
+        return queueCapacity;
+    }
+
     void ExtendCapacity(uint32_t newSize)
     {
         queueCapacity = newSize;
@@ -132,6 +183,9 @@ private:
     std::queue<T> queue_; // the queue
     uint32_t queueCapacity; // queue capacity
     mutable std::mutex mutex_; // the mutex value
+    std::condition_variable notEmpty_; // signaled by Push when a consumer waits
+    std::atomic<size_t> size_; // size for the lock free check
+    std::atomic<uint32_t> waiters_; // consumers in PopWait
     const uint32_t kMinQueueCapacity = 1; // the minimum queue capacity
     const uint32_t kMaxQueueCapacity = 10000; // the maximum queue capacity
     const uint32_t kDefaultQueueCapacity = 10; // default queue capacity
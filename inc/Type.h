@@ -43,8 +43,9 @@ typedef void *aclrtContext;
 
 enum acldvppPixelFormat
 {
-    PIXEL_FORMAT_YUV_SEMIPLANAR_420 = 0
-
+    PIXEL_FORMAT_YUV_SEMIPLANAR_420 = 0,
+    PIXEL_FORMAT_RGB_888 = 12,
+    PIXEL_FORMAT_BGR_888 = 13
 };
 
 enum acldvppStreamFormat
@@ -76,6 +77,13 @@ struct ImageData
     uint32_t alignHeight = 0;
     uint32_t size = 0;
     std::shared_ptr<uint8_t> data = nullptr;
+    // bytes from data to the first pixel of a view of a part of a larger
+    // image, 0 for a crop at the top left corner too: data, alignWidth,
+    // alignHeight and size then describe the whole buffer, which the view
+    // keeps alive. Read it with GetImagePlanes
+    uint32_t offset = 0;
+    // set by MakeImageView, the image does not own the whole buffer
+    bool isView = false;
 };
 
 struct FrameData
@@ -84,6 +92,9 @@ struct FrameData
     uint32_t frameId = 0;
     uint32_t size = 0;
     void *data = nullptr;
+    bool isKeyFrame = false;
+    // holds the memory data points into, when it is not owned by the sender
+    std::shared_ptr<const uint8_t> buffer = nullptr;
 };
 
 struct Resolution
@@ -107,11 +118,23 @@ struct BBox
     std::string text;
 };
 
+class PartitionRouter;
+
 struct Message
 {
     int dest;
     int msgId;
     std::shared_ptr<void> data = nullptr;
+    // steady clock microseconds when the message was queued
+    int64_t enqueueUs = 0;
+    // steady clock microseconds after which the message is dropped unprocessed,
+    // 0: never
+    int64_t deadlineUs = 0;
+    // accounted payload size, in flight until Process is over
+    uint64_t bytes = 0;
+    // set for a keyed send to a replica group, the key is released after Process
+    PartitionRouter* partition = nullptr;
+    uint64_t partitionKey = 0;
 };
 
 struct DataInfo
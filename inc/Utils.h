@@ -30,6 +30,7 @@
 #include <map>
 
 #include "Error.h"
+#include "Logger.h"
 #include "Type.h"
 
 /**
@@ -127,41 +128,11 @@
  */
 #define SIZEOF_ARRAY(array) (sizeof(array) / sizeof(array[0]))
 
-/**
- * @brief Write acl error level log to host log
- * @param [in]: fmt: the input format string
- * @return none
- */
-#define LOG_ERROR(fmt, ...) \
-    do { fprintf(stdout, "[ERROR]  " fmt "\n", ##__VA_ARGS__);} while (0)
-
-/**
- * @brief Write acl info level log to host log
- * @param [in]: fmt: the input format string
- * @return none
- */
-#define LOG_INFO(fmt, ...) \
-    do { fprintf(stdout, "[INFO]  " fmt "\n", ##__VA_ARGS__);}while (0)
-
-/**
- * @brief Write acl warining level log to host log
- * @param [in]: fmt: the input format string
- * @return none
- */
-#define LOG_WARNING(fmt, ...) \
-    do { fprintf(stdout, "[WARNING]  " fmt "\n", ##__VA_ARGS__); } while (0)
-
-/**
- * @brief Write acl debug level log to host log
- * @param [in]: fmt: the input format string
- * @return none
- */
-#define LOG_DEBUG(fmt, ...) \
-    do { fprintf(stdout, "[INFO]  " fmt "\n", ##__VA_ARGS__);} while (0)
-
 /**
  * @brief define variable record time &&
-          set start time
+          set start time, one sample only, SCOPED_TIMER in ScopedTimer.h
+          keeps percentiles over many
+
  * @param [X]: function name
  * @return X_START X_END
  */
@@ -298,7 +269,8 @@ void GetAllFiles(const std::string &pathList,
                  std::vector<std::string> &fileVec);
 
 /**
- * @brief Save data to binary file
+ * @brief Save data to binary file on the calling thread, AsyncWriter
+ *        does it in the background
  * @param [in]: filename: binary file name with path
  * @param [in]: data: binary data
  * @param [in]: size: bytes size of data
@@ -318,6 +290,38 @@ void SaveBinFile(const std::string &filename, const void *data, uint32_t size);
 Error ReadBinFile(const std::string &filename,
                          void *&data, uint32_t &size);
 
+/**
+ * Access hints of MapBinFile, may be combined
+ */
+enum MapFileHint {
+    MAP_HINT_NONE = 0,
+    MAP_HINT_POPULATE = 1,      // fault every page in at map time
+    MAP_HINT_SEQUENTIAL = 2,    // read ahead aggressively
+    MAP_HINT_RANDOM = 4,        // no read ahead
+    MAP_HINT_WILLNEED = 8,      // start reading the whole file in background
+};
+
+/**
+ * Read only view of a mapped file, the mapping is released with the last
+ * copy of data
+ */
+struct FileView {
+    std::shared_ptr<const uint8_t> data = nullptr;
+    uint64_t size = 0;
+};
+
+/**
+ * @brief Map binary file read only, no copy is made and files over 4GB
+ *        are supported
+ * @param [in]: filename: binary file name with path
+ * @param [out]: view: mapped data and bytes size
+ * @param [in]: hints: MapFileHint flags
+ * @return Error OK: map success
+ *                    others: map failed
+ */
+Error MapBinFile(const std::string &filename, FileView &view,
+                 uint32_t hints = MAP_HINT_NONE);
+
 /**
  * @brief Match ip address string as <1-255>.<0-255>.<0-255>.<0-255>:<port>
  * @param [in]: addrStr: Ip address string
@@ -0,0 +1,136 @@
+/**
+* Copyright (c) Huawei Technologies Co., Ltd. 2020-2022. All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+
+* http://www.apache.org/licenses/LICENSE-2.0
+
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+
+* File Watchdog.h
+* Description: stall watchdog over the app threads
+*/
+#ifndef WATCHDOG_H
+#define WATCHDOG_H
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "Thread.h"
+#include "ThreadMgr.h"
+
+/**
+ * The watchdog looks at every thread of the app once an interval. A
+ * Process call running longer than the deadline of its stage is a stall,
+ * a queue deeper on growthChecks checks in a row is a growth, a thread in
+ * THREAD_ERROR is an error. Each is counted in the stats and sent once to
+ * the main thread as a WatchdogAlert, the end of a stall as well. Threads
+ * started after the watchdog are picked up on the next check.
+ */
+
+enum WatchdogMsg {
+    MSG_WATCHDOG_START = 1500,
+    MSG_WATCHDOG_TICK,
+    MSG_WATCHDOG_ALERT,
+};
+
+enum WatchdogAlertType {
+    WATCHDOG_STALL = 0,
+    WATCHDOG_STALL_END,
+    WATCHDOG_QUEUE_GROWTH,
+    WATCHDOG_THREAD_ERROR,
+};
+
+struct WatchdogAlert {
+    WatchdogAlertType type = WATCHDOG_STALL;
+    int instId = INVALID_INSTANCE_ID;
+    std::string threadName;
+    // the message in Process for a stall
+    int msgId = 0;
+    // time in Process for a stall, its whole length for a stall end
+    int64_t busyUs = 0;
+    int64_t deadlineUs = 0;
+    uint32_t depth = 0;
+};
+
+struct WatchdogConfig {
+    int64_t intervalUs = 100000;
+    // longest Process call of a stage by thread name, others take the default
+    std::map<std::string, int64_t> deadlinesUs;
+    int64_t defaultDeadlineUs = 1000000;
+    // checks in a row with a deeper queue before a growth is reported
+    uint32_t growthChecks = 5;
+    // queues not deeper than this are never a growth
+    uint32_t minGrowthDepth = 16;
+    // send WatchdogAlert to the main thread
+    bool notifyMain = true;
+};
+
+struct StageHealth {
+    int instId = INVALID_INSTANCE_ID;
+    std::string name;
+    int64_t deadlineUs = 0;
+    ThreadQueueStats queue;
+    int64_t maxBusyUs = 0;
+    uint32_t stalls = 0;
+    uint32_t growths = 0;
+    bool stalled = false;
+};
+
+struct WatchdogStats {
+    uint64_t checks = 0;
+    uint32_t stalls = 0;
+    uint32_t queueGrowths = 0;
+    uint32_t threadErrors = 0;
+    // alerts the main thread queue did not take
+    uint32_t alertsDropped = 0;
+    std::vector<StageHealth> stages;
+};
+
+class Watchdog : public Thread {
+public:
+    explicit Watchdog(const WatchdogConfig& config);
+    ~Watchdog() {}
+
+    int Init() override;
+    int Process(int msgId, std::shared_ptr<void> msgData) override;
+
+    /**
+     * @brief Get the watchdog statistics, callable from any thread
+     * @return statistics of the last check
+     */
+    WatchdogStats GetStats();
+
+private:
+    struct Stage {
+        StageHealth health;
+        uint32_t lastDepth = 0;
+        uint32_t growStreak = 0;
+        // completed messages when the stall began, tells calls apart
+        uint64_t stallMessages = 0;
+        int64_t stallBusyUs = 0;
+        bool erred = false;
+    };
+
+    void Check();
+    void CheckStage(Stage& stage, bool abnormal, WatchdogStats& stats);
+    void Alert(WatchdogAlertType type, const Stage& stage, int64_t busyUs);
+
+    WatchdogConfig config_;
+    bool running_;
+    std::vector<Stage> stages_;
+    std::mutex statsLock_;
+    WatchdogStats stats_;
+};
+
+#endif
@@ -8,8 +8,10 @@
 * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
 */
 
+#include <map>
 #include "App.h"
 #include "ThreadMgr.h"
+#include "MsgAllocator.h"
 
 using namespace std;
 namespace {
@@ -104,6 +106,33 @@ int App::Start(vector<ThreadParam>& threadParamTbl)
             return ERROR;
         }
         threadParamTbl[i].threadInstId = instId;
+        threadList_[instId]->SetWaitStrategy(threadParamTbl[i].waitStrategy, threadParamTbl[i].spinUs);
+        threadList_[instId]->SetMemoryAdmission(threadParamTbl[i].memoryAdmission);
+    }
+    // the first thread of a fuse group leads it
+    map<string, int> fuseLeaders;
+    for (size_t i = 0; i < threadParamTbl.size(); i++) {
+        const string& group = threadParamTbl[i].fuseGroup;
+        if (group.empty()) {
+            continue;
+        }
+        int instId = threadParamTbl[i].threadInstId;
+        auto leader = fuseLeaders.find(group);
+        if (leader == fuseLeaders.end()) {
+            fuseLeaders[group] = instId;
+        } else {
+            threadList_[leader->second]->AddFuseMember(threadList_[instId]);
+        }
+    }
+    for (size_t i = 0; i < threadParamTbl.size(); i++) {
+        const string& group = threadParamTbl[i].replicaGroup;
+        if (group.empty()) {
+            continue;
+        }
+        PartitionRouter* router = ::GetPartitionRouter(group);
+        int instId = threadParamTbl[i].threadInstId;
+        router->AddReplica(instId, threadParamTbl[i].threadInstName);
+        threadList_[instId]->SetPartitionRouter(router);
     }
     // Note:The instance id must generate first, then create thread,
     // for the user thread get other thread instance id in Init function
@@ -141,19 +170,147 @@ int App::GetThreadIdByName(const string& threadName)
 
 Error App::SendMessage(int dest, int msgId, shared_ptr<void> data)
 {
-    if ((uint32_t)dest > threadList_.size()) {
+    return PostMessage(dest, msgId, data, 0, 0);
+}
+
+Error App::SendMessageWithBytes(int dest, int msgId, shared_ptr<void> data, uint64_t bytes)
+{
+    return PostMessage(dest, msgId, data, 0, bytes);
+}
+
+Error App::SendMessageWithDeadline(int dest, int msgId, shared_ptr<void> data, int64_t deadlineUs,
+                                   uint64_t bytes)
+{
+    return PostMessage(dest, msgId, data, deadlineUs, bytes);
+}
+
+Error App::PostMessage(int dest, int msgId, shared_ptr<void>& data, int64_t deadlineUs, uint64_t bytes,
+                       PartitionRouter* router, uint64_t partitionKey)
+{
+    if ((uint32_t)dest >= threadList_.size()) {
         LOG_ERROR("Send message to %d failed for thread not exist", dest);
+        if (router != nullptr) {
+            router->Release(partitionKey);
+        }
         return ERROR_DEST_INVALID;
     }
 
-    shared_ptr<Message> pMessage = make_shared<Message>();
+    int64_t nowUs = MsgClockUs();
+    if (threadList_[dest]->CanProcessInline()) {
+        Error ret = OK;
+        if (deadlineUs > 0 && nowUs > deadlineUs) {
+            threadList_[dest]->ExpireMessage(msgId, data, nowUs - deadlineUs);
+        } else {
+            // fused with the sender, no queue hop
+            ret = threadList_[dest]->ProcessInline(msgId, data, bytes);
+        }
+        if (router != nullptr) {
+            router->Release(partitionKey);
+        }
+        return ret;
+    }
+
+    shared_ptr<Message> pMessage = MakeMsgShared<Message>();
     pMessage->dest = dest;
     pMessage->msgId = msgId;
     pMessage->data = data;
+    pMessage->enqueueUs = nowUs;
+    pMessage->deadlineUs = deadlineUs;
+    pMessage->bytes = bytes;
+    pMessage->partition = router;
+    pMessage->partitionKey = partitionKey;
+
+    Error ret = OK;
+    if (bytes > 0) {
+        MemoryBudget& budget = MemoryBudget::GetInstance();
+        ThreadMgr* sender = ThreadMgr::GetCurrent();
+        if (sender != nullptr && sender->GetMemoryAdmission()) {
+            if (!budget.TryAcquire(bytes)) {
+                // the source backs off as for a full queue
+                ret = ERROR_ENQUEUE;
+            }
+        } else {
+            budget.Acquire(bytes);
+        }
+    }
+    if (ret == OK) {
+        ret = threadList_[dest]->PushMsgToQueue(pMessage);
+        if (ret != OK && bytes > 0) {
+            MemoryBudget::GetInstance().Release(bytes);
+        }
+    }
+    if (ret != OK && router != nullptr) {
+        router->Release(partitionKey);
+    }
+    return ret;
+}
 
+Error App::SendMessageToQueue(int dest, int msgId, shared_ptr<void> data)
+{
+    if ((dest < 0) || ((uint32_t)dest >= threadList_.size()) || (threadList_[dest] == nullptr)) {
+        LOG_ERROR("Send message to %d failed for thread not exist", dest);
+        return ERROR_DEST_INVALID;
+    }
+    shared_ptr<Message> pMessage = MakeMsgShared<Message>();
+    pMessage->dest = dest;
+    pMessage->msgId = msgId;
+    pMessage->data = data;
+    pMessage->enqueueUs = MsgClockUs();
     return threadList_[dest]->PushMsgToQueue(pMessage);
 }
 
+Error App::SendMessage(int dest, int msgId, shared_ptr<void> data, uint64_t partitionKey)
+{
+    return SendMessageWithBytes(dest, msgId, data, partitionKey, 0);
+}
+
+Error App::SendMessageWithBytes(int dest, int msgId, shared_ptr<void> data, uint64_t partitionKey, uint64_t bytes)
+{
+    if ((dest < 0) || ((uint32_t)dest >= threadList_.size()) || (threadList_[dest] == nullptr)) {
+        LOG_ERROR("Send message to %d failed for thread not exist", dest);
+        return ERROR_DEST_INVALID;
+    }
+    PartitionRouter* router = threadList_[dest]->GetPartitionRouter();
+    if (router == nullptr) {
+        return PostMessage(dest, msgId, data, 0, bytes);
+    }
+    int replica = router->Route(partitionKey);
+    if (replica == INVALID_INSTANCE_ID) {
+        LOG_ERROR("Send message %d failed, replica group of thread %d has no active replica", msgId, dest);
+        return ERROR_DEST_INVALID;
+    }
+    return PostMessage(replica, msgId, data, 0, bytes, router, partitionKey);
+}
+
+Error App::SetReplicaActive(int instId, bool active)
+{
+    if ((instId < 0) || ((uint32_t)instId >= threadList_.size()) || (threadList_[instId] == nullptr)) {
+        return ERROR_DEST_INVALID;
+    }
+    PartitionRouter* router = threadList_[instId]->GetPartitionRouter();
+    if (router == nullptr || !router->SetActive(instId, active)) {
+        return ERROR_DEST_INVALID;
+    }
+    return OK;
+}
+
+Error App::GetThreadQueueStats(int instId, ThreadQueueStats& stats)
+{
+    if ((instId < 0) || ((uint32_t)instId >= threadList_.size()) || (threadList_[instId] == nullptr)) {
+        return ERROR_DEST_INVALID;
+    }
+    threadList_[instId]->GetQueueStats(stats);
+    return OK;
+}
+
+string App::GetThreadName(int instId)
+{
+    if ((instId < 0) || ((uint32_t)instId >= threadList_.size()) || (threadList_[instId] == nullptr)) {
+        return "";
+    }
+    return threadList_[instId]->GetThreadName();
+}
+
 void App::Wait()
 {
     while (true) {
@@ -166,7 +323,7 @@ void App::Wait()
 bool App::CheckThreadAbnormal()
 {
     for (size_t i = 0; i < threadList_.size(); i++) {
-        if (threadList_[i]->GetStatus() == THREAD_ERROR) {
+        if ((threadList_[i] != nullptr) && (threadList_[i]->GetStatus() == THREAD_ERROR)) {
             return true;
         }
     }
@@ -191,7 +348,16 @@ void App::Wait(MsgProcess msgProcess, void* param)
             usleep(kWaitInterval);
             continue;
         }
-        int ret = msgProcess(msg->msgId, msg->data, param);
+        int ret = 0;
+        int64_t lateUs = (msg->deadlineUs > 0) ? MsgClockUs() - msg->deadlineUs : 0;
+        if (lateUs > 0) {
+            // too old to be worth a msgProcess call
+            mainMgr->ExpireMessage(msg->msgId, msg->data, lateUs);
+        } else {
+            ret = msgProcess(msg->msgId, msg->data, param);
+        }
+        msg->data = nullptr;
+        mainMgr->EndMessage(*msg);
         if (ret) {
             LOG_ERROR(" app exit for message %d process error:%d", msg->msgId, ret);
             break;
@@ -261,3 +427,45 @@ int GetThreadIdByName(const string& threadName)
     App& app = App::GetInstance();
     return app.GetThreadIdByName(threadName);
 }
+
+Error GetThreadQueueStats(int instId, ThreadQueueStats& stats)
+{
+    App& app = App::GetInstance();
+    return app.GetThreadQueueStats(instId, stats);
+}
+
+Error SendMessage(int dest, int msgId, shared_ptr<void> data, uint64_t partitionKey)
+{
+    App& app = App::GetInstance();
+    return app.SendMessage(dest, msgId, data, partitionKey);
+}
+
+Error SendMessageWithDeadline(int dest, int msgId, shared_ptr<void> data, int64_t deadlineUs, uint64_t bytes)
+{
+    App& app = App::GetInstance();
+    return app.SendMessageWithDeadline(dest, msgId, data, deadlineUs, bytes);
+}
+
+Error SendMessageWithTtl(int dest, int msgId, shared_ptr<void> data, int64_t ttlUs, uint64_t bytes)
+{
+    App& app = App::GetInstance();
+    return app.SendMessageWithTtl(dest, msgId, data, ttlUs, bytes);
+}
+
+Error SendMessageWithBytes(int dest, int msgId, shared_ptr<void> data, uint64_t bytes)
+{
+    App& app = App::GetInstance();
+    return app.SendMessageWithBytes(dest, msgId, data, bytes);
+}
+
+Error SendMessageToQueue(int dest, int msgId, shared_ptr<void> data)
+{
+    App& app = App::GetInstance();
+    return app.SendMessageToQueue(dest, msgId, data);
+}
+
+Error SendMessageWithBytes(int dest, int msgId, shared_ptr<void> data, uint64_t partitionKey, uint64_t bytes)
+{
+    App& app = App::GetInstance();
+    return app.SendMessageWithBytes(dest, msgId, data, partitionKey, bytes);
+}
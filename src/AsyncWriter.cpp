@@ -0,0 +1,407 @@
+/**
+* Copyright (c) Huawei Technologies Co., Ltd. 2020-2022. All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+
+* http://www.apache.org/licenses/LICENSE-2.0
+
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+
+* File AsyncWriter.cpp
+* Description: background batched file writer
+*/
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include "AsyncWriter.h"
+#include "IoUring.h"
+#include "Utils.h"
+
+using namespace std;
+
+namespace {
+const uint32_t kMaxSyncBatch = 1024;
+const double kBytesPerMegaByte = 1024.0 * 1024.0;
+}
+
+/**
+ * Where the writes and syncs run. Requests are made in rounds, Reap
+ * collects the results of the round, the tag is the caller's index
+ */
+class WriteBackend {
+public:
+    virtual ~WriteBackend() {}
+    virtual bool IsIoUring() const = 0;
+    // false when no slot is free, try again after a Reap
+    virtual bool Write(uint64_t tag, int fd, const struct iovec* iov, uint32_t iovCnt, uint64_t offset) = 0;
+    virtual bool Sync(uint64_t tag, int fd) = 0;
+    // wait blocks until at least one request is done
+    virtual void Reap(vector<IoCompletion>& done, bool wait) = 0;
+};
+
+namespace {
+class UringWriteBackend : public WriteBackend {
+public:
+    Error Init(uint32_t entries)
+    {
+        return ring_.Init(entries);
+    }
+
+    bool IsIoUring() const override
+    {
+        return true;
+    }
+
+    bool Write(uint64_t tag, int fd, const struct iovec* iov, uint32_t iovCnt, uint64_t offset) override
+    {
+        return ring_.PrepWritev(fd, iov, iovCnt, offset, tag);
+    }
+
+    bool Sync(uint64_t tag, int fd) override
+    {
+        return ring_.PrepFsync(fd, true, tag);
+    }
+
+    void Reap(vector<IoCompletion>& done, bool wait) override
+    {
+        int ret = ring_.Submit(wait ? 1 : 0);
+        if (ret < 0) {
+            LOG_ERROR("io_uring submit failed, errno %d", -ret);
+        }
+        IoCompletion completion;
+        while (ring_.PeekCompletion(completion)) {
+            done.push_back(completion);
+        }
+    }
+
+private:
+    IoUring ring_;
+};
+
+// runs each request when it is made, on the writer thread
+class PlainWriteBackend : public WriteBackend {
+public:
+    bool IsIoUring() const override
+    {
+        return false;
+    }
+
+    bool Write(uint64_t tag, int fd, const struct iovec* iov, uint32_t iovCnt, uint64_t offset) override
+    {
+        ssize_t ret;
+        do {
+            ret = pwritev(fd, iov, iovCnt, offset);
+        } while (ret < 0 && errno == EINTR);
+        IoCompletion completion;
+        completion.userData = tag;
+        completion.result = (ret < 0) ? -errno : static_cast<int32_t>(ret);
+        done_.push_back(completion);
+        return true;
+    }
+
+    bool Sync(uint64_t tag, int fd) override
+    {
+        IoCompletion completion;
+        completion.userData = tag;
+        completion.result = (fdatasync(fd) != 0) ? -errno : 0;
+        done_.push_back(completion);
+        return true;
+    }
+
+    void Reap(vector<IoCompletion>& done, bool) override
+    {
+        done.insert(done.end(), done_.begin(), done_.end());
+        done_.clear();
+    }
+
+private:
+    vector<IoCompletion> done_;
+};
+
+// the part of the buffers from done on, a short write goes on from there
+void BuildIov(const vector<WriteBuffer>& buffers, uint64_t done, vector<struct iovec>& iov)
+{
+    iov.clear();
+    for (const auto& buffer : buffers) {
+        if (done >= buffer.size) {
+            done -= buffer.size;
+            continue;
+        }
+        struct iovec piece;
+        piece.iov_base = const_cast<uint8_t*>(static_cast<const uint8_t*>(buffer.data.get()) + done);
+        piece.iov_len = buffer.size - done;
+        iov.push_back(piece);
+        done = 0;
+    }
+}
+}
+
+AsyncWriter::AsyncWriter(const AsyncWriterConfig& config) : config_(config), queueBytes_(0),
+    working_(false), flushWaiters_(0), exit_(false), unsyncedNum_(0)
+{
+    config_.batchSize = (config_.batchSize == 0) ? 1 : config_.batchSize;
+    config_.syncBatch = (config_.syncBatch == 0) ? 1 : config_.syncBatch;
+    config_.syncBatch = (config_.syncBatch > kMaxSyncBatch) ? kMaxSyncBatch : config_.syncBatch;
+    if (config_.useIoUring) {
+        unique_ptr<UringWriteBackend> uring(new UringWriteBackend());
+        if (uring->Init(config_.batchSize) == OK) {
+            backend_ = move(uring);
+        }
+    }
+    if (backend_ == nullptr) {
+        backend_.reset(new PlainWriteBackend());
+    }
+    stats_.ioUring = backend_->IsIoUring();
+    worker_ = thread(&AsyncWriter::WorkerEntry, this);
+}
+
+AsyncWriter::~AsyncWriter()
+{
+    {
+        lock_guard<mutex> guard(lock_);
+        exit_ = true;
+    }
+    jobReady_.notify_all();
+    worker_.join();
+}
+
+AsyncWriter& AsyncWriter::GetInstance()
+{
+    static AsyncWriter instance;
+    return instance;
+}
+
+Error AsyncWriter::Write(const string& fileName, shared_ptr<const void> data, uint32_t size)
+{
+    WriteBuffer buffer;
+    buffer.data = move(data);
+    buffer.size = size;
+    return Write(fileName, vector<WriteBuffer>(1, buffer));
+}
+
+Error AsyncWriter::Write(const string& fileName, const vector<WriteBuffer>& buffers)
+{
+    if (fileName.empty() || buffers.size() > IOV_MAX) {
+        return ERROR_INVALID_ARGS;
+    }
+    WriteJob job;
+    job.fileName = fileName;
+    for (const auto& buffer : buffers) {
+        if (buffer.size == 0) {
+            continue;
+        }
+        if (buffer.data == nullptr) {
+            return ERROR_INVALID_ARGS;
+        }
+        job.buffers.push_back(buffer);
+        job.size += buffer.size;
+    }
+
+    {
+        lock_guard<mutex> guard(lock_);
+        // one file larger than the byte limit still goes when the queue is empty
+        if (queue_.size() >= config_.maxQueueFiles ||
+            (!queue_.empty() && queueBytes_ + job.size > config_.maxQueueBytes)) {
+            stats_.rejected++;
+            return ERROR_ENQUEUE;
+        }
+        queueBytes_ += job.size;
+        queue_.push_back(move(job));
+        if (queue_.size() > stats_.maxQueueFiles) {
+            stats_.maxQueueFiles = queue_.size();
+        }
+    }
+    jobReady_.notify_one();
+    return OK;
+}
+
+void AsyncWriter::Flush()
+{
+    unique_lock<mutex> guard(lock_);
+    flushWaiters_++;
+    jobReady_.notify_one();
+    idle_.wait(guard, [this] { return queue_.empty() && !working_ && unsyncedNum_ == 0; });
+    flushWaiters_--;
+}
+
+AsyncWriterStats AsyncWriter::GetStats()
+{
+    lock_guard<mutex> guard(lock_);
+    AsyncWriterStats stats = stats_;
+    stats.queueFiles = queue_.size();
+    stats.queueBytes = queueBytes_;
+    if (stats.writeSeconds > 0) {
+        stats.megaBytesPerSecond = stats.bytes / kBytesPerMegaByte / stats.writeSeconds;
+    }
+    return stats;
+}
+
+void AsyncWriter::WorkerEntry()
+{
+    vector<WriteJob> batch;
+    while (true) {
+        bool drain = false;
+        batch.clear();
+        {
+            unique_lock<mutex> guard(lock_);
+            jobReady_.wait(guard, [this] {
+                return exit_ || !queue_.empty() || (flushWaiters_ > 0 && unsyncedNum_ > 0);
+            });
+            if (queue_.empty() && unsyncedNum_ == 0) {
+                return;
+            }
+            while (!queue_.empty() && batch.size() < config_.batchSize) {
+                queueBytes_ -= queue_.front().size;
+                batch.push_back(move(queue_.front()));
+                queue_.pop_front();
+            }
+            // the files of this batch are the last ones asked for
+            drain = queue_.empty() && (flushWaiters_ > 0 || exit_);
+            working_ = true;
+        }
+
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        uint64_t written = 0;
+        uint64_t failed = 0;
+        uint64_t bytes = 0;
+        if (!batch.empty()) {
+            WriteBatch(batch, written, failed);
+            for (const auto& job : batch) {
+                bytes += job.done;
+            }
+        }
+        uint64_t syncs = 0;
+        if (!unsynced_.empty() && (drain || config_.durability == WRITE_DURABILITY_FILE ||
+                                   unsynced_.size() >= config_.syncBatch)) {
+            syncs = unsynced_.size();
+            failed += SyncPending();
+        }
+        chrono::duration<double> cost = chrono::steady_clock::now() - start;
+
+        {
+            lock_guard<mutex> guard(lock_);
+            stats_.files += written;
+            stats_.failed += failed;
+            stats_.bytes += bytes;
+            stats_.syncs += syncs;
+            stats_.writeSeconds += cost.count();
+            unsyncedNum_ = unsynced_.size();
+            working_ = false;
+        }
+        // drop the buffers before telling the waiters
+        batch.clear();
+        idle_.notify_all();
+    }
+}
+
+void AsyncWriter::WriteBatch(vector<WriteJob>& batch, uint64_t& written, uint64_t& failed)
+{
+    vector<vector<struct iovec>> iovs(batch.size());
+    uint32_t outstanding = 0;
+    vector<IoCompletion> done;
+    auto finish = [this, &written, &failed](WriteJob& job, bool ok) {
+        if (!ok) {
+            close(job.fd);
+            failed++;
+            return;
+        }
+        written++;
+        if (config_.durability == WRITE_DURABILITY_NONE) {
+            close(job.fd);
+        } else {
+            unsynced_.push_back(job.fd);
+        }
+    };
+    // a ring can be full, make room by taking the results first
+    auto submit = [this, &batch, &iovs, &outstanding, &done](uint32_t index) {
+        WriteJob& job = batch[index];
+        BuildIov(job.buffers, job.done, iovs[index]);
+        while (!backend_->Write(index, job.fd, iovs[index].data(), iovs[index].size(), job.done)) {
+            backend_->Reap(done, true);
+        }
+        outstanding++;
+    };
+
+    for (uint32_t i = 0; i < batch.size(); i++) {
+        WriteJob& job = batch[i];
+        job.fd = open(job.fileName.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+        if (job.fd < 0) {
+            LOG_ERROR("Save file %s failed for open error, errno %d", job.fileName.c_str(), errno);
+            failed++;
+            continue;
+        }
+        if (job.size == 0) {
+            finish(job, true);
+            continue;
+        }
+        submit(i);
+    }
+
+    size_t next = 0;
+    while (outstanding > 0) {
+        if (next == done.size()) {
+            done.clear();
+            next = 0;
+            backend_->Reap(done, true);
+            continue;
+        }
+        IoCompletion completion = done[next++];
+        outstanding--;
+        uint32_t index = static_cast<uint32_t>(completion.userData);
+        WriteJob& job = batch[index];
+        if (completion.result <= 0) {
+            LOG_ERROR("Save file %s failed, %lu of %lu bytes written, errno %d", job.fileName.c_str(),
+                      (unsigned long)job.done, (unsigned long)job.size, -completion.result);
+            finish(job, false);
+            continue;
+        }
+        job.done += completion.result;
+        if (job.done < job.size) {
+            submit(index);
+            continue;
+        }
+        finish(job, true);
+    }
+}
+
+uint64_t AsyncWriter::SyncPending()
+{
+    uint32_t outstanding = 0;
+    vector<IoCompletion> done;
+    for (uint32_t i = 0; i < unsynced_.size(); i++) {
+        while (!backend_->Sync(i, unsynced_[i])) {
+            backend_->Reap(done, true);
+        }
+        outstanding++;
+    }
+    uint64_t failed = 0;
+    size_t next = 0;
+    while (outstanding > 0) {
+        if (next == done.size()) {
+            done.clear();
+            next = 0;
+            backend_->Reap(done, true);
+            continue;
+        }
+        const IoCompletion& completion = done[next++];
+        outstanding--;
+        if (completion.result < 0) {
+            LOG_ERROR("Sync written file failed, errno %d", -completion.result);
+            failed++;
+        }
+    }
+    for (int fd : unsynced_) {
+        close(fd);
+    }
+    unsynced_.clear();
+    return failed;
+}
@@ -0,0 +1,244 @@
+/**
+* Copyright (c) Huawei Technologies Co., Ltd. 2020-2022. All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+
+* http://www.apache.org/licenses/LICENSE-2.0
+
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+
+* File BatchStage.cpp
+* Description: dynamic batching stage that packs frames into model batches
+*/
+#include <algorithm>
+#include <cstring>
+#include "App.h"
+#include "BatchStage.h"
+#include "FramePool.h"
+#include "ImagePlanes.h"
+
+using namespace std;
+
+namespace {
+// longest sleep of one tick waiting for the batch deadline, frames that
+// arrive meanwhile wait at most this long
+const int64_t kMaxTickWaitUs = 200;
+
+bool SameGeometry(const ImageData& a, const ImageData& b)
+{
+    return (a.format == b.format) && (a.width == b.width) && (a.height == b.height) &&
+           (a.alignWidth == b.alignWidth) && (a.alignHeight == b.alignHeight) && (a.size == b.size);
+}
+}
+
+Error SplitBatchResult(const FrameBatch& batch, const shared_ptr<const uint8_t>& output,
+                       size_t outputSize, vector<BatchFrameResult>& results)
+{
+    results.clear();
+    if (batch.capacity == 0 || output == nullptr || (outputSize % batch.capacity) != 0) {
+        LOG_ERROR("Batch %u output of %zu bytes does not split into %u slots", batch.batchId, outputSize,
+                  batch.capacity);
+        return ERROR_INVALID_ARGS;
+    }
+    size_t slotSize = outputSize / batch.capacity;
+    results.resize(batch.count);
+    for (uint32_t i = 0; i < batch.count; i++) {
+        results[i].item = (i < batch.items.size()) ? batch.items[i] : nullptr;
+        results[i].data = shared_ptr<const uint8_t>(output, output.get() + i * slotSize);
+        results[i].size = slotSize;
+    }
+    return OK;
+}
+
+BatchStage::BatchStage(const BatchStageConfig& config) : config_(config), destId_(INVALID_INSTANCE_ID),
+    batchId_(0), batchOpenUs_(0), addedUsTotal_(0)
+{
+    config_.maxBatch = max(config_.maxBatch, 1u);
+    config_.maxWaitUs = max<int64_t>(config_.maxWaitUs, 0);
+    stats_.fillCounts.assign(config_.maxBatch + 1, 0);
+}
+
+int BatchStage::Init()
+{
+    return OK;
+}
+
+int BatchStage::Process(int msgId, shared_ptr<void> msgData)
+{
+    if (msgId == config_.inputMsgId) {
+        AddFrame(msgData);
+        return OK;
+    }
+    switch (msgId) {
+        case MSG_BATCH_TICK:
+            Tick();
+            break;
+        case MSG_BATCH_FLUSH:
+            Flush(FLUSH_REQUEST);
+            break;
+        case MSG_BATCH_FINISH: {
+            Flush(FLUSH_REQUEST);
+            shared_ptr<FrameBatch> finished = make_shared<FrameBatch>();
+            finished->isFinished = true;
+            finished->batchId = batchId_;
+            SendBatch(finished);
+            break;
+        }
+        default:
+            LOG_WARNING("Batch stage %s ignores message %d", SelfInstanceName().c_str(), msgId);
+            break;
+    }
+    return OK;
+}
+
+BatchStageStats BatchStage::GetStats()
+{
+    lock_guard<mutex> guard(statsLock_);
+    BatchStageStats stats = stats_;
+    if (stats.batches > 0) {
+        stats.meanFill = static_cast<double>(stats.frames) / (stats.batches * config_.maxBatch);
+    }
+    if (stats.frames > 0) {
+        stats.meanAddedUs = addedUsTotal_ / static_cast<int64_t>(stats.frames);
+    }
+    return stats;
+}
+
+void BatchStage::AddFrame(shared_ptr<void> item)
+{
+    const ImageData* image = nullptr;
+    if (item != nullptr) {
+        image = config_.getImage ? config_.getImage(item) : static_cast<const ImageData*>(item.get());
+    }
+    // a slot holds the rows of a view only, not its whole buffer
+    ImageData slot;
+    bool isView = (image != nullptr) && IsImageView(*image);
+    if (image == nullptr || image->data == nullptr || image->size == 0 ||
+        (isView && !GetCompactGeometry(*image, slot))) {
+        lock_guard<mutex> guard(statsLock_);
+        stats_.rejectedFrames++;
+        return;
+    }
+    if (!isView) {
+        slot = *image;
+    }
+    if (batch_ != nullptr && !SameGeometry(batch_->image, slot)) {
+        Flush(FLUSH_MISMATCH);
+    }
+    if (batch_ == nullptr && OpenBatch(slot) != OK) {
+        lock_guard<mutex> guard(statsLock_);
+        stats_.rejectedFrames++;
+        return;
+    }
+    // copy on arrival, the batch is ready to go when it fills
+    uint8_t* slotData = batch_->data.get() + static_cast<size_t>(batch_->count) * batch_->frameSize;
+    if (!isView) {
+        memcpy(slotData, image->data.get(), batch_->frameSize);
+    } else {
+        slot.data = shared_ptr<uint8_t>(batch_->data, slotData);
+        CopyImage(*image, slot);
+    }
+    batch_->items.push_back(item);
+    batch_->itemBytes += CurrentMessageBytes();
+    HoldBytes(CurrentMessageBytes());
+    batch_->count++;
+    arrivalUs_.push_back(MsgClockUs());
+    if (batch_->count >= batch_->capacity) {
+        Flush(FLUSH_FULL);
+    } else {
+        ScheduleTick(MSG_BATCH_TICK);
+    }
+}
+
+Error BatchStage::OpenBatch(const ImageData& image)
+{
+    shared_ptr<FrameBatch> batch = make_shared<FrameBatch>();
+    batch->batchId = batchId_;
+    batch->capacity = config_.maxBatch;
+    batch->frameSize = image.size;
+    batch->image = image;
+    batch->image.data = nullptr;
+    batch->data = FramePool::GetInstance().Alloc(static_cast<size_t>(batch->capacity) * batch->frameSize);
+    if (batch->data == nullptr) {
+        LOG_ERROR("Batch stage %s alloc %u slots of %u bytes failed", SelfInstanceName().c_str(),
+                  batch->capacity, batch->frameSize);
+        return ERROR_MALLOC;
+    }
+    batch->items.reserve(batch->capacity);
+    // the open batch counts in the gauge of the stage until it goes out
+    HoldBytes(PayloadBytes(*batch));
+    batchId_++;
+    batch_ = batch;
+    batchOpenUs_ = MsgClockUs();
+    arrivalUs_.clear();
+    return OK;
+}
+
+void BatchStage::Flush(FlushReason reason)
+{
+    if (batch_ == nullptr) {
+        return;
+    }
+    shared_ptr<FrameBatch> batch = batch_;
+    batch_ = nullptr;
+    if (config_.padBatch && batch->count < batch->capacity) {
+        size_t used = static_cast<size_t>(batch->count) * batch->frameSize;
+        memset(batch->data.get() + used, 0, static_cast<size_t>(batch->capacity) * batch->frameSize - used);
+    }
+    int64_t nowUs = MsgClockUs();
+    {
+        lock_guard<mutex> guard(statsLock_);
+        stats_.batches++;
+        stats_.frames += batch->count;
+        stats_.fillCounts[batch->count]++;
+        uint64_t* reasons[] = {&stats_.fullBatches, &stats_.timeoutBatches, &stats_.mismatchBatches,
+                               &stats_.flushBatches};
+        (*reasons[reason])++;
+        for (int64_t arrivalUs : arrivalUs_) {
+            addedUsTotal_ += nowUs - arrivalUs;
+            stats_.maxAddedUs = max(stats_.maxAddedUs, nowUs - arrivalUs);
+        }
+    }
+    arrivalUs_.clear();
+    SendBatch(batch);
+    ReleaseHeldBytes(PayloadBytes(*batch));
+}
+
+void BatchStage::Tick()
+{
+    if (batch_ == nullptr) {
+        return;
+    }
+    int64_t remainUs = batchOpenUs_ + config_.maxWaitUs - MsgClockUs();
+    if (remainUs <= 0) {
+        Flush(FLUSH_TIMEOUT);
+        return;
+    }
+    ScheduleTick(MSG_BATCH_TICK, min(remainUs, kMaxTickWaitUs));
+}
+
+void BatchStage::SendBatch(shared_ptr<FrameBatch> batch)
+{
+    if (destId_ == INVALID_INSTANCE_ID) {
+        destId_ = GetThreadIdByName(config_.destThread);
+        if (destId_ == INVALID_INSTANCE_ID) {
+            LOG_ERROR("Batch stage %s has no receiver thread %s, batch %u lost", SelfInstanceName().c_str(),
+                      config_.destThread.c_str(), batch->batchId);
+            return;
+        }
+    }
+    uint64_t retries = 0;
+    Error ret = SendWithRetry(destId_, config_.destMsgId, batch, PayloadBytes(*batch), retries);
+    if (ret != OK) {
+        LOG_ERROR("Batch stage %s send batch %u failed, error %d", SelfInstanceName().c_str(),
+                  batch->batchId, ret);
+    }
+    lock_guard<mutex> guard(statsLock_);
+    stats_.queueFullRetries += retries;
+}
@@ -0,0 +1,395 @@
+/**
+* Copyright (c) Huawei Technologies Co., Ltd. 2020-2022. All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+
+* http://www.apache.org/licenses/LICENSE-2.0
+
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+
+* File CameraSource.cpp
+* Description: simulated multi-camera NV12 source thread for load tests
+*/
+#include <algorithm>
+#include <cstring>
+#include "App.h"
+#include "CameraSource.h"
+#include "FramePool.h"
+
+using namespace std;
+
+namespace {
+// longest sleep of one tick waiting for the next frame
+const int64_t kMaxPaceWaitUs = 10000;
+// wait when the receiver queue is full for a finish message
+const int64_t kRetryWaitUs = 1000;
+// frames sent in one tick over all cameras, so a tick stays short
+const uint32_t kMaxFramesPerTick = 64;
+// frames of the generated pattern, and most frames kept of a raw file
+const uint32_t kPatternFrames = 8;
+const uint32_t kMaxRawFrames = 16;
+const uint32_t kPatternBox = 64;
+const uint32_t kPatternStep = 8;
+const uint8_t kNeutralChroma = 128;
+const uint8_t kBoxLuma = 235;
+
+bool ValidCamera(const CameraConfig& camera)
+{
+    const Resolution& res = camera.resolution;
+    // NV12 takes even sizes
+    return (res.width > 0) && (res.height > 0) && (res.width % 2 == 0) && (res.height % 2 == 0) &&
+           (camera.fps > 0);
+}
+}
+
+CameraSource::CameraSource(const CameraSourceConfig& config) : config_(config),
+    destId_(INVALID_INSTANCE_ID), running_(false), random_(config.seed)
+{
+}
+
+int CameraSource::Init()
+{
+    return OK;
+}
+
+int CameraSource::Process(int msgId, shared_ptr<void> msgData)
+{
+    switch (msgId) {
+        case MSG_CAMERA_START:
+            if (running_) {
+                LOG_WARNING("Camera source %s is running, start ignored", SelfInstanceName().c_str());
+                return OK;
+            }
+            if (Start() != OK) {
+                return OK;
+            }
+            Tick();
+            break;
+        case MSG_CAMERA_TICK:
+            Tick();
+            break;
+        default:
+            LOG_WARNING("Camera source %s ignores message %d", SelfInstanceName().c_str(), msgId);
+            break;
+    }
+    return OK;
+}
+
+CameraSourceStats CameraSource::GetStats()
+{
+    lock_guard<mutex> guard(statsLock_);
+    return stats_;
+}
+
+Error CameraSource::Start()
+{
+    destId_ = GetThreadIdByName(config_.destThread);
+    if (destId_ == INVALID_INSTANCE_ID) {
+        LOG_ERROR("Camera source %s has no receiver thread %s", SelfInstanceName().c_str(),
+                  config_.destThread.c_str());
+        return ERROR_DEST_INVALID;
+    }
+    if (config_.cameras.empty()) {
+        LOG_ERROR("Camera source %s has no camera", SelfInstanceName().c_str());
+        return ERROR_INVALID_ARGS;
+    }
+    cameras_.clear();
+    cameras_.resize(config_.cameras.size());
+    for (size_t i = 0; i < cameras_.size(); i++) {
+        cameras_[i].config = config_.cameras[i];
+        Error ret = PrepareCamera(cameras_[i]);
+        if (ret != OK) {
+            cameras_.clear();
+            return ret;
+        }
+    }
+    {
+        lock_guard<mutex> guard(statsLock_);
+        stats_ = CameraSourceStats();
+        stats_.cameras.resize(cameras_.size());
+        for (size_t i = 0; i < cameras_.size(); i++) {
+            stats_.cameras[i].cameraId = cameras_[i].config.cameraId;
+        }
+    }
+    startTime_ = chrono::steady_clock::now();
+    for (Camera& camera : cameras_) {
+        ScheduleNext(camera);
+    }
+    running_ = true;
+    LOG_INFO("Camera source %s plays %zu cameras, jitter %u us, %s", SelfInstanceName().c_str(),
+             cameras_.size(), config_.jitterUs, config_.synchronized ? "synchronized" : "free running");
+    return OK;
+}
+
+Error CameraSource::PrepareCamera(Camera& camera)
+{
+    const CameraConfig& config = camera.config;
+    if (!ValidCamera(config)) {
+        LOG_ERROR("Camera %u has invalid resolution %ux%u or fps %.2f", config.cameraId,
+                  config.resolution.width, config.resolution.height, config.fps);
+        return ERROR_INVALID_ARGS;
+    }
+    camera.intervalUs = static_cast<int64_t>(1000000.0 / config.fps);
+    camera.phaseUs = 0;
+    if (!config_.synchronized && camera.intervalUs > 0) {
+        camera.phaseUs = uniform_int_distribution<int64_t>(0, camera.intervalUs - 1)(random_);
+    }
+    camera.frameId = 0;
+    camera.finished = false;
+    camera.frames.clear();
+    Error ret = FramePool::GetInstance().AllocImage(camera.geometry, config.resolution.width,
+                                                     config.resolution.height);
+    if (ret != OK) {
+        LOG_ERROR("Camera %u alloc image failed, error %d", config.cameraId, ret);
+        return ret;
+    }
+    camera.geometry.data = nullptr;
+    if (!config.rawFile.empty()) {
+        return LoadRawFrames(camera);
+    }
+    GenerateFrames(camera);
+    return OK;
+}
+
+Error CameraSource::LoadRawFrames(Camera& camera)
+{
+    const CameraConfig& config = camera.config;
+    FileView file;
+    Error ret = MapBinFile(config.rawFile, file, MAP_HINT_SEQUENTIAL);
+    if (ret != OK) {
+        LOG_ERROR("Camera %u can not map %s, error %d", config.cameraId, config.rawFile.c_str(), ret);
+        return ret;
+    }
+    uint32_t width = config.resolution.width;
+    uint32_t height = config.resolution.height;
+    uint64_t frameSize = YUV420SP_SIZE(static_cast<uint64_t>(width), height);
+    uint64_t count = min<uint64_t>(file.size / frameSize, kMaxRawFrames);
+    if (count == 0) {
+        LOG_ERROR("Camera %u file %s is smaller than one %ux%u frame", config.cameraId,
+                  config.rawFile.c_str(), width, height);
+        return ERROR_INVALID_FILE;
+    }
+    const ImageData& geometry = camera.geometry;
+    for (uint64_t i = 0; i < count; i++) {
+        shared_ptr<uint8_t> buffer = FramePool::GetInstance().Alloc(geometry.size);
+        if (buffer == nullptr) {
+            return ERROR_MALLOC;
+        }
+        memset(buffer.get(), 0, geometry.size);
+        // the file is packed, the pool image has the VPC stride
+        const uint8_t* src = file.data.get() + i * frameSize;
+        uint8_t* dstY = buffer.get();
+        uint8_t* dstUv = buffer.get() + geometry.alignWidth * geometry.alignHeight;
+        for (uint32_t row = 0; row < height; row++) {
+            memcpy(dstY + row * geometry.alignWidth, src + row * width, width);
+        }
+        src += width * height;
+        for (uint32_t row = 0; row < height / 2; row++) {
+            memcpy(dstUv + row * geometry.alignWidth, src + row * width, width);
+        }
+        camera.frames.push_back(buffer);
+    }
+    LOG_INFO("Camera %u replays %lu frames of %s", config.cameraId, (unsigned long)count,
+             config.rawFile.c_str());
+    return OK;
+}
+
+void CameraSource::GenerateFrames(Camera& camera)
+{
+    const ImageData& geometry = camera.geometry;
+    uint32_t width = geometry.width;
+    uint32_t height = geometry.height;
+    uint32_t box = min(kPatternBox, min(width, height));
+    for (uint32_t i = 0; i < kPatternFrames; i++) {
+        shared_ptr<uint8_t> buffer = FramePool::GetInstance().Alloc(geometry.size);
+        if (buffer == nullptr) {
+            break;
+        }
+        memset(buffer.get(), 0, geometry.size);
+        // a diagonal gradient and a bright box, both moving with the frame
+        uint32_t shift = i * kPatternStep + camera.config.cameraId * kPatternBox;
+        uint32_t boxX = (i * (width - box)) / kPatternFrames;
+        uint32_t boxY = (i * (height - box)) / kPatternFrames;
+        uint8_t* luma = buffer.get();
+        for (uint32_t y = 0; y < height; y++) {
+            uint8_t* row = luma + y * geometry.alignWidth;
+            bool inBoxRow = (y >= boxY) && (y < boxY + box);
+            for (uint32_t x = 0; x < width; x++) {
+                bool inBox = inBoxRow && (x >= boxX) && (x < boxX + box);
+                row[x] = inBox ? kBoxLuma : static_cast<uint8_t>(x + y + shift);
+            }
+        }
+        // a tint for each camera tells them apart
+        uint8_t* chroma = luma + geometry.alignWidth * geometry.alignHeight;
+        uint8_t u = static_cast<uint8_t>(kNeutralChroma + camera.config.cameraId * 16);
+        uint8_t v = static_cast<uint8_t>(kNeutralChroma - camera.config.cameraId * 16);
+        for (uint32_t y = 0; y < height / 2; y++) {
+            uint8_t* row = chroma + y * geometry.alignWidth;
+            for (uint32_t x = 0; x + 1 < width; x += 2) {
+                row[x] = u;
+                row[x + 1] = v;
+            }
+        }
+        camera.frames.push_back(buffer);
+    }
+}
+
+void CameraSource::Tick()
+{
+    if (!running_) {
+        return;
+    }
+    uint32_t sent = 0;
+    bool progress = true;
+    bool refused = false;
+    // one frame of each due camera in turn, a camera far behind does not
+    // starve the others
+    while (progress && sent < kMaxFramesPerTick) {
+        progress = false;
+        int64_t nowUs = NowUs();
+        for (Camera& camera : cameras_) {
+            if (camera.finished || camera.dueUs > nowUs || sent >= kMaxFramesPerTick) {
+                continue;
+            }
+            if (config_.framesPerCamera > 0 && camera.frameId >= config_.framesPerCamera) {
+                camera.finished = SendFinished(camera);
+                refused = refused || !camera.finished;
+                continue;
+            }
+            SendFrame(camera, nowUs);
+            ScheduleNext(camera);
+            sent++;
+            progress = true;
+        }
+    }
+    int64_t nextDueUs = -1;
+    for (const Camera& camera : cameras_) {
+        if (!camera.finished && (nextDueUs < 0 || camera.dueUs < nextDueUs)) {
+            nextDueUs = camera.dueUs;
+        }
+    }
+    if (nextDueUs < 0) {
+        running_ = false;
+        CameraSourceStats stats = GetStats();
+        chrono::duration<double> elapsed = chrono::steady_clock::now() - startTime_;
+        LOG_INFO("Camera source %s done: %u frames, %u dropped, %u by policy, %u late, %lu bytes in %.3f s",
+                 SelfInstanceName().c_str(), stats.frames, stats.droppedFrames, stats.policyDrops, stats.lateFrames,
+                 (unsigned long)stats.bytes, elapsed.count());
+        cameras_.clear();
+        return;
+    }
+    int64_t waitUs = refused ? kRetryWaitUs : nextDueUs - NowUs();
+    if (waitUs > 0) {
+        usleep(static_cast<useconds_t>(min(waitUs, kMaxPaceWaitUs)));
+    }
+    Error ret = ScheduleTick(MSG_CAMERA_TICK);
+    if (ret != OK) {
+        LOG_ERROR("Camera source %s stops for tick failed, error %d", SelfInstanceName().c_str(), ret);
+        running_ = false;
+    }
+}
+
+void CameraSource::SendFrame(Camera& camera, int64_t nowUs)
+{
+    size_t index = &camera - &cameras_[0];
+    int64_t lateUs = nowUs - camera.dueUs;
+    if (config_.dropPolicy != nullptr && !config_.dropPolicy->Admit(camera.config.cameraId, camera.frameId)) {
+        camera.frameId++;
+        lock_guard<mutex> guard(statsLock_);
+        stats_.cameras[index].policyDrops++;
+        stats_.policyDrops++;
+        return;
+    }
+    shared_ptr<CameraFrame> frame = make_shared<CameraFrame>();
+    frame->cameraId = camera.config.cameraId;
+    frame->frameId = camera.frameId;
+    frame->timestampUs = CaptureTimeUs(camera, camera.frameId);
+    frame->image = camera.geometry;
+    camera.frameId++;
+
+    Error ret = ERROR_MALLOC;
+    if (!camera.frames.empty()) {
+        const shared_ptr<uint8_t>& source = camera.frames[frame->frameId % camera.frames.size()];
+        if (config_.copyFrames) {
+            // the copy stands in for the capture DMA writing a fresh buffer
+            frame->image.data = FramePool::GetInstance().Alloc(frame->image.size);
+            if (frame->image.data != nullptr) {
+                memcpy(frame->image.data.get(), source.get(), frame->image.size);
+            }
+        } else {
+            frame->image.data = source;
+        }
+        if (frame->image.data != nullptr) {
+            // the time to live starts at the capture, not at the late send
+            int64_t deadlineUs = 0;
+            if (config_.frameTtlUs > 0) {
+                deadlineUs = chrono::duration_cast<chrono::microseconds>(startTime_.time_since_epoch()).count() +
+                             frame->timestampUs + config_.frameTtlUs;
+            }
+            ret = SendMessageWithDeadline(destId_, config_.destMsgId, frame, deadlineUs, PayloadBytes(*frame));
+        }
+    }
+    if (ret != OK && ret != ERROR_ENQUEUE) {
+        LOG_ERROR("Camera %u send frame %u failed, error %d", frame->cameraId, frame->frameId, ret);
+    }
+
+    lock_guard<mutex> guard(statsLock_);
+    CameraStats& stats = stats_.cameras[index];
+    if (ret != OK) {
+        // a sensor does not wait for the reader, the frame is lost
+        stats.droppedFrames++;
+        stats_.droppedFrames++;
+        return;
+    }
+    stats.frames++;
+    stats_.frames++;
+    stats_.bytes += frame->image.size;
+    stats.maxLateUs = max(stats.maxLateUs, lateUs);
+    if (lateUs > camera.intervalUs) {
+        stats.lateFrames++;
+        stats_.lateFrames++;
+    }
+}
+
+bool CameraSource::SendFinished(Camera& camera)
+{
+    shared_ptr<CameraFrame> finished = make_shared<CameraFrame>();
+    finished->isFinished = true;
+    finished->cameraId = camera.config.cameraId;
+    finished->frameId = camera.frameId;
+    finished->timestampUs = CaptureTimeUs(camera, camera.frameId);
+    Error ret = SendMessage(destId_, config_.destMsgId, finished);
+    if (ret == ERROR_ENQUEUE) {
+        return false;
+    }
+    if (ret != OK) {
+        LOG_ERROR("Camera %u send finish failed, error %d", camera.config.cameraId, ret);
+    }
+    return true;
+}
+
+int64_t CameraSource::CaptureTimeUs(const Camera& camera, uint32_t frameId) const
+{
+    // from the frame number, not summed intervals, so cameras do not drift
+    return camera.phaseUs + static_cast<int64_t>(frameId * 1000000.0 / camera.config.fps);
+}
+
+void CameraSource::ScheduleNext(Camera& camera)
+{
+    int64_t jitterUs = 0;
+    if (config_.jitterUs > 0) {
+        jitterUs = uniform_int_distribution<int64_t>(0, config_.jitterUs)(random_);
+    }
+    camera.dueUs = CaptureTimeUs(camera, camera.frameId) + jitterUs;
+}
+
+int64_t CameraSource::NowUs() const
+{
+    return chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - startTime_).count();
+}
@@ -0,0 +1,427 @@
+/**
+* Copyright (c) Huawei Technologies Co., Ltd. 2020-2022. All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+
+* http://www.apache.org/licenses/LICENSE-2.0
+
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+
+* File ColorConvert.cpp
+* Description: NV12 and packed RGB colour conversion of ImageData
+*/
+#include "ColorConvert.h"
+#include "FramePool.h"
+#include "ImagePlanes.h"
+#include "ParallelFor.h"
+#include "Simd.h"
+#include "Utils.h"
+
+using namespace std;
+
+namespace {
+// rows of one parallel task are at least this many pixels
+const uint32_t kMinPixelsPerTask = 64 * 1024;
+
+// yuv to rgb, BT.601 limited range scaled by 64. Luma is scaled by 74.5 as
+// (y * 0x0101 * kYMul) >> 16, the form a 16 bit unsigned mulhi computes
+const int kYMul = 18997;
+const int kYBias = 1192;
+const int kRV = 102;
+const int kGU = -25;
+const int kGV = -52;
+const int kBU = 129;
+const int kYuvRound = 32;
+const int kYuvShift = 6;
+
+// rgb to yuv, BT.601 limited range scaled by 256
+const int kYR = 66;
+const int kYG = 129;
+const int kYB = 25;
+const int kUR = -38;
+const int kUG = -74;
+const int kUB = 112;
+const int kVR = 112;
+const int kVG = -94;
+const int kVB = -18;
+const int kRgbRound = 128;
+const int kRgbShift = 8;
+
+typedef void (*Nv12ToRgbRowFunc)(const uint8_t* y, const uint8_t* uv, uint8_t* dst,
+                                 uint32_t width, bool bgr);
+typedef void (*RgbToNv12RowsFunc)(const uint8_t* rgb0, const uint8_t* rgb1,
+                                  uint8_t* y0, uint8_t* y1, uint8_t* uv,
+                                  uint32_t width, bool bgr);
+
+inline uint8_t Clamp255(int value)
+{
+    return (value < 0) ? 0 : ((value > 255) ? 255 : static_cast<uint8_t>(value));
+}
+
+void Nv12ToRgbRowScalar(const uint8_t* y, const uint8_t* uv, uint8_t* dst,
+                        uint32_t begin, uint32_t width, bool bgr)
+{
+    const int rIdx = bgr ? 2 : 0;
+    const int bIdx = bgr ? 0 : 2;
+    for (uint32_t x = begin; x < width; x++) {
+        int yy = static_cast<int>((y[x] * 0x0101u * kYMul) >> 16) - kYBias;
+        int u = uv[x & ~1u] - 128;
+        int v = uv[(x & ~1u) + 1] - 128;
+        uint8_t* pixel = dst + x * 3;
+        pixel[rIdx] = Clamp255((yy + kRV * v + kYuvRound) >> kYuvShift);
+        pixel[1] = Clamp255((yy + kGU * u + kGV * v + kYuvRound) >> kYuvShift);
+        pixel[bIdx] = Clamp255((yy + kBU * u + kYuvRound) >> kYuvShift);
+    }
+}
+
+void Nv12ToRgbRowC(const uint8_t* y, const uint8_t* uv, uint8_t* dst, uint32_t width, bool bgr)
+{
+    Nv12ToRgbRowScalar(y, uv, dst, 0, width, bgr);
+}
+
+inline uint8_t RgbToY(int r, int g, int b)
+{
+    return static_cast<uint8_t>(((kYR * r + kYG * g + kYB * b + kRgbRound) >> kRgbShift) + 16);
+}
+
+inline uint8_t RgbToU(int r, int g, int b)
+{
+    return static_cast<uint8_t>(((kUR * r + kUG * g + kUB * b + kRgbRound) >> kRgbShift) + 128);
+}
+
+inline uint8_t RgbToV(int r, int g, int b)
+{
+    return static_cast<uint8_t>(((kVR * r + kVG * g + kVB * b + kRgbRound) >> kRgbShift) + 128);
+}
+
+// y1 is nullptr for the last row of an odd height image, rgb1 then repeats rgb0
+void RgbToNv12RowsScalar(const uint8_t* rgb0, const uint8_t* rgb1, uint8_t* y0, uint8_t* y1,
+                         uint8_t* uv, uint32_t begin, uint32_t width, bool bgr)
+{
+    const int rIdx = bgr ? 2 : 0;
+    const int bIdx = bgr ? 0 : 2;
+    for (uint32_t x = begin; x < width; x++) {
+        const uint8_t* p0 = rgb0 + x * 3;
+        y0[x] = RgbToY(p0[rIdx], p0[1], p0[bIdx]);
+        if (y1 != nullptr) {
+            const uint8_t* p1 = rgb1 + x * 3;
+            y1[x] = RgbToY(p1[rIdx], p1[1], p1[bIdx]);
+        }
+    }
+    for (uint32_t x = begin; x < width; x += 2) {
+        uint32_t x1 = (x + 1 < width) ? x + 1 : x;
+        const uint8_t* p00 = rgb0 + x * 3;
+        const uint8_t* p01 = rgb0 + x1 * 3;
+        const uint8_t* p10 = rgb1 + x * 3;
+        const uint8_t* p11 = rgb1 + x1 * 3;
+        int r = (p00[rIdx] + p01[rIdx] + p10[rIdx] + p11[rIdx] + 2) >> 2;
+        int g = (p00[1] + p01[1] + p10[1] + p11[1] + 2) >> 2;
+        int b = (p00[bIdx] + p01[bIdx] + p10[bIdx] + p11[bIdx] + 2) >> 2;
+        uv[x] = RgbToU(r, g, b);
+        uv[x + 1] = RgbToV(r, g, b);
+    }
+}
+
+void RgbToNv12RowsC(const uint8_t* rgb0, const uint8_t* rgb1, uint8_t* y0, uint8_t* y1,
+                    uint8_t* uv, uint32_t width, bool bgr)
+{
+    RgbToNv12RowsScalar(rgb0, rgb1, y0, y1, uv, 0, width, bgr);
+}
+
+#if SIMD_X86
+// one colour channel of 16 pixels: (y + chroma + round) >> 6, chroma is per
+// pixel pair. Only the blue sum can leave 16 bit, and then it saturates to a
+// value the scalar path clamps to 255 as well
+SIMD_TARGET("sse4.1")
+inline __m128i YuvChannelSse41(__m128i yLo, __m128i yHi, __m128i chroma)
+{
+    const __m128i round = _mm_set1_epi16(kYuvRound);
+    __m128i lo = _mm_adds_epi16(_mm_adds_epi16(yLo, _mm_unpacklo_epi16(chroma, chroma)), round);
+    __m128i hi = _mm_adds_epi16(_mm_adds_epi16(yHi, _mm_unpackhi_epi16(chroma, chroma)), round);
+    return _mm_packus_epi16(_mm_srai_epi16(lo, kYuvShift), _mm_srai_epi16(hi, kYuvShift));
+}
+
+SIMD_TARGET("sse4.1")
+void Nv12ToRgbRowSse41(const uint8_t* y, const uint8_t* uv, uint8_t* dst, uint32_t width, bool bgr)
+{
+    const __m128i lowMask = _mm_set1_epi16(0x00FF);
+    const __m128i yBias = _mm_set1_epi16(kYBias);
+    const __m128i bias128 = _mm_set1_epi16(128);
+    const __m128i yMul = _mm_set1_epi16(static_cast<int16_t>(kYMul));
+    uint32_t x = 0;
+    for (; x + 16 <= width; x += 16) {
+        __m128i yv = _mm_loadu_si128(reinterpret_cast<const __m128i*>(y + x));
+        __m128i uvv = _mm_loadu_si128(reinterpret_cast<const __m128i*>(uv + x));
+        __m128i u = _mm_sub_epi16(_mm_and_si128(uvv, lowMask), bias128);
+        __m128i v = _mm_sub_epi16(_mm_srli_epi16(uvv, 8), bias128);
+        __m128i rc = _mm_mullo_epi16(v, _mm_set1_epi16(kRV));
+        __m128i gc = _mm_add_epi16(_mm_mullo_epi16(u, _mm_set1_epi16(kGU)),
+                                   _mm_mullo_epi16(v, _mm_set1_epi16(kGV)));
+        __m128i bc = _mm_mullo_epi16(u, _mm_set1_epi16(kBU));
+        __m128i yLo = _mm_sub_epi16(_mm_mulhi_epu16(_mm_unpacklo_epi8(yv, yv), yMul), yBias);
+        __m128i yHi = _mm_sub_epi16(_mm_mulhi_epu16(_mm_unpackhi_epi8(yv, yv), yMul), yBias);
+        __m128i r = YuvChannelSse41(yLo, yHi, rc);
+        __m128i g = YuvChannelSse41(yLo, yHi, gc);
+        __m128i b = YuvChannelSse41(yLo, yHi, bc);
+        if (bgr) {
+            InterleaveRgb16(b, g, r, dst + x * 3);
+        } else {
+            InterleaveRgb16(r, g, b, dst + x * 3);
+        }
+    }
+    Nv12ToRgbRowScalar(y, uv, dst, x, width, bgr);
+}
+
+SIMD_TARGET("avx2")
+inline __m256i YuvChannelAvx2(__m256i yLo, __m256i yHi, __m256i chroma)
+{
+    const __m256i round = _mm256_set1_epi16(kYuvRound);
+    __m256i lo = _mm256_adds_epi16(_mm256_adds_epi16(yLo, _mm256_unpacklo_epi16(chroma, chroma)), round);
+    __m256i hi = _mm256_adds_epi16(_mm256_adds_epi16(yHi, _mm256_unpackhi_epi16(chroma, chroma)), round);
+    // packing the in-lane unpacked halves gives pixels 0..15 in the low lane
+    return _mm256_packus_epi16(_mm256_srai_epi16(lo, kYuvShift), _mm256_srai_epi16(hi, kYuvShift));
+}
+
+SIMD_TARGET("avx2")
+void Nv12ToRgbRowAvx2(const uint8_t* y, const uint8_t* uv, uint8_t* dst, uint32_t width, bool bgr)
+{
+    const __m256i lowMask = _mm256_set1_epi16(0x00FF);
+    const __m256i yBias = _mm256_set1_epi16(kYBias);
+    const __m256i bias128 = _mm256_set1_epi16(128);
+    const __m256i yMul = _mm256_set1_epi16(static_cast<int16_t>(kYMul));
+    uint32_t x = 0;
+    for (; x + 32 <= width; x += 32) {
+        __m256i yv = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(y + x));
+        __m256i uvv = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(uv + x));
+        __m256i u = _mm256_sub_epi16(_mm256_and_si256(uvv, lowMask), bias128);
+        __m256i v = _mm256_sub_epi16(_mm256_srli_epi16(uvv, 8), bias128);
+        __m256i rc = _mm256_mullo_epi16(v, _mm256_set1_epi16(kRV));
+        __m256i gc = _mm256_add_epi16(_mm256_mullo_epi16(u, _mm256_set1_epi16(kGU)),
+                                      _mm256_mullo_epi16(v, _mm256_set1_epi16(kGV)));
+        __m256i bc = _mm256_mullo_epi16(u, _mm256_set1_epi16(kBU));
+        // unpack in lane: pixels 0..7 and 16..23 go low, 8..15 and 24..31 high,
+        // the same order _mm256_unpacklo/hi_epi16 gives the chroma pairs
+        __m256i yLo = _mm256_sub_epi16(_mm256_mulhi_epu16(_mm256_unpacklo_epi8(yv, yv), yMul), yBias);
+        __m256i yHi = _mm256_sub_epi16(_mm256_mulhi_epu16(_mm256_unpackhi_epi8(yv, yv), yMul), yBias);
+        __m256i r = YuvChannelAvx2(yLo, yHi, rc);
+        __m256i g = YuvChannelAvx2(yLo, yHi, gc);
+        __m256i b = YuvChannelAvx2(yLo, yHi, bc);
+        if (bgr) {
+            __m256i t = r;
+            r = b;
+            b = t;
+        }
+        InterleaveRgb16(_mm256_castsi256_si128(r), _mm256_castsi256_si128(g),
+                        _mm256_castsi256_si128(b), dst + x * 3);
+        InterleaveRgb16(_mm256_extracti128_si256(r, 1), _mm256_extracti128_si256(g, 1),
+                        _mm256_extracti128_si256(b, 1), dst + x * 3 + 48);
+    }
+    if (x + 16 <= width) {
+        Nv12ToRgbRowSse41(y + x, uv + x, dst + x * 3, width - x, bgr);
+        return;
+    }
+    Nv12ToRgbRowScalar(y, uv, dst, x, width, bgr);
+}
+
+// y of 8 pixels in 16 bit lanes, all intermediates fit unsigned 16 bit
+SIMD_TARGET("sse4.1")
+inline __m128i RgbToYSse41(__m128i r, __m128i g, __m128i b)
+{
+    __m128i sum = _mm_add_epi16(_mm_mullo_epi16(r, _mm_set1_epi16(kYR)),
+                                _mm_mullo_epi16(g, _mm_set1_epi16(kYG)));
+    sum = _mm_add_epi16(sum, _mm_mullo_epi16(b, _mm_set1_epi16(kYB)));
+    sum = _mm_srli_epi16(_mm_add_epi16(sum, _mm_set1_epi16(kRgbRound)), kRgbShift);
+    return _mm_add_epi16(sum, _mm_set1_epi16(16));
+}
+
+SIMD_TARGET("sse4.1")
+inline __m128i RgbToChromaSse41(__m128i r, __m128i g, __m128i b, int cr, int cg, int cb)
+{
+    __m128i sum = _mm_add_epi16(_mm_mullo_epi16(r, _mm_set1_epi16(cr)),
+                                _mm_mullo_epi16(g, _mm_set1_epi16(cg)));
+    sum = _mm_add_epi16(sum, _mm_mullo_epi16(b, _mm_set1_epi16(cb)));
+    sum = _mm_srai_epi16(_mm_add_epi16(sum, _mm_set1_epi16(kRgbRound)), kRgbShift);
+    return _mm_add_epi16(sum, _mm_set1_epi16(128));
+}
+
+SIMD_TARGET("sse4.1")
+inline void StoreYSse41(__m128i r, __m128i g, __m128i b, uint8_t* dst)
+{
+    const __m128i zero = _mm_setzero_si128();
+    __m128i lo = RgbToYSse41(_mm_cvtepu8_epi16(r), _mm_cvtepu8_epi16(g), _mm_cvtepu8_epi16(b));
+    __m128i hi = RgbToYSse41(_mm_unpackhi_epi8(r, zero), _mm_unpackhi_epi8(g, zero),
+                             _mm_unpackhi_epi8(b, zero));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), _mm_packus_epi16(lo, hi));
+}
+
+// average of 2x2 blocks of 16 pixels by 2 rows, 8 values in 16 bit lanes
+SIMD_TARGET("sse4.1")
+inline __m128i Average2x2Sse41(__m128i row0, __m128i row1)
+{
+    const __m128i zero = _mm_setzero_si128();
+    __m128i lo = _mm_add_epi16(_mm_cvtepu8_epi16(row0), _mm_cvtepu8_epi16(row1));
+    __m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(row0, zero), _mm_unpackhi_epi8(row1, zero));
+    __m128i sum = _mm_hadd_epi16(lo, hi);
+    return _mm_srli_epi16(_mm_add_epi16(sum, _mm_set1_epi16(2)), 2);
+}
+
+SIMD_TARGET("sse4.1")
+void RgbToNv12RowsSse41(const uint8_t* rgb0, const uint8_t* rgb1, uint8_t* y0, uint8_t* y1,
+                        uint8_t* uv, uint32_t width, bool bgr)
+{
+    uint32_t x = 0;
+    for (; x + 16 <= width; x += 16) {
+        __m128i r0, g0, b0, r1, g1, b1;
+        if (bgr) {
+            DeinterleaveRgb16(rgb0 + x * 3, b0, g0, r0);
+            DeinterleaveRgb16(rgb1 + x * 3, b1, g1, r1);
+        } else {
+            DeinterleaveRgb16(rgb0 + x * 3, r0, g0, b0);
+            DeinterleaveRgb16(rgb1 + x * 3, r1, g1, b1);
+        }
+        StoreYSse41(r0, g0, b0, y0 + x);
+        if (y1 != nullptr) {
+            StoreYSse41(r1, g1, b1, y1 + x);
+        }
+        __m128i r = Average2x2Sse41(r0, r1);
+        __m128i g = Average2x2Sse41(g0, g1);
+        __m128i b = Average2x2Sse41(b0, b1);
+        __m128i u = RgbToChromaSse41(r, g, b, kUR, kUG, kUB);
+        __m128i v = RgbToChromaSse41(r, g, b, kVR, kVG, kVB);
+        __m128i u8 = _mm_packus_epi16(u, u);
+        __m128i v8 = _mm_packus_epi16(v, v);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(uv + x), _mm_unpacklo_epi8(u8, v8));
+    }
+    RgbToNv12RowsScalar(rgb0, rgb1, y0, y1, uv, x, width, bgr);
+}
+#endif
+
+Nv12ToRgbRowFunc SelectNv12ToRgbRow()
+{
+#if SIMD_X86
+    SimdLevel level = GetSimdLevel();
+    if (level >= SIMD_AVX2) {
+        return Nv12ToRgbRowAvx2;
+    }
+    if (level >= SIMD_SSE41) {
+        return Nv12ToRgbRowSse41;
+    }
+#endif
+    return Nv12ToRgbRowC;
+}
+
+// the rgb deinterleave is the bound here, a wider path does not pay off
+RgbToNv12RowsFunc SelectRgbToNv12Rows()
+{
+#if SIMD_X86
+    if (GetSimdLevel() >= SIMD_SSE41) {
+        return RgbToNv12RowsSse41;
+    }
+#endif
+    return RgbToNv12RowsC;
+}
+
+inline bool IsRgbFormat(acldvppPixelFormat format)
+{
+    return (format == PIXEL_FORMAT_RGB_888) || (format == PIXEL_FORMAT_BGR_888);
+}
+
+// take a pooled buffer for dst, or check the one the caller gave
+Error PrepareDst(const ImageData& src, ImageData& dst, StrideAlign align, ImagePlanes& planes)
+{
+    if (dst.data == nullptr) {
+        Error ret = FramePool::GetInstance().AllocImage(dst, src.width, src.height, dst.format, align);
+        if (ret != OK) {
+            return ret;
+        }
+    } else if (dst.width != src.width || dst.height != src.height) {
+        LOG_ERROR("Output image %ux%u does not match input %ux%u",
+                  dst.width, dst.height, src.width, src.height);
+        return ERROR_INVALID_ARGS;
+    }
+    if (!GetImagePlanes(dst, planes)) {
+        LOG_ERROR("Output image buffer is invalid, stride %ux%u size %u",
+                  dst.alignWidth, dst.alignHeight, dst.size);
+        return ERROR_INVALID_ARGS;
+    }
+    return OK;
+}
+
+uint32_t RowPairsPerTask(uint32_t width)
+{
+    uint32_t pairs = kMinPixelsPerTask / (width * 2);
+    return (pairs == 0) ? 1 : pairs;
+}
+}
+
+Error ConvertNv12ToRgb(const ImageData& src, ImageData& dst)
+{
+    ImagePlanes in;
+    if (src.format != PIXEL_FORMAT_YUV_SEMIPLANAR_420 || !GetImagePlanes(src, in)) {
+        LOG_ERROR("Convert nv12 to rgb failed for invalid input, format %d", src.format);
+        return ERROR_INVALID_ARGS;
+    }
+    if (!IsRgbFormat(dst.format)) {
+        LOG_ERROR("Convert nv12 to rgb failed for output format %d", dst.format);
+        return ERROR_INVALID_ARGS;
+    }
+    ImagePlanes out;
+    Error ret = PrepareDst(src, dst, STRIDE_ALIGN_NONE, out);
+    if (ret != OK) {
+        return ret;
+    }
+
+    Nv12ToRgbRowFunc rowFunc = SelectNv12ToRgbRow();
+    bool bgr = (dst.format == PIXEL_FORMAT_BGR_888);
+    uint32_t width = src.width;
+    uint32_t height = src.height;
+    // a task owns whole row pairs, they share one chroma row
+    ParallelFor((height + 1) / 2, RowPairsPerTask(width), [&](uint32_t begin, uint32_t end) {
+        for (uint32_t pair = begin; pair < end; pair++) {
+            const uint8_t* uv = in.plane[1] + pair * in.stride[1];
+            for (uint32_t row = pair * 2; row < pair * 2 + 2 && row < height; row++) {
+                rowFunc(in.plane[0] + row * in.stride[0], uv,
+                        out.plane[0] + row * out.stride[0], width, bgr);
+            }
+        }
+    });
+    return OK;
+}
+
+Error ConvertRgbToNv12(const ImageData& src, ImageData& dst)
+{
+    ImagePlanes in;
+    if (!IsRgbFormat(src.format) || !GetImagePlanes(src, in)) {
+        LOG_ERROR("Convert rgb to nv12 failed for invalid input, format %d", src.format);
+        return ERROR_INVALID_ARGS;
+    }
+    dst.format = PIXEL_FORMAT_YUV_SEMIPLANAR_420;
+    ImagePlanes out;
+    Error ret = PrepareDst(src, dst, STRIDE_ALIGN_VPC, out);
+    if (ret != OK) {
+        return ret;
+    }
+
+    RgbToNv12RowsFunc rowsFunc = SelectRgbToNv12Rows();
+    bool bgr = (src.format == PIXEL_FORMAT_BGR_888);
+    uint32_t width = src.width;
+    uint32_t height = src.height;
+    ParallelFor((height + 1) / 2, RowPairsPerTask(width), [&](uint32_t begin, uint32_t end) {
+        for (uint32_t pair = begin; pair < end; pair++) {
+            uint32_t row = pair * 2;
+            bool hasRow1 = (row + 1 < height);
+            const uint8_t* rgb0 = in.plane[0] + row * in.stride[0];
+            const uint8_t* rgb1 = hasRow1 ? rgb0 + in.stride[0] : rgb0;
+            uint8_t* y0 = out.plane[0] + row * out.stride[0];
+            uint8_t* y1 = hasRow1 ? y0 + out.stride[0] : nullptr;
+            rowsFunc(rgb0, rgb1, y0, y1, out.plane[1] + pair * out.stride[1], width, bgr);
+        }
+    });
+    return OK;
+}
@@ -0,0 +1,366 @@
+/**
+* Copyright (c) Huawei Technologies Co., Ltd. 2020-2022. All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+
+* http://www.apache.org/licenses/LICENSE-2.0
+
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+
+* File ConfigService.cpp
+* Description: config file watcher sending changed keys as messages
+*/
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "App.h"
+#include "ConfigService.h"
+#include "Utils.h"
+
+using namespace std;
+
+namespace {
+const uint32_t kEventBufferSize = 4096;
+const int64_t kNsPerSecond = 1000000000LL;
+const uint32_t kUsPerMs = 1000;
+
+int64_t FileModifyTime(const string& path)
+{
+    struct stat sBuf;
+    if (stat(path.c_str(), &sBuf) != 0) {
+        return -1;
+    }
+    return sBuf.st_mtim.tv_sec * kNsPerSecond + sBuf.st_mtim.tv_nsec;
+}
+}
+
+ConfigValue ParseConfigValue(const string& key, const string& text)
+{
+    ConfigValue value;
+    value.key = key;
+    value.text = text;
+    if (text.empty()) {
+        return value;
+    }
+
+    string lower = text;
+    transform(lower.begin(), lower.end(), lower.begin(), [](unsigned char c) { return tolower(c); });
+    if (lower == "true" || lower == "yes" || lower == "on" ||
+        lower == "false" || lower == "no" || lower == "off") {
+        value.type = CONFIG_VALUE_BOOL;
+        value.boolValue = (lower == "true" || lower == "yes" || lower == "on");
+        value.intValue = value.boolValue ? 1 : 0;
+        value.floatValue = value.intValue;
+        return value;
+    }
+
+    const char* begin = text.c_str();
+    char* end = nullptr;
+    errno = 0;
+    long long intValue = strtoll(begin, &end, 0);
+    if (errno == 0 && end != begin && *end == '\0') {
+        value.type = CONFIG_VALUE_INT;
+        value.intValue = intValue;
+        value.floatValue = static_cast<double>(intValue);
+        value.boolValue = (intValue != 0);
+        return value;
+    }
+    errno = 0;
+    double floatValue = strtod(begin, &end);
+    if (errno == 0 && end != begin && *end == '\0') {
+        value.type = CONFIG_VALUE_FLOAT;
+        value.floatValue = floatValue;
+        value.intValue = static_cast<int64_t>(floatValue);
+        value.boolValue = (floatValue != 0);
+    }
+    return value;
+}
+
+const ConfigValue* FindConfigValue(const ConfigUpdate& update, const string& key)
+{
+    for (const auto& value : update.values) {
+        if (value.key == key) {
+            return &value;
+        }
+    }
+    return nullptr;
+}
+
+ConfigService::ConfigService(const ConfigServiceConfig& config) : config_(config), inotifyFd_(-1),
+    watchFd_(-1), fileTime_(-1), running_(false)
+{
+    string::size_type pos = config_.configFile.rfind('/');
+    if (pos == string::npos) {
+        fileDir_ = ".";
+        fileName_ = config_.configFile;
+    } else {
+        fileDir_ = (pos == 0) ? "/" : config_.configFile.substr(0, pos);
+        fileName_ = config_.configFile.substr(pos + 1);
+    }
+}
+
+ConfigService::~ConfigService()
+{
+    if (inotifyFd_ >= 0) {
+        close(inotifyFd_);
+    }
+}
+
+int ConfigService::Init()
+{
+    if (!ReadConfig(text_, config_.configFile.c_str())) {
+        LOG_ERROR("Config service %s can not read %s", SelfInstanceName().c_str(),
+                  config_.configFile.c_str());
+        return ERROR_ACCESS_FILE;
+    }
+    for (const auto& item : text_) {
+        values_[item.first] = ParseConfigValue(item.first, item.second);
+    }
+    fileTime_ = FileModifyTime(config_.configFile);
+
+    // the directory is watched, a file replaced by rename keeps being seen
+    inotifyFd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotifyFd_ >= 0) {
+        watchFd_ = inotify_add_watch(inotifyFd_, fileDir_.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+        if (watchFd_ < 0) {
+            close(inotifyFd_);
+            inotifyFd_ = -1;
+        }
+    }
+    stats_.inotify = (inotifyFd_ >= 0);
+    LOG_INFO("Config service %s watches %s by %s, %zu keys", SelfInstanceName().c_str(),
+             config_.configFile.c_str(), stats_.inotify ? "inotify" : "file time", values_.size());
+    return OK;
+}
+
+int ConfigService::Process(int msgId, shared_ptr<void> msgData)
+{
+    switch (msgId) {
+        case MSG_CONFIG_START:
+            if (running_) {
+                LOG_WARNING("Config service %s is running, start ignored", SelfInstanceName().c_str());
+                return OK;
+            }
+            running_ = true;
+            for (const auto& subscription : config_.subscriptions) {
+                Subscribe(subscription);
+            }
+            Tick();
+            break;
+        case MSG_CONFIG_SUBSCRIBE:
+            if (msgData == nullptr) {
+                return OK;
+            }
+            Subscribe(*static_pointer_cast<ConfigSubscription>(msgData));
+            break;
+        case MSG_CONFIG_TICK:
+            Tick();
+            break;
+        default:
+            LOG_WARNING("Config service %s ignores message %d", SelfInstanceName().c_str(), msgId);
+            break;
+    }
+    return OK;
+}
+
+ConfigServiceStats ConfigService::GetStats()
+{
+    lock_guard<mutex> guard(statsLock_);
+    return stats_;
+}
+
+void ConfigService::Subscribe(const ConfigSubscription& subscription)
+{
+    int threadId = GetThreadIdByName(subscription.threadName);
+    if (threadId == INVALID_INSTANCE_ID) {
+        LOG_ERROR("Config service %s has no subscriber thread %s",
+                  SelfInstanceName().c_str(), subscription.threadName.c_str());
+        return;
+    }
+    Subscriber* subscriber = nullptr;
+    for (auto& item : subscribers_) {
+        if (item.threadId == threadId && item.msgId == subscription.msgId) {
+            subscriber = &item;
+            break;
+        }
+    }
+    if (subscriber == nullptr) {
+        subscribers_.push_back(Subscriber { threadId, subscription.threadName, set<string>(),
+                                            subscription.msgId, false });
+        subscriber = &subscribers_.back();
+    } else if (subscriber->keys.empty()) {
+        // already has all keys
+        SendUpdate(*subscriber, nullptr);
+        return;
+    }
+    if (subscription.keys.empty()) {
+        subscriber->keys.clear();
+    } else {
+        subscriber->keys.insert(subscription.keys.begin(), subscription.keys.end());
+    }
+    SendUpdate(*subscriber, nullptr);
+}
+
+void ConfigService::Tick()
+{
+    if (!running_) {
+        return;
+    }
+    if (FileChanged()) {
+        Reload();
+    }
+    for (auto& subscriber : subscribers_) {
+        if (subscriber.resync) {
+            SendUpdate(subscriber, nullptr);
+        }
+    }
+    Error ret = ScheduleTick(MSG_CONFIG_TICK);
+    if (ret != OK) {
+        LOG_ERROR("Config service %s stops for tick failed, error %d", SelfInstanceName().c_str(), ret);
+        running_ = false;
+    }
+}
+
+bool ConfigService::FileChanged()
+{
+    if (inotifyFd_ < 0) {
+        usleep(config_.pollMs * kUsPerMs);
+        int64_t fileTime = FileModifyTime(config_.configFile);
+        if (fileTime < 0 || fileTime == fileTime_) {
+            return false;
+        }
+        fileTime_ = fileTime;
+        return true;
+    }
+
+    struct pollfd waitFd = { inotifyFd_, POLLIN, 0 };
+    if (poll(&waitFd, 1, config_.pollMs) <= 0) {
+        return false;
+    }
+    bool changed = false;
+    alignas(struct inotify_event) char buffer[kEventBufferSize];
+    while (true) {
+        ssize_t len = read(inotifyFd_, buffer, sizeof(buffer));
+        if (len <= 0) {
+            break;
+        }
+        for (ssize_t offset = 0; offset < len;) {
+            const struct inotify_event* event = reinterpret_cast<const struct inotify_event*>(buffer + offset);
+            if (event->len > 0 && fileName_ == event->name) {
+                changed = true;
+            }
+            offset += sizeof(struct inotify_event) + event->len;
+        }
+    }
+    return changed;
+}
+
+void ConfigService::Reload()
+{
+    map<string, string> text;
+    if (!ReadConfig(text, config_.configFile.c_str())) {
+        // keep the last keys while the file is missing
+        lock_guard<mutex> guard(statsLock_);
+        stats_.failedReloads++;
+        return;
+    }
+
+    vector<ConfigValue> changed;
+    for (const auto& item : text) {
+        auto old = text_.find(item.first);
+        if (old == text_.end() || old->second != item.second) {
+            changed.push_back(ParseConfigValue(item.first, item.second));
+        }
+    }
+    for (const auto& item : text_) {
+        if (text.count(item.first) == 0) {
+            ConfigValue value;
+            value.key = item.first;
+            value.removed = true;
+            changed.push_back(value);
+        }
+    }
+    text_.swap(text);
+    {
+        lock_guard<mutex> guard(statsLock_);
+        stats_.reloads++;
+        if (!changed.empty()) {
+            stats_.version++;
+        }
+    }
+    if (changed.empty()) {
+        return;
+    }
+    for (const auto& value : changed) {
+        if (value.removed) {
+            values_.erase(value.key);
+        } else {
+            values_[value.key] = value;
+        }
+    }
+    LOG_INFO("Config service %s reloaded %s, %zu keys changed", SelfInstanceName().c_str(),
+             config_.configFile.c_str(), changed.size());
+    for (auto& subscriber : subscribers_) {
+        if (!subscriber.resync) {
+            SendUpdate(subscriber, &changed);
+        }
+    }
+}
+
+bool ConfigService::Wants(const Subscriber& subscriber, const string& key) const
+{
+    return subscriber.keys.empty() || subscriber.keys.count(key) > 0;
+}
+
+void ConfigService::SendUpdate(Subscriber& subscriber, const vector<ConfigValue>* changed)
+{
+    shared_ptr<ConfigUpdate> update = make_shared<ConfigUpdate>();
+    if (changed == nullptr) {
+        for (const auto& item : values_) {
+            if (Wants(subscriber, item.first)) {
+                update->values.push_back(item.second);
+            }
+        }
+    } else {
+        for (const auto& value : *changed) {
+            if (Wants(subscriber, value.key)) {
+                update->values.push_back(value);
+            }
+        }
+        if (update->values.empty()) {
+            return;
+        }
+    }
+
+    {
+        lock_guard<mutex> guard(statsLock_);
+        update->version = stats_.version;
+    }
+    // not under statsLock_, a fused subscriber runs its Process in the send
+    Error ret = SendMessage(subscriber.threadId, subscriber.msgId, update);
+    if (ret != OK) {
+        if (!subscriber.resync) {
+            LOG_WARNING("Config update to %s failed, error %d, sent again later",
+                        subscriber.threadName.c_str(), ret);
+        }
+        subscriber.resync = true;
+        lock_guard<mutex> guard(statsLock_);
+        stats_.sendFailed++;
+        return;
+    }
+    subscriber.resync = false;
+    lock_guard<mutex> guard(statsLock_);
+    stats_.updatesSent++;
+}
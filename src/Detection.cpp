@@ -0,0 +1,301 @@
+/**
+* Copyright (c) Huawei Technologies Co., Ltd. 2020-2022. All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+
+* http://www.apache.org/licenses/LICENSE-2.0
+
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+
+* File Detection.cpp
+* Description: score threshold, top-k and nms of detection model output
+*/
+#include <algorithm>
+#include "Detection.h"
+#include "Simd.h"
+#include "Utils.h"
+
+using namespace std;
+
+namespace {
+// both encodings have the box score, or the objectness bounding it, here
+const uint32_t kScoreColumn = 4;
+const uint32_t kClassColumn = 5;
+const uint32_t kXyxyStride = 6;
+const uint32_t kCxcywhHeader = 5;
+const float kPercent = 100.0f;
+
+uint32_t BoxStride(const TensorLayout& layout)
+{
+    return (layout.encoding == BOX_XYXY_SCORE_CLASS) ? kXyxyStride : kCxcywhHeader + layout.classNum;
+}
+
+void ScanScoresC(const float* column, uint32_t stride, uint32_t begin, uint32_t num,
+                 float threshold, vector<uint32_t>& hits)
+{
+    for (uint32_t i = begin; i < num; i++) {
+        if (column[(size_t)i * stride] >= threshold) {
+            hits.push_back(i);
+        }
+    }
+}
+
+// overlap of box i with boxes [begin, end), suppress the ones over the threshold.
+// iou > t is tested as inter > t * union to keep the division out
+void SuppressC(const float* x1, const float* y1, const float* x2, const float* y2,
+               const float* area, const int32_t* classId, uint32_t i, uint32_t begin,
+               uint32_t end, float threshold, bool classAware, int32_t* suppressed)
+{
+    for (uint32_t j = begin; j < end; j++) {
+        float w = min(x2[i], x2[j]) - max(x1[i], x1[j]);
+        float h = min(y2[i], y2[j]) - max(y1[i], y1[j]);
+        float inter = max(w, 0.0f) * max(h, 0.0f);
+        float unionArea = area[i] + area[j] - inter;
+        bool sameClass = !classAware || (classId[i] == classId[j]);
+        if (sameClass && inter > threshold * unionArea) {
+            suppressed[j] = -1;
+        }
+    }
+}
+
+#if SIMD_X86
+SIMD_TARGET("avx2")
+void ScanScoresAvx2(const float* column, uint32_t stride, uint32_t num,
+                    float threshold, vector<uint32_t>& hits)
+{
+    // the scores are one column of a row major tensor, gather 8 rows
+    const __m256i offset = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7),
+                                              _mm256_set1_epi32(static_cast<int>(stride)));
+    const __m256 limit = _mm256_set1_ps(threshold);
+    uint32_t i = 0;
+    for (; i + 8 <= num; i += 8) {
+        __m256 score = _mm256_i32gather_ps(column + (size_t)i * stride, offset, 4);
+        uint32_t mask = _mm256_movemask_ps(_mm256_cmp_ps(score, limit, _CMP_GE_OQ));
+        while (mask != 0) {
+            hits.push_back(i + __builtin_ctz(mask));
+            mask &= mask - 1;
+        }
+    }
+    ScanScoresC(column, stride, i, num, threshold, hits);
+}
+
+SIMD_TARGET("avx2")
+void SuppressAvx2(const float* x1, const float* y1, const float* x2, const float* y2,
+                  const float* area, const int32_t* classId, uint32_t i, uint32_t begin,
+                  uint32_t end, float threshold, bool classAware, int32_t* suppressed)
+{
+    const __m256 ix1 = _mm256_set1_ps(x1[i]);
+    const __m256 iy1 = _mm256_set1_ps(y1[i]);
+    const __m256 ix2 = _mm256_set1_ps(x2[i]);
+    const __m256 iy2 = _mm256_set1_ps(y2[i]);
+    const __m256 iArea = _mm256_set1_ps(area[i]);
+    const __m256 limit = _mm256_set1_ps(threshold);
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256i iClass = _mm256_set1_epi32(classId[i]);
+    const __m256i anyClass = _mm256_set1_epi32(classAware ? 0 : -1);
+    uint32_t j = begin;
+    for (; j + 8 <= end; j += 8) {
+        __m256 w = _mm256_sub_ps(_mm256_min_ps(ix2, _mm256_loadu_ps(x2 + j)),
+                                 _mm256_max_ps(ix1, _mm256_loadu_ps(x1 + j)));
+        __m256 h = _mm256_sub_ps(_mm256_min_ps(iy2, _mm256_loadu_ps(y2 + j)),
+                                 _mm256_max_ps(iy1, _mm256_loadu_ps(y1 + j)));
+        __m256 inter = _mm256_mul_ps(_mm256_max_ps(w, zero), _mm256_max_ps(h, zero));
+        __m256 unionArea = _mm256_sub_ps(_mm256_add_ps(iArea, _mm256_loadu_ps(area + j)), inter);
+        __m256i over = _mm256_castps_si256(_mm256_cmp_ps(inter, _mm256_mul_ps(limit, unionArea), _CMP_GT_OQ));
+        __m256i cls = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(classId + j));
+        __m256i same = _mm256_or_si256(_mm256_cmpeq_epi32(cls, iClass), anyClass);
+        __m256i* flag = reinterpret_cast<__m256i*>(suppressed + j);
+        _mm256_storeu_si256(flag, _mm256_or_si256(_mm256_loadu_si256(flag), _mm256_and_si256(over, same)));
+    }
+    SuppressC(x1, y1, x2, y2, area, classId, i, j, end, threshold, classAware, suppressed);
+}
+#endif
+
+void ScanScores(const float* column, uint32_t stride, uint32_t num, float threshold, vector<uint32_t>& hits)
+{
+#if SIMD_X86
+    if (GetSimdLevel() >= SIMD_AVX2) {
+        ScanScoresAvx2(column, stride, num, threshold, hits);
+        return;
+    }
+#endif
+    ScanScoresC(column, stride, 0, num, threshold, hits);
+}
+
+void Suppress(const BoxArray& boxes, const vector<float>& area, uint32_t i,
+              float threshold, bool classAware, int32_t* suppressed)
+{
+    uint32_t end = boxes.Size();
+#if SIMD_X86
+    if (GetSimdLevel() >= SIMD_AVX2) {
+        SuppressAvx2(boxes.x1.data(), boxes.y1.data(), boxes.x2.data(), boxes.y2.data(),
+                     area.data(), boxes.classId.data(), i, i + 1, end, threshold, classAware, suppressed);
+        return;
+    }
+#endif
+    SuppressC(boxes.x1.data(), boxes.y1.data(), boxes.x2.data(), boxes.y2.data(),
+              area.data(), boxes.classId.data(), i, i + 1, end, threshold, classAware, suppressed);
+}
+
+void DecodeCandidate(const float* row, const TensorLayout& layout, float threshold, BoxArray& boxes)
+{
+    if (layout.encoding == BOX_XYXY_SCORE_CLASS) {
+        boxes.Push(row[0], row[1], row[2], row[3], row[kScoreColumn],
+                   static_cast<int32_t>(row[kClassColumn]));
+        return;
+    }
+    const float* classScore = row + kCxcywhHeader;
+    uint32_t best = 0;
+    for (uint32_t c = 1; c < layout.classNum; c++) {
+        if (classScore[c] > classScore[best]) {
+            best = c;
+        }
+    }
+    float score = row[kScoreColumn] * classScore[best];
+    if (score < threshold) {
+        return;
+    }
+    float halfWidth = row[2] * 0.5f;
+    float halfHeight = row[3] * 0.5f;
+    boxes.Push(row[0] - halfWidth, row[1] - halfHeight, row[0] + halfWidth, row[1] + halfHeight,
+               score, static_cast<int32_t>(best));
+}
+
+void CopyBox(const BoxArray& from, uint32_t index, BoxArray& to)
+{
+    to.Push(from.x1[index], from.y1[index], from.x2[index], from.y2[index],
+            from.score[index], from.classId[index]);
+}
+
+uint32_t ClipCoord(float value, uint32_t size)
+{
+    // clamped as a float, the conversion of NaN or of a value out of the
+    // range of uint32_t is undefined
+    if (size == 0 || !(value > 0.0f)) {
+        return 0;
+    }
+    if (value >= static_cast<float>(size)) {
+        return size - 1;
+    }
+    return static_cast<uint32_t>(value);
+}
+}
+
+Error DecodeBoxes(const InferenceOutput& output, const TensorLayout& layout,
+                  float scoreThreshold, BoxArray& boxes)
+{
+    boxes.Clear();
+    if (layout.encoding == BOX_CXCYWH_OBJ_CLASSES && layout.classNum == 0) {
+        LOG_ERROR("Decode boxes failed for class number is 0");
+        return ERROR_INVALID_ARGS;
+    }
+    uint32_t stride = BoxStride(layout);
+    uint64_t tensorSize = (uint64_t)layout.boxNum * stride * sizeof(float);
+    if (output.data == nullptr || tensorSize > output.size) {
+        LOG_ERROR("Decode boxes failed for output %u bytes, %u boxes need %lu bytes",
+                  output.size, layout.boxNum, (unsigned long)tensorSize);
+        return ERROR_INVALID_ARGS;
+    }
+
+    const float* tensor = static_cast<const float*>(output.data.get());
+    // most rows fail the threshold, find the others before decoding any
+    vector<uint32_t> hits;
+    ScanScores(tensor + kScoreColumn, stride, layout.boxNum, scoreThreshold, hits);
+    boxes.Reserve(hits.size());
+    for (uint32_t index : hits) {
+        DecodeCandidate(tensor + (size_t)index * stride, layout, scoreThreshold, boxes);
+    }
+    return OK;
+}
+
+void NmsBoxes(const BoxArray& boxes, const DetectParam& param, BoxArray& result)
+{
+    result.Clear();
+    uint32_t num = boxes.Size();
+    if (num == 0 || param.maxDetections == 0) {
+        return;
+    }
+    vector<uint32_t> order(num);
+    for (uint32_t i = 0; i < num; i++) {
+        order[i] = i;
+    }
+    // the index breaks ties so the result does not depend on the library
+    auto better = [&boxes](uint32_t a, uint32_t b) {
+        return (boxes.score[a] > boxes.score[b]) || (boxes.score[a] == boxes.score[b] && a < b);
+    };
+    // linear selection of the candidates, only those are ordered
+    if (param.topK != 0 && num > param.topK) {
+        nth_element(order.begin(), order.begin() + param.topK, order.end(), better);
+        order.resize(param.topK);
+    }
+    sort(order.begin(), order.end(), better);
+
+    BoxArray sorted;
+    sorted.Reserve(order.size());
+    vector<float> area(order.size());
+    for (size_t i = 0; i < order.size(); i++) {
+        CopyBox(boxes, order[i], sorted);
+        float w = max(sorted.x2[i] - sorted.x1[i], 0.0f);
+        float h = max(sorted.y2[i] - sorted.y1[i], 0.0f);
+        area[i] = w * h;
+    }
+
+    vector<int32_t> suppressed(sorted.Size(), 0);
+    result.Reserve(min<size_t>(sorted.Size(), param.maxDetections));
+    for (uint32_t i = 0; i < sorted.Size(); i++) {
+        if (suppressed[i] != 0) {
+            continue;
+        }
+        CopyBox(sorted, i, result);
+        if (result.Size() >= param.maxDetections) {
+            break;
+        }
+        Suppress(sorted, area, i, param.iouThreshold, param.classAware, suppressed.data());
+    }
+}
+
+Error PostProcessDetections(const InferenceOutput& output, const TensorLayout& layout,
+                            const DetectParam& param, BoxArray& result)
+{
+    BoxArray candidates;
+    Error ret = DecodeBoxes(output, layout, param.scoreThreshold, candidates);
+    if (ret != OK) {
+        return ret;
+    }
+    NmsBoxes(candidates, param, result);
+    return OK;
+}
+
+void BoxesToBBoxes(const BoxArray& boxes, uint32_t width, uint32_t height,
+                   vector<BBox>& bboxes, const LabelFunc& label)
+{
+    bboxes.resize(boxes.Size());
+    for (size_t i = 0; i < boxes.Size(); i++) {
+        BBox& box = bboxes[i];
+        box.rect.ltX = ClipCoord(boxes.x1[i], width);
+        box.rect.ltY = ClipCoord(boxes.y1[i], height);
+        box.rect.rbX = ClipCoord(boxes.x2[i], width);
+        box.rect.rbY = ClipCoord(boxes.y2[i], height);
+        box.score = static_cast<uint32_t>(boxes.score[i] * kPercent + 0.5f);
+        box.text.clear();
+    }
+    if (label) {
+        AttachLabels(boxes, bboxes, label);
+    }
+}
+
+void AttachLabels(const BoxArray& boxes, vector<BBox>& bboxes, const LabelFunc& label)
+{
+    size_t num = min(boxes.Size(), bboxes.size());
+    for (size_t i = 0; i < num; i++) {
+        if (bboxes[i].text.empty()) {
+            bboxes[i].text = label(boxes.classId[i], boxes.score[i]);
+        }
+    }
+}
@@ -0,0 +1,216 @@
+/**
+* Copyright (c) Huawei Technologies Co., Ltd. 2020-2022. All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+
+* http://www.apache.org/licenses/LICENSE-2.0
+
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+
+* File DirWalker.cpp
+* Description: parallel directory traversal streaming file paths
+*/
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "DirWalker.h"
+#include "Utils.h"
+
+using namespace std;
+
+namespace {
+const uint32_t kMaxWalkThreads = 64;
+
+class DirWalk {
+public:
+    DirWalk(const PathCallback& callback, const DirWalkConfig& config)
+        : callback_(callback), config_(config), active_(0)
+    {
+    }
+
+    void AddDirectory(string path, const struct stat& info)
+    {
+        if (config_.followSymlinks) {
+            visited_.insert(make_pair(info.st_dev, info.st_ino));
+        }
+        pending_.push_back(move(path));
+    }
+
+    void Run(uint32_t threadNum)
+    {
+        vector<thread> workers;
+        for (uint32_t i = 1; i < threadNum; i++) {
+            workers.push_back(thread(&DirWalk::WorkerEntry, this));
+        }
+        WorkerEntry();
+        for (auto& worker : workers) {
+            worker.join();
+        }
+    }
+
+    const DirWalkStats& Stats() const
+    {
+        return stats_;
+    }
+
+private:
+    void WorkerEntry()
+    {
+        vector<string> subDirs;
+        vector<string> files;
+        while (true) {
+            string dir;
+            {
+                unique_lock<mutex> guard(lock_);
+                workReady_.wait(guard, [this] { return !pending_.empty() || active_ == 0; });
+                if (pending_.empty()) {
+                    return;
+                }
+                // the newest directory first keeps the walk depth first and
+                // the pending list short
+                dir = move(pending_.back());
+                pending_.pop_back();
+                active_++;
+            }
+            subDirs.clear();
+            files.clear();
+            bool readOk = ReadDirectory(dir, subDirs, files);
+            {
+                lock_guard<mutex> guard(lock_);
+                for (auto& sub : subDirs) {
+                    pending_.push_back(move(sub));
+                }
+                active_--;
+                stats_.dirs++;
+                stats_.files += files.size();
+                stats_.errors += readOk ? 0 : 1;
+            }
+            workReady_.notify_all();
+            if (!files.empty()) {
+                lock_guard<mutex> guard(callbackLock_);
+                for (const auto& file : files) {
+                    callback_(file);
+                }
+            }
+        }
+    }
+
+    bool ReadDirectory(const string& dir, vector<string>& subDirs, vector<string>& files)
+    {
+        int dirFd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (dirFd < 0) {
+            LOG_ERROR("Open directory %s failed, errno %d", dir.c_str(), errno);
+            return false;
+        }
+        DIR* stream = fdopendir(dirFd);
+        if (stream == nullptr) {
+            close(dirFd);
+            return false;
+        }
+        struct dirent* entry = nullptr;
+        while ((entry = readdir(stream)) != nullptr) {
+            const char* name = entry->d_name;
+            if (name[0] == '.' && (config_.skipHidden || name[1] == '\0' ||
+                                   (name[1] == '.' && name[2] == '\0'))) {
+                continue;
+            }
+            unsigned char type = entry->d_type;
+            struct stat info;
+            bool haveInfo = false;
+            if (type == DT_UNKNOWN || (type == DT_LNK && config_.followSymlinks)) {
+                int flags = config_.followSymlinks ? 0 : AT_SYMLINK_NOFOLLOW;
+                if (fstatat(dirFd, name, &info, flags) != 0) {
+                    // a dangling link is a file that can not be opened, as before
+                    type = DT_REG;
+                } else {
+                    type = S_ISDIR(info.st_mode) ? DT_DIR : DT_REG;
+                    haveInfo = true;
+                }
+            }
+
+            string path;
+            size_t nameLen = strlen(name);
+            path.reserve(dir.size() + 1 + nameLen);
+            path.append(dir);
+            if (path.back() != '/') {
+                path.push_back('/');
+            }
+            path.append(name, nameLen);
+            if (type != DT_DIR) {
+                files.push_back(move(path));
+                continue;
+            }
+            if (config_.followSymlinks) {
+                if (!haveInfo && fstatat(dirFd, name, &info, 0) != 0) {
+                    continue;
+                }
+                // a symlink loop, or a directory reached by two links
+                lock_guard<mutex> guard(lock_);
+                if (!visited_.insert(make_pair(info.st_dev, info.st_ino)).second) {
+                    continue;
+                }
+            }
+            subDirs.push_back(move(path));
+        }
+        closedir(stream);
+        return true;
+    }
+
+    const PathCallback& callback_;
+    DirWalkConfig config_;
+    mutex lock_;
+    condition_variable workReady_;
+    vector<string> pending_;
+    uint32_t active_;
+    set<pair<dev_t, ino_t>> visited_;
+    DirWalkStats stats_;
+    mutex callbackLock_;
+};
+}
+
+Error WalkDirectory(const string& root, const PathCallback& callback,
+                    const DirWalkConfig& config, DirWalkStats* stats)
+{
+    struct stat info;
+    if (root.empty() || stat(root.c_str(), &info) != 0) {
+        LOG_ERROR("Walk %s failed, not exist or can not access", root.c_str());
+        return ERROR_ACCESS_FILE;
+    }
+    if (!S_ISDIR(info.st_mode)) {
+        callback(root);
+        if (stats != nullptr) {
+            *stats = DirWalkStats();
+            stats->files = 1;
+        }
+        return OK;
+    }
+
+    // "dir/" would give "dir//name"
+    string top = root;
+    while (top.size() > 1 && top.back() == '/') {
+        top.pop_back();
+    }
+    DirWalk walk(callback, config);
+    walk.AddDirectory(top, info);
+    uint32_t threadNum = (config.threadNum == 0) ? 1 : config.threadNum;
+    walk.Run((threadNum > kMaxWalkThreads) ? kMaxWalkThreads : threadNum);
+    if (stats != nullptr) {
+        *stats = walk.Stats();
+    }
+    return OK;
+}
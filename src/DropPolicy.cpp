@@ -0,0 +1,132 @@
+/**
+* Copyright (c) Huawei Technologies Co., Ltd. 2020-2022. All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+
+* http://www.apache.org/licenses/LICENSE-2.0
+
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+
+* File DropPolicy.cpp
+* Description: latency budget frame dropping for live sources
+*/
+#include <algorithm>
+#include "App.h"
+#include "DropPolicy.h"
+
+using namespace std;
+
+namespace {
+// decimation value of keeping only the frames that must go
+const uint32_t kKeyFramesOnly = 0;
+}
+
+DropPolicy::DropPolicy(const DropPolicyConfig& config) : config_(config), refreshedUs_(0), latencyUs_(0),
+    decimation_(1)
+{
+    config_.maxDecimation = max(config_.maxDecimation, 1u);
+    config_.decimateAt = min(max(config_.decimateAt, 0.0), 1.0);
+    config_.latencyBudgetUs = max<int64_t>(config_.latencyBudgetUs, 1);
+    watchIds_.assign(config_.watchThreads.size(), INVALID_INSTANCE_ID);
+    watchMessages_.assign(config_.watchThreads.size(), 0);
+}
+
+bool DropPolicy::Admit(uint32_t cameraId, uint32_t frameId, bool isKeyFrame, bool isFinished)
+{
+    int64_t nowUs = MsgClockUs();
+    lock_guard<mutex> guard(lock_);
+    if (nowUs - refreshedUs_ >= config_.refreshUs) {
+        Refresh(nowUs);
+    }
+    CameraDropStats& stats = cameras_[cameraId];
+    stats.cameraId = cameraId;
+    if (isKeyFrame) {
+        stats.keyFrames++;
+    }
+    uint32_t decimation = decimation_;
+    if (decimation == kKeyFramesOnly && stats.keyFrames == 0) {
+        // no key frame would ever go, the camera would go dark
+        decimation = config_.maxDecimation;
+    }
+    bool keep = isKeyFrame || isFinished;
+    if (!keep && decimation != kKeyFramesOnly) {
+        // a phase by camera spreads the kept frames of the cameras
+        keep = ((frameId + cameraId) % decimation) == 0;
+    }
+    if (keep) {
+        stats.keptFrames++;
+    } else {
+        stats.droppedFrames++;
+    }
+    return keep;
+}
+
+DropPolicyStats DropPolicy::GetStats()
+{
+    lock_guard<mutex> guard(lock_);
+    DropPolicyStats stats;
+    stats.latencyUs = latencyUs_;
+    stats.decimation = decimation_;
+    for (auto& item : cameras_) {
+        stats.cameras.push_back(item.second);
+        stats.keptFrames += item.second.keptFrames;
+        stats.droppedFrames += item.second.droppedFrames;
+    }
+    return stats;
+}
+
+void DropPolicy::Refresh(int64_t nowUs)
+{
+    refreshedUs_ = nowUs;
+    int64_t latencyUs = 0;
+    for (size_t i = 0; i < watchIds_.size(); i++) {
+        if (watchIds_[i] == INVALID_INSTANCE_ID) {
+            // the thread may not be started yet
+            watchIds_[i] = GetThreadIdByName(config_.watchThreads[i]);
+        }
+        ThreadQueueStats queue;
+        if (watchIds_[i] == INVALID_INSTANCE_ID || GetThreadQueueStats(watchIds_[i], queue) != OK) {
+            continue;
+        }
+        // the average wait lags behind a growing queue, the depth does not.
+        // It is stale once nothing is processed, an idle or starved thread
+        // would keep the last high value for good
+        bool waitFresh = (queue.depth > 0) && (queue.messages != watchMessages_[i]);
+        watchMessages_[i] = queue.messages;
+        int64_t estimateUs = static_cast<int64_t>(queue.depth) * queue.serviceUs;
+        if (waitFresh) {
+            estimateUs = max(queue.waitUs, estimateUs);
+        }
+        latencyUs = max(latencyUs, estimateUs);
+    }
+    latencyUs_ = latencyUs;
+    uint32_t target = DecimationOf(latencyUs);
+    if (target == kKeyFramesOnly || (decimation_ != kKeyFramesOnly && target >= decimation_)) {
+        decimation_ = target;
+    } else if (decimation_ == kKeyFramesOnly) {
+        decimation_ = config_.maxDecimation;
+    } else {
+        // back off one step a refresh, so a draining queue does not flap
+        decimation_--;
+    }
+}
+
+uint32_t DropPolicy::DecimationOf(int64_t latencyUs) const
+{
+    double load = static_cast<double>(latencyUs) / config_.latencyBudgetUs;
+    if (load >= 1.0) {
+        return kKeyFramesOnly;
+    }
+    if (load < config_.decimateAt) {
+        return 1;
+    }
+    double span = max(1.0 - config_.decimateAt, 1e-6);
+    double step = (load - config_.decimateAt) / span * (config_.maxDecimation - 1);
+    return min(config_.maxDecimation, 1 + static_cast<uint32_t>(step + 0.5));
+}
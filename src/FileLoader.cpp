@@ -0,0 +1,522 @@
+/**
+* Copyright (c) Huawei Technologies Co., Ltd. 2020-2022. All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+
+* http://www.apache.org/licenses/LICENSE-2.0
+
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+
+* File FileLoader.cpp
+* Description: read ahead file loader thread for offline batch mode
+*/
+#include <cerrno>
+#include <condition_variable>
+#include <deque>
+#include <thread>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "App.h"
+#include "FileLoader.h"
+#include "FramePool.h"
+#include "IoUring.h"
+#include "Utils.h"
+
+using namespace std;
+
+namespace {
+const uint32_t kMaxPoolThreads = 16;
+// wait when the window or the receiver queue is full
+const uint32_t kRetryWaitUs = 1000;
+const double kBytesPerMegaByte = 1024.0 * 1024.0;
+
+struct ReadRequest {
+    uint64_t tag;
+    int fd;
+    uint8_t* buf;
+    uint32_t len;
+    uint64_t offset;
+};
+}
+
+/**
+ * Where the reads run. A read may complete short, the loader submits
+ * the rest again
+ */
+class ReadBackend {
+public:
+    virtual ~ReadBackend() {}
+    virtual bool IsIoUring() const = 0;
+    // false when no slot is free, try again after a Reap
+    virtual bool Read(const ReadRequest& request) = 0;
+    // collect finished reads, wait blocks until at least one is done
+    virtual void Reap(vector<IoCompletion>& done, bool wait) = 0;
+    // wait for every read handed over, their buffers may go afterwards
+    virtual void Drain() = 0;
+};
+
+namespace {
+class UringBackend : public ReadBackend {
+public:
+    UringBackend() : outstanding_(0) {}
+
+    Error Init(uint32_t entries)
+    {
+        return ring_.Init(entries);
+    }
+
+    bool IsIoUring() const override
+    {
+        return true;
+    }
+
+    bool Read(const ReadRequest& request) override
+    {
+        if (!ring_.PrepRead(request.fd, request.buf, request.len, request.offset, request.tag)) {
+            return false;
+        }
+        outstanding_++;
+        return true;
+    }
+
+    void Reap(vector<IoCompletion>& done, bool wait) override
+    {
+        // queued reads go to the kernel in one call
+        int ret = ring_.Submit(wait ? 1 : 0);
+        if (ret < 0) {
+            LOG_ERROR("io_uring submit failed, errno %d", -ret);
+        }
+        IoCompletion completion;
+        while (ring_.PeekCompletion(completion)) {
+            done.push_back(completion);
+            outstanding_--;
+        }
+    }
+
+    void Drain() override
+    {
+        // closing the ring does not stop the reads, the kernel would still
+        // write into freed buffers
+        IoCompletion completion;
+        while (outstanding_ > 0) {
+            int ret = ring_.Submit(1);
+            if (ret < 0 && ret != -EINTR) {
+                LOG_ERROR("io_uring drain of %u reads failed, errno %d", outstanding_, -ret);
+                return;
+            }
+            while (ring_.PeekCompletion(completion)) {
+                outstanding_--;
+            }
+        }
+    }
+
+private:
+    IoUring ring_;
+    // reads queued or in the kernel
+    uint32_t outstanding_;
+};
+
+class PoolBackend : public ReadBackend {
+public:
+    explicit PoolBackend(uint32_t threadNum) : exit_(false)
+    {
+        for (uint32_t i = 0; i < threadNum; i++) {
+            workers_.push_back(thread(&PoolBackend::WorkerEntry, this));
+        }
+    }
+
+    ~PoolBackend()
+    {
+        {
+            lock_guard<mutex> guard(lock_);
+            exit_ = true;
+        }
+        requestReady_.notify_all();
+        for (auto& worker : workers_) {
+            worker.join();
+        }
+    }
+
+    bool IsIoUring() const override
+    {
+        return false;
+    }
+
+    bool Read(const ReadRequest& request) override
+    {
+        {
+            lock_guard<mutex> guard(lock_);
+            requests_.push_back(request);
+        }
+        requestReady_.notify_one();
+        return true;
+    }
+
+    void Reap(vector<IoCompletion>& done, bool wait) override
+    {
+        unique_lock<mutex> guard(lock_);
+        if (wait) {
+            doneReady_.wait(guard, [this] { return !done_.empty(); });
+        }
+        done.insert(done.end(), done_.begin(), done_.end());
+        done_.clear();
+    }
+
+    void Drain() override
+    {
+        // the destructor joins the workers, a read in progress ends first
+        // and the queued ones never start
+    }
+
+private:
+    void WorkerEntry()
+    {
+        while (true) {
+            ReadRequest request;
+            {
+                unique_lock<mutex> guard(lock_);
+                requestReady_.wait(guard, [this] { return exit_ || !requests_.empty(); });
+                if (exit_) {
+                    return;
+                }
+                request = requests_.front();
+                requests_.pop_front();
+            }
+            IoCompletion completion;
+            completion.userData = request.tag;
+            completion.result = ReadFully(request);
+            {
+                lock_guard<mutex> guard(lock_);
+                done_.push_back(completion);
+            }
+            doneReady_.notify_one();
+        }
+    }
+
+    static int32_t ReadFully(const ReadRequest& request)
+    {
+        uint32_t total = 0;
+        while (total < request.len) {
+            ssize_t ret = pread(request.fd, request.buf + total, request.len - total, request.offset + total);
+            if (ret < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return -errno;
+            }
+            if (ret == 0) {
+                break;
+            }
+            total += ret;
+        }
+        return static_cast<int32_t>(total);
+    }
+
+    bool exit_;
+    mutex lock_;
+    condition_variable requestReady_;
+    condition_variable doneReady_;
+    deque<ReadRequest> requests_;
+    deque<IoCompletion> done_;
+    vector<thread> workers_;
+};
+}
+
+FileLoader::FileLoader(const FileLoaderConfig& config) : config_(config),
+    alive_(make_shared<atomic<uint32_t>>(0)), destId_(INVALID_INSTANCE_ID), running_(false),
+    nextSubmit_(0), nextDeliver_(0)
+{
+    config_.inFlight = (config_.inFlight == 0) ? 1 : config_.inFlight;
+    config_.window = (config_.window < config_.inFlight) ? config_.inFlight : config_.window;
+}
+
+FileLoader::~FileLoader()
+{
+    // stop the reads before their buffers and files go
+    if (backend_ != nullptr) {
+        backend_->Drain();
+    }
+    backend_.reset();
+    for (auto& job : reading_) {
+        close(job.second.fd);
+    }
+}
+
+int FileLoader::Init()
+{
+    if (config_.useIoUring) {
+        unique_ptr<UringBackend> uring(new UringBackend());
+        if (uring->Init(config_.inFlight) == OK) {
+            backend_ = move(uring);
+        }
+    }
+    if (backend_ == nullptr) {
+        uint32_t threadNum = (config_.inFlight > kMaxPoolThreads) ? kMaxPoolThreads : config_.inFlight;
+        backend_.reset(new PoolBackend(threadNum));
+    }
+    stats_.ioUring = backend_->IsIoUring();
+    LOG_INFO("File loader %s reads on %s, %u in flight, window %u", SelfInstanceName().c_str(),
+             stats_.ioUring ? "io_uring" : "thread pool", config_.inFlight, config_.window);
+    return OK;
+}
+
+int FileLoader::Process(int msgId, shared_ptr<void> msgData)
+{
+    switch (msgId) {
+        case MSG_FILE_LOADER_START:
+            if (running_) {
+                LOG_WARNING("File loader %s is running, start ignored", SelfInstanceName().c_str());
+                return OK;
+            }
+            if (Start() != OK) {
+                return OK;
+            }
+            Tick();
+            break;
+        case MSG_FILE_LOADER_TICK:
+            Tick();
+            break;
+        default:
+            LOG_WARNING("File loader %s ignores message %d", SelfInstanceName().c_str(), msgId);
+            break;
+    }
+    return OK;
+}
+
+FileLoaderStats FileLoader::GetStats()
+{
+    lock_guard<mutex> guard(statsLock_);
+    return stats_;
+}
+
+Error FileLoader::Start()
+{
+    destId_ = GetThreadIdByName(config_.destThread);
+    if (destId_ == INVALID_INSTANCE_ID) {
+        LOG_ERROR("File loader %s has no receiver thread %s",
+                  SelfInstanceName().c_str(), config_.destThread.c_str());
+        return ERROR_DEST_INVALID;
+    }
+    files_.clear();
+    GetAllFiles(config_.fileList, files_);
+    nextSubmit_ = 0;
+    nextDeliver_ = 0;
+    {
+        lock_guard<mutex> guard(statsLock_);
+        bool ioUring = stats_.ioUring;
+        stats_ = FileLoaderStats();
+        stats_.ioUring = ioUring;
+    }
+    startTime_ = chrono::steady_clock::now();
+    running_ = true;
+    return OK;
+}
+
+void FileLoader::Tick()
+{
+    if (!running_) {
+        return;
+    }
+    bool progress = ReapReads(false);
+    progress = DeliverReady() || progress;
+    progress = SubmitReads() || progress;
+    if (nextDeliver_ == files_.size()) {
+        SendFinished();
+        if (!running_) {
+            return;
+        }
+        progress = false;
+    }
+    if (!progress) {
+        // block on the disk only when the next file to send is still read
+        if (!reading_.empty() && ready_.count(nextDeliver_) == 0) {
+            ReapReads(true);
+        } else {
+            usleep(kRetryWaitUs);
+        }
+    }
+    UpdateStats();
+    Error ret = ScheduleTick(MSG_FILE_LOADER_TICK);
+    if (ret != OK) {
+        LOG_ERROR("File loader %s stops for tick failed, error %d", SelfInstanceName().c_str(), ret);
+        running_ = false;
+    }
+}
+
+bool FileLoader::ReapReads(bool wait)
+{
+    vector<IoCompletion> done;
+    backend_->Reap(done, wait);
+    for (const IoCompletion& completion : done) {
+        uint32_t index = static_cast<uint32_t>(completion.userData);
+        auto it = reading_.find(index);
+        if (it == reading_.end()) {
+            continue;
+        }
+        ReadJob& job = it->second;
+        if (completion.result < 0) {
+            LOG_ERROR("Read %s failed, errno %d", files_[index].c_str(), -completion.result);
+            FinishJob(index, ERROR_ACCESS_FILE);
+            continue;
+        }
+        if (completion.result == 0) {
+            LOG_ERROR("Read %s failed, file shrank to %u bytes", files_[index].c_str(), job.done);
+            FinishJob(index, ERROR_INVALID_FILE);
+            continue;
+        }
+        job.done += completion.result;
+        if (job.done >= job.size) {
+            FinishJob(index, OK);
+            continue;
+        }
+        // a short read, ask for the rest
+        ReadRequest rest = { index, job.fd, job.data.get() + job.done, job.size - job.done, job.done };
+        if (!backend_->Read(rest)) {
+            FinishJob(index, ERROR_ACCESS_FILE);
+        }
+    }
+    return !done.empty();
+}
+
+bool FileLoader::SubmitReads()
+{
+    bool progress = false;
+    while (nextSubmit_ < files_.size() && reading_.size() < config_.inFlight) {
+        if (alive_->load() >= config_.window) {
+            lock_guard<mutex> guard(statsLock_);
+            stats_.windowFullWaits++;
+            break;
+        }
+        uint32_t index = nextSubmit_;
+        const string& path = files_[index];
+        ReadJob job;
+        job.fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        struct stat sBuf;
+        if (job.fd < 0 || fstat(job.fd, &sBuf) != 0 || (uint64_t)sBuf.st_size > UINT32_MAX) {
+            LOG_ERROR("Open %s failed or it is over 4GB", path.c_str());
+            if (job.fd >= 0) {
+                close(job.fd);
+            }
+            reading_[index] = ReadJob();
+            FinishJob(index, ERROR_OPEN_FILE);
+            nextSubmit_++;
+            progress = true;
+            continue;
+        }
+        job.size = static_cast<uint32_t>(sBuf.st_size);
+        if (job.size > 0) {
+            shared_ptr<uint8_t> buffer = FramePool::GetInstance().Alloc(job.size);
+            if (buffer == nullptr) {
+                close(job.fd);
+                break;
+            }
+            // the window counts buffers until the receiver drops them
+            shared_ptr<atomic<uint32_t>> alive = alive_;
+            alive->fetch_add(1);
+            job.data = shared_ptr<uint8_t>(buffer.get(), [buffer, alive](uint8_t*) { alive->fetch_sub(1); });
+            ReadRequest request = { index, job.fd, job.data.get(), job.size, 0 };
+            if (!backend_->Read(request)) {
+                close(job.fd);
+                break;
+            }
+        }
+        reading_[index] = job;
+        nextSubmit_++;
+        progress = true;
+        if (job.size == 0) {
+            FinishJob(index, OK);
+        }
+        lock_guard<mutex> guard(statsLock_);
+        if (reading_.size() > stats_.maxInFlight) {
+            stats_.maxInFlight = reading_.size();
+        }
+    }
+    return progress;
+}
+
+void FileLoader::FinishJob(uint32_t index, Error result)
+{
+    auto it = reading_.find(index);
+    if (it == reading_.end()) {
+        return;
+    }
+    ReadJob& job = it->second;
+    if (job.fd >= 0) {
+        close(job.fd);
+    }
+    shared_ptr<LoadedFile> file = make_shared<LoadedFile>();
+    file->index = index;
+    file->path = files_[index];
+    file->result = result;
+    if (result == OK) {
+        file->size = job.size;
+        file->data = job.data;
+    }
+    ready_[index] = file;
+    reading_.erase(it);
+
+    lock_guard<mutex> guard(statsLock_);
+    stats_.files++;
+    if (result == OK) {
+        stats_.bytes += file->size;
+    } else {
+        stats_.failed++;
+    }
+}
+
+bool FileLoader::DeliverReady()
+{
+    bool progress = false;
+    while (!ready_.empty() && ready_.begin()->first == nextDeliver_) {
+        Error ret = SendMessage(destId_, config_.destMsgId, ready_.begin()->second);
+        if (ret == ERROR_ENQUEUE) {
+            lock_guard<mutex> guard(statsLock_);
+            stats_.queueFullRetries++;
+            break;
+        }
+        if (ret != OK) {
+            LOG_ERROR("File loader %s drops %s, send error %d", SelfInstanceName().c_str(),
+                      ready_.begin()->second->path.c_str(), ret);
+        }
+        ready_.erase(ready_.begin());
+        nextDeliver_++;
+        progress = true;
+    }
+    return progress;
+}
+
+void FileLoader::SendFinished()
+{
+    shared_ptr<LoadedFile> finished = make_shared<LoadedFile>();
+    finished->isFinished = true;
+    finished->index = files_.size();
+    Error ret = SendMessage(destId_, config_.destMsgId, finished);
+    if (ret == ERROR_ENQUEUE) {
+        lock_guard<mutex> guard(statsLock_);
+        stats_.queueFullRetries++;
+        return;
+    }
+    running_ = false;
+    UpdateStats();
+    FileLoaderStats stats = GetStats();
+    LOG_INFO("File loader %s done: %u files, %u failed, %.1f MB in %.3f s, %.1f MB/s",
+             SelfInstanceName().c_str(), stats.files, stats.failed, stats.bytes / kBytesPerMegaByte,
+             stats.seconds, stats.megaBytesPerSecond);
+}
+
+void FileLoader::UpdateStats()
+{
+    chrono::duration<double> elapsed = chrono::steady_clock::now() - startTime_;
+    lock_guard<mutex> guard(statsLock_);
+    stats_.seconds = elapsed.count();
+    if (stats_.seconds > 0) {
+        stats_.megaBytesPerSecond = stats_.bytes / kBytesPerMegaByte / stats_.seconds;
+    }
+}
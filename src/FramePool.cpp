@@ -0,0 +1,339 @@
+/**
+* Copyright (c) Huawei Technologies Co., Ltd. 2020-2022. All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+
+* http://www.apache.org/licenses/LICENSE-2.0
+
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+
+* File FramePool.cpp
+* Description: aligned frame buffer pool for ImageData and FrameData
+*/
+#include <map>
+#include <mutex>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include "FramePool.h"
+#include "Utils.h"
+
+using namespace std;
+
+namespace {
+const size_t kPageSize = 4096;
+const size_t kHugePageSize = 2 * 1024 * 1024;
+// eight size classes per power of two keep the waste under 12.5%
+const size_t kClassesPerPow2 = 8;
+
+struct PoolBuffer {
+    uint8_t* ptr;
+    bool mapped;
+    bool huge;
+};
+}
+
+struct FramePool::Impl {
+    struct SizeClass {
+        vector<PoolBuffer> idle;
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint32_t inUse = 0;
+    };
+
+    explicit Impl(const FramePoolConfig& cfg) : config(cfg) {}
+    ~Impl()
+    {
+        for (auto& item : classes) {
+            for (size_t i = 0; i < item.second.idle.size(); i++) {
+                FreeBuffer(item.second.idle[i], item.first);
+            }
+        }
+    }
+
+    bool NewBuffer(size_t classSize, PoolBuffer& buffer);
+    void FreeBuffer(const PoolBuffer& buffer, size_t classSize);
+    void Release(const PoolBuffer& buffer, size_t classSize);
+
+    FramePoolConfig config;
+    mutex lock;
+    map<size_t, SizeClass> classes;
+    uint64_t idleBytes = 0;
+    uint64_t inUseBytes = 0;
+    uint64_t hugePageBuffers = 0;
+};
+
+namespace {
+// shared_ptr deleter, hands the buffer back to the pool it came from
+struct PoolReturn {
+    shared_ptr<FramePool::Impl> impl;
+    PoolBuffer buffer;
+    size_t classSize;
+
+    void operator()(uint8_t*)
+    {
+        impl->Release(buffer, classSize);
+    }
+};
+
+void Prefault(uint8_t* ptr, size_t size)
+{
+    for (size_t off = 0; off < size; off += kPageSize) {
+        ptr[off] = 0;
+    }
+}
+}
+
+bool FramePool::Impl::NewBuffer(size_t classSize, PoolBuffer& buffer)
+{
+    buffer.ptr = nullptr;
+    buffer.mapped = false;
+    buffer.huge = false;
+    if (config.useHugePages && classSize >= kHugePageSize) {
+        size_t mapSize = ALIGN_UP(classSize, kHugePageSize);
+        int flags = MAP_PRIVATE | MAP_ANONYMOUS | (config.prefault ? MAP_POPULATE : 0);
+        void* addr = mmap(nullptr, mapSize, PROT_READ | PROT_WRITE, flags | MAP_HUGETLB, -1, 0);
+        if (addr != MAP_FAILED) {
+            buffer.huge = true;
+        } else {
+            // no reserved huge pages, ask for transparent huge pages instead
+            addr = mmap(nullptr, mapSize, PROT_READ | PROT_WRITE, flags, -1, 0);
+            if (addr == MAP_FAILED) {
+                LOG_ERROR("Frame pool map %zu bytes failed", mapSize);
+                return false;
+            }
+            madvise(addr, mapSize, MADV_HUGEPAGE);
+        }
+        buffer.ptr = static_cast<uint8_t*>(addr);
+        buffer.mapped = true;
+        return true;
+    }
+
+    void* addr = nullptr;
+    if (posix_memalign(&addr, config.addrAlign, classSize) != 0) {
+        LOG_ERROR("Frame pool malloc %zu bytes failed", classSize);
+        return false;
+    }
+    buffer.ptr = static_cast<uint8_t*>(addr);
+    if (config.prefault) {
+        Prefault(buffer.ptr, classSize);
+    }
+    return true;
+}
+
+void FramePool::Impl::FreeBuffer(const PoolBuffer& buffer, size_t classSize)
+{
+    if (buffer.mapped) {
+        munmap(buffer.ptr, ALIGN_UP(classSize, kHugePageSize));
+    } else {
+        free(buffer.ptr);
+    }
+}
+
+void FramePool::Impl::Release(const PoolBuffer& buffer, size_t classSize)
+{
+    {
+        lock_guard<mutex> guard(lock);
+        SizeClass& sizeClass = classes[classSize];
+        sizeClass.inUse--;
+        inUseBytes -= classSize;
+        if (buffer.huge) {
+            hugePageBuffers--;
+        }
+        if (idleBytes + classSize <= config.maxIdleBytes) {
+            sizeClass.idle.push_back(buffer);
+            idleBytes += classSize;
+            if (buffer.huge) {
+                hugePageBuffers++;
+            }
+            return;
+        }
+    }
+    FreeBuffer(buffer, classSize);
+}
+
+FramePool::FramePool(const FramePoolConfig& config)
+    : impl_(make_shared<Impl>(config))
+{
+}
+
+FramePool::~FramePool()
+{
+    Trim();
+}
+
+size_t FramePool::ClassSize(size_t size)
+{
+    if (size <= kPageSize) {
+        return kPageSize;
+    }
+    size_t highBit = static_cast<size_t>(1) << (63 - __builtin_clzll(size - 1));
+    size_t step = highBit / kClassesPerPow2;
+    if (step < kPageSize) {
+        step = kPageSize;
+    }
+    return ALIGN_UP(size, step);
+}
+
+shared_ptr<uint8_t> FramePool::Alloc(size_t size)
+{
+    size_t classSize = ClassSize(size);
+    PoolBuffer buffer;
+    bool hit = false;
+    {
+        lock_guard<mutex> guard(impl_->lock);
+        Impl::SizeClass& sizeClass = impl_->classes[classSize];
+        if (!sizeClass.idle.empty()) {
+            buffer = sizeClass.idle.back();
+            sizeClass.idle.pop_back();
+            impl_->idleBytes -= classSize;
+            if (buffer.huge) {
+                impl_->hugePageBuffers--;
+            }
+            sizeClass.hits++;
+            hit = true;
+        } else {
+            sizeClass.misses++;
+        }
+    }
+
+    // create the buffer out of the lock, page faults of big maps are slow
+    if (!hit && !impl_->NewBuffer(classSize, buffer)) {
+        return nullptr;
+    }
+
+    {
+        lock_guard<mutex> guard(impl_->lock);
+        impl_->classes[classSize].inUse++;
+        impl_->inUseBytes += classSize;
+        if (buffer.huge) {
+            impl_->hugePageBuffers++;
+        }
+    }
+
+    PoolReturn deleter;
+    deleter.impl = impl_;
+    deleter.buffer = buffer;
+    deleter.classSize = classSize;
+    return shared_ptr<uint8_t>(buffer.ptr, deleter);
+}
+
+Error FramePool::AllocImage(ImageData& image, uint32_t width, uint32_t height,
+                            acldvppPixelFormat format, StrideAlign align)
+{
+    if (width == 0 || height == 0) {
+        LOG_ERROR("Alloc image failed for invalid size %ux%u", width, height);
+        return ERROR_INVALID_ARGS;
+    }
+    uint32_t alignWidth = 0;
+    uint32_t alignHeight = 0;
+    GetAlignedStride(width, height, align, alignWidth, alignHeight);
+    uint32_t size = GetImageBufferSize(format, alignWidth, alignHeight);
+    if (size == 0) {
+        LOG_ERROR("Alloc image failed for unsupported format %d", format);
+        return ERROR_INVALID_ARGS;
+    }
+
+    shared_ptr<uint8_t> data = Alloc(size);
+    if (data == nullptr) {
+        return ERROR_MALLOC;
+    }
+    image.format = format;
+    image.width = width;
+    image.height = height;
+    image.alignWidth = alignWidth;
+    image.alignHeight = alignHeight;
+    image.size = size;
+    image.data = data;
+    return OK;
+}
+
+shared_ptr<uint8_t> FramePool::AllocFrame(FrameData& frame, uint32_t size)
+{
+    shared_ptr<uint8_t> data = Alloc(size);
+    if (data == nullptr) {
+        return nullptr;
+    }
+    frame.size = size;
+    frame.data = data.get();
+    return data;
+}
+
+void FramePool::Trim()
+{
+    vector<pair<PoolBuffer, size_t>> freeList;
+    {
+        lock_guard<mutex> guard(impl_->lock);
+        for (auto& item : impl_->classes) {
+            for (size_t i = 0; i < item.second.idle.size(); i++) {
+                freeList.push_back(make_pair(item.second.idle[i], item.first));
+                if (item.second.idle[i].huge) {
+                    impl_->hugePageBuffers--;
+                }
+            }
+            item.second.idle.clear();
+        }
+        impl_->idleBytes = 0;
+    }
+    for (size_t i = 0; i < freeList.size(); i++) {
+        impl_->FreeBuffer(freeList[i].first, freeList[i].second);
+    }
+}
+
+void FramePool::GetStats(FramePoolStats& stats)
+{
+    stats = FramePoolStats();
+    lock_guard<mutex> guard(impl_->lock);
+    for (auto& item : impl_->classes) {
+        FramePoolClassStats classStats;
+        classStats.classSize = item.first;
+        classStats.hits = item.second.hits;
+        classStats.misses = item.second.misses;
+        classStats.idle = item.second.idle.size();
+        classStats.inUse = item.second.inUse;
+        stats.hits += classStats.hits;
+        stats.misses += classStats.misses;
+        stats.classes.push_back(classStats);
+    }
+    stats.idleBytes = impl_->idleBytes;
+    stats.inUseBytes = impl_->inUseBytes;
+    stats.hugePageBuffers = impl_->hugePageBuffers;
+}
+
+void GetAlignedStride(uint32_t width, uint32_t height, StrideAlign align,
+                      uint32_t& alignWidth, uint32_t& alignHeight)
+{
+    switch (align) {
+        case STRIDE_ALIGN_VPC:
+            alignWidth = ALIGN_UP16(width);
+            alignHeight = ALIGN_UP2(height);
+            break;
+        case STRIDE_ALIGN_JPEGD:
+            alignWidth = ALIGN_UP128(width);
+            alignHeight = ALIGN_UP16(height);
+            break;
+        default:
+            alignWidth = width;
+            alignHeight = height;
+            break;
+    }
+}
+
+uint32_t GetImageBufferSize(acldvppPixelFormat format,
+                            uint32_t alignWidth, uint32_t alignHeight)
+{
+    switch (format) {
+        case PIXEL_FORMAT_YUV_SEMIPLANAR_420:
+            return YUV420SP_SIZE(alignWidth, alignHeight);
+        case PIXEL_FORMAT_RGB_888:
+        case PIXEL_FORMAT_BGR_888:
+            return RGBU8_IMAGE_SIZE(alignWidth, alignHeight);
+        default:
+            return 0;
+    }
+}
@@ -0,0 +1,111 @@
+/**
+* Copyright (c) Huawei Technologies Co., Ltd. 2020-2022. All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+
+* http://www.apache.org/licenses/LICENSE-2.0
+
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+
+* File ImagePlanes.cpp
+* Description: zero copy views and compact copies of ImageData
+*/
+#include <cstring>
+#include "ImagePlanes.h"
+#include "Utils.h"
+
+namespace {
+inline bool IsNv12(const ImageData& image)
+{
+    return image.format == PIXEL_FORMAT_YUV_SEMIPLANAR_420;
+}
+}
+
+bool MakeImageView(const ImageData& image, const Rect& rect, ImageData& view)
+{
+    ImagePlanes planes;
+    if (!GetImagePlanes(image, planes) || rect.ltX >= image.width || rect.ltY >= image.height ||
+        rect.rbX < rect.ltX || rect.rbY < rect.ltY) {
+        return false;
+    }
+    uint32_t x = rect.ltX;
+    uint32_t y = rect.ltY;
+    uint32_t right = ((rect.rbX < image.width) ? rect.rbX : image.width - 1) + 1;
+    uint32_t bottom = ((rect.rbY < image.height) ? rect.rbY : image.height - 1) + 1;
+    uint32_t pixelBytes = 3;
+    if (IsNv12(image)) {
+        // whole chroma samples
+        x &= ~1u;
+        y &= ~1u;
+        right = (ALIGN_UP2(right) < image.width) ? ALIGN_UP2(right) : image.width;
+        bottom = (ALIGN_UP2(bottom) < image.height) ? ALIGN_UP2(bottom) : image.height;
+        pixelBytes = 1;
+    }
+    view = image;
+    // the strides stay those of the whole buffer
+    view.alignWidth = (image.alignWidth != 0) ? image.alignWidth : image.width;
+    view.alignHeight = (image.alignHeight != 0) ? image.alignHeight : image.height;
+    view.width = right - x;
+    view.height = bottom - y;
+    view.offset = image.offset + y * planes.stride[0] + x * pixelBytes;
+    view.isView = true;
+    return true;
+}
+
+bool IsImageView(const ImageData& image)
+{
+    return image.isView;
+}
+
+bool GetCompactGeometry(const ImageData& image, ImageData& compact)
+{
+    ImagePlanes planes;
+    if (!GetImagePlanes(image, planes)) {
+        return false;
+    }
+    compact = image;
+    compact.data = nullptr;
+    compact.offset = 0;
+    compact.isView = false;
+    compact.alignWidth = (image.alignWidth != 0) ? image.alignWidth : image.width;
+    if (IsNv12(image)) {
+        compact.alignHeight = ALIGN_UP2(image.height);
+        compact.size = YUV420SP_SIZE(compact.alignWidth, compact.alignHeight);
+    } else {
+        compact.alignHeight = image.height;
+        compact.size = planes.stride[0] * image.height;
+    }
+    return true;
+}
+
+bool CopyImage(const ImageData& src, const ImageData& dst)
+{
+    ImagePlanes in;
+    ImagePlanes out;
+    if (src.format != dst.format || src.width != dst.width || src.height != dst.height ||
+        !GetImagePlanes(src, in) || !GetImagePlanes(dst, out)) {
+        return false;
+    }
+    if (IsNv12(src)) {
+        for (uint32_t row = 0; row < src.height; row++) {
+            memcpy(out.plane[0] + (size_t)row * out.stride[0], in.plane[0] + (size_t)row * in.stride[0], src.width);
+        }
+        // a chroma row covers the odd last column too
+        uint32_t uvBytes = ALIGN_UP2(src.width);
+        for (uint32_t row = 0; row < (src.height + 1) / 2; row++) {
+            memcpy(out.plane[1] + (size_t)row * out.stride[1], in.plane[1] + (size_t)row * in.stride[1], uvBytes);
+        }
+    } else {
+        for (uint32_t row = 0; row < src.height; row++) {
+            memcpy(out.plane[0] + (size_t)row * out.stride[0], in.plane[0] + (size_t)row * in.stride[0],
+                   (size_t)src.width * 3);
+        }
+    }
+    return true;
+}
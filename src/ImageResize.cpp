@@ -0,0 +1,685 @@
+/**
+* Copyright (c) Huawei Technologies Co., Ltd. 2020-2022. All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+
+* http://www.apache.org/licenses/LICENSE-2.0
+
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+
+* File ImageResize.cpp
+* Description: crop, resize and letterbox of NV12 and RGB ImageData
+*/
+#include <cstring>
+#include <map>
+#include "FramePool.h"
+#include "ImagePlanes.h"
+#include "ImageResize.h"
+#include "ParallelFor.h"
+#include "Simd.h"
+#include "Utils.h"
+
+using namespace std;
+
+namespace {
+// rows of one parallel task are at least this many pixels
+const uint32_t kMinPixelsPerTask = 64 * 1024;
+// bilinear weights are 7 bit so that a horizontal sum fits 16 bit lanes
+const int kWeightBits = 7;
+const int kWeightOne = 1 << kWeightBits;
+// the vertical weight is shifted to Q15 for the rounding high multiply
+const int kWeightToQ15 = 15 - kWeightBits;
+
+// sampling positions of one axis. Offsets are in elements, pixel index
+// times channels for the x axis and row index for the y axis
+struct AxisMap {
+    vector<uint32_t> offset0;
+    vector<uint32_t> offset1;
+    vector<int16_t> weight;   // weight of offset1 in 1/128
+};
+
+struct PlaneRef {
+    uint8_t* data;
+    uint32_t stride;
+    uint32_t width;
+    uint32_t height;
+    uint32_t channels;
+};
+
+struct CropArea {
+    uint32_t x;
+    uint32_t y;
+    uint32_t width;
+    uint32_t height;
+};
+
+void BuildAxisMap(uint32_t srcLen, uint32_t dstLen, uint32_t channels,
+                  ResizeInterp interp, AxisMap& map)
+{
+    map.offset0.resize(dstLen);
+    map.offset1.resize(dstLen);
+    map.weight.resize(dstLen);
+    double scale = static_cast<double>(srcLen) / dstLen;
+    for (uint32_t d = 0; d < dstLen; d++) {
+        // pixel centres line up: src = (dst + 0.5) * scale - 0.5
+        uint32_t s0;
+        int weight = 0;
+        if (interp == RESIZE_NEAREST) {
+            s0 = static_cast<uint32_t>((d + 0.5) * scale);
+        } else {
+            double pos = (d + 0.5) * scale - 0.5;
+            pos = (pos < 0) ? 0 : pos;
+            s0 = static_cast<uint32_t>(pos);
+            weight = static_cast<int>((pos - s0) * kWeightOne + 0.5);
+            if (weight >= kWeightOne) {
+                s0++;
+                weight = 0;
+            }
+        }
+        if (s0 >= srcLen - 1) {
+            s0 = srcLen - 1;
+            weight = 0;
+        }
+        uint32_t s1 = (weight == 0) ? s0 : s0 + 1;
+        map.offset0[d] = s0 * channels;
+        map.offset1[d] = s1 * channels;
+        map.weight[d] = static_cast<int16_t>(weight);
+    }
+}
+
+void NearestRowC(const uint8_t* src, uint8_t* dst, const AxisMap& xMap,
+                 uint32_t begin, uint32_t dstWidth, uint32_t channels)
+{
+    const uint32_t* offset = xMap.offset0.data();
+    switch (channels) {
+        case 1:
+            for (uint32_t x = begin; x < dstWidth; x++) {
+                dst[x] = src[offset[x]];
+            }
+            break;
+        case 2:
+            for (uint32_t x = begin; x < dstWidth; x++) {
+                dst[x * 2] = src[offset[x]];
+                dst[x * 2 + 1] = src[offset[x] + 1];
+            }
+            break;
+        default:
+            for (uint32_t x = begin; x < dstWidth; x++) {
+                dst[x * 3] = src[offset[x]];
+                dst[x * 3 + 1] = src[offset[x] + 1];
+                dst[x * 3 + 2] = src[offset[x] + 2];
+            }
+            break;
+    }
+}
+
+template<uint32_t CH>
+void HorizontalRow(const uint8_t* src, uint16_t* dst, const AxisMap& xMap, uint32_t dstWidth)
+{
+    const uint32_t* offset0 = xMap.offset0.data();
+    const uint32_t* offset1 = xMap.offset1.data();
+    const int16_t* weight = xMap.weight.data();
+    for (uint32_t x = 0; x < dstWidth; x++) {
+        const uint8_t* p0 = src + offset0[x];
+        const uint8_t* p1 = src + offset1[x];
+        int w1 = weight[x];
+        int w0 = kWeightOne - w1;
+        for (uint32_t c = 0; c < CH; c++) {
+            dst[x * CH + c] = static_cast<uint16_t>(p0[c] * w0 + p1[c] * w1);
+        }
+    }
+}
+
+void HorizontalRowC(const uint8_t* src, uint16_t* dst, const AxisMap& xMap,
+                    uint32_t dstWidth, uint32_t channels)
+{
+    switch (channels) {
+        case 1:
+            HorizontalRow<1>(src, dst, xMap, dstWidth);
+            break;
+        case 2:
+            HorizontalRow<2>(src, dst, xMap, dstWidth);
+            break;
+        default:
+            HorizontalRow<3>(src, dst, xMap, dstWidth);
+            break;
+    }
+}
+
+// out = (h0 + round_q15((h1 - h0) * fy) + 64) >> 7, the form mulhrs computes
+void VerticalBlendC(const uint16_t* h0, const uint16_t* h1, int fy, uint8_t* dst,
+                    uint32_t begin, uint32_t count)
+{
+    int fyQ15 = fy << kWeightToQ15;
+    for (uint32_t i = begin; i < count; i++) {
+        int diff = static_cast<int>(h1[i]) - static_cast<int>(h0[i]);
+        int delta = (diff * fyQ15 + (1 << 14)) >> 15;
+        dst[i] = static_cast<uint8_t>((h0[i] + delta + (kWeightOne >> 1)) >> kWeightBits);
+    }
+}
+
+#if SIMD_X86
+SIMD_TARGET("sse4.1")
+inline __m128i VerticalBlend8Sse41(const uint16_t* h0, const uint16_t* h1, __m128i fy)
+{
+    __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(h0));
+    __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(h1));
+    __m128i sum = _mm_add_epi16(a, _mm_mulhrs_epi16(_mm_sub_epi16(b, a), fy));
+    return _mm_srli_epi16(_mm_add_epi16(sum, _mm_set1_epi16(kWeightOne >> 1)), kWeightBits);
+}
+
+SIMD_TARGET("sse4.1")
+void VerticalBlendSse41(const uint16_t* h0, const uint16_t* h1, int fy, uint8_t* dst, uint32_t count)
+{
+    const __m128i fyQ15 = _mm_set1_epi16(static_cast<int16_t>(fy << kWeightToQ15));
+    uint32_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m128i lo = VerticalBlend8Sse41(h0 + i, h1 + i, fyQ15);
+        __m128i hi = VerticalBlend8Sse41(h0 + i + 8, h1 + i + 8, fyQ15);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_packus_epi16(lo, hi));
+    }
+    VerticalBlendC(h0, h1, fy, dst, i, count);
+}
+
+SIMD_TARGET("avx2")
+inline __m256i VerticalBlend16Avx2(const uint16_t* h0, const uint16_t* h1, __m256i fy)
+{
+    __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(h0));
+    __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(h1));
+    __m256i sum = _mm256_add_epi16(a, _mm256_mulhrs_epi16(_mm256_sub_epi16(b, a), fy));
+    return _mm256_srli_epi16(_mm256_add_epi16(sum, _mm256_set1_epi16(kWeightOne >> 1)), kWeightBits);
+}
+
+SIMD_TARGET("avx2")
+void VerticalBlendAvx2(const uint16_t* h0, const uint16_t* h1, int fy, uint8_t* dst, uint32_t count)
+{
+    const __m256i fyQ15 = _mm256_set1_epi16(static_cast<int16_t>(fy << kWeightToQ15));
+    uint32_t i = 0;
+    for (; i + 32 <= count; i += 32) {
+        __m256i lo = VerticalBlend16Avx2(h0 + i, h1 + i, fyQ15);
+        __m256i hi = VerticalBlend16Avx2(h0 + i + 16, h1 + i + 16, fyQ15);
+        // packus works in lane, put the 64 bit quarters back in order
+        __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(lo, hi), 0xD8);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), packed);
+    }
+    if (i + 16 <= count) {
+        VerticalBlendSse41(h0 + i, h1 + i, fy, dst + i, count - i);
+        return;
+    }
+    VerticalBlendC(h0, h1, fy, dst, i, count);
+}
+
+// gathers 4 bytes per pixel, safeEnd excludes the pixels whose read would
+// run past the end of the source row
+SIMD_TARGET("avx2")
+void NearestRowAvx2(const uint8_t* src, uint8_t* dst, const AxisMap& xMap,
+                    uint32_t safeEnd, uint32_t dstWidth, uint32_t channels)
+{
+    const int* offset = reinterpret_cast<const int*>(xMap.offset0.data());
+    const int* base = reinterpret_cast<const int*>(src);
+    uint32_t x = 0;
+    if (channels == 1) {
+        const __m256i pick = _mm256_setr_epi8(0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                                              0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+        const __m256i order = _mm256_setr_epi32(0, 4, 1, 1, 1, 1, 1, 1);
+        for (; x + 8 <= safeEnd; x += 8) {
+            __m256i idx = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(offset + x));
+            __m256i pixels = _mm256_i32gather_epi32(base, idx, 1);
+            pixels = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(pixels, pick), order);
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(dst + x), _mm256_castsi256_si128(pixels));
+        }
+    } else if (channels == 2) {
+        const __m256i pick = _mm256_setr_epi8(0, 1, 4, 5, 8, 9, 12, 13, -1, -1, -1, -1, -1, -1, -1, -1,
+                                              0, 1, 4, 5, 8, 9, 12, 13, -1, -1, -1, -1, -1, -1, -1, -1);
+        for (; x + 8 <= safeEnd; x += 8) {
+            __m256i idx = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(offset + x));
+            __m256i pixels = _mm256_i32gather_epi32(base, idx, 1);
+            pixels = _mm256_permute4x64_epi64(_mm256_shuffle_epi8(pixels, pick), 0x08);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x * 2), _mm256_castsi256_si128(pixels));
+        }
+    } else {
+        const __m256i pick = _mm256_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+                                              0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+        const __m256i order = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7);
+        for (; x + 8 <= safeEnd; x += 8) {
+            __m256i idx = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(offset + x));
+            __m256i pixels = _mm256_i32gather_epi32(base, idx, 1);
+            pixels = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(pixels, pick), order);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x * 3), _mm256_castsi256_si128(pixels));
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(dst + x * 3 + 16), _mm256_extracti128_si256(pixels, 1));
+        }
+    }
+    NearestRowC(src, dst, xMap, x, dstWidth, channels);
+}
+#endif
+
+void VerticalBlend(const uint16_t* h0, const uint16_t* h1, int fy, uint8_t* dst, uint32_t count)
+{
+#if SIMD_X86
+    SimdLevel level = GetSimdLevel();
+    if (level >= SIMD_AVX2) {
+        VerticalBlendAvx2(h0, h1, fy, dst, count);
+        return;
+    }
+    if (level >= SIMD_SSE41) {
+        VerticalBlendSse41(h0, h1, fy, dst, count);
+        return;
+    }
+#endif
+    VerticalBlendC(h0, h1, fy, dst, 0, count);
+}
+
+// leading output pixels whose 4 byte gather stays inside the source row
+uint32_t GatherSafeEnd(const AxisMap& xMap, uint32_t srcWidth, uint32_t channels)
+{
+    uint32_t rowBytes = srcWidth * channels;
+    uint32_t end = xMap.offset0.size();
+    while (end > 0 && xMap.offset0[end - 1] + 4 > rowBytes) {
+        end--;
+    }
+    return end;
+}
+
+void NearestRows(const PlaneRef& src, const PlaneRef& dst, const AxisMap& xMap,
+                 const AxisMap& yMap, uint32_t rowBegin, uint32_t rowEnd)
+{
+    uint32_t rowBytes = dst.width * dst.channels;
+#if SIMD_X86
+    bool useGather = (GetSimdLevel() >= SIMD_AVX2);
+    uint32_t safeEnd = useGather ? GatherSafeEnd(xMap, src.width, src.channels) : 0;
+#endif
+    for (uint32_t y = rowBegin; y < rowEnd; y++) {
+        uint8_t* out = dst.data + y * dst.stride;
+        // upscaled rows repeat the source row, copy the previous output
+        if (y > rowBegin && yMap.offset0[y] == yMap.offset0[y - 1]) {
+            memcpy(out, out - dst.stride, rowBytes);
+            continue;
+        }
+        const uint8_t* in = src.data + yMap.offset0[y] * src.stride;
+#if SIMD_X86
+        if (useGather) {
+            NearestRowAvx2(in, out, xMap, safeEnd, dst.width, dst.channels);
+            continue;
+        }
+#endif
+        NearestRowC(in, out, xMap, 0, dst.width, dst.channels);
+    }
+}
+
+void BilinearRows(const PlaneRef& src, const PlaneRef& dst, const AxisMap& xMap,
+                  const AxisMap& yMap, uint32_t rowBegin, uint32_t rowEnd)
+{
+    uint32_t count = dst.width * dst.channels;
+    // horizontal results of the two source rows last used
+    vector<uint16_t> cache(count * 2);
+    uint16_t* slot[2] = { cache.data(), cache.data() + count };
+    uint32_t slotRow[2] = { UINT32_MAX, UINT32_MAX };
+
+    for (uint32_t y = rowBegin; y < rowEnd; y++) {
+        uint32_t rows[2] = { yMap.offset0[y], yMap.offset1[y] };
+        uint16_t* h[2] = { nullptr, nullptr };
+        for (int i = 0; i < 2; i++) {
+            for (int s = 0; s < 2; s++) {
+                if (slotRow[s] == rows[i]) {
+                    h[i] = slot[s];
+                }
+            }
+            if (h[i] != nullptr) {
+                continue;
+            }
+            // overwrite the slot the other row does not need
+            int s = (slotRow[0] == rows[1 - i]) ? 1 : 0;
+            HorizontalRowC(src.data + rows[i] * src.stride, slot[s], xMap, dst.width, dst.channels);
+            slotRow[s] = rows[i];
+            h[i] = slot[s];
+        }
+        VerticalBlend(h[0], h[1], yMap.weight[y], dst.data + y * dst.stride, count);
+    }
+}
+
+void ResizePlane(const PlaneRef& src, const PlaneRef& dst, const AxisMap& xMap,
+                 const AxisMap& yMap, ResizeInterp interp, bool parallel)
+{
+    uint32_t rowsPerTask = kMinPixelsPerTask / dst.width;
+    rowsPerTask = (rowsPerTask == 0) ? 1 : rowsPerTask;
+    if (!parallel) {
+        rowsPerTask = dst.height;
+    }
+    ParallelFor(dst.height, rowsPerTask, [&](uint32_t begin, uint32_t end) {
+        if (interp == RESIZE_NEAREST) {
+            NearestRows(src, dst, xMap, yMap, begin, end);
+        } else {
+            BilinearRows(src, dst, xMap, yMap, begin, end);
+        }
+    });
+}
+
+void ResizePlaneAuto(const PlaneRef& src, const PlaneRef& dst, ResizeInterp interp, bool parallel)
+{
+    AxisMap xMap;
+    AxisMap yMap;
+    BuildAxisMap(src.width, dst.width, src.channels, interp, xMap);
+    BuildAxisMap(src.height, dst.height, 1, interp, yMap);
+    ResizePlane(src, dst, xMap, yMap, interp, parallel);
+}
+
+void FillPlane(const PlaneRef& plane, const uint8_t* value)
+{
+    for (uint32_t y = 0; y < plane.height; y++) {
+        uint8_t* row = plane.data + y * plane.stride;
+        if (plane.channels == 1) {
+            memset(row, value[0], plane.width);
+            continue;
+        }
+        for (uint32_t x = 0; x < plane.width; x++) {
+            memcpy(row + x * plane.channels, value, plane.channels);
+        }
+    }
+}
+
+PlaneRef SubPlane(const PlaneRef& plane, uint32_t x, uint32_t y, uint32_t width, uint32_t height)
+{
+    PlaneRef sub = plane;
+    sub.data = plane.data + y * plane.stride + x * plane.channels;
+    sub.width = width;
+    sub.height = height;
+    return sub;
+}
+
+// fill plane except the content rectangle
+void FillBorder(const PlaneRef& plane, const CropArea& content, const uint8_t* value)
+{
+    uint32_t right = content.x + content.width;
+    uint32_t bottom = content.y + content.height;
+    FillPlane(SubPlane(plane, 0, 0, plane.width, content.y), value);
+    FillPlane(SubPlane(plane, 0, bottom, plane.width, plane.height - bottom), value);
+    FillPlane(SubPlane(plane, 0, content.y, content.x, content.height), value);
+    FillPlane(SubPlane(plane, right, content.y, plane.width - right, content.height), value);
+}
+
+inline bool IsNv12(const ImageData& image)
+{
+    return image.format == PIXEL_FORMAT_YUV_SEMIPLANAR_420;
+}
+
+bool ClipRoi(const ImageData& src, const Rect& roi, CropArea& area)
+{
+    if (roi.ltX >= src.width || roi.ltY >= src.height ||
+        roi.rbX < roi.ltX || roi.rbY < roi.ltY) {
+        return false;
+    }
+    uint32_t right = ((roi.rbX < src.width) ? roi.rbX : src.width - 1) + 1;
+    uint32_t bottom = ((roi.rbY < src.height) ? roi.rbY : src.height - 1) + 1;
+    area.x = roi.ltX;
+    area.y = roi.ltY;
+    if (IsNv12(src)) {
+        // whole chroma samples
+        area.x &= ~1u;
+        area.y &= ~1u;
+        right = ALIGN_UP2(right) < src.width ? ALIGN_UP2(right) : src.width;
+        bottom = ALIGN_UP2(bottom) < src.height ? ALIGN_UP2(bottom) : src.height;
+    }
+    area.width = right - area.x;
+    area.height = bottom - area.y;
+    return true;
+}
+
+// planes of image restricted to area, for NV12 the chroma plane is halved
+uint32_t GetAreaPlanes(const ImageData& image, const ImagePlanes& planes,
+                       const CropArea& area, PlaneRef out[2])
+{
+    if (!IsNv12(image)) {
+        PlaneRef rgb = { planes.plane[0], planes.stride[0], image.width, image.height, 3 };
+        out[0] = SubPlane(rgb, area.x, area.y, area.width, area.height);
+        return 1;
+    }
+    PlaneRef luma = { planes.plane[0], planes.stride[0], image.width, image.height, 1 };
+    PlaneRef chroma = { planes.plane[1], planes.stride[1], (image.width + 1) / 2, (image.height + 1) / 2, 2 };
+    out[0] = SubPlane(luma, area.x, area.y, area.width, area.height);
+    out[1] = SubPlane(chroma, area.x / 2, area.y / 2, (area.width + 1) / 2, (area.height + 1) / 2);
+    return 2;
+}
+
+Error PrepareResizeDst(const ImageData& src, ImageData& dst, ImagePlanes& planes)
+{
+    if (dst.width == 0 || dst.height == 0) {
+        LOG_ERROR("Resize failed for output size %ux%u", dst.width, dst.height);
+        return ERROR_INVALID_ARGS;
+    }
+    if (dst.data == nullptr) {
+        StrideAlign align = IsNv12(src) ? STRIDE_ALIGN_VPC : STRIDE_ALIGN_NONE;
+        Error ret = FramePool::GetInstance().AllocImage(dst, dst.width, dst.height, src.format, align);
+        if (ret != OK) {
+            return ret;
+        }
+    } else if (dst.format != src.format) {
+        LOG_ERROR("Resize failed for output format %d differs from input %d", dst.format, src.format);
+        return ERROR_INVALID_ARGS;
+    }
+    if (!GetImagePlanes(dst, planes)) {
+        LOG_ERROR("Resize failed for invalid output buffer, stride %ux%u size %u",
+                  dst.alignWidth, dst.alignHeight, dst.size);
+        return ERROR_INVALID_ARGS;
+    }
+    return OK;
+}
+
+Error CheckResizeSrc(const ImageData& src, ImagePlanes& planes)
+{
+    if (!GetImagePlanes(src, planes)) {
+        LOG_ERROR("Resize failed for invalid input image, format %d", src.format);
+        return ERROR_INVALID_ARGS;
+    }
+    return OK;
+}
+
+uint64_t AxisKey(uint32_t srcLen, uint32_t dstLen, uint32_t channels)
+{
+    return (static_cast<uint64_t>(srcLen) << 32) | (static_cast<uint64_t>(dstLen) << 2) | channels;
+}
+
+const AxisMap& GetAxisMap(map<uint64_t, AxisMap>& cache, uint32_t srcLen, uint32_t dstLen,
+                          uint32_t channels, ResizeInterp interp)
+{
+    uint64_t key = AxisKey(srcLen, dstLen, channels);
+    auto it = cache.find(key);
+    if (it != cache.end()) {
+        return it->second;
+    }
+    AxisMap& axis = cache[key];
+    BuildAxisMap(srcLen, dstLen, channels, interp, axis);
+    return axis;
+}
+}
+
+Error CropResizeImage(const ImageData& src, const Rect& roi, ImageData& dst, ResizeInterp interp)
+{
+    ImagePlanes srcPlanes;
+    ImagePlanes dstPlanes;
+    Error ret = CheckResizeSrc(src, srcPlanes);
+    if (ret != OK) {
+        return ret;
+    }
+    CropArea area;
+    if (!ClipRoi(src, roi, area)) {
+        LOG_ERROR("Crop area (%u,%u)-(%u,%u) is out of image %ux%u",
+                  roi.ltX, roi.ltY, roi.rbX, roi.rbY, src.width, src.height);
+        return ERROR_INVALID_ARGS;
+    }
+    ret = PrepareResizeDst(src, dst, dstPlanes);
+    if (ret != OK) {
+        return ret;
+    }
+
+    PlaneRef in[2];
+    PlaneRef out[2];
+    CropArea full = { 0, 0, dst.width, dst.height };
+    uint32_t planeNum = GetAreaPlanes(src, srcPlanes, area, in);
+    GetAreaPlanes(dst, dstPlanes, full, out);
+    for (uint32_t i = 0; i < planeNum; i++) {
+        ResizePlaneAuto(in[i], out[i], interp, true);
+    }
+    return OK;
+}
+
+Error ResizeImage(const ImageData& src, ImageData& dst, ResizeInterp interp)
+{
+    Rect roi;
+    roi.rbX = (src.width > 0) ? src.width - 1 : 0;
+    roi.rbY = (src.height > 0) ? src.height - 1 : 0;
+    return CropResizeImage(src, roi, dst, interp);
+}
+
+Error LetterboxImage(const ImageData& src, const Rect& roi, ImageData& dst,
+                     const uint8_t padValue[3], LetterboxInfo& info, ResizeInterp interp)
+{
+    ImagePlanes srcPlanes;
+    ImagePlanes dstPlanes;
+    Error ret = CheckResizeSrc(src, srcPlanes);
+    if (ret != OK) {
+        return ret;
+    }
+    CropArea area;
+    if (!ClipRoi(src, roi, area)) {
+        LOG_ERROR("Letterbox area (%u,%u)-(%u,%u) is out of image %ux%u",
+                  roi.ltX, roi.ltY, roi.rbX, roi.rbY, src.width, src.height);
+        return ERROR_INVALID_ARGS;
+    }
+    ret = PrepareResizeDst(src, dst, dstPlanes);
+    if (ret != OK) {
+        return ret;
+    }
+
+    float scaleX = static_cast<float>(dst.width) / area.width;
+    float scaleY = static_cast<float>(dst.height) / area.height;
+    info.scale = (scaleX < scaleY) ? scaleX : scaleY;
+    info.contentWidth = static_cast<uint32_t>(area.width * info.scale + 0.5f);
+    info.contentHeight = static_cast<uint32_t>(area.height * info.scale + 0.5f);
+    info.contentWidth = (info.contentWidth == 0) ? 1 : info.contentWidth;
+    info.contentHeight = (info.contentHeight == 0) ? 1 : info.contentHeight;
+    info.contentWidth = (info.contentWidth > dst.width) ? dst.width : info.contentWidth;
+    info.contentHeight = (info.contentHeight > dst.height) ? dst.height : info.contentHeight;
+    info.padLeft = (dst.width - info.contentWidth) / 2;
+    info.padTop = (dst.height - info.contentHeight) / 2;
+    if (IsNv12(dst)) {
+        // the content starts on a chroma sample
+        info.padLeft &= ~1u;
+        info.padTop &= ~1u;
+    }
+
+    PlaneRef in[2];
+    PlaneRef out[2];
+    CropArea full = { 0, 0, dst.width, dst.height };
+    CropArea content = { info.padLeft, info.padTop, info.contentWidth, info.contentHeight };
+    uint32_t planeNum = GetAreaPlanes(src, srcPlanes, area, in);
+    GetAreaPlanes(dst, dstPlanes, full, out);
+    for (uint32_t i = 0; i < planeNum; i++) {
+        // chroma plane works on halved coordinates
+        CropArea planeContent = content;
+        if (i == 1) {
+            planeContent.x = content.x / 2;
+            planeContent.y = content.y / 2;
+            planeContent.width = (content.width + 1) / 2;
+            planeContent.height = (content.height + 1) / 2;
+        }
+        const uint8_t* value = (planeNum == 2 && i == 1) ? padValue + 1 : padValue;
+        FillBorder(out[i], planeContent, value);
+        PlaneRef target = SubPlane(out[i], planeContent.x, planeContent.y,
+                                   planeContent.width, planeContent.height);
+        ResizePlaneAuto(in[i], target, interp, true);
+    }
+    return OK;
+}
+
+Error CropResizeBatch(const ImageData& src, const vector<BBox>& boxes, uint32_t dstSize,
+                      shared_ptr<uint8_t> buffer, uint32_t bufferSize,
+                      vector<ImageData>& outputs, ResizeInterp interp)
+{
+    outputs.clear();
+    ImagePlanes srcPlanes;
+    Error ret = CheckResizeSrc(src, srcPlanes);
+    if (ret != OK) {
+        return ret;
+    }
+    if (dstSize == 0 || (IsNv12(src) && (dstSize & 1) != 0)) {
+        LOG_ERROR("Crop resize batch failed for output size %u", dstSize);
+        return ERROR_INVALID_ARGS;
+    }
+    if (boxes.empty()) {
+        return OK;
+    }
+
+    vector<CropArea> areas(boxes.size());
+    for (size_t i = 0; i < boxes.size(); i++) {
+        if (!ClipRoi(src, boxes[i].rect, areas[i])) {
+            const Rect& rect = boxes[i].rect;
+            LOG_ERROR("Box %zu (%u,%u)-(%u,%u) is out of image %ux%u", i,
+                      rect.ltX, rect.ltY, rect.rbX, rect.rbY, src.width, src.height);
+            return ERROR_INVALID_ARGS;
+        }
+    }
+
+    uint32_t imageSize = GetImageBufferSize(src.format, dstSize, dstSize);
+    uint64_t totalSize = static_cast<uint64_t>(imageSize) * boxes.size();
+    if (buffer == nullptr) {
+        buffer = FramePool::GetInstance().Alloc(totalSize);
+        if (buffer == nullptr) {
+            return ERROR_MALLOC;
+        }
+    } else if (bufferSize < totalSize) {
+        LOG_ERROR("Crop resize batch buffer %u bytes is less than %lu bytes",
+                  bufferSize, (unsigned long)totalSize);
+        return ERROR_INVALID_ARGS;
+    }
+
+    // scale tables depend only on crop size, build each once for all boxes
+    map<uint64_t, AxisMap> axisCache;
+    vector<const AxisMap*> axes(boxes.size() * 4);
+    uint32_t outChroma = (dstSize + 1) / 2;
+    for (size_t i = 0; i < boxes.size(); i++) {
+        if (IsNv12(src)) {
+            axes[i * 4] = &GetAxisMap(axisCache, areas[i].width, dstSize, 1, interp);
+            axes[i * 4 + 1] = &GetAxisMap(axisCache, areas[i].height, dstSize, 1, interp);
+            axes[i * 4 + 2] = &GetAxisMap(axisCache, (areas[i].width + 1) / 2, outChroma, 2, interp);
+            axes[i * 4 + 3] = &GetAxisMap(axisCache, (areas[i].height + 1) / 2, outChroma, 1, interp);
+        } else {
+            axes[i * 4] = &GetAxisMap(axisCache, areas[i].width, dstSize, 3, interp);
+            axes[i * 4 + 1] = &GetAxisMap(axisCache, areas[i].height, dstSize, 1, interp);
+        }
+    }
+
+    outputs.resize(boxes.size());
+    for (size_t i = 0; i < boxes.size(); i++) {
+        ImageData& out = outputs[i];
+        out.format = src.format;
+        out.width = dstSize;
+        out.height = dstSize;
+        out.alignWidth = dstSize;
+        out.alignHeight = dstSize;
+        out.size = imageSize;
+        out.data = shared_ptr<uint8_t>(buffer, buffer.get() + i * imageSize);
+    }
+
+    // boxes are independent, spread them over the workers
+    ParallelFor(boxes.size(), 1, [&](uint32_t begin, uint32_t end) {
+        for (uint32_t i = begin; i < end; i++) {
+            ImagePlanes dstPlanes;
+            GetImagePlanes(outputs[i], dstPlanes);
+            PlaneRef in[2];
+            PlaneRef out[2];
+            CropArea full = { 0, 0, dstSize, dstSize };
+            uint32_t planeNum = GetAreaPlanes(src, srcPlanes, areas[i], in);
+            GetAreaPlanes(outputs[i], dstPlanes, full, out);
+            for (uint32_t p = 0; p < planeNum; p++) {
+                ResizePlane(in[p], out[p], *axes[i * 4 + p * 2], *axes[i * 4 + p * 2 + 1], interp, false);
+            }
+        }
+    });
+    return OK;
+}
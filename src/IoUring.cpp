@@ -0,0 +1,279 @@
+/**
+* Copyright (c) Huawei Technologies Co., Ltd. 2020-2022. All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+
+* http://www.apache.org/licenses/LICENSE-2.0
+
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+
+* File IoUring.cpp
+* Description: minimal io_uring ring on the raw system calls
+*/
+#include <cerrno>
+#include <cstring>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "IoUring.h"
+#include "Utils.h"
+
+#if defined(__linux__) && defined(__NR_io_uring_setup)
+#include <linux/io_uring.h>
+#define IO_URING_AVAILABLE 1
+#else
+#define IO_URING_AVAILABLE 0
+#endif
+
+using namespace std;
+
+IoUring::IoUring() : ringFd_(-1), entries_(0), queued_(0), sqRing_(nullptr), cqRing_(nullptr),
+    sqes_(nullptr), sqRingSize_(0), cqRingSize_(0), sqesSize_(0), sqHead_(nullptr),
+    sqTail_(nullptr), sqMask_(nullptr), sqArray_(nullptr), cqHead_(nullptr), cqTail_(nullptr),
+    cqMask_(nullptr), cqes_(nullptr)
+{
+}
+
+IoUring::~IoUring()
+{
+    Release();
+}
+
+#if IO_URING_AVAILABLE
+namespace {
+inline uint32_t* RingField(void* ring, uint32_t offset)
+{
+    return reinterpret_cast<uint32_t*>(static_cast<uint8_t*>(ring) + offset);
+}
+}
+
+Error IoUring::Init(uint32_t entries)
+{
+    if (IsReady()) {
+        return ERROR_INITED_ALREADY;
+    }
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    int fd = syscall(__NR_io_uring_setup, entries, &params);
+    if (fd < 0) {
+        LOG_INFO("io_uring is not available, errno %d", errno);
+        return ERROR;
+    }
+    // plain READ and WRITE came in 5.6, fast poll marks a 5.7 kernel
+    if ((params.features & IORING_FEAT_FAST_POLL) == 0) {
+        LOG_INFO("io_uring of this kernel is too old, features 0x%x", params.features);
+        close(fd);
+        return ERROR;
+    }
+    ringFd_ = fd;
+    entries_ = params.sq_entries;
+
+    sqRingSize_ = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+    cqRingSize_ = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    bool singleMap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (singleMap) {
+        sqRingSize_ = (cqRingSize_ > sqRingSize_) ? cqRingSize_ : sqRingSize_;
+    }
+    sqRing_ = mmap(nullptr, sqRingSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   fd, IORING_OFF_SQ_RING);
+    if (sqRing_ == MAP_FAILED) {
+        sqRing_ = nullptr;
+        Release();
+        return ERROR;
+    }
+    if (singleMap) {
+        cqRing_ = sqRing_;
+    } else {
+        cqRing_ = mmap(nullptr, cqRingSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                       fd, IORING_OFF_CQ_RING);
+        if (cqRing_ == MAP_FAILED) {
+            cqRing_ = nullptr;
+            Release();
+            return ERROR;
+        }
+    }
+    sqesSize_ = params.sq_entries * sizeof(struct io_uring_sqe);
+    sqes_ = mmap(nullptr, sqesSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                 fd, IORING_OFF_SQES);
+    if (sqes_ == MAP_FAILED) {
+        sqes_ = nullptr;
+        Release();
+        return ERROR;
+    }
+
+    sqHead_ = RingField(sqRing_, params.sq_off.head);
+    sqTail_ = RingField(sqRing_, params.sq_off.tail);
+    sqMask_ = RingField(sqRing_, params.sq_off.ring_mask);
+    sqArray_ = RingField(sqRing_, params.sq_off.array);
+    cqHead_ = RingField(cqRing_, params.cq_off.head);
+    cqTail_ = RingField(cqRing_, params.cq_off.tail);
+    cqMask_ = RingField(cqRing_, params.cq_off.ring_mask);
+    cqes_ = static_cast<uint8_t*>(cqRing_) + params.cq_off.cqes;
+    return OK;
+}
+
+void* IoUring::NextEntry(uint32_t& index)
+{
+    if (!IsReady()) {
+        return nullptr;
+    }
+    // only this thread moves the tail, the kernel moves the head
+    uint32_t tail = *sqTail_;
+    uint32_t head = __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE);
+    if (tail - head >= entries_) {
+        return nullptr;
+    }
+    index = tail & *sqMask_;
+    struct io_uring_sqe* sqe = static_cast<struct io_uring_sqe*>(sqes_) + index;
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+void IoUring::QueueEntry(uint32_t index)
+{
+    sqArray_[index] = index;
+    __atomic_store_n(sqTail_, *sqTail_ + 1, __ATOMIC_RELEASE);
+    queued_++;
+}
+
+bool IoUring::PrepRead(int fd, void* buf, uint32_t len, uint64_t offset, uint64_t userData)
+{
+    uint32_t index = 0;
+    struct io_uring_sqe* sqe = static_cast<struct io_uring_sqe*>(NextEntry(index));
+    if (sqe == nullptr) {
+        return false;
+    }
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->off = offset;
+    sqe->addr = reinterpret_cast<uint64_t>(buf);
+    sqe->len = len;
+    sqe->user_data = userData;
+    QueueEntry(index);
+    return true;
+}
+
+bool IoUring::PrepWritev(int fd, const struct iovec* iov, uint32_t iovCnt, uint64_t offset, uint64_t userData)
+{
+    uint32_t index = 0;
+    struct io_uring_sqe* sqe = static_cast<struct io_uring_sqe*>(NextEntry(index));
+    if (sqe == nullptr) {
+        return false;
+    }
+    sqe->opcode = IORING_OP_WRITEV;
+    sqe->fd = fd;
+    sqe->off = offset;
+    sqe->addr = reinterpret_cast<uint64_t>(iov);
+    sqe->len = iovCnt;
+    sqe->user_data = userData;
+    QueueEntry(index);
+    return true;
+}
+
+bool IoUring::PrepFsync(int fd, bool dataOnly, uint64_t userData)
+{
+    uint32_t index = 0;
+    struct io_uring_sqe* sqe = static_cast<struct io_uring_sqe*>(NextEntry(index));
+    if (sqe == nullptr) {
+        return false;
+    }
+    sqe->opcode = IORING_OP_FSYNC;
+    sqe->fd = fd;
+    sqe->fsync_flags = dataOnly ? IORING_FSYNC_DATASYNC : 0;
+    sqe->user_data = userData;
+    QueueEntry(index);
+    return true;
+}
+
+int IoUring::Submit(uint32_t waitNum)
+{
+    if (!IsReady()) {
+        return -EBADF;
+    }
+    uint32_t flags = (waitNum > 0) ? IORING_ENTER_GETEVENTS : 0;
+    while (true) {
+        int ret = syscall(__NR_io_uring_enter, ringFd_, queued_, waitNum, flags, nullptr, 0);
+        if (ret >= 0) {
+            queued_ -= ((uint32_t)ret < queued_) ? ret : queued_;
+            return ret;
+        }
+        if (errno != EINTR) {
+            return -errno;
+        }
+    }
+}
+
+bool IoUring::PeekCompletion(IoCompletion& completion)
+{
+    if (!IsReady()) {
+        return false;
+    }
+    uint32_t head = *cqHead_;
+    uint32_t tail = __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE);
+    if (head == tail) {
+        return false;
+    }
+    const struct io_uring_cqe* cqe = static_cast<const struct io_uring_cqe*>(cqes_) + (head & *cqMask_);
+    completion.userData = cqe->user_data;
+    completion.result = cqe->res;
+    __atomic_store_n(cqHead_, head + 1, __ATOMIC_RELEASE);
+    return true;
+}
+#else
+Error IoUring::Init(uint32_t)
+{
+    return ERROR;
+}
+
+bool IoUring::PrepRead(int, void*, uint32_t, uint64_t, uint64_t)
+{
+    return false;
+}
+
+bool IoUring::PrepWritev(int, const struct iovec*, uint32_t, uint64_t, uint64_t)
+{
+    return false;
+}
+
+bool IoUring::PrepFsync(int, bool, uint64_t)
+{
+    return false;
+}
+
+int IoUring::Submit(uint32_t)
+{
+    return -ENOSYS;
+}
+
+bool IoUring::PeekCompletion(IoCompletion&)
+{
+    return false;
+}
+#endif
+
+void IoUring::Release()
+{
+    if (sqes_ != nullptr) {
+        munmap(sqes_, sqesSize_);
+    }
+    if (cqRing_ != nullptr && cqRing_ != sqRing_) {
+        munmap(cqRing_, cqRingSize_);
+    }
+    if (sqRing_ != nullptr) {
+        munmap(sqRing_, sqRingSize_);
+    }
+    if (ringFd_ >= 0) {
+        close(ringFd_);
+    }
+    ringFd_ = -1;
+    sqes_ = nullptr;
+    cqRing_ = nullptr;
+    sqRing_ = nullptr;
+    queued_ = 0;
+}
@@ -0,0 +1,632 @@
+/**
+* Copyright (c) Huawei Technologies Co., Ltd. 2020-2022. All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+
+* http://www.apache.org/licenses/LICENSE-2.0
+
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+
+* File Logger.cpp
+* Description: asynchronous logger behind the LOG_* macros
+*/
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Logger.h"
+
+using namespace std;
+
+namespace {
+// per thread, a power of two
+const uint32_t kThreadBufferSize = 256 * 1024;
+const uint32_t kFlushIntervalMs = 20;
+const uint32_t kDefaultRateLimit = 20;
+const int64_t kNsPerSecond = 1000000000LL;
+const uint32_t kPadRecord = UINT32_MAX;
+const uint32_t kRecordAlign = 8;
+const uint32_t kFormatBufferSize = 256;
+
+const char* const kLevelPrefix[] = { "[DEBUG]  ", "[INFO]  ", "[WARNING]  ", "[ERROR]  " };
+
+struct RecordHeader {
+    uint32_t size;
+    // kPadRecord for the filler before the ring wraps
+    uint32_t suppressed;
+    int64_t time;
+    const LogSite* site;
+};
+
+int64_t NowNs()
+{
+    return chrono::duration_cast<chrono::nanoseconds>(
+        chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * Single producer, the owning thread, and single consumer, who holds the
+ * drain lock. Records never wrap, a filler takes the end of the ring
+ */
+class ThreadLogBuffer {
+public:
+    ThreadLogBuffer() : data_(new uint8_t[kThreadBufferSize]), head_(0), tail_(0), dropped_(0),
+        alive_(true)
+    {
+    }
+
+    bool Push(const LogSite& site, uint32_t suppressed, int64_t time, const LogArgs& args)
+    {
+        uint64_t need = (sizeof(RecordHeader) + args.Size() + kRecordAlign - 1) & ~(uint64_t)(kRecordAlign - 1);
+        uint64_t tail = tail_.load(memory_order_relaxed);
+        uint64_t head = head_.load(memory_order_acquire);
+        uint64_t pos = tail & (kThreadBufferSize - 1);
+        uint64_t toEnd = kThreadBufferSize - pos;
+        uint64_t pad = (need > toEnd) ? toEnd : 0;
+        if (tail + pad + need - head > kThreadBufferSize) {
+            dropped_.fetch_add(1, memory_order_relaxed);
+            return false;
+        }
+        if (pad > 0) {
+            RecordHeader filler = { static_cast<uint32_t>(pad), kPadRecord, 0, nullptr };
+            // the tail of the ring is 8 byte aligned, the first two fields fit
+            memcpy(data_.get() + pos, &filler, sizeof(uint32_t) * 2);
+            pos = 0;
+        }
+        RecordHeader header = { static_cast<uint32_t>(need), suppressed, time, &site };
+        memcpy(data_.get() + pos, &header, sizeof(header));
+        memcpy(data_.get() + pos + sizeof(header), args.Data(), args.Size());
+        tail_.store(tail + pad + need, memory_order_release);
+        return true;
+    }
+
+    template<typename Func>
+    void Drain(Func&& func)
+    {
+        uint64_t head = head_.load(memory_order_relaxed);
+        uint64_t tail = tail_.load(memory_order_acquire);
+        while (head != tail) {
+            const uint8_t* record = data_.get() + (head & (kThreadBufferSize - 1));
+            RecordHeader header;
+            memcpy(&header, record, sizeof(uint32_t) * 2);
+            if (header.suppressed != kPadRecord) {
+                memcpy(&header, record, sizeof(header));
+                func(header, record + sizeof(header), header.size - sizeof(header));
+            }
+            head += header.size;
+        }
+        head_.store(head, memory_order_release);
+    }
+
+    uint64_t TakeDropped()
+    {
+        return dropped_.exchange(0, memory_order_relaxed);
+    }
+
+    bool IsEmpty() const
+    {
+        return head_.load(memory_order_acquire) == tail_.load(memory_order_acquire);
+    }
+
+    void SetDead()
+    {
+        alive_.store(false, memory_order_release);
+    }
+
+    bool IsAlive() const
+    {
+        return alive_.load(memory_order_acquire);
+    }
+
+private:
+    unique_ptr<uint8_t[]> data_;
+    atomic<uint64_t> head_;
+    atomic<uint64_t> tail_;
+    atomic<uint64_t> dropped_;
+    atomic<bool> alive_;
+};
+
+class ArgReader {
+public:
+    ArgReader(const uint8_t* data, uint32_t size) : data_(data), end_(data + size) {}
+
+    int64_t NextInt()
+    {
+        uint8_t width = 0;
+        return static_cast<int64_t>(NextInteger(width));
+    }
+
+    // the 64 bits of an integer argument and its size before it was packed
+    uint64_t NextInteger(uint8_t& width)
+    {
+        uint8_t type = 0;
+        uint64_t bits = NextBits(type, width);
+        if (type == LogArgs::ARG_DOUBLE) {
+            double value;
+            memcpy(&value, &bits, sizeof(value));
+            width = sizeof(int64_t);
+            return static_cast<uint64_t>(static_cast<int64_t>(value));
+        }
+        return bits;
+    }
+
+    double NextDouble()
+    {
+        uint8_t type = 0;
+        uint64_t bits = NextBits(type);
+        if (type == LogArgs::ARG_DOUBLE) {
+            double value;
+            memcpy(&value, &bits, sizeof(value));
+            return value;
+        }
+        return (type == LogArgs::ARG_INT) ? static_cast<double>(static_cast<int64_t>(bits)) : bits;
+    }
+
+    const void* NextPointer()
+    {
+        uint8_t type = 0;
+        return reinterpret_cast<const void*>(static_cast<uintptr_t>(NextBits(type)));
+    }
+
+    const char* NextString()
+    {
+        if (data_ >= end_) {
+            return "<?>";
+        }
+        if (*data_ != LogArgs::ARG_STRING) {
+            uint8_t type = 0;
+            NextBits(type);
+            return "<?>";
+        }
+        uint16_t len = 0;
+        memcpy(&len, data_ + 1, sizeof(len));
+        const char* text = reinterpret_cast<const char*>(data_ + 1 + sizeof(len));
+        data_ += 1 + sizeof(len) + len + 1;
+        return text;
+    }
+
+private:
+    uint64_t NextBits(uint8_t& type)
+    {
+        uint8_t width = 0;
+        return NextBits(type, width);
+    }
+
+    uint64_t NextBits(uint8_t& type, uint8_t& width)
+    {
+        width = sizeof(uint64_t);
+        if (data_ >= end_) {
+            type = LogArgs::ARG_UINT;
+            return 0;
+        }
+        type = *data_ & LogArgs::kTypeMask;
+        if (type == LogArgs::ARG_INT || type == LogArgs::ARG_UINT) {
+            width = *data_ >> LogArgs::kWidthShift;
+        }
+        if (type == LogArgs::ARG_STRING) {
+            NextString();
+            return 0;
+        }
+        uint64_t bits = 0;
+        memcpy(&bits, data_ + 1, sizeof(bits));
+        data_ += 1 + sizeof(bits);
+        return bits;
+    }
+
+    const uint8_t* data_;
+    const uint8_t* end_;
+};
+
+template<typename T>
+void AppendFormat(string& out, const string& spec, T value)
+{
+    char buffer[kFormatBufferSize];
+    int len = snprintf(buffer, sizeof(buffer), spec.c_str(), value);
+    if (len < 0) {
+        return;
+    }
+    if ((uint32_t)len < sizeof(buffer)) {
+        out.append(buffer, len);
+        return;
+    }
+    size_t start = out.size();
+    out.resize(start + len + 1);
+    snprintf(&out[start], len + 1, spec.c_str(), value);
+    out.resize(start + len);
+}
+
+// size printf reads an integer as: the length modifier, or int with the
+// argument promoted to it
+uint32_t IntegerWidth(const string& length, uint8_t argWidth)
+{
+    if (length == "hh") {
+        return sizeof(char);
+    } else if (length == "h") {
+        return sizeof(short);
+    } else if (length == "l") {
+        return sizeof(long);
+    } else if (length == "ll" || length == "q" || length == "j") {
+        return sizeof(long long);
+    } else if (length == "z") {
+        return sizeof(size_t);
+    } else if (length == "t") {
+        return sizeof(ptrdiff_t);
+    }
+    return max<uint32_t>(argWidth, sizeof(int));
+}
+
+uint64_t TruncateBits(uint64_t bits, uint32_t width)
+{
+    return (width >= sizeof(uint64_t)) ? bits : (bits & ((1ULL << (width * 8)) - 1));
+}
+
+int64_t SignExtendBits(uint64_t bits, uint32_t width)
+{
+    uint32_t shift = (width >= sizeof(uint64_t)) ? 0 : 64 - width * 8;
+    return static_cast<int64_t>(bits << shift) >> shift;
+}
+
+// printf over the packed arguments, the length modifiers of the format
+// are replaced by those of the 64 bit values that were packed, after the
+// value is cut to the size printf would have read
+void FormatMessage(const char* format, ArgReader& reader, string& out)
+{
+    const char* p = format;
+    while (*p != '\0') {
+        if (*p != '%') {
+            const char* next = strchr(p, '%');
+            size_t len = (next == nullptr) ? strlen(p) : (size_t)(next - p);
+            out.append(p, len);
+            p += len;
+            continue;
+        }
+        if (p[1] == '%') {
+            out.push_back('%');
+            p += 2;
+            continue;
+        }
+        const char* start = p++;
+        string spec = "%";
+        while (*p != '\0' && strchr("-+ #0'", *p) != nullptr) {
+            spec.push_back(*p++);
+        }
+        if (*p == '*') {
+            spec += to_string(reader.NextInt());
+            p++;
+        }
+        while (*p >= '0' && *p <= '9') {
+            spec.push_back(*p++);
+        }
+        if (*p == '.') {
+            spec.push_back(*p++);
+            if (*p == '*') {
+                spec += to_string(reader.NextInt());
+                p++;
+            }
+            while (*p >= '0' && *p <= '9') {
+                spec.push_back(*p++);
+            }
+        }
+        string length;
+        while (*p != '\0' && strchr("hlLqjzt", *p) != nullptr) {
+            length.push_back(*p++);
+        }
+        char conversion = *p;
+        if (conversion == '\0') {
+            out.append(start);
+            return;
+        }
+        p++;
+        switch (conversion) {
+            case 'd':
+            case 'i': {
+                uint8_t argWidth = 0;
+                uint64_t bits = reader.NextInteger(argWidth);
+                AppendFormat(out, spec + "lld", (long long)SignExtendBits(bits, IntegerWidth(length, argWidth)));
+                break;
+            }
+            case 'u':
+            case 'o':
+            case 'x':
+            case 'X': {
+                uint8_t argWidth = 0;
+                uint64_t bits = reader.NextInteger(argWidth);
+                AppendFormat(out, spec + "ll" + conversion,
+                             (unsigned long long)TruncateBits(bits, IntegerWidth(length, argWidth)));
+                break;
+            }
+            case 'c':
+                AppendFormat(out, spec + conversion, (int)reader.NextInt());
+                break;
+            case 'e':
+            case 'E':
+            case 'f':
+            case 'F':
+            case 'g':
+            case 'G':
+            case 'a':
+            case 'A':
+                AppendFormat(out, spec + conversion, reader.NextDouble());
+                break;
+            case 's':
+                AppendFormat(out, spec + conversion, reader.NextString());
+                break;
+            case 'p':
+                AppendFormat(out, spec + conversion, reader.NextPointer());
+                break;
+            case 'n':
+                reader.NextPointer();
+                break;
+            default:
+                out.append(start, p - start);
+                break;
+        }
+    }
+}
+
+struct LogLine {
+    int64_t time;
+    string text;
+};
+
+/**
+ * The buffers of all threads and the flusher draining them
+ */
+class LogCore {
+public:
+    LogCore() : exit_(false), wake_(false), written_(0), dropped_(0), suppressed_(0)
+    {
+        flusher_ = thread(&LogCore::FlusherEntry, this);
+    }
+
+    ThreadLogBuffer* LocalBuffer()
+    {
+        thread_local LocalHolder holder;
+        if (holder.buffer == nullptr) {
+            holder.buffer = make_shared<ThreadLogBuffer>();
+            lock_guard<mutex> guard(listLock_);
+            buffers_.push_back(holder.buffer);
+        }
+        return holder.buffer.get();
+    }
+
+    void Wake()
+    {
+        {
+            lock_guard<mutex> guard(wakeLock_);
+            wake_ = true;
+        }
+        wakeUp_.notify_one();
+    }
+
+    void Drain()
+    {
+        lock_guard<mutex> drainGuard(drainLock_);
+        vector<shared_ptr<ThreadLogBuffer>> buffers;
+        {
+            lock_guard<mutex> guard(listLock_);
+            buffers = buffers_;
+        }
+        lines_.clear();
+        uint64_t dropped = 0;
+        for (const auto& buffer : buffers) {
+            buffer->Drain([this](const RecordHeader& header, const uint8_t* args, uint32_t size) {
+                LogLine line;
+                line.time = header.time;
+                line.text = kLevelPrefix[header.site->level];
+                ArgReader reader(args, size);
+                FormatMessage(header.site->format, reader, line.text);
+                if (header.suppressed > 0) {
+                    line.text += " (" + to_string(header.suppressed) + " similar messages suppressed)";
+                }
+                line.text.push_back('\n');
+                lines_.push_back(move(line));
+            });
+            dropped += buffer->TakeDropped();
+        }
+        // threads that ended and left nothing behind
+        {
+            lock_guard<mutex> guard(listLock_);
+            buffers_.erase(remove_if(buffers_.begin(), buffers_.end(), [](const shared_ptr<ThreadLogBuffer>& buffer) {
+                return !buffer->IsAlive() && buffer->IsEmpty();
+            }), buffers_.end());
+        }
+        if (lines_.empty() && dropped == 0) {
+            return;
+        }
+        stable_sort(lines_.begin(), lines_.end(), [](const LogLine& a, const LogLine& b) {
+            return a.time < b.time;
+        });
+        out_.clear();
+        for (const auto& line : lines_) {
+            out_ += line.text;
+        }
+        if (dropped > 0) {
+            out_ += string(kLevelPrefix[LOG_LEVEL_WARNING]) + "Logger dropped " + to_string(dropped) +
+                    " messages for full buffers\n";
+        }
+        fwrite(out_.data(), 1, out_.size(), stdout);
+        fflush(stdout);
+        written_.fetch_add(lines_.size(), memory_order_relaxed);
+        dropped_.fetch_add(dropped, memory_order_relaxed);
+    }
+
+    void Stop()
+    {
+        {
+            lock_guard<mutex> guard(wakeLock_);
+            exit_ = true;
+        }
+        wakeUp_.notify_one();
+        if (flusher_.joinable()) {
+            flusher_.join();
+        }
+        Drain();
+    }
+
+    uint32_t ThreadNum()
+    {
+        lock_guard<mutex> guard(listLock_);
+        return buffers_.size();
+    }
+
+    atomic<uint64_t>& Written()
+    {
+        return written_;
+    }
+    atomic<uint64_t>& Dropped()
+    {
+        return dropped_;
+    }
+    atomic<uint64_t>& Suppressed()
+    {
+        return suppressed_;
+    }
+
+private:
+    struct LocalHolder {
+        shared_ptr<ThreadLogBuffer> buffer;
+        ~LocalHolder()
+        {
+            if (buffer != nullptr) {
+                buffer->SetDead();
+            }
+        }
+    };
+
+    void FlusherEntry()
+    {
+        while (true) {
+            {
+                unique_lock<mutex> guard(wakeLock_);
+                wakeUp_.wait_for(guard, chrono::milliseconds(kFlushIntervalMs), [this] { return wake_ || exit_; });
+                if (exit_) {
+                    return;
+                }
+                wake_ = false;
+            }
+            Drain();
+        }
+    }
+
+    mutex listLock_;
+    vector<shared_ptr<ThreadLogBuffer>> buffers_;
+    mutex drainLock_;
+    vector<LogLine> lines_;
+    string out_;
+    mutex wakeLock_;
+    condition_variable wakeUp_;
+    bool exit_;
+    bool wake_;
+    atomic<uint64_t> written_;
+    atomic<uint64_t> dropped_;
+    atomic<uint64_t> suppressed_;
+    thread flusher_;
+};
+
+LogCore* g_logCore = nullptr;
+atomic<bool> g_logStopped(false);
+
+void StopLogger()
+{
+    g_logStopped.store(true);
+    g_logCore->Stop();
+}
+}
+
+atomic<int> Logger::level_(LOG_LEVEL_INFO);
+
+void LogArgs::AddString(const char* value)
+{
+    if (value == nullptr) {
+        value = "(null)";
+    }
+    const uint32_t overhead = 1 + sizeof(uint16_t) + 1;
+    if (size_ + overhead > kCapacity) {
+        return;
+    }
+    size_t len = strlen(value);
+    size_t room = kCapacity - size_ - overhead;
+    len = (len > room) ? room : len;
+    uint16_t len16 = static_cast<uint16_t>(len);
+    data_[size_] = ARG_STRING;
+    memcpy(data_ + size_ + 1, &len16, sizeof(len16));
+    memcpy(data_ + size_ + 1 + sizeof(len16), value, len);
+    data_[size_ + 1 + sizeof(len16) + len] = '\0';
+    size_ += overhead + len;
+}
+
+Logger::Logger() : rateLimit_(kDefaultRateLimit)
+{
+    g_logCore = new LogCore();
+    // the logger lives on for logs written from static destructors, the
+    // messages of the flusher are written when exit starts
+    atexit(StopLogger);
+}
+
+Logger& Logger::GetInstance()
+{
+    static Logger* instance = new Logger();
+    return *instance;
+}
+
+void Logger::Write(LogSite& site, const LogArgs& args)
+{
+    int64_t now = NowNs();
+    uint32_t limit = rateLimit_.load(memory_order_relaxed);
+    uint32_t suppressed = 0;
+    if (limit > 0 && site.rateLimited) {
+        int64_t second = now / kNsPerSecond;
+        int64_t window = site.window.load(memory_order_relaxed);
+        if (window != second && site.window.compare_exchange_strong(window, second)) {
+            site.count.store(0, memory_order_relaxed);
+        }
+        if (site.count.fetch_add(1, memory_order_relaxed) >= limit) {
+            site.suppressed.fetch_add(1, memory_order_relaxed);
+            g_logCore->Suppressed().fetch_add(1, memory_order_relaxed);
+            return;
+        }
+        suppressed = site.suppressed.exchange(0, memory_order_relaxed);
+    }
+
+    if (g_logStopped.load(memory_order_relaxed)) {
+        // after exit began there is no flusher, write at once
+        string text = kLevelPrefix[site.level];
+        ArgReader reader(args.Data(), args.Size());
+        FormatMessage(site.format, reader, text);
+        text.push_back('\n');
+        fwrite(text.data(), 1, text.size(), stdout);
+        fflush(stdout);
+        return;
+    }
+    g_logCore->LocalBuffer()->Push(site, suppressed, now, args);
+    if (site.level >= LOG_LEVEL_ERROR) {
+        g_logCore->Wake();
+    }
+}
+
+void Logger::Flush()
+{
+    g_logCore->Drain();
+}
+
+LoggerStats Logger::GetStats()
+{
+    LoggerStats stats;
+    stats.written = g_logCore->Written().load();
+    stats.dropped = g_logCore->Dropped().load();
+    stats.suppressed = g_logCore->Suppressed().load();
+    stats.threads = g_logCore->ThreadNum();
+    return stats;
+}
@@ -0,0 +1,86 @@
+/**
+* Copyright (c) Huawei Technologies Co., Ltd. 2020-2022. All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+
+* http://www.apache.org/licenses/LICENSE-2.0
+
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+
+* File MemoryBudget.cpp
+* Description: bytes in flight between threads and the memory ceiling
+*/
+#include "MemoryBudget.h"
+#include "ImagePlanes.h"
+
+using namespace std;
+
+MemoryBudget::MemoryBudget() : bytesInFlight_(0), maxBytesInFlight_(0), ceiling_(0), refused_(0),
+    refusedBytes_(0)
+{
+}
+
+void MemoryBudget::SetCeiling(uint64_t bytes)
+{
+    ceiling_.store(bytes, memory_order_relaxed);
+}
+
+bool MemoryBudget::TryAcquire(uint64_t bytes)
+{
+    uint64_t ceiling = ceiling_.load(memory_order_relaxed);
+    uint64_t inFlight = bytesInFlight_.load(memory_order_relaxed);
+    while (true) {
+        if (ceiling != 0 && inFlight != 0 && inFlight + bytes > ceiling) {
+            refused_.fetch_add(1, memory_order_relaxed);
+            refusedBytes_.fetch_add(bytes, memory_order_relaxed);
+            return false;
+        }
+        if (bytesInFlight_.compare_exchange_weak(inFlight, inFlight + bytes, memory_order_relaxed)) {
+            UpdateMax(inFlight + bytes);
+            return true;
+        }
+    }
+}
+
+void MemoryBudget::Acquire(uint64_t bytes)
+{
+    UpdateMax(bytesInFlight_.fetch_add(bytes, memory_order_relaxed) + bytes);
+}
+
+void MemoryBudget::Release(uint64_t bytes)
+{
+    bytesInFlight_.fetch_sub(bytes, memory_order_relaxed);
+}
+
+MemoryBudgetStats MemoryBudget::GetStats()
+{
+    MemoryBudgetStats stats;
+    stats.bytesInFlight = bytesInFlight_.load(memory_order_relaxed);
+    stats.maxBytesInFlight = maxBytesInFlight_.load(memory_order_relaxed);
+    stats.ceiling = ceiling_.load(memory_order_relaxed);
+    stats.refused = refused_.load(memory_order_relaxed);
+    stats.refusedBytes = refusedBytes_.load(memory_order_relaxed);
+    return stats;
+}
+
+void MemoryBudget::UpdateMax(uint64_t inFlight)
+{
+    uint64_t max = maxBytesInFlight_.load(memory_order_relaxed);
+    while (inFlight > max && !maxBytesInFlight_.compare_exchange_weak(max, inFlight, memory_order_relaxed)) {
+    }
+}
+
+uint64_t PayloadBytes(const ImageData& image)
+{
+    ImageData compact;
+    if (IsImageView(image) && GetCompactGeometry(image, compact)) {
+        return compact.size;
+    }
+    return image.size;
+}
@@ -0,0 +1,386 @@
+/**
+* Copyright (c) Huawei Technologies Co., Ltd. 2020-2022. All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+
+* http://www.apache.org/licenses/LICENSE-2.0
+
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+
+* File MsgAllocator.cpp
+* Description: per-thread slab allocator for short-lived message payloads
+*/
+#include <atomic>
+#include <mutex>
+#include <new>
+#include <vector>
+#include <stdlib.h>
+#include "MsgAllocator.h"
+
+using namespace std;
+
+namespace {
+// size classes are the powers of two from 16 bytes to 256 KB
+const uint32_t kMinClassShift = 4;
+const uint32_t kMaxClassShift = 18;
+const uint32_t kClassNum = kMaxClassShift - kMinClassShift + 1;
+// every block is preceded by a header, keeps the user area 16 bytes aligned
+const size_t kHeaderSize = 16;
+const size_t kSlabSize = 256 * 1024;
+const size_t kMinBlocksPerSlab = 4;
+const size_t kSlabAlign = 64;
+// remote frees are handed back to the owner in chains of this length
+const uint32_t kRemoteBatchSize = 32;
+
+struct ThreadCache;
+
+struct BlockHeader {
+    ThreadCache* owner;  // nullptr: large block served by new
+    uint64_t info;       // size class, or bytes size of a large block
+};
+
+// overlays the user area of a free block
+struct FreeBlock {
+    FreeBlock* next;
+};
+
+// counters written only by the owner thread, read by GetMsgAllocStats
+struct OwnerCounter {
+    atomic<uint64_t> value;
+
+    OwnerCounter() : value(0) {}
+    void Add(uint64_t n)
+    {
+        value.store(value.load(memory_order_relaxed) + n, memory_order_relaxed);
+    }
+    uint64_t Get() const
+    {
+        return value.load(memory_order_relaxed);
+    }
+};
+
+struct ThreadCache {
+    FreeBlock* freeList[kClassNum];
+    vector<void*> slabs;
+    atomic<FreeBlock*> remoteHead;
+    // updated by the freeing threads once per batch
+    atomic<uint64_t> remoteFreedBytes;
+    atomic<uint64_t> remoteFreeCount;
+    bool active;
+    OwnerCounter bytesAlloc;
+    OwnerCounter bytesFreed;
+    OwnerCounter bytesReserved;
+    OwnerCounter allocCount;
+    OwnerCounter freeCount;
+
+    ThreadCache() : remoteHead(nullptr), remoteFreedBytes(0), remoteFreeCount(0), active(true)
+    {
+        for (uint32_t i = 0; i < kClassNum; i++) {
+            freeList[i] = nullptr;
+        }
+    }
+};
+
+// frees of blocks owned by another thread, waiting to be pushed in one go
+struct RemoteBatch {
+    ThreadCache* owner;
+    FreeBlock* head;
+    FreeBlock* tail;
+    uint32_t count;
+    uint64_t bytes;
+};
+
+struct Registry {
+    mutex lock;
+    vector<ThreadCache*> caches;
+};
+
+// thread caches are never destroyed: blocks may outlive their thread, so an
+// exited thread's cache is parked and adopted by the next new thread
+Registry& GetRegistry()
+{
+    static Registry* registry = new Registry();
+    return *registry;
+}
+
+atomic<uint64_t> g_largeBytes(0);
+atomic<uint64_t> g_largeAllocCount(0);
+atomic<uint64_t> g_largeFreeCount(0);
+
+void FlushRemoteBatch();
+
+struct CacheHolder {
+    ~CacheHolder();
+};
+
+thread_local ThreadCache* t_cache = nullptr;
+thread_local bool t_cacheReleased = false;
+thread_local RemoteBatch t_batch = { nullptr, nullptr, nullptr, 0, 0 };
+thread_local CacheHolder t_holder;
+
+inline BlockHeader* HeaderOf(void* ptr)
+{
+    return reinterpret_cast<BlockHeader*>(static_cast<uint8_t*>(ptr) - kHeaderSize);
+}
+
+inline size_t ClassSize(uint32_t cls)
+{
+    return static_cast<size_t>(1) << (cls + kMinClassShift);
+}
+
+inline uint32_t SizeToClass(size_t size)
+{
+    if (size <= ClassSize(0)) {
+        return 0;
+    }
+    uint32_t shift = 64 - __builtin_clzll(static_cast<unsigned long long>(size - 1));
+    return shift - kMinClassShift;
+}
+
+CacheHolder::~CacheHolder()
+{
+    FlushRemoteBatch();
+    if (t_cache != nullptr) {
+        Registry& registry = GetRegistry();
+        lock_guard<mutex> lock(registry.lock);
+        t_cache->active = false;
+    }
+    t_cache = nullptr;
+    t_cacheReleased = true;
+}
+
+ThreadCache* GetCache()
+{
+    if (t_cache != nullptr) {
+        return t_cache;
+    }
+    // thread is exiting, its thread locals are being destroyed
+    if (t_cacheReleased) {
+        return nullptr;
+    }
+    // odr-use the holder so that it is constructed and releases the cache
+    (void)&t_holder;
+
+    Registry& registry = GetRegistry();
+    lock_guard<mutex> lock(registry.lock);
+    for (size_t i = 0; i < registry.caches.size(); i++) {
+        if (!registry.caches[i]->active) {
+            registry.caches[i]->active = true;
+            t_cache = registry.caches[i];
+            return t_cache;
+        }
+    }
+    ThreadCache* cache = new(nothrow) ThreadCache();
+    if (cache == nullptr) {
+        return nullptr;
+    }
+    registry.caches.push_back(cache);
+    t_cache = cache;
+    return t_cache;
+}
+
+void PushRemote(ThreadCache* owner, FreeBlock* head, FreeBlock* tail,
+                uint32_t count, uint64_t bytes)
+{
+    owner->remoteFreedBytes.fetch_add(bytes, memory_order_relaxed);
+    owner->remoteFreeCount.fetch_add(count, memory_order_relaxed);
+    FreeBlock* old = owner->remoteHead.load(memory_order_relaxed);
+    do {
+        tail->next = old;
+    } while (!owner->remoteHead.compare_exchange_weak(old, head,
+                                                      memory_order_release,
+                                                      memory_order_relaxed));
+}
+
+void FlushRemoteBatch()
+{
+    if (t_batch.count == 0) {
+        return;
+    }
+    PushRemote(t_batch.owner, t_batch.head, t_batch.tail, t_batch.count, t_batch.bytes);
+    t_batch.owner = nullptr;
+    t_batch.head = nullptr;
+    t_batch.tail = nullptr;
+    t_batch.count = 0;
+    t_batch.bytes = 0;
+}
+
+void DrainRemote(ThreadCache* cache)
+{
+    // the freeing threads already accounted these blocks
+    FreeBlock* blk = cache->remoteHead.exchange(nullptr, memory_order_acquire);
+    while (blk != nullptr) {
+        FreeBlock* next = blk->next;
+        uint32_t cls = static_cast<uint32_t>(HeaderOf(blk)->info);
+        blk->next = cache->freeList[cls];
+        cache->freeList[cls] = blk;
+        blk = next;
+    }
+}
+
+bool RefillSlab(ThreadCache* cache, uint32_t cls)
+{
+    size_t blockSize = ClassSize(cls) + kHeaderSize;
+    size_t blockNum = kSlabSize / blockSize;
+    if (blockNum < kMinBlocksPerSlab) {
+        blockNum = kMinBlocksPerSlab;
+    }
+    void* slab = nullptr;
+    if (posix_memalign(&slab, kSlabAlign, blockNum * blockSize) != 0) {
+        return false;
+    }
+    cache->slabs.push_back(slab);
+    cache->bytesReserved.Add(blockNum * blockSize);
+
+    uint8_t* base = static_cast<uint8_t*>(slab);
+    // link in reverse so that blocks are handed out in address order
+    for (size_t i = blockNum; i > 0; i--) {
+        uint8_t* block = base + (i - 1) * blockSize;
+        BlockHeader* hdr = reinterpret_cast<BlockHeader*>(block);
+        hdr->owner = cache;
+        hdr->info = cls;
+        FreeBlock* blk = reinterpret_cast<FreeBlock*>(block + kHeaderSize);
+        blk->next = cache->freeList[cls];
+        cache->freeList[cls] = blk;
+    }
+    return true;
+}
+
+void* LargeAlloc(size_t size)
+{
+    uint8_t* block = static_cast<uint8_t*>(::operator new(size + kHeaderSize, nothrow));
+    if (block == nullptr) {
+        return nullptr;
+    }
+    BlockHeader* hdr = reinterpret_cast<BlockHeader*>(block);
+    hdr->owner = nullptr;
+    hdr->info = size;
+    g_largeBytes.fetch_add(size, memory_order_relaxed);
+    g_largeAllocCount.fetch_add(1, memory_order_relaxed);
+    return block + kHeaderSize;
+}
+
+void LargeFree(BlockHeader* hdr)
+{
+    g_largeBytes.fetch_sub(hdr->info, memory_order_relaxed);
+    g_largeFreeCount.fetch_add(1, memory_order_relaxed);
+    ::operator delete(hdr);
+}
+}
+
+void* MsgAlloc(size_t size)
+{
+    uint32_t cls = SizeToClass(size);
+    if (cls >= kClassNum) {
+        return LargeAlloc(size);
+    }
+    ThreadCache* cache = GetCache();
+    if (cache == nullptr) {
+        return LargeAlloc(size);
+    }
+
+    FreeBlock* blk = cache->freeList[cls];
+    if (blk == nullptr) {
+        // reuse what other threads handed back before growing
+        DrainRemote(cache);
+        if (cache->freeList[cls] == nullptr && !RefillSlab(cache, cls)) {
+            return nullptr;
+        }
+        blk = cache->freeList[cls];
+    }
+    cache->freeList[cls] = blk->next;
+    cache->bytesAlloc.Add(ClassSize(cls));
+    cache->allocCount.Add(1);
+    return blk;
+}
+
+void MsgFree(void* ptr)
+{
+    if (ptr == nullptr) {
+        return;
+    }
+    BlockHeader* hdr = HeaderOf(ptr);
+    ThreadCache* owner = hdr->owner;
+    if (owner == nullptr) {
+        LargeFree(hdr);
+        return;
+    }
+
+    FreeBlock* blk = static_cast<FreeBlock*>(ptr);
+    if (owner == t_cache) {
+        uint32_t cls = static_cast<uint32_t>(hdr->info);
+        blk->next = owner->freeList[cls];
+        owner->freeList[cls] = blk;
+        owner->bytesFreed.Add(ClassSize(cls));
+        owner->freeCount.Add(1);
+        return;
+    }
+
+    uint64_t bytes = ClassSize(static_cast<uint32_t>(hdr->info));
+    if (t_cacheReleased) {
+        PushRemote(owner, blk, blk, 1, bytes);
+        return;
+    }
+    // make sure the batch is flushed when this thread exits
+    (void)&t_holder;
+    if (t_batch.owner != owner) {
+        FlushRemoteBatch();
+        t_batch.owner = owner;
+        t_batch.tail = blk;
+    }
+    blk->next = t_batch.head;
+    t_batch.head = blk;
+    t_batch.count++;
+    t_batch.bytes += bytes;
+    if (t_batch.count >= kRemoteBatchSize) {
+        FlushRemoteBatch();
+    }
+}
+
+void MsgAllocFlush()
+{
+    FlushRemoteBatch();
+}
+
+void GetMsgAllocStats(MsgAllocStats& stats)
+{
+    stats = MsgAllocStats();
+    Registry& registry = GetRegistry();
+    {
+        lock_guard<mutex> lock(registry.lock);
+        for (size_t i = 0; i < registry.caches.size(); i++) {
+            ThreadCache* cache = registry.caches[i];
+            uint64_t remoteBytes = cache->remoteFreedBytes.load(memory_order_relaxed);
+            uint64_t remoteCount = cache->remoteFreeCount.load(memory_order_relaxed);
+            uint64_t freedBytes = cache->bytesFreed.Get() + remoteBytes;
+            uint64_t allocBytes = cache->bytesAlloc.Get();
+            // counters are sampled without a lock, never report a wrapped value
+            stats.bytesInUse += (allocBytes > freedBytes) ? (allocBytes - freedBytes) : 0;
+            stats.bytesReserved += cache->bytesReserved.Get();
+            stats.allocCount += cache->allocCount.Get();
+            stats.freeCount += cache->freeCount.Get() + remoteCount;
+            stats.remoteFreeCount += remoteCount;
+        }
+        stats.threadCaches = registry.caches.size();
+    }
+    uint64_t largeAlloc = g_largeAllocCount.load(memory_order_relaxed);
+    stats.bytesInUse += g_largeBytes.load(memory_order_relaxed);
+    stats.allocCount += largeAlloc;
+    stats.freeCount += g_largeFreeCount.load(memory_order_relaxed);
+    stats.largeAllocCount = largeAlloc;
+}
+
+shared_ptr<uint8_t> MsgAllocBuffer(size_t size)
+{
+    uint8_t* buf = static_cast<uint8_t*>(MsgAlloc(size));
+    if (buf == nullptr) {
+        return nullptr;
+    }
+    return shared_ptr<uint8_t>(buf, [](uint8_t* p) { MsgFree(p); }, MsgAllocator<uint8_t>());
+}
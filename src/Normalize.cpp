@@ -0,0 +1,270 @@
+/**
+* Copyright (c) Huawei Technologies Co., Ltd. 2020-2022. All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+
+* http://www.apache.org/licenses/LICENSE-2.0
+
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+
+* File Normalize.cpp
+* Description: packed RGB u8 to normalized float32 NCHW tensor
+*/
+#include "FramePool.h"
+#include "ImagePlanes.h"
+#include "Normalize.h"
+#include "ParallelFor.h"
+#include "Simd.h"
+
+using namespace std;
+
+namespace {
+// rows of one parallel task are at least this many pixels
+const uint32_t kMinPixelsPerTask = 64 * 1024;
+const uint32_t kChannels = 3;
+
+// per input channel: the output plane and x * scale + bias
+struct ChannelMap {
+    float* plane[kChannels];
+    float scale[kChannels];
+    float bias[kChannels];
+};
+
+typedef void (*NormalizeRowFunc)(const uint8_t* src, const ChannelMap& map, uint32_t width);
+
+void NormalizeRowScalar(const uint8_t* src, const ChannelMap& map, uint32_t begin, uint32_t width)
+{
+    float* dst0 = map.plane[0];
+    float* dst1 = map.plane[1];
+    float* dst2 = map.plane[2];
+    for (uint32_t x = begin; x < width; x++) {
+        const uint8_t* pixel = src + x * kChannels;
+        dst0[x] = pixel[0] * map.scale[0] + map.bias[0];
+        dst1[x] = pixel[1] * map.scale[1] + map.bias[1];
+        dst2[x] = pixel[2] * map.scale[2] + map.bias[2];
+    }
+}
+
+void NormalizeRowC(const uint8_t* src, const ChannelMap& map, uint32_t width)
+{
+    NormalizeRowScalar(src, map, 0, width);
+}
+
+#if SIMD_X86
+SIMD_TARGET("avx2,fma")
+inline void StoreChannelAvx2(__m128i value, __m256 scale, __m256 bias, float* dst)
+{
+    __m256 lo = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(value));
+    __m256 hi = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_srli_si128(value, 8)));
+    _mm256_storeu_ps(dst, _mm256_fmadd_ps(lo, scale, bias));
+    _mm256_storeu_ps(dst + 8, _mm256_fmadd_ps(hi, scale, bias));
+}
+
+SIMD_TARGET("avx2,fma")
+void NormalizeRowAvx2(const uint8_t* src, const ChannelMap& map, uint32_t width)
+{
+    const __m256 scale0 = _mm256_set1_ps(map.scale[0]);
+    const __m256 scale1 = _mm256_set1_ps(map.scale[1]);
+    const __m256 scale2 = _mm256_set1_ps(map.scale[2]);
+    const __m256 bias0 = _mm256_set1_ps(map.bias[0]);
+    const __m256 bias1 = _mm256_set1_ps(map.bias[1]);
+    const __m256 bias2 = _mm256_set1_ps(map.bias[2]);
+    uint32_t x = 0;
+    for (; x + 16 <= width; x += 16) {
+        __m128i c0, c1, c2;
+        DeinterleaveRgb16(src + x * kChannels, c0, c1, c2);
+        StoreChannelAvx2(c0, scale0, bias0, map.plane[0] + x);
+        StoreChannelAvx2(c1, scale1, bias1, map.plane[1] + x);
+        StoreChannelAvx2(c2, scale2, bias2, map.plane[2] + x);
+    }
+    NormalizeRowScalar(src, map, x, width);
+}
+
+// 16 pixels are widened to floats as they lie in memory, then two source
+// permutes pick every third float for each channel
+SIMD_TARGET("avx512f,avx512bw")
+inline __m512 LoadFloat16Avx512(const uint8_t* src)
+{
+    // the zero masked forms, gcc 12 warns on the undefined source of the plain ones
+    const __mmask16 all = 0xFFFF;
+    __m512i value = _mm512_maskz_cvtepu8_epi32(all, _mm_loadu_si128(reinterpret_cast<const __m128i*>(src)));
+    return _mm512_maskz_cvtepi32_ps(all, value);
+}
+
+SIMD_TARGET("avx512f,avx512bw")
+inline void NormalizeBlockAvx512(const uint8_t* src, const __m512 scale[kChannels],
+                                 const __m512 bias[kChannels], const __m512i pick[kChannels][2],
+                                 float* const dst[kChannels])
+{
+    __m512 f0 = LoadFloat16Avx512(src);
+    __m512 f1 = LoadFloat16Avx512(src + 16);
+    __m512 f2 = LoadFloat16Avx512(src + 32);
+    for (uint32_t c = 0; c < kChannels; c++) {
+        __m512 low = _mm512_permutex2var_ps(f0, pick[c][0], f1);
+        __m512 value = _mm512_permutex2var_ps(low, pick[c][1], f2);
+        _mm512_storeu_ps(dst[c], _mm512_fmadd_ps(value, scale[c], bias[c]));
+    }
+}
+
+// float 3 * i + c of a block for channel c: taken from f0:f1 by the first
+// permute, the rest from f2 by the second
+alignas(64) const int32_t kPickFirst[kChannels][16] = {
+    { 0, 3, 6, 9, 12, 15, 18, 21, 24, 27, 30, 0, 0, 0, 0, 0 },
+    { 1, 4, 7, 10, 13, 16, 19, 22, 25, 28, 31, 0, 0, 0, 0, 0 },
+    { 2, 5, 8, 11, 14, 17, 20, 23, 26, 29, 0, 0, 0, 0, 0, 0 },
+};
+alignas(64) const int32_t kPickSecond[kChannels][16] = {
+    { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 17, 20, 23, 26, 29 },
+    { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 18, 21, 24, 27, 30 },
+    { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 16, 19, 22, 25, 28, 31 },
+};
+
+SIMD_TARGET("avx512f,avx512bw")
+void NormalizeRowAvx512(const uint8_t* src, const ChannelMap& map, uint32_t width)
+{
+    __m512 scale[kChannels];
+    __m512 bias[kChannels];
+    __m512i pick[kChannels][2];
+    for (uint32_t c = 0; c < kChannels; c++) {
+        scale[c] = _mm512_set1_ps(map.scale[c]);
+        bias[c] = _mm512_set1_ps(map.bias[c]);
+        pick[c][0] = _mm512_load_si512(kPickFirst[c]);
+        pick[c][1] = _mm512_load_si512(kPickSecond[c]);
+    }
+    uint32_t x = 0;
+    for (; x + 16 <= width; x += 16) {
+        float* const dst[kChannels] = { map.plane[0] + x, map.plane[1] + x, map.plane[2] + x };
+        NormalizeBlockAvx512(src + x * kChannels, scale, bias, pick, dst);
+    }
+    NormalizeRowScalar(src, map, x, width);
+}
+#endif
+
+// the sse path would spend most of its time in the deinterleave, older
+// cpus take the scalar loop
+NormalizeRowFunc SelectNormalizeRow()
+{
+#if SIMD_X86
+    SimdLevel level = GetSimdLevel();
+    if (level >= SIMD_AVX512) {
+        return NormalizeRowAvx512;
+    }
+    if (level >= SIMD_AVX2) {
+        return NormalizeRowAvx2;
+    }
+#endif
+    return NormalizeRowC;
+}
+
+inline bool IsRgbFormat(acldvppPixelFormat format)
+{
+    return (format == PIXEL_FORMAT_RGB_888) || (format == PIXEL_FORMAT_BGR_888);
+}
+
+Error CheckParam(const NormalizeParam& param)
+{
+    if (!IsRgbFormat(param.tensorFormat)) {
+        LOG_ERROR("Normalize failed for tensor format %d", param.tensorFormat);
+        return ERROR_INVALID_ARGS;
+    }
+    for (uint32_t c = 0; c < kChannels; c++) {
+        if (param.std[c] == 0.0f) {
+            LOG_ERROR("Normalize failed for std of channel %u is 0", c);
+            return ERROR_INVALID_ARGS;
+        }
+    }
+    return OK;
+}
+
+// tensor channel c takes input channel c, or 2 - c when the orders differ
+void BuildChannelMap(const ImageData& image, const NormalizeParam& param, float* tensor, ChannelMap& map)
+{
+    bool swap = (image.format != param.tensorFormat);
+    uint32_t planeSize = image.width * image.height;
+    for (uint32_t c = 0; c < kChannels; c++) {
+        uint32_t in = swap ? (kChannels - 1 - c) : c;
+        map.plane[in] = tensor + c * planeSize;
+        map.scale[in] = 1.0f / param.std[c];
+        map.bias[in] = -param.mean[c] / param.std[c];
+    }
+}
+
+Error NormalizeImages(const ImageData* images, uint32_t batch, const NormalizeParam& param, float* tensor)
+{
+    Error ret = CheckParam(param);
+    if (ret != OK) {
+        return ret;
+    }
+    uint32_t width = images[0].width;
+    uint32_t height = images[0].height;
+    vector<ImagePlanes> planes(batch);
+    vector<ChannelMap> maps(batch);
+    for (uint32_t i = 0; i < batch; i++) {
+        const ImageData& image = images[i];
+        if (!IsRgbFormat(image.format) || !GetImagePlanes(image, planes[i])) {
+            LOG_ERROR("Normalize failed for invalid image %u, format %d", i, image.format);
+            return ERROR_INVALID_ARGS;
+        }
+        if (image.width != width || image.height != height) {
+            LOG_ERROR("Normalize failed for image %u size %ux%u differs from %ux%u",
+                      i, image.width, image.height, width, height);
+            return ERROR_INVALID_ARGS;
+        }
+        BuildChannelMap(image, param, tensor + (size_t)i * kChannels * width * height, maps[i]);
+    }
+
+    NormalizeRowFunc rowFunc = SelectNormalizeRow();
+    uint32_t rowsPerTask = kMinPixelsPerTask / width;
+    rowsPerTask = (rowsPerTask == 0) ? 1 : rowsPerTask;
+    // rows of all images form one range, small images still spread evenly
+    ParallelFor(batch * height, rowsPerTask, [&](uint32_t begin, uint32_t end) {
+        for (uint32_t row = begin; row < end; row++) {
+            uint32_t index = row / height;
+            uint32_t y = row % height;
+            const ChannelMap& map = maps[index];
+            ChannelMap rowMap = map;
+            for (uint32_t c = 0; c < kChannels; c++) {
+                rowMap.plane[c] = map.plane[c] + y * width;
+            }
+            rowFunc(planes[index].plane[0] + y * planes[index].stride[0], rowMap, width);
+        }
+    });
+    return OK;
+}
+}
+
+Error NormalizeToNchw(const ImageData& src, const NormalizeParam& param, float* dst)
+{
+    if (dst == nullptr) {
+        LOG_ERROR("Normalize failed for output is nullptr");
+        return ERROR_INVALID_ARGS;
+    }
+    return NormalizeImages(&src, 1, param, dst);
+}
+
+Error NormalizeBatchToNchw(const vector<ImageData>& images, const NormalizeParam& param,
+                           InferenceOutput& output)
+{
+    if (images.empty() || images[0].width == 0 || images[0].height == 0) {
+        LOG_ERROR("Normalize failed for no input image");
+        return ERROR_INVALID_ARGS;
+    }
+    uint32_t tensorSize = GetNchwTensorSize(images[0].width, images[0].height, images.size());
+    if (output.data == nullptr) {
+        output.data = FramePool::GetInstance().Alloc(tensorSize);
+        if (output.data == nullptr) {
+            return ERROR_MALLOC;
+        }
+    } else if (output.size < tensorSize) {
+        LOG_ERROR("Normalize output %u bytes is less than tensor %u bytes", output.size, tensorSize);
+        return ERROR_INVALID_ARGS;
+    }
+    output.size = tensorSize;
+    return NormalizeImages(images.data(), images.size(), param, static_cast<float*>(output.data.get()));
+}
@@ -0,0 +1,184 @@
+/**
+* Copyright (c) Huawei Technologies Co., Ltd. 2020-2022. All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+
+* http://www.apache.org/licenses/LICENSE-2.0
+
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+
+* File ParallelFor.cpp
+* Description: split data parallel kernels over a shared worker pool
+*/
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include "ParallelFor.h"
+#include "Utils.h"
+
+using namespace std;
+
+namespace {
+const uint32_t kMaxDefaultWorkers = 8;
+const uint32_t kWorkersUnset = 0xFFFFFFFF;
+
+struct ParallelJob {
+    const ParallelTask* task = nullptr;
+    uint32_t count = 0;
+    uint32_t grain = 0;
+    uint32_t chunks = 0;
+    atomic<uint32_t> next;
+    atomic<uint32_t> done;
+    mutex lock;
+    condition_variable finished;
+
+    ParallelJob() : next(0), done(0) {}
+
+    // run chunks until none is left, the last finished chunk wakes the caller
+    void RunChunks()
+    {
+        uint32_t chunk;
+        while ((chunk = next.fetch_add(1)) < chunks) {
+            uint32_t begin = chunk * grain;
+            uint32_t end = (count - begin > grain) ? begin + grain : count;
+            (*task)(begin, end);
+            if (done.fetch_add(1) + 1 == chunks) {
+                lock_guard<mutex> guard(lock);
+                finished.notify_all();
+            }
+        }
+    }
+};
+
+class WorkerPool {
+public:
+    explicit WorkerPool(uint32_t workerNum) : workerNum_(workerNum)
+    {
+        for (uint32_t i = 0; i < workerNum_; i++) {
+            thread worker(&WorkerPool::WorkerEntry, this);
+            worker.detach();
+        }
+    }
+
+    uint32_t WorkerNum() const
+    {
+        return workerNum_;
+    }
+
+    void Post(const shared_ptr<ParallelJob>& job)
+    {
+        lock_guard<mutex> guard(lock_);
+        jobs_.push_back(job);
+        wakeup_.notify_all();
+    }
+
+    void Remove(const shared_ptr<ParallelJob>& job)
+    {
+        lock_guard<mutex> guard(lock_);
+        for (auto it = jobs_.begin(); it != jobs_.end(); ++it) {
+            if (*it == job) {
+                jobs_.erase(it);
+                break;
+            }
+        }
+    }
+
+private:
+    void WorkerEntry()
+    {
+        while (true) {
+            shared_ptr<ParallelJob> job;
+            {
+                unique_lock<mutex> guard(lock_);
+                wakeup_.wait(guard, [this] { return !jobs_.empty(); });
+                job = jobs_.front();
+                // every chunk is taken, the job is left to the running threads
+                if (job->next.load() >= job->chunks) {
+                    jobs_.pop_front();
+                    continue;
+                }
+            }
+            job->RunChunks();
+        }
+    }
+
+    uint32_t workerNum_;
+    mutex lock_;
+    condition_variable wakeup_;
+    deque<shared_ptr<ParallelJob>> jobs_;
+};
+
+atomic<uint32_t> g_workerNum(kWorkersUnset);
+
+uint32_t DefaultWorkerNum()
+{
+    uint32_t cpuNum = thread::hardware_concurrency();
+    if (cpuNum <= 1) {
+        return 0;
+    }
+    return (cpuNum - 1 > kMaxDefaultWorkers) ? kMaxDefaultWorkers : cpuNum - 1;
+}
+
+// the pool lives until the process exits, its workers are detached
+WorkerPool& GetWorkerPool()
+{
+    static WorkerPool* pool = nullptr;
+    static once_flag created;
+    call_once(created, [] {
+        uint32_t expected = kWorkersUnset;
+        g_workerNum.compare_exchange_strong(expected, DefaultWorkerNum());
+        pool = new WorkerPool(g_workerNum.load());
+    });
+    return *pool;
+}
+}
+
+void ParallelFor(uint32_t count, uint32_t grain, const ParallelTask& task)
+{
+    if (count == 0) {
+        return;
+    }
+    if (grain == 0) {
+        grain = 1;
+    }
+    uint32_t chunks = (count + grain - 1) / grain;
+    WorkerPool& pool = GetWorkerPool();
+    if (chunks == 1 || pool.WorkerNum() == 0) {
+        task(0, count);
+        return;
+    }
+
+    shared_ptr<ParallelJob> job = make_shared<ParallelJob>();
+    job->task = &task;
+    job->count = count;
+    job->grain = grain;
+    job->chunks = chunks;
+    pool.Post(job);
+    job->RunChunks();
+    pool.Remove(job);
+
+    unique_lock<mutex> guard(job->lock);
+    job->finished.wait(guard, [&job] { return job->done.load() == job->chunks; });
+}
+
+void SetParallelWorkers(uint32_t num)
+{
+    uint32_t expected = kWorkersUnset;
+    if (!g_workerNum.compare_exchange_strong(expected, num)) {
+        LOG_WARNING("Parallel workers already started with %u threads", expected);
+    }
+}
+
+uint32_t GetParallelWorkers()
+{
+    return GetWorkerPool().WorkerNum();
+}
@@ -0,0 +1,174 @@
+/**
+* Copyright (c) Huawei Technologies Co., Ltd. 2020-2022. All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+
+* http://www.apache.org/licenses/LICENSE-2.0
+
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+
+* File PartitionRouter.cpp
+* Description: key affine routing over the replicas of a stage
+*/
+#include <map>
+#include <memory>
+#include "PartitionRouter.h"
+
+using namespace std;
+
+namespace {
+const uint64_t kFnvOffset = 0xcbf29ce484222325ULL;
+const uint64_t kFnvPrime = 0x100000001b3ULL;
+
+// the seed of a replica comes from its name, so it does not depend on the
+// start order and a restarted replica gets its keys back
+uint64_t HashName(const string& name)
+{
+    uint64_t hash = kFnvOffset;
+    for (unsigned char c : name) {
+        hash = (hash ^ c) * kFnvPrime;
+    }
+    return hash;
+}
+
+// splitmix64 finalizer
+uint64_t Mix(uint64_t x)
+{
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+}
+
+size_t PickReplica(uint64_t key, const vector<uint64_t>& seeds)
+{
+    size_t best = seeds.size();
+    uint64_t bestScore = 0;
+    uint64_t keyHash = Mix(key);
+    for (size_t i = 0; i < seeds.size(); i++) {
+        uint64_t score = Mix(keyHash ^ seeds[i]);
+        if (best == seeds.size() || score > bestScore) {
+            best = i;
+            bestScore = score;
+        }
+    }
+    return best;
+}
+
+PartitionRouter::PartitionRouter(const string& group) : group_(group), routed_(0), heldRoutes_(0)
+{
+}
+
+void PartitionRouter::AddReplica(int instId, const string& name)
+{
+    lock_guard<mutex> guard(lock_);
+    for (ReplicaStats& replica : replicas_) {
+        if (replica.instId == instId) {
+            replica.active = true;
+            UpdateActive();
+            return;
+        }
+    }
+    ReplicaStats replica;
+    replica.instId = instId;
+    replica.name = name;
+    replica.active = true;
+    replicas_.push_back(replica);
+    UpdateActive();
+}
+
+bool PartitionRouter::SetActive(int instId, bool active)
+{
+    lock_guard<mutex> guard(lock_);
+    for (ReplicaStats& replica : replicas_) {
+        if (replica.instId == instId) {
+            replica.active = active;
+            UpdateActive();
+            return true;
+        }
+    }
+    return false;
+}
+
+int PartitionRouter::Route(uint64_t key)
+{
+    lock_guard<mutex> guard(lock_);
+    KeyState& state = keys_[key];
+    size_t index = 0;
+    if (state.inFlight > 0) {
+        // stay behind the messages in flight, even on an inactive replica
+        index = state.index;
+        size_t pick = PickReplica(key, activeSeeds_);
+        if (pick == activeSeeds_.size() || activeIndex_[pick] != index) {
+            heldRoutes_++;
+        }
+    } else {
+        size_t pick = PickReplica(key, activeSeeds_);
+        if (pick == activeSeeds_.size()) {
+            keys_.erase(key);
+            return -1;
+        }
+        index = activeIndex_[pick];
+    }
+    state.index = index;
+    state.inFlight++;
+    routed_++;
+    replicas_[index].routed++;
+    return replicas_[index].instId;
+}
+
+void PartitionRouter::Release(uint64_t key)
+{
+    lock_guard<mutex> guard(lock_);
+    auto state = keys_.find(key);
+    if (state == keys_.end()) {
+        return;
+    }
+    if (--state->second.inFlight == 0) {
+        // the next message of the key picks again, on the replicas active then
+        keys_.erase(state);
+    }
+}
+
+PartitionStats PartitionRouter::GetStats()
+{
+    lock_guard<mutex> guard(lock_);
+    PartitionStats stats;
+    stats.group = group_;
+    stats.replicas = replicas_;
+    stats.routed = routed_;
+    stats.heldRoutes = heldRoutes_;
+    stats.keysInFlight = keys_.size();
+    return stats;
+}
+
+void PartitionRouter::UpdateActive()
+{
+    activeSeeds_.clear();
+    activeIndex_.clear();
+    for (size_t i = 0; i < replicas_.size(); i++) {
+        if (replicas_[i].active) {
+            activeSeeds_.push_back(HashName(replicas_[i].name));
+            activeIndex_.push_back(i);
+        }
+    }
+}
+
+PartitionRouter* GetPartitionRouter(const string& group)
+{
+    static mutex registryLock;
+    // never freed, thread loops may still release keys at exit
+    static map<string, unique_ptr<PartitionRouter>>* routers = new map<string, unique_ptr<PartitionRouter>>();
+    lock_guard<mutex> guard(registryLock);
+    unique_ptr<PartitionRouter>& router = (*routers)[group];
+    if (router == nullptr) {
+        router.reset(new PartitionRouter(group));
+    }
+    return router.get();
+}
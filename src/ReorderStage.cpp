@@ -0,0 +1,225 @@
+/**
+* Copyright (c) Huawei Technologies Co., Ltd. 2020-2022. All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+
+* http://www.apache.org/licenses/LICENSE-2.0
+
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+
+* File ReorderStage.cpp
+* Description: reorder buffer that restores frameId order after parallel workers
+*/
+#include <algorithm>
+#include "App.h"
+#include "ReorderStage.h"
+
+using namespace std;
+
+namespace {
+// longest sleep of one tick waiting for a gap timeout
+const int64_t kMaxTickWaitUs = 1000;
+}
+
+ReorderStage::ReorderStage(const ReorderStageConfig& config) : config_(config), destId_(INVALID_INSTANCE_ID),
+    occupancy_(0)
+{
+    config_.windowSize = max(config_.windowSize, 1u);
+    config_.gapTimeoutUs = max<int64_t>(config_.gapTimeoutUs, 0);
+}
+
+int ReorderStage::Init()
+{
+    return OK;
+}
+
+int ReorderStage::Process(int msgId, shared_ptr<void> msgData)
+{
+    if (msgId == config_.inputMsgId) {
+        AddFrame(msgData, CurrentMessageBytes());
+    } else if (msgId == MSG_REORDER_TICK) {
+        Tick();
+    } else if (msgId == MSG_REORDER_FLUSH) {
+        for (auto& item : streams_) {
+            while (!item.second.window.empty()) {
+                SkipGap(item.second);
+                ReleaseReady(item.second);
+            }
+        }
+    } else {
+        LOG_WARNING("Reorder stage %s ignores message %d", SelfInstanceName().c_str(), msgId);
+        return OK;
+    }
+    UpdateStats();
+    return OK;
+}
+
+ReorderStageStats ReorderStage::GetStats()
+{
+    lock_guard<mutex> guard(statsLock_);
+    return stats_;
+}
+
+void ReorderStage::AddFrame(shared_ptr<void> item, uint64_t bytes)
+{
+    ReorderKey key;
+    bool valid = false;
+    if (item != nullptr) {
+        if (config_.getKey) {
+            valid = config_.getKey(item, key);
+        } else {
+            const FrameData* frame = static_cast<const FrameData*>(item.get());
+            key.frameId = frame->frameId;
+            key.isFinished = frame->isFinished;
+            valid = true;
+        }
+    }
+    if (!valid) {
+        totals_.rejected++;
+        return;
+    }
+    auto found = streams_.find(key.streamId);
+    if (found == streams_.end()) {
+        found = streams_.insert(make_pair(key.streamId, Stream())).first;
+        found->second.nextFrameId = config_.firstFrameId;
+        found->second.stats.streamId = key.streamId;
+    }
+    Stream& stream = found->second;
+    if (key.frameId < stream.nextFrameId) {
+        stream.stats.lateFrames++;
+        totals_.lateFrames++;
+        if (config_.forwardLate) {
+            Send(item, bytes);
+        }
+        return;
+    }
+    Pending pending;
+    pending.item = item;
+    pending.bytes = bytes;
+    pending.isFinished = key.isFinished;
+    pending.arrivalUs = MsgClockUs();
+    if (!stream.window.insert(make_pair(key.frameId, pending)).second) {
+        stream.stats.duplicates++;
+        totals_.duplicates++;
+        return;
+    }
+    occupancy_++;
+    // still memory in flight while it waits in the window
+    HoldBytes(bytes);
+    stream.stats.maxOccupancy = max(stream.stats.maxOccupancy, static_cast<uint32_t>(stream.window.size()));
+    ReleaseReady(stream);
+    while (stream.window.size() > config_.windowSize) {
+        // a full window does not wait for the timeout
+        totals_.overflowSkips++;
+        SkipGap(stream);
+        ReleaseReady(stream);
+    }
+    if (!stream.window.empty()) {
+        ScheduleTick(MSG_REORDER_TICK);
+    }
+}
+
+void ReorderStage::ReleaseReady(Stream& stream)
+{
+    while (!stream.window.empty() && stream.window.begin()->first == stream.nextFrameId) {
+        Pending pending = stream.window.begin()->second;
+        stream.window.erase(stream.window.begin());
+        occupancy_--;
+        stream.nextFrameId++;
+        stream.stats.released++;
+        totals_.released++;
+        Send(pending.item, pending.bytes);
+        ReleaseHeldBytes(pending.bytes);
+        if (pending.isFinished) {
+            // a new run of the stream starts over, frames held past the
+            // finish are sent as they are
+            while (!stream.window.empty()) {
+                Pending rest = stream.window.begin()->second;
+                stream.window.erase(stream.window.begin());
+                occupancy_--;
+                stream.stats.released++;
+                totals_.released++;
+                Send(rest.item, rest.bytes);
+                ReleaseHeldBytes(rest.bytes);
+            }
+            stream.nextFrameId = config_.firstFrameId;
+            return;
+        }
+    }
+}
+
+void ReorderStage::SkipGap(Stream& stream)
+{
+    if (stream.window.empty()) {
+        return;
+    }
+    uint32_t lowest = stream.window.begin()->first;
+    if (lowest > stream.nextFrameId) {
+        stream.stats.skipped += lowest - stream.nextFrameId;
+        totals_.skipped += lowest - stream.nextFrameId;
+        stream.nextFrameId = lowest;
+    }
+}
+
+void ReorderStage::Tick()
+{
+    int64_t nowUs = MsgClockUs();
+    int64_t nextTimeoutUs = -1;
+    for (auto& item : streams_) {
+        Stream& stream = item.second;
+        while (!stream.window.empty()) {
+            int64_t oldestUs = nowUs;
+            for (auto& pending : stream.window) {
+                oldestUs = min(oldestUs, pending.second.arrivalUs);
+            }
+            int64_t timeoutUs = oldestUs + config_.gapTimeoutUs;
+            if (timeoutUs > nowUs) {
+                nextTimeoutUs = (nextTimeoutUs < 0) ? timeoutUs : min(nextTimeoutUs, timeoutUs);
+                break;
+            }
+            totals_.timeoutSkips++;
+            SkipGap(stream);
+            ReleaseReady(stream);
+        }
+    }
+    if (nextTimeoutUs < 0) {
+        return;
+    }
+    ScheduleTick(MSG_REORDER_TICK, min(nextTimeoutUs - nowUs, kMaxTickWaitUs));
+}
+
+void ReorderStage::Send(const shared_ptr<void>& item, uint64_t bytes)
+{
+    if (destId_ == INVALID_INSTANCE_ID) {
+        destId_ = GetThreadIdByName(config_.destThread);
+        if (destId_ == INVALID_INSTANCE_ID) {
+            LOG_ERROR("Reorder stage %s has no receiver thread %s, frame lost", SelfInstanceName().c_str(),
+                      config_.destThread.c_str());
+            return;
+        }
+    }
+    Error ret = SendWithRetry(destId_, config_.destMsgId, item, bytes, totals_.queueFullRetries);
+    if (ret != OK) {
+        LOG_ERROR("Reorder stage %s send failed, error %d", SelfInstanceName().c_str(), ret);
+    }
+}
+
+void ReorderStage::UpdateStats()
+{
+    lock_guard<mutex> guard(statsLock_);
+    stats_ = totals_;
+    stats_.occupancy = occupancy_;
+    stats_.streams.clear();
+    for (auto& item : streams_) {
+        ReorderStreamStats stream = item.second.stats;
+        stream.occupancy = item.second.window.size();
+        stream.nextFrameId = item.second.nextFrameId;
+        stats_.streams.push_back(stream);
+    }
+}
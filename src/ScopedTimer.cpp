@@ -0,0 +1,403 @@
+/**
+* Copyright (c) Huawei Technologies Co., Ltd. 2020-2022. All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+
+* http://www.apache.org/licenses/LICENSE-2.0
+
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+
+* File ScopedTimer.cpp
+* Description: named scoped timers recorded into histograms
+*/
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+#include "ScopedTimer.h"
+#include "Utils.h"
+
+using namespace std;
+
+namespace {
+// log linear buckets, values below 16 have their own bucket and every
+// power of two above is split in 16
+const uint32_t kSubBucketBits = 4;
+const uint32_t kSubBuckets = 1 << kSubBucketBits;
+const uint32_t kBucketNum = (64 - kSubBucketBits + 1) * kSubBuckets;
+const double kNsPerUs = 1000.0;
+const double kP50 = 0.5;
+const double kP99 = 0.99;
+const double kP999 = 0.999;
+
+inline uint32_t BucketIndex(uint64_t value)
+{
+    if (value < kSubBuckets) {
+        return static_cast<uint32_t>(value);
+    }
+    uint32_t exponent = 63 - __builtin_clzll(value);
+    uint32_t sub = static_cast<uint32_t>(value >> (exponent - kSubBucketBits)) & (kSubBuckets - 1);
+    return (exponent - kSubBucketBits + 1) * kSubBuckets + sub;
+}
+
+// the middle of the values falling in the bucket
+inline double BucketValue(uint32_t index)
+{
+    if (index < kSubBuckets) {
+        return index;
+    }
+    uint32_t exponent = index / kSubBuckets + kSubBucketBits - 1;
+    uint32_t sub = index % kSubBuckets;
+    double width = static_cast<double>(1ULL << (exponent - kSubBucketBits));
+    return (kSubBuckets + sub) * width + width / 2;
+}
+
+/**
+ * Written by one thread with plain relaxed stores, read by the reporter
+ */
+struct Histogram {
+    Histogram()
+    {
+        Clear();
+    }
+
+    void Clear()
+    {
+        count.store(0, memory_order_relaxed);
+        total.store(0, memory_order_relaxed);
+        minValue.store(UINT64_MAX, memory_order_relaxed);
+        maxValue.store(0, memory_order_relaxed);
+        for (auto& bucket : buckets) {
+            bucket.store(0, memory_order_relaxed);
+        }
+    }
+
+    void Add(uint64_t value)
+    {
+        atomic<uint64_t>& bucket = buckets[BucketIndex(value)];
+        bucket.store(bucket.load(memory_order_relaxed) + 1, memory_order_relaxed);
+        count.store(count.load(memory_order_relaxed) + 1, memory_order_relaxed);
+        total.store(total.load(memory_order_relaxed) + value, memory_order_relaxed);
+        if (value < minValue.load(memory_order_relaxed)) {
+            minValue.store(value, memory_order_relaxed);
+        }
+        if (value > maxValue.load(memory_order_relaxed)) {
+            maxValue.store(value, memory_order_relaxed);
+        }
+    }
+
+    atomic<uint64_t> count;
+    atomic<uint64_t> total;
+    atomic<uint64_t> minValue;
+    atomic<uint64_t> maxValue;
+    atomic<uint64_t> buckets[kBucketNum];
+};
+
+struct MergedHistogram {
+    uint64_t count = 0;
+    uint64_t total = 0;
+    uint64_t minValue = UINT64_MAX;
+    uint64_t maxValue = 0;
+    vector<uint64_t> buckets = vector<uint64_t>(kBucketNum, 0);
+
+    void Merge(const Histogram& histogram)
+    {
+        count += histogram.count.load(memory_order_relaxed);
+        total += histogram.total.load(memory_order_relaxed);
+        uint64_t minValueOfThread = histogram.minValue.load(memory_order_relaxed);
+        uint64_t maxValueOfThread = histogram.maxValue.load(memory_order_relaxed);
+        minValue = (minValueOfThread < minValue) ? minValueOfThread : minValue;
+        maxValue = (maxValueOfThread > maxValue) ? maxValueOfThread : maxValue;
+        for (uint32_t i = 0; i < kBucketNum; i++) {
+            buckets[i] += histogram.buckets[i].load(memory_order_relaxed);
+        }
+    }
+
+    void Merge(const MergedHistogram& other)
+    {
+        count += other.count;
+        total += other.total;
+        minValue = (other.minValue < minValue) ? other.minValue : minValue;
+        maxValue = (other.maxValue > maxValue) ? other.maxValue : maxValue;
+        for (uint32_t i = 0; i < kBucketNum; i++) {
+            buckets[i] += other.buckets[i];
+        }
+    }
+
+    double Percentile(double ratio) const
+    {
+        uint64_t rank = static_cast<uint64_t>(ratio * count);
+        rank = (rank >= count) ? count - 1 : rank;
+        uint64_t seen = 0;
+        for (uint32_t i = 0; i < kBucketNum; i++) {
+            seen += buckets[i];
+            if (seen > rank) {
+                double value = BucketValue(i);
+                // the bucket middle can lie outside what was seen
+                value = (value < minValue) ? minValue : value;
+                return (value > maxValue) ? maxValue : value;
+            }
+        }
+        return maxValue;
+    }
+};
+
+/**
+ * TSC to nanoseconds, measured against steady_clock from the first use
+ * up to the latest report
+ */
+class TimerClock {
+public:
+    static TimerClock& GetInstance()
+    {
+        static TimerClock instance;
+        return instance;
+    }
+
+    bool UsesTsc() const
+    {
+        return useTsc_;
+    }
+
+    double NsPerTick()
+    {
+        if (!useTsc_) {
+            return 1.0;
+        }
+        lock_guard<mutex> guard(lock_);
+        uint64_t tsc = TimerTicks();
+        int64_t ns = SteadyNs();
+        if (ns > startNs_ && tsc > startTsc_) {
+            nsPerTick_ = static_cast<double>(ns - startNs_) / (tsc - startTsc_);
+        }
+        return nsPerTick_;
+    }
+
+private:
+    TimerClock() : useTsc_(InvariantTsc()), startTsc_(0), startNs_(0), nsPerTick_(1.0)
+    {
+        if (!useTsc_) {
+            return;
+        }
+        // a first guess, refined at each report over a longer span
+        startTsc_ = TimerTicks();
+        startNs_ = SteadyNs();
+        while (SteadyNs() - startNs_ < kCalibrateNs) {
+        }
+        nsPerTick_ = static_cast<double>(SteadyNs() - startNs_) / (TimerTicks() - startTsc_);
+    }
+
+    static bool InvariantTsc()
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        unsigned int eax = 0;
+        unsigned int ebx = 0;
+        unsigned int ecx = 0;
+        unsigned int edx = 0;
+        if (__get_cpuid(kCpuidPowerLeaf, &eax, &ebx, &ecx, &edx) == 0) {
+            return false;
+        }
+        return (edx & kInvariantTscBit) != 0;
+#else
+        return false;
+#endif
+    }
+
+    static uint64_t TimerTicks()
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#else
+        return 0;
+#endif
+    }
+
+    static int64_t SteadyNs()
+    {
+        return chrono::duration_cast<chrono::nanoseconds>(
+            chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    static const unsigned int kCpuidPowerLeaf = 0x80000007;
+    static const unsigned int kInvariantTscBit = 1 << 8;
+    static const int64_t kCalibrateNs = 2000000;
+
+    const bool useTsc_;
+    mutex lock_;
+    uint64_t startTsc_;
+    int64_t startNs_;
+    double nsPerTick_;
+};
+
+/**
+ * Timer names and the histograms of all threads. A thread that ends
+ * folds its histograms into retired_
+ */
+class TimerRegistry {
+public:
+    static TimerRegistry& GetInstance()
+    {
+        static TimerRegistry* instance = new TimerRegistry();
+        return *instance;
+    }
+
+    uint32_t Register(const char* name)
+    {
+        lock_guard<mutex> guard(lock_);
+        auto it = ids_.find(name);
+        if (it != ids_.end()) {
+            return it->second;
+        }
+        uint32_t id = names_.size();
+        names_.push_back(name);
+        ids_[name] = id;
+        return id;
+    }
+
+    Histogram* Create(uint32_t timerId, vector<shared_ptr<Histogram>>& local)
+    {
+        lock_guard<mutex> guard(lock_);
+        if (local.size() <= timerId) {
+            local.resize(timerId + 1);
+        }
+        local[timerId] = make_shared<Histogram>();
+        threads_.insert(&local);
+        return local[timerId].get();
+    }
+
+    void Retire(vector<shared_ptr<Histogram>>& local)
+    {
+        lock_guard<mutex> guard(lock_);
+        for (uint32_t id = 0; id < local.size(); id++) {
+            if (local[id] != nullptr) {
+                retired_[id].Merge(*local[id]);
+            }
+        }
+        threads_.erase(&local);
+    }
+
+    vector<TimerStats> Report()
+    {
+        double nsPerTick = TimerClock::GetInstance().NsPerTick();
+        double usPerTick = nsPerTick / kNsPerUs;
+        lock_guard<mutex> guard(lock_);
+        vector<MergedHistogram> merged(names_.size());
+        for (const auto& item : retired_) {
+            merged[item.first].Merge(item.second);
+        }
+        for (const auto* local : threads_) {
+            for (uint32_t id = 0; id < local->size(); id++) {
+                if ((*local)[id] != nullptr) {
+                    merged[id].Merge(*(*local)[id]);
+                }
+            }
+        }
+        vector<TimerStats> report;
+        for (uint32_t id = 0; id < names_.size(); id++) {
+            const MergedHistogram& histogram = merged[id];
+            if (histogram.count == 0) {
+                continue;
+            }
+            TimerStats stats;
+            stats.name = names_[id];
+            stats.count = histogram.count;
+            stats.totalUs = histogram.total * usPerTick;
+            stats.meanUs = stats.totalUs / histogram.count;
+            stats.minUs = histogram.minValue * usPerTick;
+            stats.p50Us = histogram.Percentile(kP50) * usPerTick;
+            stats.p99Us = histogram.Percentile(kP99) * usPerTick;
+            stats.p999Us = histogram.Percentile(kP999) * usPerTick;
+            stats.maxUs = histogram.maxValue * usPerTick;
+            report.push_back(stats);
+        }
+        return report;
+    }
+
+    void Reset()
+    {
+        lock_guard<mutex> guard(lock_);
+        retired_.clear();
+        // the owners keep writing, a sample taken meanwhile may survive
+        for (auto* local : threads_) {
+            for (auto& histogram : *local) {
+                if (histogram != nullptr) {
+                    histogram->Clear();
+                }
+            }
+        }
+    }
+
+private:
+    TimerRegistry() {}
+
+    mutex lock_;
+    vector<string> names_;
+    map<string, uint32_t> ids_;
+    set<vector<shared_ptr<Histogram>>*> threads_;
+    map<uint32_t, MergedHistogram> retired_;
+};
+}
+
+bool TimerUsesTsc()
+{
+    static const bool useTsc = TimerClock::GetInstance().UsesTsc();
+    return useTsc;
+}
+
+uint32_t RegisterTimer(const char* name)
+{
+    // the clock is set up before the first sample is taken
+    TimerUsesTsc();
+    return TimerRegistry::GetInstance().Register(name);
+}
+
+void RecordTimer(uint32_t timerId, uint64_t ticks)
+{
+    struct LocalHistograms {
+        vector<shared_ptr<Histogram>> histograms;
+        ~LocalHistograms()
+        {
+            TimerRegistry::GetInstance().Retire(histograms);
+        }
+    };
+    thread_local LocalHistograms local;
+    Histogram* histogram = nullptr;
+    if (timerId < local.histograms.size()) {
+        histogram = local.histograms[timerId].get();
+    }
+    if (histogram == nullptr) {
+        histogram = TimerRegistry::GetInstance().Create(timerId, local.histograms);
+    }
+    histogram->Add(ticks);
+}
+
+vector<TimerStats> GetTimerReport()
+{
+    return TimerRegistry::GetInstance().Report();
+}
+
+void LogTimerReport()
+{
+    for (const auto& stats : GetTimerReport()) {
+        // one line per timer, more than the rate limit of a site may pass
+        LOG_AT_UNLIMITED(LOG_LEVEL_INFO,
+                         "Timer %s count %lu mean %.1f us p50 %.1f us p99 %.1f us p999 %.1f us max %.1f us",
+                         stats.name.c_str(), (unsigned long)stats.count, stats.meanUs, stats.p50Us,
+                         stats.p99Us, stats.p999Us, stats.maxUs);
+    }
+}
+
+void ResetTimers()
+{
+    TimerRegistry::GetInstance().Reset();
+}
@@ -0,0 +1,89 @@
+/**
+* Copyright (c) Huawei Technologies Co., Ltd. 2020-2022. All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+
+* http://www.apache.org/licenses/LICENSE-2.0
+
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+
+* File Simd.cpp
+* Description: runtime cpu feature dispatch and shared simd helpers
+*/
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include "Simd.h"
+#include "Utils.h"
+
+using namespace std;
+
+namespace {
+const char* kSimdEnv = "RUN_LOOP_SIMD";
+const char* kSimdLevelNames[] = { "scalar", "sse41", "avx2", "avx512" };
+const int kLevelUnknown = -1;
+
+atomic<int> g_simdLevel(kLevelUnknown);
+
+SimdLevel DetectSimdLevel()
+{
+#if SIMD_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")) {
+        return SIMD_AVX512;
+    }
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        return SIMD_AVX2;
+    }
+    if (__builtin_cpu_supports("sse4.1")) {
+        return SIMD_SSE41;
+    }
+#endif
+    return SIMD_SCALAR;
+}
+
+SimdLevel EnvSimdLevel(SimdLevel detected)
+{
+    const char* env = getenv(kSimdEnv);
+    if (env == nullptr) {
+        return detected;
+    }
+    for (int i = SIMD_SCALAR; i <= SIMD_AVX512; i++) {
+        if (strcmp(env, kSimdLevelNames[i]) == 0) {
+            return (i < detected) ? static_cast<SimdLevel>(i) : detected;
+        }
+    }
+    LOG_WARNING("Ignore invalid %s=%s", kSimdEnv, env);
+    return detected;
+}
+}
+
+SimdLevel GetSimdLevel()
+{
+    int level = g_simdLevel.load(memory_order_relaxed);
+    if (level == kLevelUnknown) {
+        level = EnvSimdLevel(DetectSimdLevel());
+        g_simdLevel.store(level, memory_order_relaxed);
+    }
+    return static_cast<SimdLevel>(level);
+}
+
+void SetSimdLevel(SimdLevel level)
+{
+    SimdLevel detected = DetectSimdLevel();
+    g_simdLevel.store((level < detected) ? level : detected, memory_order_relaxed);
+}
+
+const char* SimdLevelName(SimdLevel level)
+{
+    if (level < SIMD_SCALAR || level > SIMD_AVX512) {
+        return "unknown";
+    }
+    return kSimdLevelNames[level];
+}
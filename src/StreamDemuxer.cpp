@@ -0,0 +1,395 @@
+/**
+* Copyright (c) Huawei Technologies Co., Ltd. 2020-2022. All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+
+* http://www.apache.org/licenses/LICENSE-2.0
+
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+
+* File StreamDemuxer.cpp
+* Description: H.264/H.265 Annex-B elementary stream source thread
+*/
+#include <algorithm>
+#include <cctype>
+#include "App.h"
+#include "Simd.h"
+#include "StreamDemuxer.h"
+
+using namespace std;
+
+namespace {
+const uint32_t kStartCodeSize = 3;
+// wait when the receiver queue is full
+const uint32_t kRetryWaitUs = 1000;
+// longest sleep of one tick waiting for a paced frame
+const int64_t kMaxPaceWaitUs = 10000;
+
+const uint32_t kH264NalTypeMask = 0x1F;
+const uint8_t kH264SliceNonIdr = 1;
+const uint8_t kH264SliceIdr = 5;
+const uint8_t kH264Sei = 6;
+const uint8_t kH264Aud = 9;
+const uint8_t kH264PrefixFirst = 14;
+const uint8_t kH264PrefixLast = 18;
+
+const uint8_t kH265VclLast = 31;
+const uint8_t kH265IrapFirst = 16;
+const uint8_t kH265IrapLast = 23;
+const uint8_t kH265Vps = 32;
+const uint8_t kH265Aud = 35;
+const uint8_t kH265PrefixSei = 39;
+const uint8_t kH265RsvFirst = 41;
+const uint8_t kH265RsvLast = 44;
+const uint8_t kH265UnspecFirst = 48;
+const uint8_t kH265UnspecLast = 55;
+
+// first_mb_in_slice, first_slice_segment_in_pic_flag: a leading 1 bit
+const uint8_t kFirstSliceBit = 0x80;
+
+const uint8_t* FindStartCodeScalar(const uint8_t* p, const uint8_t* end)
+{
+    // the third byte decides how far the next prefix can start
+    while (end - p >= (ptrdiff_t)kStartCodeSize) {
+        if (p[2] > 1) {
+            p += kStartCodeSize;
+        } else if (p[2] == 0) {
+            p++;
+        } else if (p[0] == 0 && p[1] == 0) {
+            return p;
+        } else {
+            p += kStartCodeSize;
+        }
+    }
+    return end;
+}
+
+#if SIMD_X86
+const uint8_t* FindStartCodeSse2(const uint8_t* p, const uint8_t* end)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i one = _mm_set1_epi8(1);
+    while (end - p >= 16 + 2) {
+        __m128i b0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        __m128i b1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 1));
+        __m128i b2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 2));
+        __m128i hit = _mm_and_si128(_mm_and_si128(_mm_cmpeq_epi8(b0, zero), _mm_cmpeq_epi8(b1, zero)),
+                                    _mm_cmpeq_epi8(b2, one));
+        uint32_t mask = _mm_movemask_epi8(hit);
+        if (mask != 0) {
+            return p + __builtin_ctz(mask);
+        }
+        p += 16;
+    }
+    return FindStartCodeScalar(p, end);
+}
+
+SIMD_TARGET("avx2")
+const uint8_t* FindStartCodeAvx2(const uint8_t* p, const uint8_t* end)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i one = _mm256_set1_epi8(1);
+    while (end - p >= 32 + 2) {
+        __m256i b2 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + 2));
+        __m256i ones = _mm256_cmpeq_epi8(b2, one);
+        // most blocks have no 01 byte at all
+        if (_mm256_testz_si256(ones, ones)) {
+            p += 32;
+            continue;
+        }
+        __m256i b0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        __m256i b1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + 1));
+        __m256i hit = _mm256_and_si256(_mm256_and_si256(_mm256_cmpeq_epi8(b0, zero),
+                                                        _mm256_cmpeq_epi8(b1, zero)), ones);
+        uint32_t mask = _mm256_movemask_epi8(hit);
+        if (mask != 0) {
+            return p + __builtin_ctz(mask);
+        }
+        p += 32;
+    }
+    return FindStartCodeScalar(p, end);
+}
+#endif
+
+StreamCodec CodecOfFile(const string& path)
+{
+    string::size_type pos = path.rfind('.');
+    string ext = (pos == string::npos) ? "" : path.substr(pos + 1);
+    transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return tolower(c); });
+    return (ext == "h265" || ext == "hevc" || ext == "265") ? STREAM_CODEC_H265 : STREAM_CODEC_H264;
+}
+}
+
+const uint8_t* FindStartCode(const uint8_t* begin, const uint8_t* end)
+{
+    if (begin >= end) {
+        return end;
+    }
+#if SIMD_X86
+    SimdLevel level = GetSimdLevel();
+    if (level >= SIMD_AVX2) {
+        return FindStartCodeAvx2(begin, end);
+    }
+    if (level >= SIMD_SSE41) {
+        return FindStartCodeSse2(begin, end);
+    }
+#endif
+    return FindStartCodeScalar(begin, end);
+}
+
+AnnexBParser::AnnexBParser(const uint8_t* data, uint64_t size, StreamCodec codec)
+    : begin_(data), end_(data + size), next_(data), codec_(codec)
+{
+}
+
+void AnnexBParser::Rewind()
+{
+    next_ = begin_;
+}
+
+bool AnnexBParser::StartsAccessUnit(const uint8_t* nal, bool haveSlice, bool& isSlice, bool& isKey) const
+{
+    if (codec_ == STREAM_CODEC_H265) {
+        uint8_t type = (nal[0] >> 1) & 0x3F;
+        isSlice = (type <= kH265VclLast);
+        isKey = (type >= kH265IrapFirst && type <= kH265IrapLast);
+        if (isSlice) {
+            bool firstSlice = (end_ - nal > 2) && (nal[2] & kFirstSliceBit) != 0;
+            return haveSlice && firstSlice;
+        }
+        bool prefix = (type >= kH265Vps && type <= kH265Aud) || type == kH265PrefixSei ||
+                      (type >= kH265RsvFirst && type <= kH265RsvLast) ||
+                      (type >= kH265UnspecFirst && type <= kH265UnspecLast);
+        return haveSlice && prefix;
+    }
+
+    uint8_t type = nal[0] & kH264NalTypeMask;
+    isSlice = (type == kH264SliceNonIdr || type == kH264SliceIdr);
+    isKey = (type == kH264SliceIdr);
+    if (isSlice) {
+        bool firstSlice = (end_ - nal > 1) && (nal[1] & kFirstSliceBit) != 0;
+        return haveSlice && firstSlice;
+    }
+    bool prefix = (type >= kH264Sei && type <= kH264Aud) ||
+                  (type >= kH264PrefixFirst && type <= kH264PrefixLast);
+    return haveSlice && prefix;
+}
+
+bool AnnexBParser::Next(AccessUnit& unit)
+{
+    if (next_ >= end_) {
+        return false;
+    }
+    const uint8_t* start = next_;
+    const uint8_t* code = FindStartCode(start, end_);
+    bool haveSlice = false;
+    bool isKey = false;
+    const uint8_t* stop = end_;
+    while (code != end_) {
+        const uint8_t* nal = code + kStartCodeSize;
+        if (nal >= end_) {
+            break;
+        }
+        bool isSlice = false;
+        bool key = false;
+        bool starts = StartsAccessUnit(nal, haveSlice, isSlice, key);
+        if (starts && code > start) {
+            // the zero of a four byte start code goes with the next unit
+            stop = (code > start && code[-1] == 0) ? code - 1 : code;
+            break;
+        }
+        haveSlice = haveSlice || isSlice;
+        isKey = isKey || key;
+        code = FindStartCode(nal, end_);
+    }
+    unit.data = start;
+    unit.size = static_cast<uint32_t>(stop - start);
+    unit.isKeyFrame = isKey;
+    next_ = stop;
+    return true;
+}
+
+StreamDemuxer::StreamDemuxer(const StreamDemuxerConfig& config) : config_(config), hasPending_(false),
+    skipToKey_(false), destId_(INVALID_INSTANCE_ID), running_(false), frameId_(0)
+{
+    config_.framesPerTick = (config_.framesPerTick == 0) ? 1 : config_.framesPerTick;
+    if (config_.codec == STREAM_CODEC_AUTO) {
+        config_.codec = CodecOfFile(config_.filePath);
+    }
+}
+
+int StreamDemuxer::Init()
+{
+    return OK;
+}
+
+int StreamDemuxer::Process(int msgId, shared_ptr<void> msgData)
+{
+    switch (msgId) {
+        case MSG_DEMUX_START:
+            if (running_) {
+                LOG_WARNING("Demuxer %s is running, start ignored", SelfInstanceName().c_str());
+                return OK;
+            }
+            if (Start() != OK) {
+                return OK;
+            }
+            Tick();
+            break;
+        case MSG_DEMUX_TICK:
+            Tick();
+            break;
+        default:
+            LOG_WARNING("Demuxer %s ignores message %d", SelfInstanceName().c_str(), msgId);
+            break;
+    }
+    return OK;
+}
+
+StreamDemuxerStats StreamDemuxer::GetStats()
+{
+    lock_guard<mutex> guard(statsLock_);
+    return stats_;
+}
+
+Error StreamDemuxer::Start()
+{
+    destId_ = GetThreadIdByName(config_.destThread);
+    if (destId_ == INVALID_INSTANCE_ID) {
+        LOG_ERROR("Demuxer %s has no receiver thread %s", SelfInstanceName().c_str(), config_.destThread.c_str());
+        return ERROR_DEST_INVALID;
+    }
+    Error ret = MapBinFile(config_.filePath, file_, MAP_HINT_SEQUENTIAL | MAP_HINT_WILLNEED);
+    if (ret != OK) {
+        LOG_ERROR("Demuxer %s can not map %s, error %d", SelfInstanceName().c_str(),
+                  config_.filePath.c_str(), ret);
+        return ret;
+    }
+    parser_.reset(new AnnexBParser(file_.data.get(), file_.size, config_.codec));
+    hasPending_ = false;
+    skipToKey_ = false;
+    frameId_ = 0;
+    {
+        lock_guard<mutex> guard(statsLock_);
+        stats_ = StreamDemuxerStats();
+    }
+    startTime_ = chrono::steady_clock::now();
+    running_ = true;
+    LOG_INFO("Demuxer %s replays %s as %s, %lu bytes", SelfInstanceName().c_str(), config_.filePath.c_str(),
+             (config_.codec == STREAM_CODEC_H265) ? "H.265" : "H.264", (unsigned long)file_.size);
+    return OK;
+}
+
+void StreamDemuxer::Tick()
+{
+    if (!running_) {
+        return;
+    }
+    uint32_t limit = (config_.fps > 0) ? 1 : config_.framesPerTick;
+    for (uint32_t sent = 0; sent < limit; sent++) {
+        if (!hasPending_) {
+            bool more = parser_->Next(pending_);
+            if (!more && config_.loop && frameId_ > 0) {
+                parser_->Rewind();
+                lock_guard<mutex> guard(statsLock_);
+                stats_.loops++;
+                continue;
+            }
+            if (!more) {
+                SendFinished();
+                if (!running_) {
+                    return;
+                }
+                break;
+            }
+            hasPending_ = true;
+        }
+        if (config_.fps > 0) {
+            chrono::steady_clock::time_point due = startTime_ +
+                chrono::microseconds(static_cast<int64_t>(frameId_ * 1000000.0 / config_.fps));
+            int64_t early = chrono::duration_cast<chrono::microseconds>(due - chrono::steady_clock::now()).count();
+            if (early > 0) {
+                usleep(static_cast<useconds_t>(min(early, kMaxPaceWaitUs)));
+                if (early > kMaxPaceWaitUs) {
+                    break;
+                }
+            } else if (-early > 1000000.0 / config_.fps) {
+                lock_guard<mutex> guard(statsLock_);
+                stats_.lateFrames++;
+            }
+        }
+        if (!SendFrame(pending_)) {
+            usleep(kRetryWaitUs);
+            break;
+        }
+        hasPending_ = false;
+    }
+    Error ret = ScheduleTick(MSG_DEMUX_TICK);
+    if (ret != OK) {
+        LOG_ERROR("Demuxer %s stops for tick failed, error %d", SelfInstanceName().c_str(), ret);
+        running_ = false;
+    }
+}
+
+bool StreamDemuxer::SendFrame(const AccessUnit& unit)
+{
+    if (config_.dropPolicy != nullptr) {
+        skipToKey_ = skipToKey_ && !unit.isKeyFrame;
+        if (skipToKey_ || !config_.dropPolicy->Admit(config_.cameraId, frameId_, unit.isKeyFrame)) {
+            skipToKey_ = true;
+            frameId_++;
+            lock_guard<mutex> guard(statsLock_);
+            stats_.policyDrops++;
+            return true;
+        }
+    }
+    shared_ptr<FrameData> frame = make_shared<FrameData>();
+    frame->frameId = frameId_;
+    frame->size = unit.size;
+    frame->data = const_cast<uint8_t*>(unit.data);
+    frame->isKeyFrame = unit.isKeyFrame;
+    // points into the mapping and keeps it
+    frame->buffer = shared_ptr<const uint8_t>(file_.data, unit.data);
+    Error ret = SendMessage(destId_, config_.destMsgId, frame);
+    lock_guard<mutex> guard(statsLock_);
+    if (ret == ERROR_ENQUEUE) {
+        stats_.queueFullRetries++;
+        return false;
+    }
+    if (ret != OK) {
+        LOG_ERROR("Demuxer %s send frame %u failed, error %d", SelfInstanceName().c_str(), frameId_, ret);
+    }
+    frameId_++;
+    stats_.frames++;
+    stats_.keyFrames += unit.isKeyFrame ? 1 : 0;
+    stats_.bytes += unit.size;
+    return true;
+}
+
+void StreamDemuxer::SendFinished()
+{
+    shared_ptr<FrameData> finished = make_shared<FrameData>();
+    finished->isFinished = true;
+    finished->frameId = frameId_;
+    Error ret = SendMessage(destId_, config_.destMsgId, finished);
+    if (ret == ERROR_ENQUEUE) {
+        lock_guard<mutex> guard(statsLock_);
+        stats_.queueFullRetries++;
+        return;
+    }
+    running_ = false;
+    // the frames still alive hold the mapping
+    parser_.reset();
+    file_ = FileView();
+    StreamDemuxerStats stats = GetStats();
+    chrono::duration<double> elapsed = chrono::steady_clock::now() - startTime_;
+    LOG_INFO("Demuxer %s done: %u frames, %u key frames, %lu bytes in %.3f s",
+             SelfInstanceName().c_str(), stats.frames, stats.keyFrames, (unsigned long)stats.bytes,
+             elapsed.count());
+}
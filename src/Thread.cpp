@@ -17,10 +17,16 @@
 * Description: handle file operations
 */
 #include "Thread.h"
+#include "App.h"
 using namespace std;
+namespace {
+    // wait when the receiver queue is full
+    const uint32_t kRetryWaitUs = 1000;
+}
+
 Thread::Thread():context_(nullptr), runMode_(ACL_HOST),
     instanceId_(INVALID_INSTANCE_ID), instanceName_(""),
-    baseConfiged_(false)
+    baseConfiged_(false), tickMsgId_(0), tickPending_(false), tickDeferred_(false), msgBytes_(0)
 {
 }
 
@@ -41,3 +47,83 @@ Error Thread::BaseConfig(int instanceId, const string& threadName,
     return OK;
 }
 
+void Thread::BeforeProcess(int msgId, uint64_t bytes)
+{
+    msgBytes_ = bytes;
+    if (tickPending_ && !tickDeferred_ && msgId == tickMsgId_) {
+        tickPending_ = false;
+    }
+}
+
+void Thread::AfterProcess()
+{
+    if (!tickDeferred_) {
+        return;
+    }
+    // a message just left the queue. Settled before the send, the tick
+    // must count as queued by the time it runs
+    tickDeferred_ = false;
+    tickPending_ = true;
+    Error ret = SendMessageToQueue(instanceId_, tickMsgId_, nullptr);
+    if (ret == ERROR_ENQUEUE) {
+        tickDeferred_ = true;
+    } else if (ret != OK) {
+        tickPending_ = false;
+    }
+}
+
+Error Thread::ScheduleTick(int tickMsgId, int64_t waitUs)
+{
+    if (tickPending_ && tickMsgId == tickMsgId_) {
+        return OK;
+    }
+    // sleep only with nothing else queued, messages must not wait behind the tick
+    ThreadQueueStats queue;
+    if (waitUs > 0 && GetThreadQueueStats(instanceId_, queue) == OK && queue.depth == 0) {
+        usleep(static_cast<useconds_t>(waitUs));
+    }
+    tickMsgId_ = tickMsgId;
+    // through the queue, a direct call in a fuse group would run the tick
+    // before it counts as pending
+    Error ret = SendMessageToQueue(instanceId_, tickMsgId, nullptr);
+    if (ret == ERROR_ENQUEUE) {
+        // the queue holds other messages, AfterProcess sends it
+        tickDeferred_ = true;
+        ret = OK;
+    }
+    tickPending_ = (ret == OK);
+    return ret;
+}
+
+void Thread::HoldBytes(uint64_t bytes)
+{
+    ThreadMgr* current = ThreadMgr::GetCurrent();
+    if (bytes > 0 && current != nullptr && current->GetUserInstance() == this) {
+        current->HoldBytes(bytes);
+    }
+}
+
+void Thread::ReleaseHeldBytes(uint64_t bytes)
+{
+    ThreadMgr* current = ThreadMgr::GetCurrent();
+    if (bytes > 0 && current != nullptr && current->GetUserInstance() == this) {
+        current->ReleaseHeldBytes(bytes);
+    }
+}
+
+Error Thread::SendWithRetry(int dest, int msgId, shared_ptr<void> data, uint64_t bytes, uint64_t& retries)
+{
+    while (true) {
+        Error ret = SendMessageWithBytes(dest, msgId, data, bytes);
+        if (ret != ERROR_ENQUEUE) {
+            return ret;
+        }
+        ThreadQueueStats self;
+        if (GetThreadQueueStats(instanceId_, self) != OK || self.status != THREAD_RUNNING) {
+            // asked to stop, the receiver may never drain
+            return ret;
+        }
+        retries++;
+        usleep(kRetryWaitUs);
+    }
+}
@@ -16,18 +16,69 @@
 * File ThreadMgr.cpp
 * Description: handle file operations
 */
+#include <algorithm>
+#include <ctime>
 #include "ThreadMgr.h"
 #include "Utils.h"
+#include "MsgAllocator.h"
+#include "PartitionRouter.h"
+#include "MemoryBudget.h"
 using namespace std;
 namespace {
     const uint32_t kWait10Milliseconds = 10000;
     const uint32_t kWaitThreadStart = 1000;
+    // weight of a new sample in the moving averages, 1/8
+    const int kAverageShift = 3;
+    // leader of the fuse group running on the calling OS thread
+    thread_local ThreadMgr* t_fuseLeader = nullptr;
+    // thread in Process on the calling OS thread
+    thread_local ThreadMgr* t_current = nullptr;
+    // longest block on the queue, the status is checked in between
+    const int64_t kParkTimeoutUs = 100000;
+    // longest spin of WAIT_SPIN and WAIT_YIELD before the status is checked
+    const int64_t kSpinCheckUs = 1000;
+    const int64_t kCpuSampleUs = 10000;
+
+    inline void CpuRelax()
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#elif defined(__aarch64__)
+        asm volatile("yield" ::: "memory");
+#endif
+    }
+
+    // end the accounting of a message that is never processed, a key left
+    // in flight would keep routing to a stopped replica
+    void ReleaseUndelivered(const Message& msg)
+    {
+        if (msg.bytes > 0) {
+            MemoryBudget::GetInstance().Release(msg.bytes);
+        }
+        if (msg.partition != nullptr) {
+            msg.partition->Release(msg.partitionKey);
+        }
+    }
+
+    int64_t ThreadCpuUs()
+    {
+        struct timespec ts;
+        if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0) {
+            return 0;
+        }
+        return static_cast<int64_t>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+    }
 }
 
 ThreadMgr::ThreadMgr(Thread* userThreadInstance,
     const string& threadName, const uint32_t msgQueueSize):isExit_(false),
     status_(THREAD_READY), userInstance_(userThreadInstance),
-    name_(threadName), msgQueue_(msgQueueSize)
+    name_(threadName), msgQueue_(msgQueueSize), messages_(0), waitUs_(0),
+    maxWaitUs_(0), serviceUs_(0), busySinceUs_(0), busyMsgId_(0),
+    fuseLeader_(nullptr), inProcess_(false), fuseFailed_(nullptr), router_(nullptr),
+    waitStrategy_(WAIT_SLEEP), spinUs_(0), wakeups_(0), wakeUs_(0), parks_(0), cpuUs_(0),
+    processTotalUs_(0), cpuSampledUs_(0), expired_(0), maxExpiredLateUs_(0),
+    bytesInFlight_(0), maxBytesInFlight_(0), heldBytes_(0), memoryAdmission_(false)
 {
 }
 
@@ -35,7 +86,15 @@ ThreadMgr::~ThreadMgr()
 {
     userInstance_ = nullptr;
     while (!msgQueue_.Empty()) {
-        msgQueue_.Pop();
+        shared_ptr<Message> msg = msgQueue_.Pop();
+        if (msg != nullptr) {
+            ReleaseUndelivered(*msg);
+        }
+    }
+    // payloads the user thread held are gone with it
+    uint64_t held = heldBytes_.exchange(0, memory_order_relaxed);
+    if (held > 0) {
+        MemoryBudget::GetInstance().Release(held);
     }
 }
 
@@ -49,53 +108,283 @@ void ThreadMgr::CreateThread()
 void ThreadMgr::ThreadEntry(void* arg)
 {
     ThreadMgr* thMgr = (ThreadMgr*)arg;
-    Thread* userInstance = thMgr->GetUserInstance();
-    if (userInstance == nullptr) {
-        LOG_ERROR(" thread exit for user thread instance is null");
+    if (thMgr->fuseLeader_ != nullptr && thMgr->fuseLeader_ != thMgr) {
+        // a fused member runs on the OS thread of its leader
         return;
     }
+    vector<ThreadMgr*> members = thMgr->fuseMembers_;
+    if (members.empty()) {
+        members.push_back(thMgr);
+    }
+    for (ThreadMgr* member : members) {
+        Thread* userInstance = member->GetUserInstance();
+        if (userInstance == nullptr) {
+            LOG_ERROR(" thread exit for user thread instance is null");
+            thMgr->StopFuseGroup(nullptr);
+            return;
+        }
 
-    string& instName = userInstance->SelfInstanceName();
-    aclrtContext context = userInstance->GetContext();
-    // aclError aclRet = aclrtSetCurrentContext(context);
-    // if (aclRet != ACL_SUCCESS) {
-    //     LOG_ERROR("Thread %s set context failed, error: %d",
-    //                       instName.c_str(), aclRet);
-    //     return;
-    // }
+        string& instName = userInstance->SelfInstanceName();
+        aclrtContext context = userInstance->GetContext();
+        // aclError aclRet = aclrtSetCurrentContext(context);
+        // if (aclRet != ACL_SUCCESS) {
+        //     LOG_ERROR("Thread %s set context failed, error: %d",
+        //                       instName.c_str(), aclRet);
+        //     return;
+        // }
 
-    int ret = userInstance->Init();
-    if (ret) {
-        LOG_ERROR("Thread %s init error %d, thread exit",
-                          instName.c_str(), ret);
-        thMgr->SetStatus(THREAD_ERROR);
-        return;
+        int ret = userInstance->Init();
+        if (ret) {
+            LOG_ERROR("Thread %s init error %d, thread exit",
+                              instName.c_str(), ret);
+            thMgr->StopFuseGroup(member);
+            return;
+        }
     }
 
-    thMgr->SetStatus(THREAD_RUNNING);
+    for (ThreadMgr* member : members) {
+        member->SetStatus(THREAD_RUNNING);
+    }
+    t_fuseLeader = thMgr;
     while (THREAD_RUNNING == thMgr->GetStatus()) {
         // get data from queue
-        shared_ptr<Message> msg = thMgr->PopMsgFromQueue();
+        bool waited = false;
+        shared_ptr<Message> msg = thMgr->WaitMessage(waited);
         if (msg == nullptr) {
-            usleep(kWait10Milliseconds);
             continue;
         }
+        if (waited) {
+            thMgr->RecordWakeup(MsgClockUs() - msg->enqueueUs);
+        }
         // call function to process thread msg
-        ret = userInstance->Process(msg->msgId, msg->data);
+        ThreadMgr* target = thMgr->FindFuseMember(msg->dest);
+        int ret = 0;
+        int64_t lateUs = (msg->deadlineUs > 0) ? MsgClockUs() - msg->deadlineUs : 0;
+        if (lateUs > 0) {
+            // too old to be worth a Process call
+            target->ExpireMessage(msg->msgId, msg->data, lateUs);
+        } else {
+            ret = target->RunProcess(msg->msgId, msg->data, msg->enqueueUs, msg->bytes);
+        }
         msg->data = nullptr;
+        target->EndMessage(*msg);
         if (ret) {
             LOG_ERROR("Thread %s process function return "
-                              "error %d, thread exit", instName.c_str(), ret);
-            thMgr->SetStatus(THREAD_ERROR);
+                              "error %d, thread exit", target->name_.c_str(), ret);
+            thMgr->StopFuseGroup(target);
             return;
         }
-        usleep(0);
+        if (thMgr->fuseFailed_ != nullptr) {
+            // a direct call failed, ProcessInline recorded the member
+            thMgr->StopFuseGroup(thMgr->fuseFailed_);
+            return;
+        }
+        for (ThreadMgr* member : members) {
+            // the queue has room again for a tick that found it full
+            member->userInstance_->AfterProcess();
+        }
+        if (thMgr->waitStrategy_ == WAIT_SLEEP) {
+            usleep(0);
+        }
     }
-    thMgr->SetStatus(THREAD_EXITED);
+    thMgr->StopFuseGroup(nullptr);
 
     return;
 }
 
+shared_ptr<Message> ThreadMgr::WaitMessage(bool& waited)
+{
+    int64_t startUs = MsgClockUs();
+    if (startUs - cpuSampledUs_ >= kCpuSampleUs) {
+        SampleCpu(startUs);
+    }
+    shared_ptr<Message> msg = msgQueue_.Pop();
+    if (msg != nullptr) {
+        return msg;
+    }
+    waited = true;
+    // hand batched payload frees back to their owner threads
+    MsgAllocFlush();
+    switch (waitStrategy_) {
+        case WAIT_SPIN:
+            while (msgQueue_.EmptyRelaxed() && MsgClockUs() - startUs < kSpinCheckUs) {
+                CpuRelax();
+            }
+            return msgQueue_.Pop();
+        case WAIT_YIELD:
+            while (msgQueue_.EmptyRelaxed() && MsgClockUs() - startUs < kSpinCheckUs) {
+                this_thread::yield();
+            }
+            return msgQueue_.Pop();
+        case WAIT_SPIN_PARK:
+            while (msgQueue_.EmptyRelaxed() && MsgClockUs() - startUs < spinUs_) {
+                CpuRelax();
+            }
+            if (!msgQueue_.EmptyRelaxed()) {
+                return msgQueue_.Pop();
+            }
+            parks_.fetch_add(1, memory_order_relaxed);
+            return msgQueue_.PopWait(kParkTimeoutUs);
+        case WAIT_BLOCK:
+            parks_.fetch_add(1, memory_order_relaxed);
+            return msgQueue_.PopWait(kParkTimeoutUs);
+        case WAIT_SLEEP:
+        default:
+            usleep(kWait10Milliseconds);
+            return msgQueue_.Pop();
+    }
+}
+
+void ThreadMgr::SampleCpu(int64_t nowUs)
+{
+    cpuSampledUs_ = nowUs;
+    cpuUs_.store(ThreadCpuUs(), memory_order_relaxed);
+}
+
+void ThreadMgr::RecordWakeup(int64_t wakeUs)
+{
+    uint64_t wakeups = wakeups_.load(memory_order_relaxed);
+    int64_t wakeAvg = wakeUs_.load(memory_order_relaxed);
+    wakeAvg = (wakeups > 0) ? wakeAvg + ((wakeUs - wakeAvg) >> kAverageShift) : wakeUs;
+    wakeUs_.store(wakeAvg, memory_order_relaxed);
+    wakeups_.store(wakeups + 1, memory_order_relaxed);
+}
+
+void ThreadMgr::SetWaitStrategy(WaitStrategy strategy, uint32_t spinUs)
+{
+    waitStrategy_ = strategy;
+    spinUs_ = spinUs;
+}
+
+int ThreadMgr::RunProcess(int msgId, shared_ptr<void>& data, int64_t enqueueUs, uint64_t bytes)
+{
+    int64_t startUs = MsgClockUs();
+    busyMsgId_.store(msgId, memory_order_relaxed);
+    busySinceUs_.store(startUs, memory_order_relaxed);
+    inProcess_ = true;
+    // a direct call nests in the Process of its sender
+    ThreadMgr* caller = t_current;
+    t_current = this;
+    userInstance_->BeforeProcess(msgId, bytes);
+    int ret = userInstance_->Process(msgId, data);
+    t_current = caller;
+    inProcess_ = false;
+    busySinceUs_.store(0, memory_order_relaxed);
+    RecordMessage(startUs - enqueueUs, MsgClockUs() - startUs);
+    return ret;
+}
+
+ThreadMgr* ThreadMgr::GetCurrent()
+{
+    return t_current;
+}
+
+void ThreadMgr::EndMessage(const Message& msg)
+{
+    if (msg.bytes > 0) {
+        bytesInFlight_.fetch_sub(msg.bytes, memory_order_relaxed);
+        MemoryBudget::GetInstance().Release(msg.bytes);
+    }
+    if (msg.partition != nullptr) {
+        // the next message of the key may go to another replica now
+        msg.partition->Release(msg.partitionKey);
+    }
+}
+
+void ThreadMgr::HoldBytes(uint64_t bytes)
+{
+    heldBytes_.fetch_add(bytes, memory_order_relaxed);
+    uint64_t inFlight = bytesInFlight_.fetch_add(bytes, memory_order_relaxed) + bytes;
+    if (inFlight > maxBytesInFlight_.load(memory_order_relaxed)) {
+        maxBytesInFlight_.store(inFlight, memory_order_relaxed);
+    }
+    MemoryBudget::GetInstance().Acquire(bytes);
+}
+
+void ThreadMgr::ReleaseHeldBytes(uint64_t bytes)
+{
+    heldBytes_.fetch_sub(bytes, memory_order_relaxed);
+    bytesInFlight_.fetch_sub(bytes, memory_order_relaxed);
+    MemoryBudget::GetInstance().Release(bytes);
+}
+
+ThreadMgr* ThreadMgr::FindFuseMember(int instId)
+{
+    for (ThreadMgr* member : fuseMembers_) {
+        if (member->userInstance_->SelfInstanceId() == instId) {
+            return member;
+        }
+    }
+    return this;
+}
+
+void ThreadMgr::StopFuseGroup(ThreadMgr* failed)
+{
+    // App::ReleaseThreads deletes a thread once it is past THREAD_EXITING,
+    // so the leader, this, goes last and nothing is touched after it
+    vector<ThreadMgr*> members = fuseMembers_;
+    if (members.empty()) {
+        members.push_back(this);
+    }
+    for (ThreadMgr* member : members) {
+        // refuse new messages
+        member->SetStatus(THREAD_EXITING);
+    }
+    while (!msgQueue_.Empty()) {
+        shared_ptr<Message> msg = msgQueue_.Pop();
+        if (msg == nullptr) {
+            continue;
+        }
+        FindFuseMember(msg->dest)->bytesInFlight_.fetch_sub(msg->bytes, memory_order_relaxed);
+        ReleaseUndelivered(*msg);
+    }
+    for (size_t i = members.size(); i-- > 0;) {
+        members[i]->SetStatus((members[i] == failed) ? THREAD_ERROR : THREAD_EXITED);
+    }
+}
+
+void ThreadMgr::AddFuseMember(ThreadMgr* member)
+{
+    if (fuseMembers_.empty()) {
+        fuseLeader_ = this;
+        fuseMembers_.push_back(this);
+    }
+    member->fuseLeader_ = this;
+    fuseMembers_.push_back(member);
+}
+
+bool ThreadMgr::CanProcessInline()
+{
+    return (fuseLeader_ != nullptr) && (fuseLeader_ == t_fuseLeader) && !inProcess_ &&
+           (status_ == THREAD_RUNNING);
+}
+
+Error ThreadMgr::ProcessInline(int msgId, shared_ptr<void> data, uint64_t bytes)
+{
+    int ret = RunProcess(msgId, data, MsgClockUs(), bytes);
+    if (ret) {
+        LOG_ERROR("Thread %s process function return "
+                          "error %d, thread exit", name_.c_str(), ret);
+        // no more messages, StopFuseGroup sets the error once the leader is
+        // out of the Process of the sender
+        SetStatus(THREAD_EXITING);
+        fuseLeader_->fuseFailed_ = this;
+        return ERROR_THREAD_ABNORMAL;
+    }
+    return OK;
+}
+
+void ThreadMgr::ExpireMessage(int msgId, shared_ptr<void>& data, int64_t lateUs)
+{
+    expired_.store(expired_.load(memory_order_relaxed) + 1, memory_order_relaxed);
+    if (lateUs > maxExpiredLateUs_.load(memory_order_relaxed)) {
+        maxExpiredLateUs_.store(lateUs, memory_order_relaxed);
+    }
+    if (userInstance_ != nullptr) {
+        userInstance_->OnExpired(msgId, data, lateUs);
+    }
+}
+
 Error ThreadMgr::WaitThreadInitEnd()
 {
     while (true) {
@@ -121,5 +410,64 @@ Error ThreadMgr::PushMsgToQueue(shared_ptr<Message>& pMessage)
                           "can not reveive message", name_.c_str(), status_);
         return ERROR_THREAD_ABNORMAL;
     }
-    return msgQueue_.Push(pMessage)? OK : ERROR_ENQUEUE;
-}
\ No newline at end of file
+    ThreadMgr* queueOwner = (fuseLeader_ != nullptr) ? fuseLeader_ : this;
+    // counted before the push, the thread may take the message off at once
+    uint64_t bytes = pMessage->bytes;
+    uint64_t inFlight = bytesInFlight_.fetch_add(bytes, memory_order_relaxed) + bytes;
+    if (!queueOwner->msgQueue_.Push(pMessage)) {
+        bytesInFlight_.fetch_sub(bytes, memory_order_relaxed);
+        return ERROR_ENQUEUE;
+    }
+    if (inFlight > maxBytesInFlight_.load(memory_order_relaxed)) {
+        maxBytesInFlight_.store(inFlight, memory_order_relaxed);
+    }
+    return OK;
+}
+
+void ThreadMgr::RecordMessage(int64_t waitUs, int64_t serviceUs)
+{
+    uint64_t messages = messages_.load(memory_order_relaxed);
+    int64_t waitAvg = waitUs_.load(memory_order_relaxed);
+    int64_t serviceAvg = serviceUs_.load(memory_order_relaxed);
+    if (messages > 0) {
+        waitAvg += (waitUs - waitAvg) >> kAverageShift;
+        serviceAvg += (serviceUs - serviceAvg) >> kAverageShift;
+    } else {
+        waitAvg = waitUs;
+        serviceAvg = serviceUs;
+    }
+    waitUs_.store(waitAvg, memory_order_relaxed);
+    processTotalUs_.store(processTotalUs_.load(memory_order_relaxed) + serviceUs, memory_order_relaxed);
+    serviceUs_.store(serviceAvg, memory_order_relaxed);
+    if (waitUs > maxWaitUs_.load(memory_order_relaxed)) {
+        maxWaitUs_.store(waitUs, memory_order_relaxed);
+    }
+    messages_.store(messages + 1, memory_order_relaxed);
+}
+
+void ThreadMgr::GetQueueStats(ThreadQueueStats& stats)
+{
+    // the members of a fuse group share the queue of the leader
+    ThreadMgr* queueOwner = (fuseLeader_ != nullptr) ? fuseLeader_ : this;
+    stats.depth = queueOwner->msgQueue_.Size();
+    stats.capacity = queueOwner->msgQueue_.Capacity();
+    stats.messages = messages_.load(memory_order_relaxed);
+    stats.waitUs = waitUs_.load(memory_order_relaxed);
+    stats.maxWaitUs = maxWaitUs_.load(memory_order_relaxed);
+    stats.serviceUs = serviceUs_.load(memory_order_relaxed);
+    stats.status = status_;
+    int64_t busySinceUs = busySinceUs_.load(memory_order_relaxed);
+    stats.busyUs = (busySinceUs > 0) ? max<int64_t>(MsgClockUs() - busySinceUs, 0) : 0;
+    stats.busyMsgId = busyMsgId_.load(memory_order_relaxed);
+    stats.waitStrategy = waitStrategy_;
+    stats.wakeups = wakeups_.load(memory_order_relaxed);
+    stats.wakeUs = wakeUs_.load(memory_order_relaxed);
+    stats.parks = parks_.load(memory_order_relaxed);
+    // a fused member runs on the OS thread of its leader
+    stats.cpuUs = ((fuseLeader_ != nullptr) ? fuseLeader_ : this)->cpuUs_.load(memory_order_relaxed);
+    stats.processTotalUs = processTotalUs_.load(memory_order_relaxed);
+    stats.expired = expired_.load(memory_order_relaxed);
+    stats.maxExpiredLateUs = maxExpiredLateUs_.load(memory_order_relaxed);
+    stats.bytesInFlight = bytesInFlight_.load(memory_order_relaxed);
+    stats.maxBytesInFlight = maxBytesInFlight_.load(memory_order_relaxed);
+}
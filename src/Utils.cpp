@@ -16,17 +16,21 @@
 * File utils.cpp
 * Description: handle file operations
 */
+#include <algorithm>
+#include <cerrno>
 #include <map>
 #include <iostream>
 #include <fstream>
 #include <unistd.h>
 #include <cstring>
-#include <dirent.h>
 #include <regex>
 #include <vector>
 #include <string.h>
+#include <fcntl.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include "DirWalker.h"
 #include "Utils.h"
 
 
@@ -41,7 +45,6 @@ namespace {
 const std::string kImagePathSeparator = ",";
 const int kStatSuccess = 0;
 const std::string kFileSperator = "/";
-const std::string kPathSeparator = "/";
 // output image prefix
 const std::string kOutputFilePrefix = "out_";
 
@@ -121,40 +124,25 @@ bool IsDirectory(const string &path)
 
 void SplitPath(const string &path, vector<string> &pathVec)
 {
-    char *charPath = const_cast<char*>(path.c_str());
-    const char *charSplit = kImagePathSeparator.c_str();
-    char *imageFile = strtok(charPath, charSplit);
-    while (imageFile) {
-        pathVec.emplace_back(imageFile);
-        imageFile = strtok(nullptr, charSplit);
+    string::size_type begin = 0;
+    while (begin < path.size()) {
+        string::size_type end = path.find(kImagePathSeparator, begin);
+        if (end == string::npos) {
+            end = path.size();
+        }
+        if (end > begin) {
+            pathVec.emplace_back(path, begin, end - begin);
+        }
+        begin = end + kImagePathSeparator.size();
     }
 }
 
 void GetPathFiles(const string &path, vector<string> &fileVec)
 {
-    struct dirent *direntPtr = nullptr;
-    DIR *dir = nullptr;
-    if (IsDirectory(path)) {
-        dir = opendir(path.c_str());
-        while ((direntPtr = readdir(dir)) != nullptr) {
-            // skip . and ..
-            if (direntPtr->d_name[0] == '.') {
-            continue;
-            }
-
-            // file path
-            string fullPath = path + kPathSeparator + direntPtr->d_name;
-            // directory need recursion
-            if (IsDirectory(fullPath)) {
-                GetPathFiles(fullPath, fileVec);
-            } else {
-                // put file
-                fileVec.emplace_back(fullPath);
-            }
-        }
-    } else {
-        fileVec.emplace_back(path);
-    }
+    size_t first = fileVec.size();
+    WalkDirectory(path, [&fileVec](const string& file) { fileVec.push_back(file); });
+    // the walk is parallel, keep the list stable from run to run
+    sort(fileVec.begin() + first, fileVec.end());
 }
 
 void GetAllFiles(const string &pathList, vector<string> &fileVec)
@@ -165,7 +153,7 @@ void GetAllFiles(const string &pathList, vector<string> &fileVec)
 
     for (string everyPath : pathVec) {
         // check path exist or not
-        if (!IsPathExist(pathList)) {
+        if (!IsPathExist(everyPath)) {
             LOG_ERROR("Failed to deal path=%s. Reason: not exist or can not access.",
                 everyPath.c_str());
             continue;
@@ -188,6 +176,11 @@ Error ReadBinFile(const string& fileName, void*& data, uint32_t& size)
                           fileName.c_str());
         return ERROR_INVALID_FILE;
     }
+    if ((uint64_t)sBuf.st_size > UINT32_MAX) {
+        LOG_ERROR("file %s is %lu bytes, use MapBinFile for files over 4GB",
+                  fileName.c_str(), (unsigned long)sBuf.st_size);
+        return ERROR_INVALID_FILE;
+    }
     std::ifstream binFile(fileName, std::ifstream::binary);
     if (binFile.is_open() == false) {
         LOG_ERROR("open file %s failed", fileName.c_str());
@@ -211,6 +204,13 @@ Error ReadBinFile(const string& fileName, void*& data, uint32_t& size)
         return ERROR_MALLOC;
     }
     binFile.read((char *)binFileBufferData, binFileBufferLen);
+    if ((uint32_t)binFile.gcount() != binFileBufferLen) {
+        LOG_ERROR("read file %s failed, %ld of %u bytes",
+                  fileName.c_str(), (long)binFile.gcount(), binFileBufferLen);
+        delete[] binFileBufferData;
+        binFile.close();
+        return ERROR_INVALID_FILE;
+    }
     binFile.close();
 
     data = binFileBufferData;
@@ -219,6 +219,57 @@ Error ReadBinFile(const string& fileName, void*& data, uint32_t& size)
     return OK;
 }
 
+Error MapBinFile(const string& fileName, FileView& view, uint32_t hints)
+{
+    int fd = open(fileName.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        LOG_ERROR("open file %s failed, errno %d", fileName.c_str(), errno);
+        return ERROR_OPEN_FILE;
+    }
+    struct stat sBuf;
+    if (fstat(fd, &sBuf) != 0 || S_ISREG(sBuf.st_mode) == 0) {
+        LOG_ERROR("%s is not a file, please enter a file", fileName.c_str());
+        close(fd);
+        return ERROR_INVALID_FILE;
+    }
+    uint64_t fileSize = sBuf.st_size;
+    if (fileSize == 0) {
+        LOG_ERROR("binfile is empty, filename is %s", fileName.c_str());
+        close(fd);
+        return ERROR_INVALID_FILE;
+    }
+
+    int flags = MAP_PRIVATE;
+    if ((hints & MAP_HINT_POPULATE) != 0) {
+        flags |= MAP_POPULATE;
+    }
+    void* addr = mmap(nullptr, fileSize, PROT_READ, flags, fd, 0);
+    int mapErrno = errno;
+    // the mapping keeps the file referenced
+    close(fd);
+    if (addr == MAP_FAILED) {
+        LOG_ERROR("mmap file %s of %lu bytes failed, errno %d",
+                  fileName.c_str(), (unsigned long)fileSize, mapErrno);
+        return ERROR_ACCESS_FILE;
+    }
+
+    // hints only tune the read ahead, a failure is not an error
+    if ((hints & MAP_HINT_SEQUENTIAL) != 0) {
+        (void)madvise(addr, fileSize, MADV_SEQUENTIAL);
+    }
+    if ((hints & MAP_HINT_RANDOM) != 0) {
+        (void)madvise(addr, fileSize, MADV_RANDOM);
+    }
+    if ((hints & MAP_HINT_WILLNEED) != 0) {
+        (void)madvise(addr, fileSize, MADV_WILLNEED);
+    }
+
+    view.data = shared_ptr<const uint8_t>(static_cast<const uint8_t*>(addr),
+        [fileSize](const uint8_t* p) { munmap(const_cast<uint8_t*>(p), fileSize); });
+    view.size = fileSize;
+    return OK;
+}
+
 void SaveBinFile(const string& filename, const void* data, uint32_t size)
 {
     FILE *outFileFp = fopen(filename.c_str(), "wb+");
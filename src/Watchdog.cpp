@@ -0,0 +1,174 @@
+/**
+* Copyright (c) Huawei Technologies Co., Ltd. 2020-2022. All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+
+* http://www.apache.org/licenses/LICENSE-2.0
+
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+
+* File Watchdog.cpp
+* Description: stall watchdog over the app threads
+*/
+#include <algorithm>
+#include "App.h"
+#include "Watchdog.h"
+
+using namespace std;
+
+namespace {
+const char* kAlertNames[] = {"stall", "stall end", "queue growth", "thread error"};
+}
+
+Watchdog::Watchdog(const WatchdogConfig& config) : config_(config), running_(false)
+{
+    config_.intervalUs = max<int64_t>(config_.intervalUs, 1000);
+    config_.growthChecks = max(config_.growthChecks, 1u);
+}
+
+int Watchdog::Init()
+{
+    return OK;
+}
+
+int Watchdog::Process(int msgId, shared_ptr<void> msgData)
+{
+    switch (msgId) {
+        case MSG_WATCHDOG_START:
+            if (running_) {
+                LOG_WARNING("Watchdog %s is running, start ignored", SelfInstanceName().c_str());
+                return OK;
+            }
+            running_ = true;
+            LOG_INFO("Watchdog %s checks every %ld us", SelfInstanceName().c_str(), (long)config_.intervalUs);
+            Check();
+            break;
+        case MSG_WATCHDOG_TICK:
+            usleep(static_cast<useconds_t>(config_.intervalUs));
+            Check();
+            break;
+        default:
+            LOG_WARNING("Watchdog %s ignores message %d", SelfInstanceName().c_str(), msgId);
+            return OK;
+    }
+    Error ret = ScheduleTick(MSG_WATCHDOG_TICK);
+    if (ret != OK) {
+        LOG_ERROR("Watchdog %s stops for tick failed, error %d", SelfInstanceName().c_str(), ret);
+        running_ = false;
+    }
+    return OK;
+}
+
+WatchdogStats Watchdog::GetStats()
+{
+    lock_guard<mutex> guard(statsLock_);
+    return stats_;
+}
+
+void Watchdog::Check()
+{
+    App& app = GetAppInstance();
+    int threadNum = app.GetThreadNum();
+    while (stages_.size() < static_cast<size_t>(threadNum)) {
+        int instId = stages_.size();
+        Stage stage;
+        // the main thread has no Process, the watchdog sleeps in its own
+        if (instId != g_MainThreadId && instId != SelfInstanceId()) {
+            stage.health.instId = instId;
+            stage.health.name = app.GetThreadName(instId);
+            auto deadline = config_.deadlinesUs.find(stage.health.name);
+            stage.health.deadlineUs = (deadline != config_.deadlinesUs.end()) ? deadline->second :
+                                      config_.defaultDeadlineUs;
+        }
+        stages_.push_back(stage);
+    }
+    WatchdogStats stats = GetStats();
+    stats.checks++;
+    stats.stages.clear();
+    // a thread in error is looked for only when there is one
+    bool abnormal = app.CheckThreadAbnormal();
+    for (Stage& stage : stages_) {
+        if (stage.health.instId == INVALID_INSTANCE_ID) {
+            continue;
+        }
+        CheckStage(stage, abnormal, stats);
+        stats.stages.push_back(stage.health);
+    }
+    lock_guard<mutex> guard(statsLock_);
+    // alertsDropped moves on in Alert meanwhile
+    stats.alertsDropped = stats_.alertsDropped;
+    stats_ = stats;
+}
+
+void Watchdog::CheckStage(Stage& stage, bool abnormal, WatchdogStats& stats)
+{
+    StageHealth& health = stage.health;
+    if (GetThreadQueueStats(health.instId, health.queue) != OK) {
+        return;
+    }
+    const ThreadQueueStats& queue = health.queue;
+    if (abnormal && queue.status == THREAD_ERROR && !stage.erred) {
+        stage.erred = true;
+        stats.threadErrors++;
+        Alert(WATCHDOG_THREAD_ERROR, stage, 0);
+    }
+
+    health.maxBusyUs = max(health.maxBusyUs, queue.busyUs);
+    // the call stalled before is over when the thread took another message
+    if (health.stalled && (queue.busyUs == 0 || queue.messages != stage.stallMessages)) {
+        health.stalled = false;
+        Alert(WATCHDOG_STALL_END, stage, stage.stallBusyUs);
+    }
+    if (queue.busyUs > health.deadlineUs) {
+        if (!health.stalled) {
+            health.stalled = true;
+            health.stalls++;
+            stats.stalls++;
+            stage.stallMessages = queue.messages;
+            Alert(WATCHDOG_STALL, stage, queue.busyUs);
+        }
+        stage.stallBusyUs = queue.busyUs;
+    }
+
+    if (queue.depth > stage.lastDepth && queue.depth > config_.minGrowthDepth) {
+        stage.growStreak++;
+        if (stage.growStreak == config_.growthChecks) {
+            health.growths++;
+            stats.queueGrowths++;
+            Alert(WATCHDOG_QUEUE_GROWTH, stage, queue.busyUs);
+        }
+    } else if (queue.depth < stage.lastDepth) {
+        stage.growStreak = 0;
+    }
+    stage.lastDepth = queue.depth;
+}
+
+void Watchdog::Alert(WatchdogAlertType type, const Stage& stage, int64_t busyUs)
+{
+    const StageHealth& health = stage.health;
+    LOG_WARNING("Watchdog: %s on thread %s, message %d busy %ld us of %ld us, queue depth %u",
+                kAlertNames[type], health.name.c_str(), health.queue.busyMsgId, (long)busyUs,
+                (long)health.deadlineUs, health.queue.depth);
+    if (!config_.notifyMain) {
+        return;
+    }
+    shared_ptr<WatchdogAlert> alert = make_shared<WatchdogAlert>();
+    alert->type = type;
+    alert->instId = health.instId;
+    alert->threadName = health.name;
+    alert->msgId = health.queue.busyMsgId;
+    alert->busyUs = busyUs;
+    alert->deadlineUs = health.deadlineUs;
+    alert->depth = health.queue.depth;
+    if (SendMessage(g_MainThreadId, MSG_WATCHDOG_ALERT, alert) != OK) {
+        // nobody drains the main queue, the stats still have it
+        lock_guard<mutex> guard(statsLock_);
+        stats_.alertsDropped++;
+    }
+}
@@ -0,0 +1,195 @@
+/**
+* Copyright (c) Huawei Technologies Co., Ltd. 2020-2022. All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+
+* http://www.apache.org/licenses/LICENSE-2.0
+
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+
+* File PartitionRouterTest.cpp
+* Description: key routing of replica groups and the memory budget gauges
+*/
+#include <cstdio>
+#include <map>
+#include <mutex>
+#include <unistd.h>
+#include "App.h"
+#include "MemoryBudget.h"
+#include "PartitionRouter.h"
+
+using namespace std;
+
+namespace {
+const int kMsgKeyed = 1;
+const uint32_t kKeyNum = 32;
+const uint32_t kMsgPerKey = 200;
+const uint32_t kKeyBytes = 4096;
+const uint32_t kDrainWaitUs = 10000;
+const int kDrainRetry = 500;
+
+int g_failures = 0;
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        printf("%s:%d check failed: %s\n", __FILE__, __LINE__, #cond); \
+        g_failures++; \
+    } \
+} while (0)
+
+struct KeyedItem {
+    uint64_t key = 0;
+    uint32_t seq = 0;
+};
+
+// last seq processed of each key, over all replicas
+mutex g_orderLock;
+map<uint64_t, uint32_t> g_nextSeq;
+uint32_t g_outOfOrder = 0;
+uint32_t g_processed = 0;
+
+class Replica : public Thread {
+public:
+    int Init() override
+    {
+        return OK;
+    }
+
+    int Process(int msgId, shared_ptr<void> msgData) override
+    {
+        if (msgId != kMsgKeyed) {
+            return OK;
+        }
+        shared_ptr<KeyedItem> item = static_pointer_cast<KeyedItem>(msgData);
+        {
+            lock_guard<mutex> guard(g_orderLock);
+            if (item->seq != g_nextSeq[item->key]) {
+                g_outOfOrder++;
+            }
+            g_nextSeq[item->key] = item->seq + 1;
+            g_processed++;
+        }
+        usleep(50);
+        return OK;
+    }
+};
+
+void TestMinimalMovement()
+{
+    const uint64_t keyNum = 20000;
+    vector<uint64_t> seeds = { 0x1111, 0x2222, 0x3333, 0x4444 };
+    vector<size_t> before(keyNum);
+    for (uint64_t key = 0; key < keyNum; key++) {
+        before[key] = PickReplica(key, seeds);
+    }
+
+    // a new replica only takes keys, about its share of them
+    vector<uint64_t> grown = seeds;
+    grown.push_back(0x5555);
+    uint64_t moved = 0;
+    for (uint64_t key = 0; key < keyNum; key++) {
+        size_t pick = PickReplica(key, grown);
+        if (pick != before[key]) {
+            CHECK(pick == seeds.size());
+            moved++;
+        }
+    }
+    CHECK(moved > keyNum / 10 && moved < keyNum * 3 / 10);
+
+    // a removed replica only gives its own keys away
+    vector<uint64_t> shrunk = { seeds[0], seeds[2], seeds[3] };
+    const size_t shrunkIndex[] = { 0, 2, 3 };
+    for (uint64_t key = 0; key < keyNum; key++) {
+        size_t pick = shrunkIndex[PickReplica(key, shrunk)];
+        CHECK(pick == before[key] || before[key] == 1);
+    }
+}
+
+shared_ptr<KeyedItem> MakeItem(uint64_t key, uint32_t seq)
+{
+    shared_ptr<KeyedItem> item = make_shared<KeyedItem>();
+    item->key = key;
+    item->seq = seq;
+    return item;
+}
+
+void TestKeyOrderAndGauges(App& app, const vector<int>& replicas)
+{
+    int dest = replicas[0];
+    for (uint32_t seq = 0; seq < kMsgPerKey; seq++) {
+        if (seq == kMsgPerKey / 4) {
+            CHECK(app.SetReplicaActive(replicas[1], false) == OK);
+        } else if (seq == kMsgPerKey / 2) {
+            CHECK(app.SetReplicaActive(replicas[2], false) == OK);
+        } else if (seq == kMsgPerKey * 3 / 4) {
+            CHECK(app.SetReplicaActive(replicas[1], true) == OK);
+            CHECK(app.SetReplicaActive(replicas[2], true) == OK);
+        }
+        for (uint64_t key = 0; key < kKeyNum; key++) {
+            shared_ptr<KeyedItem> item = MakeItem(key, seq);
+            Error ret;
+            while ((ret = app.SendMessageWithBytes(dest, kMsgKeyed, item, key, kKeyBytes)) == ERROR_ENQUEUE) {
+                usleep(100);
+            }
+            CHECK(ret == OK);
+        }
+    }
+
+    for (int retry = 0; retry < kDrainRetry; retry++) {
+        {
+            lock_guard<mutex> guard(g_orderLock);
+            if (g_processed == kKeyNum * kMsgPerKey) {
+                break;
+            }
+        }
+        usleep(kDrainWaitUs);
+    }
+    {
+        lock_guard<mutex> guard(g_orderLock);
+        CHECK(g_processed == kKeyNum * kMsgPerKey);
+        CHECK(g_outOfOrder == 0);
+    }
+
+    // Process is over for every message, nothing may be left counted
+    usleep(kDrainWaitUs);
+    MemoryBudgetStats budget = MemoryBudget::GetInstance().GetStats();
+    CHECK(budget.bytesInFlight == 0);
+    CHECK(budget.maxBytesInFlight >= kKeyBytes);
+    for (int instId : replicas) {
+        ThreadQueueStats stats;
+        CHECK(app.GetThreadQueueStats(instId, stats) == OK);
+        CHECK(stats.bytesInFlight == 0);
+    }
+    CHECK(GetPartitionRouter("replica")->GetStats().keysInFlight == 0);
+}
+}
+
+int main()
+{
+    TestMinimalMovement();
+
+    App& app = CreateAppInstance();
+    vector<ThreadParam> threadParamTbl(3);
+    for (size_t i = 0; i < threadParamTbl.size(); i++) {
+        threadParamTbl[i].threadInst = new Replica();
+        threadParamTbl[i].threadInstName = "replica" + to_string(i);
+        threadParamTbl[i].replicaGroup = "replica";
+        threadParamTbl[i].queueSize = 64;
+    }
+    CHECK(app.Start(threadParamTbl) == OK);
+    vector<int> replicas;
+    for (size_t i = 0; i < threadParamTbl.size(); i++) {
+        replicas.push_back(app.GetThreadIdByName(threadParamTbl[i].threadInstName));
+    }
+    TestKeyOrderAndGauges(app, replicas);
+    app.Exit();
+
+    printf("PartitionRouterTest %s, %d failures\n", (g_failures == 0) ? "passed" : "failed", g_failures);
+    return (g_failures == 0) ? 0 : 1;
+}
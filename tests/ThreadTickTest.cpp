@@ -0,0 +1,118 @@
+/**
+* Copyright (c) Huawei Technologies Co., Ltd. 2020-2022. All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+
+* http://www.apache.org/licenses/LICENSE-2.0
+
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+
+* File ThreadTickTest.cpp
+* Description: ticks of a fused thread across a full shared queue
+*/
+#include <atomic>
+#include <cstdio>
+#include <unistd.h>
+#include "App.h"
+
+using namespace std;
+
+namespace {
+const int kMsgWork = 1;
+const int kMsgTick = 2;
+const uint32_t kQueueSize = 4;
+const uint64_t kFloodTicks = 3;
+const int64_t kTickWaitUs = 200;
+const uint32_t kWorkUs = 100;
+const uint32_t kSettleUs = 100000;
+
+int g_failures = 0;
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        printf("%s:%d check failed: %s\n", __FILE__, __LINE__, #cond); \
+        g_failures++; \
+    } \
+} while (0)
+
+atomic<uint64_t> g_ticks(0);
+atomic<uint64_t> g_tickFailures(0);
+atomic<uint64_t> g_refused(0);
+int g_workerId = INVALID_INSTANCE_ID;
+
+class Worker : public Thread {
+public:
+    int Init() override
+    {
+        return OK;
+    }
+
+    int Process(int msgId, shared_ptr<void> msgData) override
+    {
+        usleep(kWorkUs);
+        return OK;
+    }
+};
+
+class Ticker : public Thread {
+public:
+    int Init() override
+    {
+        return OK;
+    }
+
+    int Process(int msgId, shared_ptr<void> msgData) override
+    {
+        if (msgId != kMsgTick) {
+            return OK;
+        }
+        // the first ticks leave the shared queue full, the next tick finds
+        // no room and is deferred
+        if (g_ticks++ < kFloodTicks) {
+            while (SendMessageToQueue(g_workerId, kMsgWork, nullptr) == OK) {
+            }
+            g_refused++;
+        }
+        if (ScheduleTick(kMsgTick, kTickWaitUs) != OK) {
+            g_tickFailures++;
+        }
+        return OK;
+    }
+};
+}
+
+int main()
+{
+    App& app = CreateAppInstance();
+    vector<ThreadParam> threadParamTbl(2);
+    threadParamTbl[0].threadInst = new Worker();
+    threadParamTbl[0].threadInstName = "worker";
+    threadParamTbl[1].threadInst = new Ticker();
+    threadParamTbl[1].threadInstName = "ticker";
+    for (ThreadParam& param : threadParamTbl) {
+        param.fuseGroup = "tick";
+        param.queueSize = kQueueSize;
+    }
+    CHECK(app.Start(threadParamTbl) == OK);
+    g_workerId = app.GetThreadIdByName("worker");
+    int ticker = app.GetThreadIdByName("ticker");
+    CHECK(app.SendMessageToQueue(ticker, kMsgTick, nullptr) == OK);
+
+    usleep(kSettleUs);
+    CHECK(g_refused.load() == kFloodTicks);
+    uint64_t ticks = g_ticks.load();
+    usleep(kSettleUs);
+    // the tick chain goes on once the queue drained
+    CHECK(g_ticks.load() > ticks);
+    CHECK(g_tickFailures.load() == 0);
+    app.Exit();
+
+    printf("ThreadTickTest %s, %d failures\n", (g_failures == 0) ? "passed" : "failed", g_failures);
+    return (g_failures == 0) ? 0 : 1;
+}